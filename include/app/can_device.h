@@ -34,32 +34,174 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <linux/can.h>
+#include <linux/can/netlink.h>
+
+#define CAN_RX_BATCH (32) // 单次批量接收的最大帧数
+
+#define CAN_MGR_MAX_DEVS (8) // 单个管理器最多管理的接口数
+
+#define CAN_RX_HIST_NUM (6) // 批量大小分布桶数: 1, 2~3, 4~7, 8~15, 16~31, 32
+
+#define CAN_TX_QUEUE_LEN (32)  // 发送队列可容纳的报文数
+#define CAN_TX_MSG_FRAMES (16) // 单个报文最多拆分的帧数, 即最多 16 * 8 (CAN FD 16 * 64) 字节
+#define CAN_TX_BATCH (32)	   // 单次批量发送的最大帧数
+
+// 接收的CAN FD帧在 flags 中带此标志, 旧内核头文件没有定义
+#ifndef CANFD_FDF
+#define CANFD_FDF 0x04
+#endif
+
+// 帧的接收信息: 接收接口与时间戳(SO_TIMESTAMPING)
+struct can_rx_info {
+	uint64_t sw_ns; // 内核收到帧的时刻(CLOCK_REALTIME), 内核未提供时为读取时刻
+	uint64_t hw_ns; // 控制器硬件时间戳, 与系统时钟不同源, 0代表不支持
+	int ifindex;	// 接收接口索引, 多个接口共用回调时区分来源
+};
 
 /**
  * @brief CAN帧回调
  *
  * 每接收到一帧数据都会调用此回调, 用户自行决定如何处理
  * NULL 代表无效数据
+ * 经典帧与FD帧都以 canfd_frame 交付, 两者前16字节布局相同; FD帧的 flags 带 CANFD_FDF
  * 
+ * @param frame CAN帧
+ * @param info 帧的接收信息, 无效数据时为NULL
+ */
+typedef void (*can_frame_recv_cb)(struct canfd_frame *frame, const struct can_rx_info *info);
+
+/**
+ * @brief CAN批量接收回调
+ *
+ * 每次唤醒后批量读取套接字中的帧, 一批调用一次, 在读取线程中执行
+ *
+ * @param frames 帧数组, 只在回调期间有效, 帧格式同 can_frame_recv_cb
+ * @param info 与帧数组一一对应的接收信息
+ * @param num 帧数量 1 ~ CAN_RX_BATCH
+ */
+typedef void (*can_batch_recv_cb)(
+	struct canfd_frame *frames, const struct can_rx_info *info, size_t num);
+
+/**
+ * @brief CAN报文发送完成回调, 在读取线程中执行
+ *
+ * @param ok true: 所有帧已交给控制器, false: 发送失败或设备关闭时未发完
+ * @param arg 用户参数
+ */
+typedef void (*can_tx_done_cb)(bool ok, void *arg);
+
+/**
+ * @brief 控制器状态变化回调, 在读取线程中执行
+ *
+ * @param state 新状态, 如 CAN_STATE_BUS_OFF
  */
-typedef void (*can_frame_recv_cb)(struct can_frame *frame);
+typedef void (*can_state_change_cb)(enum can_state state);
+
 struct can_config {
 	char *can_dev_name;				// `ifconfig -a` 显示的CAN名, 如 can0
 	uint32_t can_id;				// (11/29 bit)
 	size_t can_bitrate;				// can 比特率
 	struct can_filter *dev_filters; // 过滤器数组
 	size_t filter_num;				// 过滤器长度
-	can_frame_recv_cb cb;			// CAN报文 处理函数
+	can_frame_recv_cb cb;			// CAN报文 处理函数, 设置了批量回调时不使用
+	can_batch_recv_cb batch_cb;		// CAN报文 批量处理函数 可为NULL
+	bool fd_mode;					// 启用CAN FD, 单帧有效载荷最多64字节, 需控制器支持
+	size_t data_bitrate;			// CAN FD 数据段比特率, 0代表与仲裁段相同
+	bool brs;						// CAN FD 发送时切换到数据段比特率(BRS)
+	uint32_t restart_ms;			// bus-off后由驱动自动重启的延时, 0代表收到通知后立即重启
+	can_state_change_cb state_cb;	// 控制器状态变化回调 可为NULL
+};
+
+// 接收批量统计
+struct can_rx_stats {
+	uint64_t frames;				// 接收帧数
+	uint32_t batches;				// 批次数, 即recvmmsg返回有数据的次数
+	uint32_t wakeups;				// 读取线程唤醒次数
+	uint32_t max_batch;				// 最大批量
+	uint32_t hist[CAN_RX_HIST_NUM];	// 批量大小分布
+	uint32_t errors;				// 读取失败或帧长度错误的次数
+	uint32_t no_ts;					// 内核未提供时间戳的帧数
+};
+
+// 发送统计
+struct can_tx_stats {
+	uint64_t frames;	// 发送帧数
+	uint32_t batches;	// 批次数, 即sendmmsg成功发出帧的次数
+	uint32_t max_batch; // 最大批量
+	uint32_t messages;	// 发送完成的报文数
+	uint32_t overruns;	// 发送队列满被拒绝的报文数
+	uint32_t enobufs;	// 控制器队列满(ENOBUFS)的次数, 之后退避重试
+	uint32_t errors;	// 发送失败的报文数
+	uint32_t queued;	// 当前排队的报文数
+};
+
+// 链路状态统计, 来自rtnetlink链路通知
+struct can_link_stats {
+	enum can_state state; // 当前控制器状态
+	bool running;		  // 链路可收发(carrier)
+	uint32_t bus_off;	  // 进入bus-off的次数
+	uint32_t restarts;	  // 收到bus-off通知后主动重启的次数
+	uint32_t link_events; // 本接口的链路通知次数
 };
 
 typedef struct can_device *can_handle; // CAN 句柄
 
+typedef struct can_mgr *can_mgr_handle; // 多接口管理器句柄
+
+/**
+ * @brief 创建多接口管理器, 所有接口共用一个epoll集合与链路通知套接字
+ *
+ * 网关桥接多路总线时, 多个接口共用一个读取线程, 或由主循环处理, 省去每个接口一个线程
+ *
+ * @param own_thread true: 创建一个读取线程处理所有接口;
+ *                   false: 由调用者将 can_mgr_get_fd 注册到事件循环, 可读时调用 can_mgr_poll
+ * @return can_mgr_handle 成功
+ * @return NULL 失败
+ */
+can_mgr_handle can_mgr_create(bool own_thread);
+
+/**
+ * @brief 销毁管理器, 停止读取线程; 需先关闭管理器中的所有接口
+ *
+ * @param mgr 管理器
+ */
+void can_mgr_destroy(can_mgr_handle mgr);
+
+/**
+ * @brief 获取管理器的epoll描述符, 任一接口有事件时可读, 可注册到事件循环
+ *
+ * @param mgr 管理器
+ * @return int 描述符, 失败返回-1
+ */
+int can_mgr_get_fd(can_mgr_handle mgr);
+
+/**
+ * @brief 处理所有接口已就绪的事件, 不阻塞; 用于未创建读取线程的管理器
+ *
+ * 接收回调、发送完成回调与状态回调都在调用者线程中执行
+ *
+ * @param mgr 管理器
+ */
+void can_mgr_poll(can_mgr_handle mgr);
+
+/**
+ * @brief 打开CAN接口并加入管理器, 与管理器中的其他接口共用读取线程或事件循环
+ *
+ * 通过rtnetlink配置接口比特率并启用, 初始化CAN套接字并绑定到接口, 注册到管理器的epoll
+ * 套接字启用 SO_TIMESTAMPING 接收时间戳, 控制器支持时同时启用硬件时间戳
+ * 回调中可以发送, 但不能打开或关闭同一管理器中的接口
+ *
+ * @param mgr 管理器
+ * @param config 用户配置信息, 每个接口一份, 需在设备关闭前保持有效
+ * @return can_handle 成功
+ * @return NULL 失败
+ */
+can_handle can_device_open(can_mgr_handle mgr, const struct can_config *config);
+
 /**
- * @brief CAN设备初始化
+ * @brief CAN设备初始化, 创建独占的管理器与读取线程
  *
- * 初始化CAN套接字,设置接口,绑定套接字到CAN设备,创建epoll实例,等
- * 添加CAN套接字和eventfd到epoll
- * 成功后会启动读取线程
+ * 等同于 can_mgr_create(true) 后 can_device_open, 关闭设备时一起销毁管理器
  * 每当读取成功一帧就会调用 can_frame_recv_cb 函数指针
  *
  * @param config 用户配置信息
@@ -71,20 +213,81 @@ can_handle can_device_init(const struct can_config *config);
 /**
  * @brief 关闭CAN设备
  *
- * 关闭CAN套接字,停止读取线程,释放所有分配的资源.
+ * 退出管理器, 释放设备资源; 由 can_device_init 创建时同时停止读取线程
+ * 不能在该设备所属管理器的回调中调用
  *
  * @param handle CAN句柄
  */
 void can_device_close(can_handle handle);
 
 /**
- * @brief CAN发送函数
+ * @brief 获取接口索引, 与接收信息中的 ifindex 对应
+ *
+ * @param handle CAN句柄
+ * @return int 接口索引, 参数非法返回0
+ */
+int can_device_get_ifindex(can_handle handle);
+
+/**
+ * @brief 获取接收批量统计
+ *
+ * @param handle CAN句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零
+ * @return true 成功
+ * @return false 参数非法
+ */
+bool can_device_get_rx_stats(can_handle handle, struct can_rx_stats *out, bool reset);
+
+/**
+ * @brief 获取发送统计
+ *
+ * @param handle CAN句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零, 当前排队数不清零
+ * @return true 成功
+ * @return false 参数非法
+ */
+bool can_device_get_tx_stats(can_handle handle, struct can_tx_stats *out, bool reset);
+
+/**
+ * @brief 获取链路状态统计
+ *
+ * @param handle CAN句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零计数, 当前状态不清零
+ * @return true 成功
+ * @return false 参数非法
+ */
+bool can_device_get_link_stats(can_handle handle, struct can_link_stats *out, bool reset);
+
+/**
+ * @brief CAN异步发送, 数据按8字节(CAN FD 64字节)拆分为多帧作为一个报文入队
+ *
+ * 读取线程用sendmmsg批量发送, 控制器队列满时等待可写或退避重试, 不阻塞调用者;
+ * 报文按总线仲裁顺序(基本ID越小越优先, 同基本ID标准帧优先)发送, 同ID先入先出,
+ * 一个报文的帧不会被其他报文插入
+ *
+ * @param handle CAN句柄
+ * @param can_id CAN ID (11/29 bit, 扩展帧需带 CAN_EFF_FLAG)
+ * @param data 数据缓冲
+ * @param len 数据长度 1 ~ CAN_TX_MSG_FRAMES * CAN_MAX_DLEN (CAN FD 为 CANFD_MAX_DLEN)
+ * @param cb 发送完成回调 可为NULL
+ * @param arg 回调参数
+ * @return true 已入队
+ * @return false 参数非法或发送队列满
+ */
+bool can_device_send(can_handle handle, uint32_t can_id, const uint8_t *data, size_t len,
+	can_tx_done_cb cb, void *arg);
+
+/**
+ * @brief CAN发送函数, 使用配置的CAN ID异步发送
  *
  * @param handle can 句柄
  * @param data 数据缓冲
  * @param len 数据长度
- * @return true 发送成功
- * @return false 发送失败
+ * @return true 已入队
+ * @return false 参数非法或发送队列满
  */
 bool can_device_write(can_handle handle, uint8_t *data, size_t len);
 
@@ -0,0 +1,175 @@
+/**
+ * @file can_dispatch.h
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief CAN ID 分发表
+ * @version 1.0
+ * @date 2025-01-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _CAN_DISPATCH_H
+#define _CAN_DISPATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/can.h>
+
+#include "app/can_device.h"
+
+#define CAN_DISPATCH_RING_LEN (256)	  // 延后处理环形队列长度, 必须为2的幂
+#define CAN_DISPATCH_EXT_BUCKETS (64) // 扩展帧哈希桶数, 必须为2的幂
+#define CAN_DISPATCH_LAT_BUCKETS (8)  // 交付延时分布桶数(us): 100/200/500/1000/2000/5000/10000/更大
+
+// 处理函数执行位置
+enum can_dispatch_mode {
+	CAN_DISPATCH_INLINE = 0, // 在CAN读取线程中立即执行, 只用于耗时短的处理
+	CAN_DISPATCH_DEFERRED,	 // 拷贝帧进入环形队列, 在主循环中执行
+};
+
+/**
+ * @brief CAN ID 处理函数
+ *
+ * @param frame CAN帧, 只在回调期间有效
+ * @param info 帧的接收信息, 只在回调期间有效
+ * @param arg 用户参数
+ */
+typedef void (*can_id_handler)(
+	const struct canfd_frame *frame, const struct can_rx_info *info, void *arg);
+
+// 分发统计
+struct can_dispatch_stats {
+	uint64_t inline_frames;	  // 读取线程中直接处理的帧数
+	uint64_t deferred_frames; // 进入环形队列的帧数
+	uint64_t deferred_runs;	  // 主循环中处理的帧数
+	uint32_t ring_overruns;	  // 环形队列满丢弃的帧数
+	uint32_t ring_max;		  // 环形队列最大深度
+	uint32_t unhandled;		  // 没有注册处理函数的帧数
+	uint32_t busy_drops;	  // 多个读取线程同时分发而丢弃的帧数
+};
+
+// 单个接口上CAN ID的时序统计, 交付延时为内核接收时间戳到处理函数被调用的时间
+struct can_id_timing {
+	uint32_t count;								// 交付的帧数
+	uint32_t min_us;							// 最小交付延时
+	uint32_t max_us;							// 最大交付延时
+	uint64_t sum_us;							// 交付延时总和, 平均值为 sum_us / count
+	uint32_t buckets[CAN_DISPATCH_LAT_BUCKETS]; // 交付延时分布
+	uint32_t gaps;								// 统计的到达间隔数
+	uint32_t gap_min_us;						// 最小到达间隔
+	uint32_t gap_max_us;						// 最大到达间隔
+	uint64_t gap_sum_us;						// 到达间隔总和
+	uint32_t jitter_us;							// 到达抖动, 相邻间隔之差的平滑均值(RFC 3550)
+};
+
+typedef struct can_dispatch *can_dispatch_handle;
+
+/**
+ * @brief 创建分发表
+ *
+ * @return can_dispatch_handle 成功
+ * @return NULL 失败
+ */
+can_dispatch_handle can_dispatch_create(void);
+
+/**
+ * @brief 销毁分发表, 未处理的延后帧直接丢弃
+ *
+ * @param handle 分发表句柄
+ */
+void can_dispatch_destroy(can_dispatch_handle handle);
+
+/**
+ * @brief 注册CAN ID的处理函数, 同一ID重复注册时覆盖
+ *
+ * 标准帧直接按ID索引, 扩展帧按哈希查找; 需在开始分发(CAN设备初始化)前完成注册
+ *
+ * @param handle 分发表句柄
+ * @param can_id CAN ID, 扩展帧需带 CAN_EFF_FLAG
+ * @param f_handle 处理函数
+ * @param arg 处理函数参数
+ * @param mode 执行位置
+ * @return true 成功
+ * @return false 参数非法或内存不足
+ */
+bool can_dispatch_register(can_dispatch_handle handle, uint32_t can_id, can_id_handler f_handle,
+	void *arg, enum can_dispatch_mode mode);
+
+/**
+ * @brief 分发一批帧, 在CAN读取线程中调用, 可直接作为批量接收回调的实现
+ *
+ * 延后处理的帧进入无锁环形队列(单生产者单消费者), 队列满时丢弃并计数, 不阻塞读取线程
+ * 一个分发表只能由一个管理器(一个读取线程)分发, 其他线程同时分发的整批帧被丢弃并计数
+ * 到达间隔优先使用硬件时间戳, 交付延时使用软件时间戳
+ *
+ * @param handle 分发表句柄
+ * @param frames 帧数组
+ * @param info 与帧数组一一对应的接收信息
+ * @param num 帧数量
+ */
+void can_dispatch_frames(can_dispatch_handle handle, const struct canfd_frame *frames,
+	const struct can_rx_info *info, size_t num);
+
+/**
+ * @brief 在主循环中执行延后处理的帧
+ *
+ * @param handle 分发表句柄
+ * @param max 最多处理的帧数, 0代表处理到队列为空
+ * @return size_t 处理的帧数
+ */
+size_t can_dispatch_run(can_dispatch_handle handle, size_t max);
+
+/**
+ * @brief 获取延后处理通知描述符, 有帧入队时可读, 可注册到事件循环
+ *
+ * @param handle 分发表句柄
+ * @return int 描述符, 失败返回-1
+ */
+int can_dispatch_get_fd(can_dispatch_handle handle);
+
+/**
+ * @brief 获取分发统计
+ *
+ * @param handle 分发表句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零
+ * @return true 成功
+ * @return false 参数非法
+ */
+bool can_dispatch_get_stats(can_dispatch_handle handle, struct can_dispatch_stats *out, bool reset);
+
+/**
+ * @brief 获取某个接口上CAN ID的交付延时与到达间隔统计
+ *
+ * @param handle 分发表句柄
+ * @param ifindex 接口索引, 与接收信息中的 ifindex 对应
+ * @param can_id CAN ID, 扩展帧需带 CAN_EFF_FLAG
+ * @param out 输出统计, 该接口上还没有收到帧时全为0
+ * @param reset 读取后是否清零, 抖动为滑动估计, 不清零
+ * @return true 成功
+ * @return false 参数非法或ID未注册
+ */
+bool can_dispatch_get_timing(can_dispatch_handle handle, int ifindex, uint32_t can_id,
+	struct can_id_timing *out, bool reset);
+
+#endif /* _CAN_DISPATCH_H */
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "protocol/modbus.h"
+
 #define REG_NUM(end, start) ((end) - (start))
 
 /*********************************************************************************/
@@ -834,6 +836,14 @@ typedef enum {
 
 } RTU_UPGRADE_CONTENT_60100_60200_E;
 
+typedef union {
+	struct {
+		uint16_t index;
+		uint16_t content[64];
+	};
+	uint16_t all_data[REG_NUM(REG_60100_60200_END, UPGRADE_CONTENT_INDEX)];
+} reg_60100_60200;
+
 /*********************************************************************************/
 //升级结果
 typedef enum {
@@ -881,4 +891,67 @@ typedef union {
 #define PRI_60100_60200_REG_OFFSET(r) REG_OFFSET(r, UPGRADE_CONTENT_INDEX)
 #define PRI_60400_60409_REG_OFFSET(r) REG_OFFSET(r, UPGRADE_STATUS)
 
+/*********************************************************************************/
+/**
+ * @brief 寄存器块描述表, 按起始寄存器升序排列且互不重叠
+ * 
+ * X(块名, 起始寄存器, 结束寄存器(不含), 映像类型, 映像最后一个字段)
+ * 新增寄存器块只需在此增加一行, 以下内容均由此表生成:
+ * 块枚举、起止寄存器常量、映像字段编译期检查、从机处理表项
+ */
+#define MODBUS_PRIV_REG_BLOCKS(X)                                                                  \
+	X(0000_0011, REG_0000_0011_SOFTWARE_VERTION, REG_0000_0011_END, reg_0000_0011, reset)          \
+	X(1000_1199, REG_1000_1199_BAT_ID, REG_1000_1199_END, reg_1000_1199, loader_status)            \
+	X(1200_1299, REG_1200_1299_BAT_ID, REG_1200_1299_END, reg_1200_1299, protect_status)           \
+	X(2000_2099, REG_2000_2099_FRAME_NUM, REG_2000_2099_END, reg_2000_2099, bq34_soft_version)     \
+	X(3000_3099, REG_3000_3099_FRAME_NUM, REG_3000_3099_END, reg_3000_3099,                        \
+		history_charge_max_current_for_charge_filled_count)                                        \
+	X(5000_5099, REG_5000_5099_FRAME_NUM, REG_5000_5099_END, reg_5000_5099, protect_status)        \
+	X(55000_55229, REG_55000_55229_BMS_MODE, REG_55000_55229_END, reg_55000_55229, alarm_argv_set) \
+	X(55600_55799, REG_55600_55799_HV_VERSION, REG_55600_55799_END, reg_55600_55799, bat_data)     \
+	X(57000_57199, FAULT_RECORD_START, FAULT_RECORD_END, reg_57000_57199, flash_data)              \
+	X(57200_57399, CHG_DSG_RECORD_DATA_START, CHG_DSG_RECORD_DATA_END, reg_57200_57399, flash_data)\
+	X(57400_57599, EXTREM_DATA_START, EXTREM_DATA_END, reg_57400_57599, flash_data)                \
+	X(57600_57799, PERIOD_DATA_START, PERIOD_DATA_END, reg_57600_57799, flash_data)                \
+	X(57800_57849, INFO_4G_RIGISTER_RESULT, REG_57800_57849_END, reg_57800_57849, reserved_data)   \
+	X(60000_60099, UPGRADE_INFO_FILE_SIZE, REG_60000_60099_END, reg_60000_60099, reserved)         \
+	X(60100_60200, UPGRADE_CONTENT_INDEX, REG_60100_60200_END, reg_60100_60200, content)           \
+	X(60400_60409, UPGRADE_STATUS, UPGRADE_RESULT_END, reg_60400_60409, app_sv)
+
+// 块枚举
+#define PRIV_REG_BLOCK_ENUM(blk, s, e, t, last) PRIV_REG_BLOCK_##blk,
+typedef enum {
+	MODBUS_PRIV_REG_BLOCKS(PRIV_REG_BLOCK_ENUM) PRIV_REG_BLOCK_NUM,
+} PRIV_REG_BLOCK_E;
+#undef PRIV_REG_BLOCK_ENUM
+
+// 块起止寄存器常量
+#define PRIV_REG_BLOCK_RANGE(blk, s, e, t, last)                                                   \
+	PRIV_REG_START_##blk = (s), PRIV_REG_END_##blk = (e),
+enum {
+	MODBUS_PRIV_REG_BLOCKS(PRIV_REG_BLOCK_RANGE)
+};
+#undef PRIV_REG_BLOCK_RANGE
+
+// 块不能为空, 映像字段必须正好覆盖寄存器范围
+// 映像为字段与 all_data 的联合, 联合大小总等于寄存器范围, 因此检查最后一个字段的结束位置
+#define PRIV_REG_BLOCK_CHECK(blk, s, e, t, last)                                                   \
+	_Static_assert((e) > (s), "register block " #blk " is empty");                                 \
+	_Static_assert(offsetof(t, last) + sizeof(((t *)0)->last) == REG_NUM(e, s) * sizeof(uint16_t), \
+		"fields of register image " #t " do not match its register range");
+MODBUS_PRIV_REG_BLOCKS(PRIV_REG_BLOCK_CHECK)
+#undef PRIV_REG_BLOCK_CHECK
+
+// 块内偏移
+#define PRIV_REG_OFFSET(blk, r) REG_OFFSET(r, PRIV_REG_START_##blk)
+
+// 块寄存器数量
+#define PRIV_REG_SIZE(blk) REG_NUM(PRIV_REG_END_##blk, PRIV_REG_START_##blk)
+
+// 从机处理表项, 范围取自描述表
+#define PRIV_REG_WORK(blk, handle)                                                                 \
+	{                                                                                              \
+		.start = PRIV_REG_START_##blk, .end = PRIV_REG_END_##blk, .resp = (handle),                \
+	}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,181 @@
+/**
+ * @file isotp.h
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief ISO-TP (ISO 15765-2) CAN多帧传输层
+ * @version 1.0
+ * @date 2025-01-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _ISOTP_H
+#define _ISOTP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define ISOTP_CAN_DL (8)	// 经典CAN帧长
+#define ISOTP_CANFD_DL (64)	// CAN FD帧长
+
+#define ISOTP_MAX_LEN (4095)  // 不使用长度扩展时的最大报文长度
+#define ISOTP_CF_BATCH (16)	  // STmin为0时单次提交的最多连续帧数, 与CAN发送队列单报文帧数一致
+#define ISOTP_MAX_WFT (8)	  // 最多接受的连续等待流控帧数
+#define ISOTP_PAD_BYTE (0xCC) // 填充字节
+
+// 流控帧状态
+enum isotp_fc_flag {
+	ISOTP_FC_CTS = 0,	// 继续发送
+	ISOTP_FC_WAIT = 1,	// 等待
+	ISOTP_FC_OVFLW = 2,	// 接收缓冲不足, 放弃发送
+};
+
+/**
+ * @brief 收到一个完整报文, 单帧直接指向帧内数据, 多帧指向重组缓冲, 均不再拷贝
+ *
+ * @param data 报文数据, 只在回调期间有效
+ * @param len 报文长度
+ * @param arg 用户参数
+ */
+typedef void (*isotp_recv_cb)(const uint8_t *data, size_t len, void *arg);
+
+/**
+ * @brief 报文发送结束
+ *
+ * @param ok true: 所有帧已提交, false: 流控超时/溢出或被中止
+ * @param arg 用户参数
+ */
+typedef void (*isotp_sent_cb)(bool ok, void *arg);
+
+// 帧收发接口
+struct isotp_opts {
+	/**
+	 * @brief 提交若干帧, 数据按帧长依次拆分, 除最后一帧外均为整帧, 可与 can_device_send 直接对接
+	 *
+	 * @param can_id CAN ID
+	 * @param data 帧数据
+	 * @param len 数据长度
+	 * @param arg 用户参数
+	 * @return true 已提交, false 发送队列满, 稍后重试
+	 */
+	bool (*f_send)(uint32_t can_id, const uint8_t *data, size_t len, void *arg);
+	void *arg; // 用户参数
+};
+
+// 通道配置
+struct isotp_cfg {
+	uint32_t tx_id;		   // 发送CAN ID
+	uint32_t rx_id;		   // 接收CAN ID
+	bool fd;			   // 使用CAN FD帧长(64), 否则为8
+	bool padding;		   // 发送帧填充到整帧
+	uint8_t block_size;	   // 接收时告知对端的块大小, 0代表不分块
+	uint8_t st_min;		   // 接收时告知对端的连续帧间隔, 0~0x7F ms, 0xF1~0xF9 100~900 us
+	uint32_t timeout_ms;   // 等待流控帧(N_Bs)与连续帧(N_Cr)的超时, 0代表1000ms
+	uint8_t *rx_buf;	   // 重组缓冲, 为NULL时内部申请 ISOTP_MAX_LEN 字节
+	size_t rx_buf_size;	   // 重组缓冲大小, 超过 ISOTP_MAX_LEN 时对端需使用长度扩展
+	isotp_recv_cb on_recv; // 收到报文回调
+	isotp_sent_cb on_sent; // 发送结束回调 可为NULL
+	void *cb_arg;		   // 回调参数
+};
+
+// 统计
+struct isotp_stats {
+	uint32_t rx_msgs;	 // 收到的完整报文数
+	uint32_t tx_msgs;	 // 发送完成的报文数
+	uint32_t rx_aborts;	 // 接收中止次数(序号错误/超时/溢出)
+	uint32_t tx_aborts;	 // 发送中止次数(流控超时/溢出/等待过多)
+	uint32_t tx_retries; // 发送队列满的重试次数
+	uint64_t rx_bytes;	 // 收到的报文字节数
+	uint64_t tx_bytes;	 // 发送完成的报文字节数
+};
+
+typedef struct isotp *isotp_handle;
+
+/**
+ * @brief 创建ISO-TP通道
+ *
+ * @param cfg 通道配置, 需在通道销毁前保持有效
+ * @param opts 帧收发接口, 需在通道销毁前保持有效
+ * @return isotp_handle 成功
+ * @return NULL 失败
+ */
+isotp_handle isotp_create(const struct isotp_cfg *cfg, const struct isotp_opts *opts);
+
+/**
+ * @brief 销毁通道, 未完成的发送以失败回调
+ *
+ * @param handle 通道句柄
+ */
+void isotp_destroy(isotp_handle handle);
+
+/**
+ * @brief 发送一个报文, 不拷贝数据, 发送结束回调之前调用者需保持数据有效
+ *
+ * 单帧报文提交后在返回前回调 on_sent
+ *
+ * @param handle 通道句柄
+ * @param data 报文数据
+ * @param len 报文长度 1 ~ UINT32_MAX, 超过 ISOTP_MAX_LEN 时使用长度扩展
+ * @return true 已开始发送
+ * @return false 参数非法, 上一个报文未发完或发送队列满
+ */
+bool isotp_send(isotp_handle handle, const uint8_t *data, size_t len);
+
+/**
+ * @brief 输入一帧接收到的CAN帧
+ *
+ * 收到流控帧且允许发送时, 直接在调用线程中提交连续帧
+ *
+ * @param handle 通道句柄
+ * @param can_id CAN ID
+ * @param data 帧数据
+ * @param len 帧长度
+ * @return true 属于本通道
+ * @return false 不属于本通道
+ */
+bool isotp_on_frame(isotp_handle handle, uint32_t can_id, const uint8_t *data, size_t len);
+
+/**
+ * @brief 周期调用, 按STmin提交连续帧, 重试发送队列满时未提交的帧, 检查超时
+ *
+ * @param handle 通道句柄
+ */
+void isotp_poll(isotp_handle handle);
+
+/**
+ * @brief 是否正在发送
+ *
+ * @param handle 通道句柄
+ * @return true 发送中
+ */
+bool isotp_busy(isotp_handle handle);
+
+/**
+ * @brief 获取统计
+ *
+ * @param handle 通道句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零
+ */
+void isotp_get_stats(isotp_handle handle, struct isotp_stats *out, bool reset);
+
+#endif /* _ISOTP_H */
@@ -9,6 +9,8 @@
 #define MODBUS_FUN_WR_REG_MUL (0x10) // 写功能码
 
 #define MODBUS_REG_NUM_MAX (126) // 最大寄存器数量
+#define MODBUS_RD_REG_NUM_MAX (125) // 单次读最大寄存器数量(协议规定)
+#define MODBUS_WR_REG_NUM_MAX (123) // 单次写最大寄存器数量(协议规定)
 
 #define MODBUS_ADDR_BYTES_NUM (1)	 // 地址字节数
 #define MODBUS_FUNC_BYTES_NUM (1)	 // 功能码字节数
@@ -19,6 +21,34 @@
 // 一帧最大字节数 256
 #define MODBUS_FRAME_BYTES_MAX (256)
 
+// PDU最大字节数(功能码 + 数据) 253
+#define MODBUS_PDU_BYTES_MAX (MODBUS_FRAME_BYTES_MAX - MODBUS_ADDR_BYTES_NUM - MODBUS_CRC_BYTES_NUM)
+
+/* Modbus TCP (MBAP) */
+#define MODBUS_TCP_DEFAULT_PORT (502)  // 默认端口
+#define MODBUS_TCP_PROTOCOL_ID (0x0000) // 协议标识, Modbus固定为0
+#define MODBUS_TCP_UNIT_ID_ANY (0xFF)	// 单元标识通配, 直连TCP设备时使用
+#define MODBUS_TCP_MBAP_BYTES_NUM (7)	// MBAP头: 事务(2) + 协议(2) + 长度(2) + 单元(1)
+
+// TCP一帧最大字节数 260
+#define MODBUS_TCP_FRAME_BYTES_MAX (MODBUS_TCP_MBAP_BYTES_NUM + MODBUS_PDU_BYTES_MAX)
+
+/* 异常响应 */
+#define MODBUS_EXCEPTION_FLAG (0x80)	  // 异常响应功能码标志
+#define MODBUS_EX_ILLEGAL_FUNCTION (0x01) // 非法功能码
+#define MODBUS_EX_ILLEGAL_ADDRESS (0x02)  // 非法寄存器地址
+#define MODBUS_EX_ILLEGAL_VALUE (0x03)	  // 非法数据值(如寄存器数量)
+#define MODBUS_EX_DEVICE_FAILURE (0x04)	  // 从机设备故障
+#define MODBUS_EX_GW_TARGET_FAILED (0x0B) // 网关目标设备无响应
+#define MODBUS_EX_CODE_NUM (0x0C)		  // 统计的异常码数量, 下标0记录非标准异常码
+
+/* 链路统计 */
+#define MODBUS_RTU_CHAR_BITS (11) // RTU每字符位数: 起始位 + 8数据位 + 校验位(或第二停止位) + 停止位
+
+// 按波特率估算RTU线上时间(微秒), 每帧另计3.5字符的帧间隔
+#define MODBUS_RTU_WIRE_US(bytes, frames, baud)                                                    \
+	(((uint64_t)(bytes) * 2 + (uint64_t)(frames) * 7) * MODBUS_RTU_CHAR_BITS * 500000 / (baud))
+
 // 校验功能码
 #define MODBUS_FUNC_CHECK_VALID(f)                                                                 \
 	(((f) == MODBUS_FUN_RD_REG_MUL) || ((f) == MODBUS_FUN_WR_REG_MUL))
@@ -43,35 +73,39 @@ enum modbus_serial_dir {
 /**
  * @brief 串口初始化函数指针
  *
+ * @param arg 串口回调参数, 即 serial_opts.arg
  * @return true 初始化成功
  * @return false 初始化失败
  */
-typedef bool (*modbus_serial_init)(void);
+typedef bool (*modbus_serial_init)(void *arg);
 
 /**
  * @brief 串口写函数指针
  *
  * @param p_data 待写入数据指针
  * @param len 待写入数据长度
+ * @param arg 串口回调参数
  * @return size_t 实际写入数据长度 失败返回0
  */
-typedef size_t (*modbus_serial_write)(uint8_t *p_data, uint16_t len);
+typedef size_t (*modbus_serial_write)(uint8_t *p_data, uint16_t len, void *arg);
 
 /**
  * @brief 串口读函数指针
  *
  * @param p_data 读入数据指针
  * @param len 待读数据长度
+ * @param arg 串口回调参数
  * @return size_t 实际读入数据长度 失败返回0
  */
-typedef size_t (*modbus_serial_read)(uint8_t *p_data, uint16_t len);
+typedef size_t (*modbus_serial_read)(uint8_t *p_data, uint16_t len, void *arg);
 
 /**
  * @brief 串口方向控制函数指针
  *
  * @param ctrl 串口方向控制
+ * @param arg 串口回调参数
  */
-typedef void (*modbus_serial_dir_ctrl)(enum modbus_serial_dir ctrl);
+typedef void (*modbus_serial_dir_ctrl)(enum modbus_serial_dir ctrl, void *arg);
 
 /**
  * @brief 检查是否发送完成
@@ -79,9 +113,10 @@ typedef void (*modbus_serial_dir_ctrl)(enum modbus_serial_dir ctrl);
  * 如果是轮训发送可直接设置为NULL
  * DAM发送则需要查询相关标志位
  * 
+ * @param arg 串口回调参数
  * @return ture:发送完/可以接收 false:发送中
  */
-typedef bool (*modbus_serial_check_send)(void);
+typedef bool (*modbus_serial_check_send)(void *arg);
 
 // 串口回调
 struct serial_opts {
@@ -90,6 +125,24 @@ struct serial_opts {
 	modbus_serial_read f_read;			   // 串口读函数指针
 	modbus_serial_dir_ctrl f_dir_ctrl;	   // 串口方向控制函数指针
 	modbus_serial_check_send f_check_send; // 判断是否发送完成
+	void *arg;							   // 回调参数, 多个串口可共用同一组回调
+	uint32_t baud;						   // 波特率, 用于估算总线占用率, 0代表不估算
+};
+
+// RTU链路统计, 主从机共用
+struct mb_link_stats {
+	uint64_t tx_bytes;						 // 发送字节数
+	uint64_t rx_bytes;						 // 接收字节数, 含噪声及发往其他从机的帧
+	uint32_t tx_frames;						 // 发送帧数, 含重发
+	uint32_t rx_frames;						 // 校验通过且被接收的帧数
+	uint32_t crc_errors;					 // CRC校验失败次数
+	uint32_t resyncs;						 // 重同步次数, 即丢弃未完成的帧后从下一字节重新解析
+	uint32_t timeouts;						 // 超时次数(仅主机)
+	uint32_t retries;						 // 重发次数(仅主机)
+	uint32_t exceptions[MODBUS_EX_CODE_NUM]; // 按异常码统计的异常次数
+	uint64_t busy_us;						 // 估算的总线占用时间
+	uint64_t elapsed_us;					 // 统计时长
+	uint8_t occupancy_pct;					 // 总线占用率, 未配置波特率为0
 };
 
 #endif
\ No newline at end of file
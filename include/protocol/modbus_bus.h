@@ -0,0 +1,159 @@
+/**
+ * @file modbus_bus.h
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus多总线主机管理
+ * @version 1.0
+ * @date 2024-12-25
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_BUS_H
+#define _MODBUS_BUS_H
+
+#include "protocol/modbus_master.h"
+#include "protocol/modbus_poll.h"
+#include "protocol/modbus_cache.h"
+
+#define MB_BUS_MAX (8) // 最大总线数量
+
+// 总线配置, 每条总线对应一个串口、一个主机和一个轮询调度器
+struct mb_bus_cfg {
+	const char *name;						  // 总线名称, 用于日志
+	struct serial_opts *opts;				  // 串口回调, 需在总线销毁前保持有效
+	const uint8_t *slaves;					  // 总线上的从机地址 可为NULL
+	size_t slave_num;						  // 从机数量
+	const struct mb_poll_entry *poll_table;	  // 轮询表 可为NULL, 其中的从机自动加入本总线
+	size_t poll_num;						  // 轮询项数量
+	const struct mb_cache_entry *cache_table; // 缓存表 可为NULL, 由本总线的轮询调度器刷新
+	size_t cache_num;						  // 缓存项数量
+};
+
+// 总线统计, 由总线上所有从机的统计及串口链路统计汇总
+struct mb_bus_stats {
+	uint32_t ok;		   // 收到回复次数
+	uint32_t timeouts;	   // 超时次数
+	uint32_t retries;	   // 重发次数
+	uint32_t fast_fails;   // 熔断直接失败次数
+	uint32_t exceptions;   // 异常响应次数
+	uint32_t crc_errors;   // CRC校验失败次数
+	uint32_t resyncs;	   // 重同步次数
+	uint64_t tx_bytes;	   // 发送字节数
+	uint64_t rx_bytes;	   // 接收字节数
+	uint8_t occupancy_pct; // 总线占用率, 汇总时取各总线的最大值
+	uint32_t elapsed_ms;   // 自初始化起经过的时间, 用于计算吞吐
+};
+
+// 多总线管理句柄
+typedef struct mb_bus *mb_bus_handle;
+
+/**
+ * @brief 为每条总线创建主机与轮询调度器并申请句柄
+ *
+ * 同一从机地址只能属于一条总线, 请求按从机地址路由到所属总线
+ * 各总线的主机相互独立, 请求可同时在不同总线上传输
+ * 缓存项与轮询项并入同一轮询调度器, 一条总线上只有一个调度器向主机提交请求
+ *
+ * @param cfg 总线配置数组
+ * @param num 总线数量 1 ~ MB_BUS_MAX
+ * @return mb_bus_handle 成功返回句柄,失败返回NULL
+ */
+mb_bus_handle mb_bus_init(const struct mb_bus_cfg *cfg, size_t num);
+
+/**
+ * @brief 销毁所有总线的轮询调度器、主机与缓存并释放句柄
+ *
+ * @param handle 多总线管理句柄
+ */
+void mb_bus_destroy(mb_bus_handle handle);
+
+/**
+ * @brief 按从机地址提交请求到所属总线
+ *
+ * @param handle 多总线管理句柄
+ * @param request 请求结构体
+ * @return mb_mst_req_id 所属总线主机的请求标识, 从机不属于任何总线或提交失败返回0
+ */
+mb_mst_req_id mb_bus_request(mb_bus_handle handle, const struct mb_mst_request *request);
+
+/**
+ * @brief 获取从机所属总线的主机, 用于取消请求或查询从机状态
+ *
+ * @param handle 多总线管理句柄
+ * @param slave_addr 从机地址
+ * @return mb_mst_handle 不属于任何总线返回NULL
+ */
+mb_mst_handle mb_bus_route(mb_bus_handle handle, uint8_t slave_addr);
+
+/**
+ * @brief 获取从机所属总线的寄存器缓存, 用于读取缓存或订阅变化
+ *
+ * @param handle 多总线管理句柄
+ * @param slave_addr 从机地址
+ * @return mb_cache_handle 不属于任何总线或所属总线无缓存表返回NULL
+ */
+mb_cache_handle mb_bus_cache(mb_bus_handle handle, uint8_t slave_addr);
+
+/**
+ * @brief 轮询所有总线, 每条总线各自调度轮询表并处理收发, 互不等待
+ *
+ * @param handle 多总线管理句柄
+ */
+void mb_bus_poll(mb_bus_handle handle);
+
+/**
+ * @brief 所有总线中最近的超时或轮询到期时间, 用于事件循环精确休眠
+ *
+ * @param handle 多总线管理句柄
+ * @return int 毫秒, 0代表需立即轮询, -1代表无请求
+ */
+int mb_bus_next_deadline(mb_bus_handle handle);
+
+/**
+ * @brief 总线数量
+ *
+ * @param handle 多总线管理句柄
+ * @return size_t 
+ */
+size_t mb_bus_num(mb_bus_handle handle);
+
+/**
+ * @brief 获取总线名称
+ *
+ * @param handle 多总线管理句柄
+ * @param bus 总线编号
+ * @return const char* 编号无效返回NULL
+ */
+const char *mb_bus_name(mb_bus_handle handle, size_t bus);
+
+/**
+ * @brief 获取总线统计
+ *
+ * @param handle 多总线管理句柄
+ * @param bus 总线编号, -1代表所有总线汇总
+ * @param stats 统计输出
+ * @return true 成功
+ * @return false 编号无效
+ */
+bool mb_bus_get_stats(mb_bus_handle handle, int bus, struct mb_bus_stats *stats);
+
+#endif /* _MODBUS_BUS_H */
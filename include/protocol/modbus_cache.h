@@ -0,0 +1,137 @@
+/**
+ * @file modbus_cache.h
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus主机寄存器缓存
+ * @version 1.0
+ * @date 2024-12-26
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_CACHE_H
+#define _MODBUS_CACHE_H
+
+#include "protocol/modbus_master.h"
+#include "protocol/modbus_poll.h"
+
+#define MB_CACHE_SUB_MAX (16) // 最大订阅数量
+
+// 缓存项: 一个从机的一段寄存器, 同一从机的缓存项不能重叠
+struct mb_cache_entry {
+	uint8_t slave_addr;	 // 从机地址
+	uint16_t reg_addr;	 // 起始寄存器
+	uint16_t reg_len;	 // 寄存器数量 1 ~ MODBUS_RD_REG_NUM_MAX
+	uint32_t ttl_ms;	 // 新鲜期, 超过后读取会触发刷新
+	uint32_t period_ms;	 // 后台刷新周期 0代表仅在读取未命中或过期时刷新
+	uint8_t priority;	 // 刷新优先级 数值越小越优先
+	uint32_t timeout_ms; // 超时时间 0代表 MB_POLL_TIMEOUT_MS
+};
+
+// 读取结果
+enum mb_cache_result {
+	MB_CACHE_HIT = 0, // 命中, 数据在新鲜期内
+	MB_CACHE_STALE,	  // 数据已过期, 返回旧值并触发刷新
+	MB_CACHE_MISS,	  // 从未读取成功或不在缓存表中, 不输出数据
+};
+
+/**
+ * @brief 订阅回调, 寄存器值变化时调用
+ *
+ * @param slave_addr 从机地址
+ * @param reg_addr 起始寄存器
+ * @param vals 订阅范围与本次刷新范围交集内的寄存器值
+ * @param reg_len 寄存器数量
+ * @param arg 用户私有数据
+ */
+typedef void (*mb_cache_notify)(
+	uint8_t slave_addr, uint16_t reg_addr, const uint16_t *vals, uint16_t reg_len, void *arg);
+
+// 寄存器缓存句柄
+typedef struct mb_cache *mb_cache_handle;
+
+/**
+ * @brief 根据缓存表创建缓存并申请句柄
+ *
+ * 缓存本身不调度请求, 缓存项转换为轮询项并入所属总线的轮询表(见 mb_bus_cfg),
+ * 与总线上的其他轮询项统一按优先级调度, 相邻的按需缓存项合并为一个请求
+ *
+ * @param table 缓存表, 内部会拷贝
+ * @param num 缓存项数量
+ * @return mb_cache_handle 成功返回句柄,失败返回NULL
+ */
+mb_cache_handle mb_cache_init(const struct mb_cache_entry *table, size_t num);
+
+/**
+ * @brief 释放句柄, 需在挂接的轮询调度器销毁后调用
+ *
+ * @param handle 寄存器缓存句柄
+ */
+void mb_cache_destroy(mb_cache_handle handle);
+
+/**
+ * @brief 获取缓存项对应的轮询项, 用于并入总线的轮询表
+ *
+ * @param handle 寄存器缓存句柄
+ * @param num 轮询项数量输出
+ * @return const struct mb_poll_entry* 轮询项, 在缓存销毁前有效
+ */
+const struct mb_poll_entry *mb_cache_poll_table(mb_cache_handle handle, size_t *num);
+
+/**
+ * @brief 挂接刷新缓存项的轮询调度器, 读取未命中或过期时向其触发刷新
+ *
+ * @param handle 寄存器缓存句柄
+ * @param poll 轮询表包含 mb_cache_poll_table 的轮询调度器
+ */
+void mb_cache_attach(mb_cache_handle handle, mb_poll_handle poll);
+
+/**
+ * @brief 读取寄存器, 不访问总线, 未命中或过期时触发刷新
+ *
+ * 读取范围可跨越同一从机相邻的多个缓存项
+ *
+ * @param handle 寄存器缓存句柄
+ * @param slave_addr 从机地址
+ * @param reg_addr 起始寄存器
+ * @param reg_len 寄存器数量
+ * @param vals 寄存器值输出, 未命中时内容不确定
+ * @return enum mb_cache_result 读取结果
+ */
+enum mb_cache_result mb_cache_read(mb_cache_handle handle, uint8_t slave_addr, uint16_t reg_addr,
+	uint16_t reg_len, uint16_t *vals);
+
+/**
+ * @brief 订阅寄存器变化, 首次读取成功及之后值变化时回调
+ *
+ * @param handle 寄存器缓存句柄
+ * @param slave_addr 从机地址
+ * @param reg_addr 起始寄存器
+ * @param reg_len 寄存器数量
+ * @param notify 回调
+ * @param arg 用户私有数据, 回调时原样传回 可为NULL
+ * @return true 成功
+ * @return false 订阅已满或参数错误
+ */
+bool mb_cache_subscribe(mb_cache_handle handle, uint8_t slave_addr, uint16_t reg_addr,
+	uint16_t reg_len, mb_cache_notify notify, void *arg);
+
+#endif /* _MODBUS_CACHE_H */
@@ -0,0 +1,136 @@
+/**
+ * @file modbus_capture.h
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus串口抓包(pcap)与回放
+ * @version 1.0
+ * @date 2025-01-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_CAPTURE_H
+#define _MODBUS_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol/modbus.h"
+
+#define MB_CAP_DLT (147)	  // pcap链路类型 DLT_USER0, 每条记录首字节为方向
+#define MB_CAP_SNAPLEN (4096) // 单条记录最大数据长度, 不含方向字节
+
+// 数据方向, 以抓包的串口为参照
+enum mb_cap_dir {
+	MB_CAP_DIR_RX = 0, // 串口收到的数据
+	MB_CAP_DIR_TX = 1, // 串口发出的数据
+};
+
+// 回放统计
+struct mb_replay_stats {
+	uint32_t records;  // 已回放的记录数
+	uint64_t rx_bytes; // 已送入协议层的字节数
+	uint64_t tx_bytes; // 协议层写出的字节数(丢弃)
+	uint32_t tx_calls; // 协议层写出次数, 一般等于回复或请求帧数
+};
+
+// 抓包句柄
+typedef struct mb_cap *mb_cap_handle;
+
+// 回放句柄
+typedef struct mb_replay *mb_replay_handle;
+
+/***************************抓包***************************/
+
+/**
+ * @brief 创建pcap抓包文件, 写入文件头
+ *
+ * @param path 文件路径, 已存在时覆盖
+ * @return mb_cap_handle 成功返回句柄,失败返回NULL
+ */
+mb_cap_handle mb_cap_open(const char *path);
+
+/**
+ * @brief 写入一条带时间戳的记录, 超过MB_CAP_SNAPLEN的部分截断
+ *
+ * @param handle 抓包句柄
+ * @param dir 数据方向
+ * @param buf 数据
+ * @param len 数据长度
+ */
+void mb_cap_write(mb_cap_handle handle, enum mb_cap_dir dir, const uint8_t *buf, size_t len);
+
+/**
+ * @brief 写入缓冲中的记录并关闭文件
+ *
+ * @param handle 抓包句柄
+ */
+void mb_cap_close(mb_cap_handle handle);
+
+/***************************回放***************************/
+
+/**
+ * @brief 打开抓包文件, 申请回放句柄
+ *
+ * 回放句柄提供serial_opts, 读函数按顺序返回指定方向的记录, 写函数只统计并丢弃;
+ * 回放从机时送入从机收到的请求(RX), 回放主机时送入主机收到的回复(RX)
+ *
+ * @param path 抓包文件路径
+ * @param dir 送入协议层的数据方向
+ * @param realtime true: 按记录的时间间隔送入, false: 尽快送入
+ * @return mb_replay_handle 成功返回句柄,失败返回NULL
+ */
+mb_replay_handle mb_replay_open(const char *path, enum mb_cap_dir dir, bool realtime);
+
+/**
+ * @brief 关闭抓包文件并释放句柄
+ *
+ * @param handle 回放句柄
+ */
+void mb_replay_close(mb_replay_handle handle);
+
+/**
+ * @brief 获取回放用的串口回调, 直接用于主机或从机初始化
+ *
+ * @param handle 回放句柄
+ * @return struct serial_opts* 串口回调, 与句柄同生命周期
+ */
+struct serial_opts *mb_replay_opts(mb_replay_handle handle);
+
+/**
+ * @brief 判断是否已回放完所有记录
+ *
+ * @param handle 回放句柄
+ * @return true 已结束或文件损坏
+ * @return false 仍有记录
+ */
+bool mb_replay_done(mb_replay_handle handle);
+
+/**
+ * @brief 获取回放统计
+ *
+ * @param handle 回放句柄
+ * @param out 输出统计
+ */
+void mb_replay_get_stats(mb_replay_handle handle, struct mb_replay_stats *out);
+
+#endif /* _MODBUS_CAPTURE_H */
@@ -33,34 +33,79 @@
 #include "protocol/modbus.h"
 #include <stdint.h>
 
-#define MASTER_REPEATS (3) // 超时未回复重发3次
+#define MASTER_REPEATS (3)	  // 超时未回复重发3次
+#define MB_MST_POOL_SIZE (16) // 请求池大小, 即同时排队的请求数量上限
+
+#define MB_MST_RTO_MIN_MS (20)		// 自适应超时下限
+#define MB_MST_BREAKER_FAILS (2)	// 连续超时次数达到后熔断
+#define MB_MST_PROBE_MIN_MS (1000)	// 熔断后首次探测间隔
+#define MB_MST_PROBE_MAX_MS (60000)	// 探测间隔上限, 每次探测失败加倍
+
+// 请求标识, 0代表无效
+typedef uint32_t mb_mst_req_id;
+
+// 请求状态
+enum mb_mst_req_state {
+	MB_MST_REQ_NONE = 0,  // 已完成、已取消或不存在
+	MB_MST_REQ_QUEUED,	  // 排队等待发送
+	MB_MST_REQ_IN_FLIGHT, // 已发送等待回复
+};
+
+// 从机健康状态
+enum mb_mst_slave_health {
+	MB_MST_SLAVE_UNKNOWN = 0, // 尚未收到回复
+	MB_MST_SLAVE_ONLINE,	  // 正常
+	MB_MST_SLAVE_OFFLINE,	  // 熔断中, 请求直接失败不占用总线
+	MB_MST_SLAVE_PROBING,	  // 探测中, 只发送一次
+};
+
+// 从机统计
+struct mb_mst_slave_stats {
+	enum mb_mst_slave_health health; // 健康状态
+	uint32_t srtt_us;				 // 平滑往返时间
+	uint32_t rttvar_us;				 // 往返时间偏差
+	uint32_t rto_us;				 // 当前首次发送的超时时间, 0代表无样本使用请求的超时时间
+	uint32_t rtt_min_us;			 // 最小往返时间
+	uint32_t rtt_max_us;			 // 最大往返时间
+	uint32_t ok;					 // 成功次数
+	uint32_t timeouts;				 // 超时次数(重发完仍未回复)
+	uint32_t retries;				 // 重发次数
+	uint32_t fast_fails;			 // 熔断期间直接失败的次数
+	uint32_t exceptions;			 // 异常响应次数
+	uint32_t crc_errors;			 // 等待该从机回复时的CRC校验失败次数
+	uint32_t tx_frames;				 // 发送帧数, 含重发
+	uint32_t rx_frames;				 // 收到回复帧数, 含异常响应
+	uint64_t tx_bytes;				 // 发送字节数
+	uint64_t rx_bytes;				 // 回复帧字节数
+	uint64_t busy_us;				 // 估算的该从机占用总线时间, 未配置波特率为0
+	uint32_t next_probe_ms;			 // 熔断中距离下次探测的时间
+};
 
 /**
  * @brief 主机接收帧处理
  *
- * @param data 仅对 读 功能码有效  接收到的数据
- * @param len  仅对 读 功能码有效  数据长度
- * @param is_timeout ture:超时未回复 false:收到回复
+ * 失败时 len 为1代表收到异常响应, data[0] 为从机回复的异常码; len 为0代表超时或回复无效
  *
- * @return uint8_t 参考响应码
+ * @param data 仅对 读 功能码有效  接收到的数据; 异常响应时为异常码
+ * @param len  仅对 读 功能码有效  数据长度; 异常响应时为1
+ * @param is_timeout ture:超时未回复或收到异常响应 false:收到回复
+ * @param arg  请求中的用户私有数据
  */
-typedef void (*mb_mst_pdu_resp)(uint8_t *data, size_t len, bool is_timeout);
+typedef void (*mb_mst_pdu_resp)(uint8_t *data, size_t len, bool is_timeout, void *arg);
 
-// 请求报文 (必须定义为全局变量 运行时再去调整修改成员值)
+// 请求报文, 提交时拷贝到请求池, 可定义为局部变量
 struct mb_mst_request {
-	uint16_t _hide_[2]; // 保留数据 用户无需修改
-
-	/* 用户配置区域 */
-	uint32_t timeout_ms;  // 此报文的超时时间
+	uint32_t timeout_ms;  // 超时时间上限, 有往返时间样本后按从机自适应缩短
 	uint8_t slave_addr;	  // 从机地址
 	uint8_t func;		  // 功能玛 读:0x03 写:0x10
 	uint16_t reg_addr;	  // 寄存器地址
 	uint8_t reg_len;	  // 寄存器长度
 
-	uint8_t *data;		  // 数据缓冲 仅对写功能玛有效 (必须定义为全局变量)
+	uint8_t *data;		  // 数据缓冲 仅对写功能玛有效 提交时拷贝
 	uint8_t data_len;	  // 缓冲长度
 
 	mb_mst_pdu_resp resp; // 回复处理
+	void *arg;			  // 用户私有数据, 回调时原样传回 可为NULL
 };
 
 // 主机句柄
@@ -70,7 +115,7 @@ typedef struct mb_mst *mb_mst_handle;
  * @brief 主机初始化并申请句柄
  *
  * @param opts 读写等回调函数指针
- * @param period_ms 轮训周期
+ * @param period_ms 轮训周期(保留, 超时已改为单调时钟计时)
  * @return mb_mst_handle 成功返回句柄,失败返回NULL
  */
 mb_mst_handle mb_mst_init(struct serial_opts *opts, size_t period_ms);
@@ -90,11 +135,60 @@ void mb_mst_destroy(mb_mst_handle handle);
 void mb_mst_poll(mb_mst_handle handle);
 
 /**
- * @brief 主机发送报文
+ * @brief 主机发送报文, 请求及写数据拷贝到请求池, 调用后请求可立即释放或修改
  * 
  * @param handle 主机句柄
  * @param request 请求结构体
+ * @return mb_mst_req_id 请求标识, 请求非法或请求池已满返回0
+ */
+mb_mst_req_id mb_mst_pdu_request(mb_mst_handle handle, const struct mb_mst_request *request);
+
+/**
+ * @brief 取消请求, 取消后不会回调
+ * 
+ * @param handle 主机句柄
+ * @param id 请求标识
+ * @return true 已取消
+ * @return false 请求已完成或不存在
+ */
+bool mb_mst_cancel(mb_mst_handle handle, mb_mst_req_id id);
+
+/**
+ * @brief 查询请求状态
+ * 
+ * @param handle 主机句柄
+ * @param id 请求标识
+ * @return enum mb_mst_req_state 
+ */
+enum mb_mst_req_state mb_mst_req_state(mb_mst_handle handle, mb_mst_req_id id);
+
+/**
+ * @brief 距离下一个超时的时间, 用于事件循环精确休眠到超时时刻
+ * 
+ * @param handle 主机句柄
+ * @return int 毫秒, 0代表已到期或有请求待发送需立即轮询, -1代表无请求
+ */
+int mb_mst_next_deadline(mb_mst_handle handle);
+
+/**
+ * @brief 获取从机的健康状态与往返时间统计
+ * 
+ * @param handle 主机句柄
+ * @param slave_addr 从机地址
+ * @param stats 输出统计
+ * @return true 成功
+ * @return false 参数非法或从未向该从机发送请求
+ */
+bool mb_mst_get_slave_stats(
+	mb_mst_handle handle, uint8_t slave_addr, struct mb_mst_slave_stats *stats);
+
+/**
+ * @brief 获取串口链路统计, 并按配置的波特率估算总线占用率
+ * 
+ * @param handle 主机句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零, 清零后重新计时
  */
-void mb_mst_pdu_request(mb_mst_handle handle, struct mb_mst_request *request);
+void mb_mst_get_link_stats(mb_mst_handle handle, struct mb_link_stats *out, bool reset);
 
 #endif
\ No newline at end of file
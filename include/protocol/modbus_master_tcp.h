@@ -0,0 +1,124 @@
+/**
+ * @file modbus_master_tcp.h
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus主机 TCP(MBAP) 及 RTU over TCP 传输层
+ * @version 1.0
+ * @date 2024-12-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_MASTER_TCP_H
+#define _MODBUS_MASTER_TCP_H
+
+#include "protocol/modbus_master.h"
+
+#define MB_MST_TCP_MAX_CONN (8)				 // 最大连接数
+#define MB_MST_TCP_POOL_SIZE (128)			 // 请求池大小, 所有连接共用
+#define MB_MST_TCP_PIPELINE (16)			 // MBAP模式下每个连接同时在途的事务数上限
+#define MB_MST_TCP_RECONNECT_MS (1000)		 // 断线后重连间隔, 期间该连接的请求直接失败
+#define MB_MST_TCP_CONNECT_TIMEOUT_MS (3000) // 非阻塞连接超时, 超时后关闭并按间隔重连
+
+// 连接模式
+enum mb_mst_tcp_mode {
+	MB_MST_TCP_MODE_MBAP = 0, // Modbus TCP, 以事务标识匹配回复, 支持流水线
+	MB_MST_TCP_MODE_RTU,	  // RTU over TCP, 帧格式与串口相同(含CRC), 同一时间只有一个事务
+};
+
+// TCP主机句柄
+typedef struct mb_mst_tcp *mb_mst_tcp_handle;
+
+/**
+ * @brief TCP主机初始化并申请句柄, 所有连接共用一个epoll
+ *
+ * @return mb_mst_tcp_handle 成功返回句柄,失败返回NULL
+ */
+mb_mst_tcp_handle mb_mst_tcp_init(void);
+
+/**
+ * @brief 关闭所有连接并释放句柄, 未完成的请求不回调
+ *
+ * @param handle TCP主机句柄
+ */
+void mb_mst_tcp_destroy(mb_mst_tcp_handle handle);
+
+/**
+ * @brief 添加一个连接, 非阻塞连接, 断线后自动重连
+ *
+ * @param handle TCP主机句柄
+ * @param ip 服务端IPv4地址
+ * @param port 服务端端口, 通常为 MODBUS_TCP_DEFAULT_PORT
+ * @param mode 连接模式
+ * @return int 连接编号, 失败返回-1
+ */
+int mb_mst_tcp_connect(
+	mb_mst_tcp_handle handle, const char *ip, uint16_t port, enum mb_mst_tcp_mode mode);
+
+/**
+ * @brief 在指定连接上发送请求, 请求及写数据拷贝到请求池
+ *
+ * 请求中的从机地址作为MBAP单元标识;
+ * 异常回复与超时一样以 is_timeout=true 回调, 异常回复时数据为异常码
+ * 超时从提交时开始计算, 等待连接建立或流水线窗口的排队时间也计算在内
+ *
+ * @param handle TCP主机句柄
+ * @param conn 连接编号
+ * @param request 请求结构体
+ * @return mb_mst_req_id 请求标识, 请求非法、连接不存在或请求池已满返回0
+ */
+mb_mst_req_id mb_mst_tcp_request(
+	mb_mst_tcp_handle handle, int conn, const struct mb_mst_request *request);
+
+/**
+ * @brief 取消请求, 取消后不会回调, 已发送的请求迟到的回复会被丢弃
+ *
+ * @param handle TCP主机句柄
+ * @param id 请求标识
+ * @return true 已取消
+ * @return false 请求已完成或不存在
+ */
+bool mb_mst_tcp_cancel(mb_mst_tcp_handle handle, mb_mst_req_id id);
+
+/**
+ * @brief TCP主机轮询, 不阻塞, 处理所有就绪的连接、超时与重连
+ *
+ * @param handle TCP主机句柄
+ */
+void mb_mst_tcp_poll(mb_mst_tcp_handle handle);
+
+/**
+ * @brief 获取内部epoll描述符, 可注册到外部事件循环, 可读时调用 mb_mst_tcp_poll
+ *
+ * @param handle TCP主机句柄
+ * @return int epoll描述符, 失败返回-1
+ */
+int mb_mst_tcp_get_fd(mb_mst_tcp_handle handle);
+
+/**
+ * @brief 距离下一个超时或重连的时间, 用于事件循环精确休眠
+ *
+ * @param handle TCP主机句柄
+ * @return int 毫秒, 0代表需立即轮询, -1代表无请求
+ */
+int mb_mst_tcp_next_deadline(mb_mst_tcp_handle handle);
+
+#endif /* _MODBUS_MASTER_TCP_H */
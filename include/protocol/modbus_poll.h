@@ -0,0 +1,108 @@
+/**
+ * @file modbus_poll.h
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus主机周期轮询调度
+ * @version 1.0
+ * @date 2024-12-22
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_POLL_H
+#define _MODBUS_POLL_H
+
+#include "protocol/modbus_master.h"
+
+#define MB_POLL_TIMEOUT_MS (100) // 轮询项未指定超时时间时的默认值
+
+// 轮询项: 周期读取一个从机的一段寄存器
+struct mb_poll_entry {
+	uint8_t slave_addr;	  // 从机地址
+	uint16_t reg_addr;	  // 起始寄存器
+	uint16_t reg_len;	  // 寄存器数量 1 ~ MODBUS_RD_REG_NUM_MAX
+	uint32_t period_ms;	  // 读取周期 0代表仅在 mb_poll_trigger 时读取
+	uint8_t priority;	  // 优先级 数值越小越优先
+	uint32_t timeout_ms;  // 超时时间 0代表 MB_POLL_TIMEOUT_MS
+	mb_mst_pdu_resp resp; // 回复处理, 数据只包含本项的寄存器
+	void *arg;			  // 用户私有数据, 回调时原样传回 可为NULL
+};
+
+// 轮询调度句柄
+typedef struct mb_poll *mb_poll_handle;
+
+/**
+ * @brief 根据轮询表生成合并后的读请求并申请句柄
+ *
+ * 同一从机相邻或重叠的寄存器段, 在不超过 MODBUS_RD_REG_NUM_MAX 且能减少总线占用时
+ * 合并为一个0x03请求, 合并后的请求按成员中最短的周期、最高的优先级调度
+ *
+ * @param mst 主机句柄
+ * @param table 轮询表, 内部会拷贝
+ * @param num 轮询项数量
+ * @return mb_poll_handle 成功返回句柄,失败返回NULL
+ */
+mb_poll_handle mb_poll_init(mb_mst_handle mst, const struct mb_poll_entry *table, size_t num);
+
+/**
+ * @brief 释放句柄, 在途请求会被取消, 需在主机销毁前调用
+ *
+ * @param handle 轮询调度句柄
+ */
+void mb_poll_destroy(mb_poll_handle handle);
+
+/**
+ * @brief 调度轮询, 同一时间只向主机提交一个请求, 优先级最高、最早到期的先发送
+ *
+ * @param handle 轮询调度句柄
+ */
+void mb_poll_schedule(mb_poll_handle handle);
+
+/**
+ * @brief 距离下一个请求到期的时间, 用于事件循环精确休眠
+ *
+ * @param handle 轮询调度句柄
+ * @return int 毫秒, 0代表已有请求到期, -1代表请求在途或无请求
+ */
+int mb_poll_next_deadline(mb_poll_handle handle);
+
+/**
+ * @brief 触发覆盖指定寄存器的请求立即到期, 用于按需读取或提前刷新
+ *
+ * @param handle 轮询调度句柄
+ * @param slave_addr 从机地址
+ * @param reg_addr 起始寄存器
+ * @param reg_len 寄存器数量
+ * @return true 已触发或覆盖的请求正在传输
+ * @return false 轮询表中没有覆盖这些寄存器的请求
+ */
+bool mb_poll_trigger(
+	mb_poll_handle handle, uint8_t slave_addr, uint16_t reg_addr, uint16_t reg_len);
+
+/**
+ * @brief 合并后的请求数量
+ *
+ * @param handle 轮询调度句柄
+ * @return size_t 
+ */
+size_t mb_poll_request_num(mb_poll_handle handle);
+
+#endif /* _MODBUS_POLL_H */
@@ -0,0 +1,180 @@
+/**
+ * @file modbus_serial.h
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus RTU 串口传输层(RS485)
+ * @version 1.0
+ * @date 2025-01-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_SERIAL_H
+#define _MODBUS_SERIAL_H
+
+#include "protocol/modbus.h"
+#include "utils/epoll_timer.h"
+#include "protocol/modbus_capture.h"
+
+// 校验位
+enum mb_serial_parity {
+	MB_SERIAL_PARITY_NONE = 0, // 无校验
+	MB_SERIAL_PARITY_ODD,	   // 奇校验
+	MB_SERIAL_PARITY_EVEN,	   // 偶校验
+};
+
+// 收发方向控制方式
+enum mb_serial_dir_mode {
+	MB_SERIAL_DIR_NONE = 0,	// 无方向控制(RS232/全双工或收发器自动切换)
+	MB_SERIAL_DIR_KERNEL,	// 内核RS485模式(TIOCSRS485), 驱动在发送前后切换RTS
+	MB_SERIAL_DIR_RTS,		// 驱动不支持RS485模式, 由本模块手动切换RTS
+};
+
+// 串口配置, 数据位固定为8位(RTU规定)
+struct mb_serial_cfg {
+	const char *path;			  // 设备路径
+	uint32_t baud;				  // 波特率
+	enum mb_serial_parity parity; // 校验位
+	uint8_t stop_bits;			  // 停止位 1或2, 0按1处理
+	bool rs485;					  // 收发方向由RTS控制, 优先使用内核RS485模式
+	bool rts_invert;			  // 发送时RTS为逻辑0, 默认发送时为逻辑1
+	uint32_t rts_before_send_ms;  // 拉起RTS到开始发送的延时
+	uint32_t rts_after_send_ms;	  // 发送完成到释放RTS的延时, 即半双工换向时间
+	bool low_latency;			  // 低延时接收: 驱动收到数据立即推送, 不经工作队列批量唤醒
+	uint8_t rx_trig_bytes;		  // UART接收FIFO触发深度, 0代表驱动默认, 需驱动支持
+};
+
+// 接收唤醒统计, 用于比较低延时接收开启前后的批量程度
+struct mb_serial_rx_stats {
+	uint32_t wakeups;	   // 读到数据的次数
+	uint64_t bytes;		   // 读到的字节数
+	uint32_t max_burst;	   // 单次读到的最大字节数
+	uint64_t delay_sum_us; // 首字节到达至读取的延时下限之和, 按(单次字节数-1)*字符时间估算
+	uint32_t delay_max_us; // 首字节到达至读取的延时下限最大值
+};
+
+// 串口句柄
+typedef struct mb_serial *mb_serial_handle;
+
+/**
+ * @brief 打开并配置串口, 申请句柄
+ *
+ * 开启rs485时先尝试内核RS485模式, 驱动不支持时退化为手动切换RTS,
+ * 仍不支持(如伪终端)则不控制方向
+ *
+ * @param cfg 串口配置, 只在调用期间使用
+ * @return mb_serial_handle 成功返回句柄,失败返回NULL
+ */
+mb_serial_handle mb_serial_open(const struct mb_serial_cfg *cfg);
+
+/**
+ * @brief 等待发送完成, 恢复原始配置并关闭串口
+ *
+ * @param handle 串口句柄
+ */
+void mb_serial_close(mb_serial_handle handle);
+
+/**
+ * @brief 获取绑定到本串口的Modbus串口回调, 可直接用于主机或从机初始化
+ *
+ * 回调中的写函数不阻塞, 驱动写满时剩余数据进入发送队列;
+ * 发送完成由f_check_send按发送队列、驱动输出队列与tcdrain判断
+ *
+ * @param handle 串口句柄
+ * @return struct serial_opts* 串口回调, 与句柄同生命周期
+ */
+struct serial_opts *mb_serial_opts(mb_serial_handle handle);
+
+/**
+ * @brief 获取串口描述符, 可注册到外部事件循环, 可读时轮询主机或从机
+ *
+ * @param handle 串口句柄
+ * @return int 文件描述符, 失败返回-1
+ */
+int mb_serial_get_fd(mb_serial_handle handle);
+
+/**
+ * @brief 注册到事件循环, 可读时调用用户处理函数, 可写时由本模块续写发送队列
+ *
+ * 发送队列清空后也会调用一次用户处理函数, 用于检查发送完成, 此时events含EPOLLOUT;
+ * 未注册时发送队列在f_check_send中续写
+ *
+ * @param handle 串口句柄
+ * @param loop 事件循环
+ * @param f_handle 用户处理函数, 一般为轮询主机或从机
+ * @param arg 用户处理函数参数
+ * @return true 成功
+ * @return false 失败
+ */
+bool mb_serial_attach(
+	mb_serial_handle handle, et_handle loop, epoll_fd_handler f_handle, void *arg);
+
+/**
+ * @brief 从事件循环注销, 之后发送队列由f_check_send续写
+ *
+ * @param handle 串口句柄
+ */
+void mb_serial_detach(mb_serial_handle handle);
+
+/**
+ * @brief 获取实际使用的方向控制方式
+ *
+ * @param handle 串口句柄
+ * @return enum mb_serial_dir_mode
+ */
+enum mb_serial_dir_mode mb_serial_dir_mode(mb_serial_handle handle);
+
+/**
+ * @brief 开始或停止抓包, 收发数据以pcap格式写入文件, 见modbus_capture.h
+ *
+ * 接收按每次读到的数据记录, 发送按每次写入的帧记录; 已在抓包时先停止旧文件
+ *
+ * @param handle 串口句柄
+ * @param path 抓包文件路径, NULL代表停止抓包
+ * @return true 成功
+ * @return false 失败
+ */
+bool mb_serial_capture(mb_serial_handle handle, const char *path);
+
+/**
+ * @brief 获取接收唤醒统计
+ *
+ * 驱动批量推送时单次读到的字节数变多, 首字节已在缓冲中等待的时间至少为其后字节的线上时间
+ *
+ * @param handle 串口句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零
+ */
+void mb_serial_get_rx_stats(mb_serial_handle handle, struct mb_serial_rx_stats *out, bool reset);
+
+/**
+ * @brief 非阻塞写入, 不切换方向, 用于Modbus以外的透传数据
+ *
+ * 驱动写满时剩余数据进入发送队列, 保证不截断且不阻塞, 队列按顺序续写
+ *
+ * @param handle 串口句柄
+ * @param buf 数据缓冲
+ * @param len 数据长度
+ * @return size_t 写入驱动与进入发送队列的总长度, 发送队列满时小于len
+ */
+size_t mb_serial_write(mb_serial_handle handle, const uint8_t *buf, size_t len);
+
+#endif /* _MODBUS_SERIAL_H */
@@ -31,6 +31,7 @@
 #define _MODBUS_SLAVE_H
 
 #include "protocol/modbus.h"
+#include "protocol/modbus_master.h"
 
 // 响应码
 #define MODBUS_RESP_SUCCESS 0x00	// 响应成功
@@ -53,6 +54,29 @@
 typedef uint8_t (*mb_slv_frame_resp)(
 	uint8_t func, uint16_t reg, uint16_t reg_num, uint16_t *p_in_out);
 
+#define MB_SLV_MAX_UNITS (16)		 // 单个从机句柄最多服务的单元(从机地址)数量
+#define MB_SLV_GW_MAX_PENDING (16)	 // 网关同时转发中的最大请求数量
+#define MB_SLV_PDU_PENDING (0xFFFF) // 请求已转发至下游, 稍后通过回复上下文回调
+
+// 请求到回复延时直方图桶数量, 各桶上限(微秒): 100, 200, 500, 1000, 2000, 5000, 10000, 无穷
+#define MB_SLV_LAT_BUCKETS (8)
+
+// RTU请求到回复的延时统计, 从收到帧首字节的读取时刻计到回复写入驱动
+struct mb_slv_latency {
+	uint32_t count;						   // 统计的回复数量
+	uint32_t min_us;					   // 最小延时
+	uint32_t max_us;					   // 最大延时
+	uint64_t sum_us;					   // 延时总和, 平均值为 sum_us / count
+	uint32_t buckets[MB_SLV_LAT_BUCKETS]; // 延时分布
+};
+
+// 单元(从机地址)的RTU收发统计
+struct mb_slv_unit_stats {
+	uint32_t rx_frames;	 // 收到的请求帧数
+	uint32_t tx_frames;	 // 回复帧数
+	uint32_t exceptions; // 处理失败的请求数, 按异常码的分布见链路统计
+};
+
 // 寄存器区间任务处理
 struct mb_slv_work {
 	uint16_t start; // 起始寄存器
@@ -63,6 +87,23 @@ struct mb_slv_work {
 // 从机句柄
 typedef struct mb_slv *mb_slv_handle;
 
+/**
+ * @brief 异步回复回调, 网关转发的请求完成后调用
+ *
+ * @param arg 回复上下文中的用户数据
+ * @param tag 回复上下文中的标签
+ * @param pdu 响应PDU, 下游超时则为网关异常响应(MODBUS_EX_GW_TARGET_FAILED)
+ * @param pdu_len 响应PDU长度
+ */
+typedef void (*mb_slv_reply_cb)(void *arg, uint32_t tag, const uint8_t *pdu, uint16_t pdu_len);
+
+// 异步回复上下文, 由传输层提供, 用于把网关转发的结果送回对应的请求方
+struct mb_slv_reply_ctx {
+	mb_slv_reply_cb cb; // 回复回调
+	void *arg;			// 用户数据
+	uint32_t tag;		// 标签, 如TCP事务标识
+};
+
 /**
  * @brief 从机初始化并申请句柄
  *
@@ -83,10 +124,93 @@ mb_slv_handle mb_slv_init(
 void mb_slv_destroy(mb_slv_handle handle);
 
 /**
- * @brief modbus任务轮询
+ * @brief 为从机句柄增加一个单元(从机地址), 每个单元拥有独立的处理表
+ *
+ * @param handle 从机句柄
+ * @param slv_addr 从机地址
+ * @param work_table 任务处理表
+ * @param table_num 任务处理表数量
+ * @return true 成功
+ * @return false 地址已存在或单元数量已满
+ */
+bool mb_slv_add_unit(
+	mb_slv_handle handle, uint8_t slv_addr, struct mb_slv_work *work_table, uint16_t table_num);
+
+/**
+ * @brief 开启网关模式, 未注册的单元地址转发给下游主机并回传响应
+ *
+ * 下游主机的生命周期必须长于从机: 从机销毁时会取消转发中的下游请求, 因此须先销毁从机再销毁主机
+ *
+ * @param handle 从机句柄
+ * @param mst 下游主机句柄, NULL代表关闭网关, 须在从机销毁后再销毁
+ * @param timeout_ms 下游请求超时时间
+ */
+void mb_slv_set_gateway(mb_slv_handle handle, mb_mst_handle mst, uint32_t timeout_ms);
+
+/**
+ * @brief modbus任务轮询, 读取并处理当前所有完整帧
+ *
+ * 可在串口可读时直接调用(事件驱动), 也可周期调用
  *
  * @param handle 从机句柄
  */
 void mb_slv_poll(mb_slv_handle handle);
 
+/**
+ * @brief 获取RTU请求到回复的延时统计(不含网关转发的请求)
+ *
+ * @param handle 从机句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零
+ */
+void mb_slv_get_latency(mb_slv_handle handle, struct mb_slv_latency *out, bool reset);
+
+/**
+ * @brief 获取RTU串口链路统计, 并按配置的波特率估算总线占用率
+ *
+ * 从机不回复异常响应, 异常码统计的是处理失败的请求
+ *
+ * @param handle 从机句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零, 清零后重新计时
+ */
+void mb_slv_get_link_stats(mb_slv_handle handle, struct mb_link_stats *out, bool reset);
+
+/**
+ * @brief 获取单元(从机地址)的RTU收发统计
+ *
+ * @param handle 从机句柄
+ * @param slv_addr 从机地址
+ * @param out 输出统计
+ * @return true 成功
+ * @return false 参数非法或地址未注册
+ */
+bool mb_slv_get_unit_stats(mb_slv_handle handle, uint8_t slv_addr, struct mb_slv_unit_stats *out);
+
+/**
+ * @brief 处理一帧完整的请求PDU, 供RTU以外的传输层(如Modbus TCP)共用同一处理表
+ *
+ * @param handle 从机句柄
+ * @param unit_id 单元标识(从机地址), MODBUS_TCP_UNIT_ID_ANY 代表不区分
+ * @param pdu 请求PDU(功能码 + 数据), 不含地址/MBAP头及CRC
+ * @param pdu_len 请求PDU长度
+ * @param resp 响应PDU缓冲, 长度不小于 MODBUS_PDU_BYTES_MAX
+ * @param ctx 异步回复上下文, NULL代表不允许网关转发
+ * @return uint16_t 响应PDU长度, 0代表不回复, MB_SLV_PDU_PENDING代表已转发待回调
+ */
+uint16_t mb_slv_pdu_process(mb_slv_handle handle, uint8_t unit_id, const uint8_t *pdu,
+	uint16_t pdu_len, uint8_t *resp, const struct mb_slv_reply_ctx *ctx);
+
+/**
+ * @brief 取消回复上下文匹配的网关转发, 被取消的请求不再回调
+ *
+ * 传输层在释放回复上下文引用的资源(如TCP连接)前调用, 避免转发完成时访问已释放的内存
+ *
+ * @param handle 从机句柄
+ * @param cb 回复回调
+ * @param arg 用户数据, NULL代表匹配该回调的所有转发
+ * @return size_t 取消的请求数
+ */
+size_t mb_slv_cancel_reply(mb_slv_handle handle, mb_slv_reply_cb cb, const void *arg);
+
 #endif
\ No newline at end of file
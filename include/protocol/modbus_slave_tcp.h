@@ -0,0 +1,74 @@
+/**
+ * @file modbus_slave_tcp.h
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus从机 TCP(MBAP) 传输层
+ * @version 1.0
+ * @date 2024-12-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_SLAVE_TCP_H
+#define _MODBUS_SLAVE_TCP_H
+
+#include "protocol/modbus_slave.h"
+
+#define MB_SLV_TCP_MAX_CONN (16) // 最大同时连接的客户端数量
+
+// TCP从机句柄
+typedef struct mb_slv_tcp *mb_slv_tcp_handle;
+
+/**
+ * @brief TCP从机初始化并申请句柄
+ *
+ * 与RTU从机共用同一个从机句柄, 即同一张处理表和寄存器映像
+ *
+ * @param slv 从机句柄
+ * @param ip 监听地址, NULL代表监听所有网卡
+ * @param port 监听端口, 通常为 MODBUS_TCP_DEFAULT_PORT
+ * @return mb_slv_tcp_handle 成功返回句柄,失败返回NULL
+ */
+mb_slv_tcp_handle mb_slv_tcp_init(mb_slv_handle slv, const char *ip, uint16_t port);
+
+/**
+ * @brief 关闭所有连接并释放句柄
+ *
+ * @param handle TCP从机句柄
+ */
+void mb_slv_tcp_destroy(mb_slv_tcp_handle handle);
+
+/**
+ * @brief TCP从机轮询, 不阻塞, 处理所有就绪的连接
+ *
+ * @param handle TCP从机句柄
+ */
+void mb_slv_tcp_poll(mb_slv_tcp_handle handle);
+
+/**
+ * @brief 获取内部epoll描述符, 可注册到外部事件循环, 可读时调用 mb_slv_tcp_poll
+ *
+ * @param handle TCP从机句柄
+ * @return int epoll描述符, 失败返回-1
+ */
+int mb_slv_tcp_get_fd(mb_slv_tcp_handle handle);
+
+#endif /* _MODBUS_SLAVE_TCP_H */
@@ -53,6 +53,11 @@ typedef void (*timer_task_entry)(void *priv);
  */
 typedef void (*timer_task_deinit)(void *priv);
 
+/**
+ * @brief 描述符事件处理函数, events为触发的epoll事件, arg为注册时传入的指针
+ */
+typedef void (*epoll_fd_handler)(int fd, unsigned int events, void *arg);
+
 /**
  * @brief 周期任务信息
  */
@@ -98,6 +103,54 @@ bool epoll_timer_add_task(et_handle handle, const struct epoll_timer_task *task_
  */
 bool epoll_timer_remove_task(et_handle handle, const struct epoll_timer_task *task_info);
 
+/**
+ * @brief 添加描述符到监听事件, 就绪时在事件循环线程中立即调用处理函数
+ * 
+ * 用于需要低延时响应的设备(如串口), 不必等到下一个任务周期
+ * 
+ * @param handle epoll句柄
+ * @param fd 描述符(由调用者管理)
+ * @param events 监听的epoll事件, 如 EPOLLIN
+ * @param f_handle 处理函数
+ * @param arg 处理函数参数
+ * @return true 成功
+ * @return false 失败
+ */
+bool epoll_timer_add_fd(
+	et_handle handle, int fd, unsigned int events, epoll_fd_handler f_handle, void *arg);
+
+/**
+ * @brief 修改描述符的监听事件
+ * 
+ * @param handle epoll句柄
+ * @param fd 描述符
+ * @param events 监听的epoll事件
+ * @return true 成功
+ * @return false 失败
+ */
+bool epoll_timer_mod_fd(et_handle handle, int fd, unsigned int events);
+
+/**
+ * @brief 从监听事件中移除描述符, 不会关闭描述符
+ * 
+ * 处理函数中只允许移除自身
+ * 
+ * @param handle epoll句柄
+ * @param fd 描述符
+ * @return true 成功
+ * @return false 失败
+ */
+bool epoll_timer_remove_fd(et_handle handle, int fd);
+
+/**
+ * @brief 获取当前线程所属的epoll句柄
+ * 
+ * 仅在任务的 f_init/f_entry/f_deinit 及描述符处理函数中有效, 用于任务注册描述符
+ * 
+ * @return et_handle 不在回调中返回NULL
+ */
+et_handle epoll_timer_self(void);
+
 /**
  * @brief 轮询事件监听
  * 
@@ -29,14 +29,30 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/epoll.h>
 
 #include "utils/logger.h"
+#include "utils/epoll_timer.h"
 
+#include "protocol/isotp.h"
 #include "app/can_device.h"
+#include "app/can_dispatch.h"
 #include "app/app_can_task.h"
 
-// CAN 报文处理
-static void app_can_frame_handle(struct can_frame *frame);
+#define RX_STATS_REPORT_MS (60 * 1000) // 收发批量统计打印周期
+
+// CAN 报文批量处理
+static void app_can_batch_handle(
+	struct canfd_frame *frames, const struct can_rx_info *info, size_t num);
+
+// 控制器状态变化
+static void app_can_state_change(enum can_state state);
+
+// ISO-TP 报文处理
+static void app_isotp_recv(const uint8_t *data, size_t len, void *arg);
+
+// ISO-TP 帧提交
+static bool app_isotp_send(uint32_t can_id, const uint8_t *data, size_t len, void *arg);
 
 // 允许接受的CAN ID
 static struct can_filter filts[] = {
@@ -61,20 +77,200 @@ static const struct can_config config = {
 	.can_id = 0x1B0,
 	.dev_filters = filts,
 	.filter_num = sizeof(filts) / sizeof(struct can_filter),
-	.cb = app_can_frame_handle,
+	.batch_cb = app_can_batch_handle,
+	.fd_mode = false,		 // 控制器与总线上的节点都支持 CAN FD 时开启
+	.data_bitrate = 2000000, // CAN FD 数据段比特率
+	.brs = true,
+	.restart_ms = 100,		 // bus-off后由驱动自动重启
+	.state_cb = app_can_state_change,
+};
+
+// ISO-TP 通道, 多帧报文走 0x1B1 接收 / 0x1B2 发送
+static const struct isotp_cfg isotp_config = {
+	.tx_id = 0x1B2,
+	.rx_id = 0x1B1,
+	.fd = false,	 // 与 config.fd_mode 一致
+	.padding = true,
+	.block_size = 0, // 不分块, 对端连续发送
+	.st_min = 0,	 // 连续帧间隔由对端处理能力决定
+	.timeout_ms = 1000,
+	.on_recv = app_isotp_recv,
 };
 
-// CAN 报文处理
-static void app_can_frame_handle(struct can_frame *frame)
+static const struct isotp_opts isotp_frame_opts = {
+	.f_send = app_isotp_send,
+};
+
+// 打印交付延时与到达抖动的CAN ID
+static const uint32_t m_timing_ids[] = { 0x1B0, 0x1B1, 0x1B2 };
+
+static can_handle m_can = NULL;				  // CAN句柄, 供ISO-TP提交帧
+static isotp_handle m_isotp = NULL;			  // ISO-TP 通道
+static can_dispatch_handle m_dispatch = NULL; // CAN ID 分发表
+static et_handle m_loop = NULL;				  // 延后处理通知所注册的事件循环, NULL代表周期轮询
+
+// CAN 报文处理, 打印日志较慢, 延后到主循环中执行
+static void app_can_frame_handle(
+	const struct canfd_frame *frame, const struct can_rx_info *info, void *arg)
 {
+	(void)info;
+	(void)arg;
+
 	if (!frame) {
 		LOG_E("Invalid frame");
 		return;
 	}
 
-	LOG_I("Received CAN frame: ID=0x%x DLC=%d Data=[%02x %02x %02x %02x %02x %02x %02x %02x]",
-		frame->can_id, frame->can_dlc, frame->data[0], frame->data[1], frame->data[2],
-		frame->data[3], frame->data[4], frame->data[5], frame->data[6], frame->data[7]);
+	// FD帧只打印前8字节
+	LOG_I("Received CAN%s frame: ID=0x%x LEN=%d Data=[%02x %02x %02x %02x %02x %02x %02x %02x]",
+		(frame->flags & CANFD_FDF) ? " FD" : "", frame->can_id, frame->len, frame->data[0],
+		frame->data[1], frame->data[2], frame->data[3], frame->data[4], frame->data[5],
+		frame->data[6], frame->data[7]);
+}
+
+// ISO-TP 通道的帧交给传输层重组, 在读取线程中执行以保证流控及时
+static void app_isotp_frame_handle(
+	const struct canfd_frame *frame, const struct can_rx_info *info, void *arg)
+{
+	(void)info;
+
+	isotp_on_frame(arg, frame->can_id, frame->data, frame->len);
+}
+
+// CAN 报文批量处理, 一次唤醒读到的帧一起按CAN ID分发
+static void app_can_batch_handle(
+	struct canfd_frame *frames, const struct can_rx_info *info, size_t num)
+{
+	can_dispatch_frames(m_dispatch, frames, info, num);
+}
+
+/**
+ * @brief 有延后处理的帧, 在事件循环中立即执行
+ * 
+ * @param fd 通知描述符
+ * @param events 触发的事件
+ * @param arg 未使用
+ */
+static void dispatch_event_handle(int fd, unsigned int events, void *arg)
+{
+	(void)fd;
+	(void)events;
+	(void)arg;
+
+	can_dispatch_run(m_dispatch, 0);
+}
+
+// 控制器状态变化, 在CAN读取线程中执行
+static void app_can_state_change(enum can_state state)
+{
+	if (state == CAN_STATE_BUS_OFF)
+		LOG_W("CAN bus-off, waiting for restart");
+	else if (state == CAN_STATE_ERROR_ACTIVE)
+		LOG_I("CAN error active");
+}
+
+// ISO-TP 报文处理, 在CAN读取线程中执行
+static void app_isotp_recv(const uint8_t *data, size_t len, void *arg)
+{
+	(void)arg;
+
+	LOG_I("Received ISO-TP message: len=%zu first=0x%02x", len, data[0]);
+}
+
+// ISO-TP 帧提交, 一次提交的多帧作为一个报文进入CAN发送队列, 不被其他报文插入
+static bool app_isotp_send(uint32_t can_id, const uint8_t *data, size_t len, void *arg)
+{
+	(void)arg;
+
+	return can_device_send(m_can, can_id, data, len, NULL, NULL);
+}
+
+/**
+ * @brief 周期打印收发批量统计, 平均批量越大, 每帧分摊的系统调用越少
+ * 
+ * @param handle CAN句柄
+ */
+static void app_can_stats_report(can_handle handle)
+{
+	static size_t counter = 0;
+	counter += APP_CAN_TASK_PERIOD;
+	if (counter < RX_STATS_REPORT_MS)
+		return;
+	counter = 0;
+
+	struct can_tx_stats tx;
+	if (can_device_get_tx_stats(handle, &tx, true) && (tx.batches || tx.overruns || tx.errors))
+		LOG_I("CAN tx: frames=%llu batches=%u avg_batch=%.1f max_batch=%u messages=%u "
+			  "queued=%u overruns=%u enobufs=%u errors=%u",
+			(unsigned long long)tx.frames, tx.batches,
+			tx.batches ? (double)tx.frames / tx.batches : 0.0, tx.max_batch, tx.messages,
+			tx.queued, tx.overruns, tx.enobufs, tx.errors);
+
+	struct can_link_stats link;
+	if (can_device_get_link_stats(handle, &link, true) && (link.link_events || !link.running))
+		LOG_I("CAN link: state=%d running=%d bus_off=%u restarts=%u events=%u", link.state,
+			link.running, link.bus_off, link.restarts, link.link_events);
+
+	struct can_dispatch_stats ds;
+	can_dispatch_get_stats(m_dispatch, &ds, true);
+	if (ds.inline_frames || ds.deferred_frames || ds.unhandled || ds.busy_drops)
+		LOG_I("CAN dispatch: inline=%llu deferred=%llu run=%llu ring_max=%u overruns=%u "
+			  "unhandled=%u busy=%u",
+			(unsigned long long)ds.inline_frames, (unsigned long long)ds.deferred_frames,
+			(unsigned long long)ds.deferred_runs, ds.ring_max, ds.ring_overruns, ds.unhandled,
+			ds.busy_drops);
+
+	int ifindex = can_device_get_ifindex(handle);
+	for (size_t i = 0; i < sizeof(m_timing_ids) / sizeof(m_timing_ids[0]); i++) {
+		struct can_id_timing t;
+		if (!can_dispatch_get_timing(m_dispatch, ifindex, m_timing_ids[i], &t, true) || !t.count)
+			continue;
+
+		LOG_I("CAN 0x%x latency(us): n=%u min=%u avg=%llu max=%u gap(us) min=%u avg=%llu max=%u "
+			  "jitter=%u",
+			m_timing_ids[i], t.count, t.min_us, (unsigned long long)(t.sum_us / t.count),
+			t.max_us, t.gap_min_us, (unsigned long long)(t.gaps ? t.gap_sum_us / t.gaps : 0),
+			t.gap_max_us, t.jitter_us);
+		LOG_I("CAN 0x%x latency buckets <=100:%u <=200:%u <=500:%u <=1000:%u <=2000:%u "
+			  "<=5000:%u <=10000:%u >10000:%u",
+			m_timing_ids[i], t.buckets[0], t.buckets[1], t.buckets[2], t.buckets[3],
+			t.buckets[4], t.buckets[5], t.buckets[6], t.buckets[7]);
+	}
+
+	struct isotp_stats tp;
+	isotp_get_stats(m_isotp, &tp, true);
+	if (tp.rx_msgs || tp.tx_msgs || tp.rx_aborts || tp.tx_aborts)
+		LOG_I("ISO-TP: rx=%u msgs/%llu bytes tx=%u msgs/%llu bytes rx_abort=%u tx_abort=%u "
+			  "retry=%u",
+			tp.rx_msgs, (unsigned long long)tp.rx_bytes, tp.tx_msgs,
+			(unsigned long long)tp.tx_bytes, tp.rx_aborts, tp.tx_aborts, tp.tx_retries);
+
+	struct can_rx_stats st;
+	if (!can_device_get_rx_stats(handle, &st, true) || !st.batches)
+		return;
+
+	LOG_I("CAN rx: frames=%llu batches=%u wakeups=%u avg_batch=%.1f max_batch=%u errors=%u "
+		  "no_ts=%u",
+		(unsigned long long)st.frames, st.batches, st.wakeups, (double)st.frames / st.batches,
+		st.max_batch, st.errors, st.no_ts);
+	LOG_I("CAN rx batch 1:%u 2-3:%u 4-7:%u 8-15:%u 16-31:%u 32:%u", st.hist[0], st.hist[1],
+		st.hist[2], st.hist[3], st.hist[4], st.hist[5]);
+}
+
+/**
+ * @brief 测试报文发送完成回调, 在CAN读取线程中执行
+ * 
+ * @param ok 是否发送成功
+ * @param arg 未使用
+ */
+static void app_can_test_done(bool ok, void *arg)
+{
+	(void)arg;
+
+	if (ok)
+		LOG_I("Can send success");
+	else
+		LOG_E("Can send failed");
 }
 
 /**
@@ -91,15 +287,59 @@ bool app_can_init(void **priv)
 
 	can_handle handle;
 
+	// 先创建ISO-TP通道与分发表, 读取线程启动后即可交付帧
+	m_isotp = isotp_create(&isotp_config, &isotp_frame_opts);
+	if (!m_isotp) {
+		LOG_E("ISO-TP init failed");
+		return false;
+	}
+
+	m_dispatch = can_dispatch_create();
+	if (!m_dispatch)
+		goto err_destroy_isotp;
+
+	if (!can_dispatch_register(m_dispatch, isotp_config.rx_id, app_isotp_frame_handle, m_isotp,
+			CAN_DISPATCH_INLINE) ||
+		!can_dispatch_register(m_dispatch, 0x1B0, app_can_frame_handle, NULL,
+			CAN_DISPATCH_DEFERRED) ||
+		!can_dispatch_register(m_dispatch, 0x1B2, app_can_frame_handle, NULL,
+			CAN_DISPATCH_DEFERRED))
+		goto err_destroy_dispatch;
+
+	// 注册到事件循环, 延后处理的帧立即执行; 失败则退化为周期轮询
+	m_loop = epoll_timer_self();
+	if (m_loop &&
+		!epoll_timer_add_fd(
+			m_loop, can_dispatch_get_fd(m_dispatch), EPOLLIN, dispatch_event_handle, NULL)) {
+		LOG_W("CAN dispatch event register failed, fallback to polling");
+		m_loop = NULL;
+	}
+
 	handle = can_device_init(&config); // 初始化CAN设备
 	if (!handle) {
 		LOG_E("Can device init failed");
-		return false;
+		goto err_remove_fd;
 	}
 
+	m_can = handle;
 	*priv = handle;
 
 	return true;
+
+err_remove_fd:
+	if (m_loop)
+		epoll_timer_remove_fd(m_loop, can_dispatch_get_fd(m_dispatch));
+	m_loop = NULL;
+
+err_destroy_dispatch:
+	can_dispatch_destroy(m_dispatch);
+	m_dispatch = NULL;
+
+err_destroy_isotp:
+	isotp_destroy(m_isotp);
+	m_isotp = NULL;
+
+	return false;
 }
 
 /**
@@ -115,6 +355,18 @@ void app_can_deinit(void *priv)
 	can_handle handle = priv;
 
 	can_device_close(handle); // 关闭CAN设备
+	m_can = NULL;
+
+	if (m_loop)
+		epoll_timer_remove_fd(m_loop, can_dispatch_get_fd(m_dispatch));
+	m_loop = NULL;
+
+	// 读取线程已退出, 不再交付帧
+	can_dispatch_destroy(m_dispatch);
+	m_dispatch = NULL;
+
+	isotp_destroy(m_isotp);
+	m_isotp = NULL;
 }
 
 /**
@@ -139,11 +391,11 @@ static void app_can_test(can_handle handle)
 
 	uint8_t send_data[] = { cmd, frame_index, len_high, len_low, 0xFF, 0x01 }; // 全亮
 
-	bool ret = can_device_write(handle, send_data, sizeof(send_data));
+	// 异步发送, 结果在完成回调中打印
+	bool ret = can_device_send(
+		handle, config.can_id, send_data, sizeof(send_data), app_can_test_done, NULL);
 	if (!ret)
 		LOG_E("Can test Failed");
-	else
-		LOG_I("Can send success");
 }
 
 /**
@@ -159,4 +411,8 @@ void app_can_task(void *priv)
 	can_handle handle = priv;
 
 	app_can_test(handle);
+	isotp_poll(m_isotp); // 按STmin提交连续帧, 检查超时
+	if (!m_loop)
+		can_dispatch_run(m_dispatch, 0); // 未注册到事件循环时周期执行延后处理的帧
+	app_can_stats_report(handle);
 }
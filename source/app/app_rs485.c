@@ -27,279 +27,150 @@
  * 
  */
 
-#include <pthread.h>
-#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <termios.h>
-#include <errno.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <sys/eventfd.h>
 
 #include "protocol/modbus.h"
 #include "utils/logger.h"
-#include "utils/queue.h"
+#include "utils/epoll_timer.h"
 #include "app/modbus_priv_reg.h"
 #include "protocol/modbus_slave.h"
+#include "protocol/modbus_slave_tcp.h"
+#include "protocol/modbus_serial.h"
 #include "app/app_rs485.h"
 
-#define DEVICE_PATH "/dev/ttySTM1" // 设备路径
-
-#define EPOLL_SIZE 2 // 监听事件数量(串口 fd 和 stop_fd)
+// 串口配置, 半双工换向时间按收发器与线缆调整
+static const struct mb_serial_cfg m_serial_cfg = {
+	.path = "/dev/ttySTM1",
+	.baud = 115200,
+	.parity = MB_SERIAL_PARITY_NONE,
+	.stop_bits = 1,
+	.rs485 = true,
+	.rts_before_send_ms = 0,
+	.rts_after_send_ms = 0,
+	.low_latency = true, // 从机回复延时敏感
+};
 
-#define BUF_LEN 1024 // 接收buffer
-static uint8_t rx_buf[BUF_LEN];
+#define LATENCY_REPORT_MS (60 * 1000) // 链路与延时统计打印周期
 
 struct rs485_dev {
-	int fd;						 // 串口文件描述符
-	int epoll_fd;				 // epoll监听fd
-	int stop_fd;				 // 接收关闭信号
-	struct queue_info rx_q;		 // 接收队列
-	pthread_t thread;			 // 接收线程
-	pthread_rwlock_t rw_lock;	 // 读写锁
-	bool running;				 // 运行标志
-	struct termios original_tio; // 原始termios设置
+	mb_serial_handle port; // 串口
+	et_handle loop;		   // 所属事件循环, NULL代表未注册, 退化为周期轮询
+	bool tcp_registered;   // TCP从机已注册到事件循环
+	uint32_t report_ms;	   // 距上次打印延时统计的时间
 };
 
 static struct rs485_dev *g_485 = NULL;
 
-/**
- * @brief 初始化串口
- * 
- * @param dev_rs485 rs485设备结构体指针
- * @return bool 
- */
-static bool serial_config(struct rs485_dev *dev_rs485)
+//BMS设备明文参数
+static uint8_t _reg_1000_1199_rtu_slave_handle(
+	uint8_t func, uint16_t reg, uint16_t reg_num, uint16_t *p_in_out)
 {
-	struct termios options;
-
-	// 获取当前串口配置并保存
-	if (tcgetattr(dev_rs485->fd, &dev_rs485->original_tio) != 0) {
-		LOG_E("tcgetattr failed: %s", strerror(errno));
-		return false;
-	}
+	uint16_t *p;
 
-	// 设置串口基本配置
-	options = dev_rs485->original_tio;
-
-	options.c_cflag |= (CLOCAL | CREAD); // 启用串口接收和本地模式
-	options.c_cflag &= ~CSIZE;			 // 清除数据位设置
-	options.c_cflag &= ~CRTSCTS;		 // 禁用硬件流控制
-	options.c_cflag |= CS8;				 // 设置数据位为8位
-	options.c_cflag &= ~CSTOPB;			 // 设置停止位为1位
-	options.c_iflag |= IGNPAR;			 // 忽略奇偶校验错误
-	options.c_oflag = 0;				 // 原始输出模式
-	options.c_lflag = 0;				 // 禁用终端处理标志(如回显)
-
-	// 波特率115200
-	if (cfsetispeed(&options, B115200) != 0 || cfsetospeed(&options, B115200) != 0) {
-		LOG_E("Setting baud rate failed: %s", strerror(errno));
-		return false;
-	}
+	LOG_I("func is 0x%02x, reg is 0x%04x, reg_num is 0x%04x", func, reg, reg_num);
 
-	// 应用设置
-	if (tcsetattr(dev_rs485->fd, TCSANOW, &options) != 0) {
-		LOG_E("tcsetattr failed: %s", strerror(errno));
-		return false;
+	if (func == MODBUS_FUN_RD_REG_MUL) {
+		LOG_I("Read multiple registers");
+	} else if (func == MODBUS_FUN_WR_REG_MUL) {
+		LOG_I("Write multiple registers");
+	} else {
+		LOG_I("Read/Write single register");
 	}
 
-	return true;
+	return MODBUS_RESP_SUCCESS;
 }
 
+// 范围取自寄存器块描述表
+static struct mb_slv_work resp_table[] = {
+	PRIV_REG_WORK(1000_1199, _reg_1000_1199_rtu_slave_handle),
+};
+
+static mb_slv_handle m_mb_slv_handle = NULL;
+static mb_slv_tcp_handle m_mb_slv_tcp_handle = NULL; // 与RS485共用处理表的TCP从机
+
 /**
- * @brief 关闭串口并清理串口配置
+ * @brief 串口可读或发送队列清空, 立即解析回复或检查发送完成
  * 
- * @param dev_rs485 rs485设备结构体指针
+ * @param fd 串口描述符
+ * @param events 触发的事件
+ * @param arg 未使用
  */
-static void serial_deinit(struct rs485_dev *dev_rs485)
+static void serial_event_handle(int fd, unsigned int events, void *arg)
 {
-	if (dev_rs485->fd < 0)
-		return;
+	(void)fd;
+	(void)arg;
 
-	// 确保所有数据已传输
-	if (tcdrain(dev_rs485->fd) != 0) {
-		LOG_E("tcdrain failed: %s", strerror(errno));
-	}
+	if (events & (EPOLLERR | EPOLLHUP))
+		LOG_W("RS485 serial error event 0x%x", events);
 
-	// 清空输入和输出缓冲区
-	if (tcflush(dev_rs485->fd, TCIOFLUSH) != 0) {
-		LOG_E("tcflush failed: %s", strerror(errno));
-	}
-
-	// 恢复原始termios设置
-	if (tcsetattr(dev_rs485->fd, TCSANOW, &dev_rs485->original_tio) != 0) {
-		LOG_E("tcsetattr restore failed: %s", strerror(errno));
-	}
-
-	// 关闭串口
-	close(dev_rs485->fd);
+	mb_slv_poll(m_mb_slv_handle);
 }
 
 /**
- * @brief 接收数据线程
+ * @brief TCP从机有连接或数据, 立即处理
  * 
- * @param arg 
- * @return void* 
+ * @param fd TCP从机epoll描述符
+ * @param events 触发的事件
+ * @param arg 未使用
  */
-static void *read_thread(void *arg)
+static void tcp_event_handle(int fd, unsigned int events, void *arg)
 {
-	struct rs485_dev *app_485 = arg;
-
-	struct epoll_event events[EPOLL_SIZE];
-
-	while (app_485->running) {
-		int nfds = epoll_wait(app_485->epoll_fd, events, EPOLL_SIZE, -1);
-		if (nfds < 0) {
-			if (errno == EINTR)
-				continue;
-			LOG_E("epoll_wait failed: %s", strerror(errno));
-			break;
-		}
-
-		for (int i = 0; i < nfds; i++) {
-			if (events[i].data.fd == app_485->stop_fd) {
-				// 收到关闭信号,退出线程
-				uint64_t val;
-				ssize_t s = read(app_485->stop_fd, &val, sizeof(val));
-				if (s != sizeof(val))
-					LOG_E("Failed to read from eventfd: %s", strerror(errno));
-				goto exit_thread;
-			}
-
-			if (events[i].events & EPOLLIN) {
-				// 可读事件
-				uint8_t temp_buf[1024] = { 0 };
-
-				pthread_rwlock_rdlock(&app_485->rw_lock);
-				ssize_t read_len = read(app_485->fd, temp_buf, sizeof(temp_buf));
-				pthread_rwlock_unlock(&app_485->rw_lock);
-
-				if (read_len < 0) {
-					LOG_E("Read failed: %s", strerror(errno));
-					continue;
-				}
-				queue_add(&app_485->rx_q, temp_buf, read_len); // 读取的数据加入队列
-			}
-		}
-	}
+	(void)fd;
+	(void)events;
+	(void)arg;
 
-exit_thread:
-	return NULL;
+	mb_slv_tcp_poll(m_mb_slv_tcp_handle);
 }
 
-/**
- * @brief RS485初始化
- * 
- * @param p_priv 私有数据二级指针
- * @return true 初始化成功
- * @return false 初始化失败
- */
-static bool _app_rs485_init(void **p_priv)
+bool app_rs485_init(void **p_priv)
 {
-	bool ret;
-
-	struct rs485_dev *app_485 = malloc(sizeof(struct rs485_dev));
+	struct rs485_dev *app_485 = calloc(1, sizeof(struct rs485_dev));
 	if (!app_485) {
 		LOG_E("Malloc 485 failed");
 		return false;
 	}
-	app_485->running = true;
-	app_485->fd = -1;
-	app_485->epoll_fd = -1;
-	app_485->stop_fd = -1;
-
-	int res = pthread_rwlock_init(&app_485->rw_lock, NULL);
-	if (res != 0) {
-		LOG_E("Init rwlock failed");
-		goto err_free_485;
-	}
 
-	// 打开串口
-	app_485->fd = open(DEVICE_PATH, O_RDWR | O_NOCTTY | O_NONBLOCK);
-	if (app_485->fd < 0) {
-		LOG_E("Open device:%s failed: %s", DEVICE_PATH, strerror(errno));
-		goto err_free_rwlock;
-	}
-
-	// 配置串口
-	ret = serial_config(app_485);
-	if (!ret)
-		goto err_close_fd;
-
-	// 创建 epoll 实例
-	app_485->epoll_fd = epoll_create1(0);
-	if (app_485->epoll_fd < 0) {
-		LOG_E("epoll_create1 failed: %s", strerror(errno));
-		goto err_close_fd;
-	}
-
-	// 添加串口 fd 到 epoll
-	struct epoll_event ev;
-	memset(&ev, 0, sizeof(ev));
-	ev.events = EPOLLIN;
-	ev.data.fd = app_485->fd;
-	if (epoll_ctl(app_485->epoll_fd, EPOLL_CTL_ADD, app_485->fd, &ev) < 0) {
-		LOG_E("Failed to add serial fd to epoll: %s", strerror(errno));
-		goto err_close_epoll;
-	}
-
-	// 创建 stop_fd
-	app_485->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
-	if (app_485->stop_fd < 0) {
-		LOG_E("Failed to create eventfd: %s", strerror(errno));
-		goto err_close_epoll;
-	}
+	app_485->port = mb_serial_open(&m_serial_cfg);
+	if (!app_485->port)
+		goto err_free_485;
 
-	// 添加 stop_fd 到 epoll
-	memset(&ev, 0, sizeof(ev));
-	ev.events = EPOLLIN;
-	ev.data.fd = app_485->stop_fd;
-	if (epoll_ctl(app_485->epoll_fd, EPOLL_CTL_ADD, app_485->stop_fd, &ev) < 0) {
-		LOG_E("Failed to add eventfd to epoll: %s", strerror(errno));
-		goto err_close_stop_fd;
+	m_mb_slv_handle = mb_slv_init(mb_serial_opts(app_485->port), 0x06, resp_table,
+		sizeof(resp_table) / sizeof(resp_table[0]));
+	if (!m_mb_slv_handle) {
+		LOG_E("Init modbus slave failed");
+		goto err_close_port;
 	}
 
-	// 初始化队列
-	ret = queue_init(&app_485->rx_q, 1, rx_buf, BUF_LEN);
-	if (!ret) {
-		LOG_E("Init queue failed");
-		goto err_close_stop_fd;
+	// TCP从机失败不影响RS485
+	m_mb_slv_tcp_handle = mb_slv_tcp_init(m_mb_slv_handle, NULL, MODBUS_TCP_DEFAULT_PORT);
+	if (!m_mb_slv_tcp_handle)
+		LOG_W("Init modbus tcp slave failed");
+
+	// 注册到事件循环, 收到数据立即回复, 不必等待任务周期; 失败则退化为周期轮询
+	app_485->loop = epoll_timer_self();
+	if (app_485->loop &&
+		!mb_serial_attach(app_485->port, app_485->loop, serial_event_handle, NULL)) {
+		LOG_W("RS485 event register failed, fallback to polling");
+		app_485->loop = NULL;
 	}
 
-	// 创建接收线程
-	int thread_ret = pthread_create(&app_485->thread, NULL, read_thread, app_485);
-	if (thread_ret != 0) {
-		LOG_E("Create read thread failed: %s", strerror(thread_ret));
-		goto err_destroy_queue;
-	}
+	if (app_485->loop && m_mb_slv_tcp_handle)
+		app_485->tcp_registered = epoll_timer_add_fd(app_485->loop,
+			mb_slv_tcp_get_fd(m_mb_slv_tcp_handle), EPOLLIN, tcp_event_handle, NULL);
 
 	*p_priv = app_485;
 	g_485 = app_485;
 
 	return true;
 
-err_destroy_queue:
-	queue_destroy(&app_485->rx_q);
-
-err_close_stop_fd:
-	close(app_485->stop_fd);
-
-err_close_epoll:
-	close(app_485->epoll_fd);
-
-err_close_fd:
-	serial_deinit(app_485);
-
-err_free_rwlock:
-	pthread_rwlock_destroy(&app_485->rw_lock);
+err_close_port:
+	mb_serial_close(app_485->port);
 
 err_free_485:
 	free(app_485);
@@ -307,89 +178,6 @@ err_free_485:
 	return false;
 }
 
-static void slave_cir_ctrl(enum modbus_serial_dir ctrl)
-{
-}
-
-static bool slave_init(void)
-{
-	return true;
-}
-
-static size_t slave_read(uint8_t *p_data, uint16_t len)
-{
-	if (!g_485 || g_485->fd < 0)
-		return 0;
-
-	pthread_rwlock_rdlock(&g_485->rw_lock);
-	size_t ret = queue_get(&g_485->rx_q, p_data, len);
-	pthread_rwlock_unlock(&g_485->rw_lock);
-
-	return ret;
-}
-
-static size_t slave_write(uint8_t *p_data, uint16_t len)
-{
-	if (!g_485 || g_485->fd < 0)
-		return 0;
-
-	return write(g_485->fd, p_data, len);
-}
-
-static bool slave_check_send(void)
-{
-	return true;
-}
-
-static struct serial_opts s_485_opts = {
-	.f_dir_ctrl = slave_cir_ctrl,
-	.f_init = slave_init,
-	.f_read = slave_read,
-	.f_write = slave_write,
-	.f_check_send = slave_check_send,
-};
-
-//BMS设备明文参数
-static uint8_t _reg_1000_1199_rtu_slave_handle(
-	uint8_t func, uint16_t reg, uint16_t reg_num, uint16_t *p_in_out)
-{
-	uint16_t *p;
-
-	LOG_I("func is 0x%02x, reg is 0x%04x, reg_num is 0x%04x", func, reg, reg_num);
-
-	if (func == MODBUS_FUN_RD_REG_MUL) {
-		LOG_I("Read multiple registers");
-	} else if (func == MODBUS_FUN_WR_REG_MUL) {
-		LOG_I("Write multiple registers");
-	} else {
-		LOG_I("Read/Write single register");
-	}
-
-	return MODBUS_RESP_SUCCESS;
-}
-
-static struct mb_slv_work resp_table[] = {
-	{
-		.start = REG_1000_1199_BAT_ID,
-		.end = REG_1000_1199_END,
-		.resp = _reg_1000_1199_rtu_slave_handle,
-	},
-};
-
-static mb_slv_handle m_mb_slv_handle = NULL;
-
-bool app_rs485_init(void **p_priv)
-{
-	m_mb_slv_handle =
-		mb_slv_init(&s_485_opts, 0x06, resp_table, sizeof(resp_table) / sizeof(resp_table[0]));
-	if (!m_mb_slv_handle) {
-		LOG_E("Init modbus slave failed");
-		return false;
-	}
-
-	return _app_rs485_init(p_priv);
-}
-
 /**
  * @brief 去初始化rs485
  * 
@@ -402,26 +190,23 @@ void app_rs485_deinit(void *priv)
 
 	struct rs485_dev *app_485 = priv;
 
-	app_485->running = false;
-
-	// 通知 read_thread 退出
-	uint64_t val = 1;
-	ssize_t s = write(app_485->stop_fd, &val, sizeof(val));
-	if (s != sizeof(val)) {
-		LOG_E("Failed to write to eventfd: %s", strerror(errno));
+	if (app_485->loop) {
+		mb_serial_detach(app_485->port);
+		if (app_485->tcp_registered)
+			epoll_timer_remove_fd(app_485->loop, mb_slv_tcp_get_fd(m_mb_slv_tcp_handle));
 	}
 
-	pthread_join(app_485->thread, NULL);
+	g_485 = NULL;
 
-	queue_destroy(&app_485->rx_q);
-	close(app_485->stop_fd);
-	close(app_485->epoll_fd);
-	serial_deinit(app_485);
-	pthread_rwlock_destroy(&app_485->rw_lock);
-	free(app_485);
+	mb_slv_tcp_destroy(m_mb_slv_tcp_handle);
+	m_mb_slv_tcp_handle = NULL;
 
 	mb_slv_destroy(m_mb_slv_handle);
 	m_mb_slv_handle = NULL;
+
+	// 从机不再访问串口后关闭
+	mb_serial_close(app_485->port);
+	free(app_485);
 }
 
 /**
@@ -432,14 +217,10 @@ void app_rs485_deinit(void *priv)
  */
 void app_rs485_write(uint8_t *buf, size_t len)
 {
-	if (!buf || !len || !g_485 || g_485->fd < 0)
+	if (!buf || !len || !g_485)
 		return;
 
-	pthread_rwlock_wrlock(&g_485->rw_lock);
-	if (write(g_485->fd, buf, len) < 0)
-		LOG_E("Write failed: %s", strerror(errno));
-
-	pthread_rwlock_unlock(&g_485->rw_lock);
+	mb_serial_write(g_485->port, buf, len);
 }
 
 /**
@@ -452,5 +233,41 @@ void app_rs485_task(void *priv)
 	if (!priv)
 		return;
 
+	struct rs485_dev *app_485 = priv;
+
+	// 未注册到事件循环时周期轮询; 已注册时仍调用一次, 用于检查发送完成
 	mb_slv_poll(m_mb_slv_handle);
+	if (!app_485->tcp_registered)
+		mb_slv_tcp_poll(m_mb_slv_tcp_handle);
+
+	app_485->report_ms += APP_RS485_TASK_PERIOD;
+	if (app_485->report_ms < LATENCY_REPORT_MS)
+		return;
+	app_485->report_ms = 0;
+
+	struct mb_link_stats link;
+	mb_slv_get_link_stats(m_mb_slv_handle, &link, true);
+	LOG_I("RS485 link: busy=%u%% rx=%llu bytes/%u frames tx=%llu bytes/%u frames crc_err=%u "
+		  "resync=%u",
+		link.occupancy_pct, (unsigned long long)link.rx_bytes, link.rx_frames,
+		(unsigned long long)link.tx_bytes, link.tx_frames, link.crc_errors, link.resyncs);
+
+	struct mb_serial_rx_stats rx;
+	mb_serial_get_rx_stats(app_485->port, &rx, true);
+	if (rx.wakeups)
+		LOG_I("RS485 rx wakeup: n=%u avg_burst=%llu max_burst=%u delay(us) avg>=%llu max>=%u",
+			rx.wakeups, (unsigned long long)(rx.bytes / rx.wakeups), rx.max_burst,
+			(unsigned long long)(rx.delay_sum_us / rx.wakeups), rx.delay_max_us);
+
+	struct mb_slv_latency lat;
+	mb_slv_get_latency(m_mb_slv_handle, &lat, true);
+	if (!lat.count)
+		return;
+
+	LOG_I("RS485 reply latency(us): n=%u min=%u avg=%llu max=%u", lat.count, lat.min_us,
+		(unsigned long long)(lat.sum_us / lat.count), lat.max_us);
+	LOG_I("RS485 latency buckets <=100:%u <=200:%u <=500:%u <=1000:%u <=2000:%u <=5000:%u "
+		  "<=10000:%u >10000:%u",
+		lat.buckets[0], lat.buckets[1], lat.buckets[2], lat.buckets[3], lat.buckets[4],
+		lat.buckets[5], lat.buckets[6], lat.buckets[7]);
 }
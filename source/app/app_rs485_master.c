@@ -27,424 +27,380 @@
  * 
  */
 
-#include <pthread.h>
-#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <termios.h>
 #include <errno.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include "protocol/modbus.h"
 #include "utils/logger.h"
-#include "utils/queue.h"
+#include "utils/epoll_timer.h"
 #include "protocol/modbus_master.h"
+#include "protocol/modbus_poll.h"
+#include "protocol/modbus_bus.h"
+#include "protocol/modbus_serial.h"
 #include "app/app_rs485_master.h"
 
-#define DEVICE_PATH "/dev/ttySTM1" // 设备路径
+#define HEALTH_REPORT_MS (60 * 1000) // 从机健康统计打印周期
 
-#define EPOLL_SIZE 2 // 监听事件数量(串口 fd 和 stop_fd)
-
-#define BUF_LEN 1024 // 接收buffer
-static uint8_t rx_buf[BUF_LEN];
-
-struct rs485_dev {
-	int fd;						 // 串口文件描述符
-	int epoll_fd;				 // epoll监听fd
-	int stop_fd;				 // 接收关闭信号
-	struct queue_info rx_q;		 // 接收队列
-	pthread_t thread;			 // 接收线程
-	pthread_rwlock_t rw_lock;	 // 读写锁
-	bool running;				 // 运行标志
-	struct termios original_tio; // 原始termios设置
+// 串口配置, 每个串口为一条独立总线
+struct rs485_port_cfg {
+	struct mb_serial_cfg serial;			// 串口线路与方向控制配置
+	const uint8_t *slaves;					// 串口上的从机地址 可为NULL
+	size_t slave_num;						// 从机数量
+	const struct mb_poll_entry *poll_table; // 轮询表 可为NULL
+	size_t poll_num;						// 轮询项数量
+	const char *capture_path;				// 抓包文件(pcap), 用于现场问题复现 可为NULL
 };
 
-static struct rs485_dev *g_485 = NULL;
+/**************************周期读取**************************/
 
-/**
- * @brief 初始化串口
- * 
- * @param dev_rs485 rs485设备结构体指针
- * @return bool 
- */
-static bool serial_config(struct rs485_dev *dev_rs485)
+static void read_hanlde(uint8_t *data, size_t len, bool is_timeout, void *arg)
 {
-	struct termios options;
-
-	// 获取当前串口配置并保存
-	if (tcgetattr(dev_rs485->fd, &dev_rs485->original_tio) != 0) {
-		LOG_E("tcgetattr failed: %s", strerror(errno));
-		return false;
+	if (is_timeout) {
+		LOG_E("Timeout");
+		return;
 	}
 
-	// 设置串口基本配置
-	options = dev_rs485->original_tio;
-
-	options.c_cflag |= (CLOCAL | CREAD); // 启用串口接收和本地模式
-	options.c_cflag &= ~CSIZE;			 // 清除数据位设置
-	options.c_cflag &= ~CRTSCTS;		 // 禁用硬件流控制
-	options.c_cflag |= CS8;				 // 设置数据位为8位
-	options.c_cflag &= ~CSTOPB;			 // 设置停止位为1位
-	options.c_iflag |= IGNPAR;			 // 忽略奇偶校验错误
-	options.c_oflag = 0;				 // 原始输出模式
-	options.c_lflag = 0;				 // 禁用终端处理标志(如回显)
-
-	// 波特率115200
-	if (cfsetispeed(&options, B115200) != 0 || cfsetospeed(&options, B115200) != 0) {
-		LOG_E("Setting baud rate failed: %s", strerror(errno));
-		return false;
-	}
+	LOG_I("read successful");
+}
 
-	// 应用设置
-	if (tcsetattr(dev_rs485->fd, TCSANOW, &options) != 0) {
-		LOG_E("tcsetattr failed: %s", strerror(errno));
-		return false;
-	}
+// 轮询表, 同一从机相邻的寄存器段会自动合并为一个请求
+static const struct mb_poll_entry poll_table[] = {
+	{
+		.slave_addr = 0x06,
+		.reg_addr = 1069,
+		.reg_len = 1,
+		.period_ms = 2000,
+		.timeout_ms = 100,
+		.resp = read_hanlde,
+	},
+};
 
-	return true;
-}
+/**************************串口表**************************/
+
+// 其他串口上的BMS串在此添加, 各串口独立收发, 互不等待
+static const struct rs485_port_cfg port_table[] = {
+	{
+		.serial = {
+			.path = "/dev/ttySTM1",
+			.baud = 115200,
+			.parity = MB_SERIAL_PARITY_NONE,
+			.stop_bits = 1,
+			.rs485 = true,
+		},
+		.poll_table = poll_table,
+		.poll_num = sizeof(poll_table) / sizeof(poll_table[0]),
+	},
+};
 
-/**
- * @brief 关闭串口并清理串口配置
- * 
- * @param dev_rs485 rs485设备结构体指针
- */
-static void serial_deinit(struct rs485_dev *dev_rs485)
-{
-	if (dev_rs485->fd < 0)
-		return;
+#define PORT_NUM (sizeof(port_table) / sizeof(port_table[0]))
 
-	// 确保所有数据已传输
-	if (tcdrain(dev_rs485->fd) != 0) {
-		LOG_E("tcdrain failed: %s", strerror(errno));
-	}
+_Static_assert(PORT_NUM <= MB_BUS_MAX, "too many rs485 master ports");
 
-	// 清空输入和输出缓冲区
-	if (tcflush(dev_rs485->fd, TCIOFLUSH) != 0) {
-		LOG_E("tcflush failed: %s", strerror(errno));
-	}
+struct rs485_master {
+	mb_serial_handle ports[PORT_NUM];		// 串口
+	size_t port_num;						// 已打开的串口数量
+	size_t port_registered;					// 已注册到事件循环的串口数量
+	et_handle loop;							// 所属事件循环, NULL代表未注册超时定时器
+	int timer_fd;							// 主机请求超时定时器
+	uint32_t report_ms;						// 距上次打印从机健康统计的时间
+	struct mb_bus_stats last[PORT_NUM + 1];	// 上次打印时的总线统计, 最后一项为汇总
+};
 
-	// 恢复原始termios设置
-	if (tcsetattr(dev_rs485->fd, TCSANOW, &dev_rs485->original_tio) != 0) {
-		LOG_E("tcsetattr restore failed: %s", strerror(errno));
+static mb_bus_handle m_mb_bus_handle = NULL;
+
+/**************************写测试**************************/
+
+static void write_hanlde(uint8_t *data, size_t len, bool is_timeout, void *arg)
+{
+	if (is_timeout) {
+		LOG_E("Timeout");
+		return;
 	}
 
-	// 关闭串口
-	close(dev_rs485->fd);
+	LOG_I("Write successful");
 }
 
-/**
- * @brief 接收数据线程
- * 
- * @param arg 
- * @return void* 
- */
-static void *read_thread(void *arg)
+static void app_write_test(void)
 {
-	struct rs485_dev *app_485 = arg;
+	if (!m_mb_bus_handle)
+		return;
 
-	struct epoll_event events[EPOLL_SIZE];
+	// 1s一次
+	static size_t counter = 0;
+	counter += APP_RS485_TASK_MASTER_PERIOD;
+	if (counter < 1000)
+		return;
+	counter = 0;
 
-	while (app_485->running) {
-		int nfds = epoll_wait(app_485->epoll_fd, events, EPOLL_SIZE, -1);
-		if (nfds < 0) {
-			if (errno == EINTR)
-				continue;
-			LOG_E("epoll_wait failed: %s", strerror(errno));
-			break;
-		}
+	// 请求与数据提交时拷贝, 可使用局部变量, 按从机地址路由到所属串口
+	uint8_t temp_data[2] = { 0 };
+	struct mb_mst_request write_post = {
+		.slave_addr = 0x06,
+		.data = temp_data,
+		.func = MODBUS_FUN_WR_REG_MUL,
+		.reg_addr = 55000,
+		.reg_len = 1,
+		.resp = write_hanlde,
+		.timeout_ms = 100,
+		.data_len = 2,
+	};
+	mb_bus_request(m_mb_bus_handle, &write_post);
+}
 
-		for (int i = 0; i < nfds; i++) {
-			if (events[i].data.fd == app_485->stop_fd) {
-				// 收到关闭信号,退出线程
-				uint64_t val;
-				ssize_t s = read(app_485->stop_fd, &val, sizeof(val));
-				if (s != sizeof(val))
-					LOG_E("Failed to read from eventfd: %s", strerror(errno));
-				goto exit_thread;
-			}
-
-			if (events[i].events & EPOLLIN) {
-				// 可读事件
-				uint8_t temp_buf[1024] = { 0 };
-
-				pthread_rwlock_rdlock(&app_485->rw_lock);
-				ssize_t read_len = read(app_485->fd, temp_buf, sizeof(temp_buf));
-				pthread_rwlock_unlock(&app_485->rw_lock);
-
-				if (read_len < 0) {
-					LOG_E("Read failed: %s", strerror(errno));
-					continue;
-				}
-				queue_add(&app_485->rx_q, temp_buf, read_len); // 读取的数据加入队列
-			}
-		}
-	}
+/*****************************所有请求任务*****************************/
 
-exit_thread:
-	return NULL;
+static void app_request_task(void)
+{
+	// app_write_test();
 }
 
+/*****************************从机健康*****************************/
+
 /**
- * @brief RS485初始化
+ * @brief 打印各总线的吞吐、占用率以及所有通信过的从机的健康状态与往返时间
  * 
- * @param p_priv 私有数据二级指针
- * @return true 初始化成功
- * @return false 初始化失败
+ * @param mst rs485主机结构体指针
  */
-static bool _app_rs485_init(void **p_priv)
+static void health_report(struct rs485_master *mst)
 {
-	bool ret;
-
-	struct rs485_dev *app_485 = malloc(sizeof(struct rs485_dev));
-	if (!app_485) {
-		LOG_E("Malloc 485 failed");
-		return false;
-	}
-	app_485->running = true;
-	app_485->fd = -1;
-	app_485->epoll_fd = -1;
-	app_485->stop_fd = -1;
-
-	int res = pthread_rwlock_init(&app_485->rw_lock, NULL);
-	if (res != 0) {
-		LOG_E("Init rwlock failed");
-		goto err_free_485;
+	static const char *const health_str[] = {
+		[MB_MST_SLAVE_UNKNOWN] = "unknown",
+		[MB_MST_SLAVE_ONLINE] = "online",
+		[MB_MST_SLAVE_OFFLINE] = "offline",
+		[MB_MST_SLAVE_PROBING] = "probing",
+	};
+
+	// 各总线及汇总的本周期吞吐
+	for (int bus = 0; bus <= (int)mst->port_num; bus++) {
+		struct mb_bus_stats st;
+		int idx = bus < (int)mst->port_num ? bus : -1;
+		if (!mb_bus_get_stats(m_mb_bus_handle, idx, &st))
+			continue;
+
+		struct mb_bus_stats *last = &mst->last[bus];
+		uint32_t ms = st.elapsed_ms - last->elapsed_ms;
+		uint32_t frames = st.ok - last->ok;
+		const char *name = idx < 0 ? "total" : mb_bus_name(m_mb_bus_handle, idx);
+		LOG_I("RS485 bus %s: %.1f frames/s, ok=%u timeout=%u retry=%u fast_fail=%u", name,
+			ms ? frames * 1000.0 / ms : 0.0, st.ok, st.timeouts, st.retries, st.fast_fails);
+		LOG_I("RS485 bus %s: busy=%u%% tx=%llu rx=%llu crc_err=%u resync=%u exception=%u", name,
+			st.occupancy_pct, (unsigned long long)st.tx_bytes, (unsigned long long)st.rx_bytes,
+			st.crc_errors, st.resyncs, st.exceptions);
+		*last = st;
 	}
 
-	// 打开串口
-	app_485->fd = open(DEVICE_PATH, O_RDWR | O_NOCTTY | O_NONBLOCK);
-	if (app_485->fd < 0) {
-		LOG_E("Open device:%s failed: %s", DEVICE_PATH, strerror(errno));
-		goto err_free_rwlock;
-	}
+	for (int addr = 1; addr <= UINT8_MAX; addr++) {
+		struct mb_mst_slave_stats st;
+		if (!mb_mst_get_slave_stats(mb_bus_route(m_mb_bus_handle, addr), addr, &st))
+			continue;
 
-	// 配置串口
-	ret = serial_config(app_485);
-	if (!ret)
-		goto err_close_fd;
-
-	// 创建 epoll 实例
-	app_485->epoll_fd = epoll_create1(0);
-	if (app_485->epoll_fd < 0) {
-		LOG_E("epoll_create1 failed: %s", strerror(errno));
-		goto err_close_fd;
-	}
-
-	// 添加串口 fd 到 epoll
-	struct epoll_event ev;
-	memset(&ev, 0, sizeof(ev));
-	ev.events = EPOLLIN;
-	ev.data.fd = app_485->fd;
-	if (epoll_ctl(app_485->epoll_fd, EPOLL_CTL_ADD, app_485->fd, &ev) < 0) {
-		LOG_E("Failed to add serial fd to epoll: %s", strerror(errno));
-		goto err_close_epoll;
+		LOG_I("RS485 slave %d %s: ok=%u timeout=%u retry=%u fast_fail=%u exception=%u", addr,
+			health_str[st.health], st.ok, st.timeouts, st.retries, st.fast_fails, st.exceptions);
+		LOG_I("RS485 slave %d rtt(us): srtt=%u rttvar=%u min=%u max=%u rto=%u", addr, st.srtt_us,
+			st.rttvar_us, st.rtt_min_us, st.rtt_max_us, st.rto_us);
 	}
+}
 
-	// 创建 stop_fd
-	app_485->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
-	if (app_485->stop_fd < 0) {
-		LOG_E("Failed to create eventfd: %s", strerror(errno));
-		goto err_close_epoll;
-	}
+/*****************************超时定时器*****************************/
 
-	// 添加 stop_fd 到 epoll
-	memset(&ev, 0, sizeof(ev));
-	ev.events = EPOLLIN;
-	ev.data.fd = app_485->stop_fd;
-	if (epoll_ctl(app_485->epoll_fd, EPOLL_CTL_ADD, app_485->stop_fd, &ev) < 0) {
-		LOG_E("Failed to add eventfd to epoll: %s", strerror(errno));
-		goto err_close_stop_fd;
-	}
+/**
+ * @brief 按所有总线中最近的超时或轮询到期时刻设置单次定时器, 无请求时关闭
+ * 
+ * @param mst rs485主机结构体指针
+ */
+static void deadline_arm(struct rs485_master *mst)
+{
+	if (mst->timer_fd < 0)
+		return;
 
-	// 初始化队列
-	ret = queue_init(&app_485->rx_q, 1, rx_buf, BUF_LEN);
-	if (!ret) {
-		LOG_E("Init queue failed");
-		goto err_close_stop_fd;
-	}
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
 
-	// 创建接收线程
-	int thread_ret = pthread_create(&app_485->thread, NULL, read_thread, app_485);
-	if (thread_ret != 0) {
-		LOG_E("Create read thread failed: %s", strerror(thread_ret));
-		goto err_destroy_queue;
+	int wait_ms = mb_bus_next_deadline(m_mb_bus_handle);
+	if (wait_ms > 0) {
+		its.it_value.tv_sec = wait_ms / 1000;
+		its.it_value.tv_nsec = (long)(wait_ms % 1000) * 1000000;
+	} else if (wait_ms == 0) {
+		its.it_value.tv_nsec = 1; // 已到期, 立即触发
 	}
 
-	*p_priv = app_485;
-	g_485 = app_485;
-
-	return true;
-
-err_destroy_queue:
-	queue_destroy(&app_485->rx_q);
-
-err_close_stop_fd:
-	close(app_485->stop_fd);
-
-err_close_epoll:
-	close(app_485->epoll_fd);
-
-err_close_fd:
-	serial_deinit(app_485);
-
-err_free_rwlock:
-	pthread_rwlock_destroy(&app_485->rw_lock);
-
-err_free_485:
-	free(app_485);
-
-	return false;
+	if (timerfd_settime(mst->timer_fd, 0, &its, NULL) < 0)
+		LOG_E("timerfd_settime failed: %s", strerror(errno));
 }
 
-static void slave_cir_ctrl(enum modbus_serial_dir ctrl)
-{
-}
-
-static bool slave_init(void)
-{
-	return true;
-}
-
-static size_t slave_read(uint8_t *p_data, uint16_t len)
+/**
+ * @brief 请求超时或轮询表到期, 立即处理, 不必等待任务周期
+ * 
+ * @param fd 定时器描述符
+ * @param events 触发的事件
+ * @param arg rs485主机结构体指针
+ */
+static void deadline_event_handle(int fd, unsigned int events, void *arg)
 {
-	if (!g_485 || g_485->fd < 0)
-		return 0;
+	(void)events;
 
-	pthread_rwlock_rdlock(&g_485->rw_lock);
-	size_t ret = queue_get(&g_485->rx_q, p_data, len);
-	pthread_rwlock_unlock(&g_485->rw_lock);
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		LOG_E("Read timerfd failed: %s", strerror(errno));
 
-	return ret;
+	mb_bus_poll(m_mb_bus_handle);
+	deadline_arm(arg);
 }
 
-static size_t slave_write(uint8_t *p_data, uint16_t len)
+/**
+ * @brief 创建超时定时器并注册到当前事件循环, 失败则退化为任务周期轮询
+ * 
+ * @param mst rs485主机结构体指针
+ */
+static void deadline_init(struct rs485_master *mst)
 {
-	if (!g_485 || g_485->fd < 0)
-		return 0;
+	mst->loop = epoll_timer_self();
+	if (!mst->loop)
+		return;
 
-	return write(g_485->fd, p_data, len);
-}
+	mst->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (mst->timer_fd < 0) {
+		LOG_W("timerfd_create failed: %s", strerror(errno));
+		goto err_no_loop;
+	}
 
-static bool slave_check_send(void)
-{
-	return true;
-}
+	if (!epoll_timer_add_fd(mst->loop, mst->timer_fd, EPOLLIN, deadline_event_handle, mst)) {
+		LOG_W("RS485 master deadline register failed, fallback to polling");
+		goto err_close_timer;
+	}
 
-static struct serial_opts s_485_opts = {
-	.f_dir_ctrl = slave_cir_ctrl,
-	.f_init = slave_init,
-	.f_read = slave_read,
-	.f_write = slave_write,
-	.f_check_send = slave_check_send,
-};
+	return;
 
-static mb_mst_handle m_mb_mst_handle = NULL;
+err_close_timer:
+	close(mst->timer_fd);
+	mst->timer_fd = -1;
 
-/**************************读测试**************************/
+err_no_loop:
+	mst->loop = NULL;
+}
 
-static void read_hanlde(uint8_t *data, size_t len, bool is_timeout)
+/**
+ * @brief 串口可读或发送队列清空, 立即解析回复、检查发送完成并发送下一个请求
+ * 
+ * @param fd 串口描述符
+ * @param events 触发的事件
+ * @param arg rs485主机结构体指针
+ */
+static void serial_event_handle(int fd, unsigned int events, void *arg)
 {
-	if (is_timeout) {
-		LOG_E("Timeout");
-		return;
-	}
+	if (events & (EPOLLERR | EPOLLHUP))
+		LOG_W("RS485 master serial fd %d error event 0x%x", fd, events);
 
-	LOG_I("read successful");
+	mb_bus_poll(m_mb_bus_handle);
+	deadline_arm(arg);
 }
 
-static uint8_t test_cmd[2] = { 0 };
-static struct mb_mst_request read_post = {
-	.slave_addr = 0x06,
-	.func = MODBUS_FUN_RD_REG_MUL,
-	.reg_addr = 1069,
-	.reg_len = 1,
-	.resp = read_hanlde,
-	.timeout_ms = 100,
-};
-
-static void app_read_test(void)
+/**
+ * @brief 各串口注册到超时定时器所在的事件循环, 注册失败的串口由任务周期轮询
+ * 
+ * @param mst rs485主机结构体指针
+ */
+static void serial_events_init(struct rs485_master *mst)
 {
-	if (!m_mb_mst_handle)
+	if (!mst->loop)
 		return;
 
-	// 1s一次
-	static size_t counter = 0;
-	counter += APP_RS485_TASK_MASTER_PERIOD;
-	if (counter < 2000)
-		return;
-	counter = 0;
-
-	mb_mst_pdu_request(m_mb_mst_handle, &read_post);
+	for (; mst->port_registered < mst->port_num; mst->port_registered++) {
+		mb_serial_handle port = mst->ports[mst->port_registered];
+		if (!mb_serial_attach(port, mst->loop, serial_event_handle, mst)) {
+			LOG_W("RS485 master serial event register failed, fallback to polling");
+			break;
+		}
+	}
 }
 
-/**************************写测试**************************/
-
-static void write_hanlde(uint8_t *data, size_t len, bool is_timeout)
+/**
+ * @brief 注销串口事件
+ * 
+ * @param mst rs485主机结构体指针
+ */
+static void serial_events_deinit(struct rs485_master *mst)
 {
-	if (is_timeout) {
-		LOG_E("Timeout");
-		return;
-	}
-
-	LOG_I("Write successful");
+	while (mst->port_registered)
+		mb_serial_detach(mst->ports[--mst->port_registered]);
 }
 
-static uint8_t temp_data[2] = { 0 };
-static struct mb_mst_request write_post = {
-	.slave_addr = 0x06,
-	.data = temp_data,
-	.func = MODBUS_FUN_WR_REG_MUL,
-	.reg_addr = 55000,
-	.reg_len = 1,
-	.resp = write_hanlde,
-	.timeout_ms = 100,
-	.data_len = 2,
-};
-
-static void app_write_test(void)
+/**
+ * @brief 注销并关闭超时定时器
+ * 
+ * @param mst rs485主机结构体指针
+ */
+static void deadline_deinit(struct rs485_master *mst)
 {
-	if (!m_mb_mst_handle)
+	if (mst->timer_fd < 0)
 		return;
 
-	// 1s一次
-	static size_t counter = 0;
-	counter += APP_RS485_TASK_MASTER_PERIOD;
-	if (counter < 1000)
-		return;
-	counter = 0;
-
-	mb_mst_pdu_request(m_mb_mst_handle, &write_post);
-}
-
-/*****************************所有请求任务*****************************/
-
-static void app_request_task(void)
-{
-	app_read_test();
-	// app_write_test();
+	epoll_timer_remove_fd(mst->loop, mst->timer_fd);
+	close(mst->timer_fd);
+	mst->timer_fd = -1;
+	mst->loop = NULL;
 }
 
 /***************************API***************************/
 
 bool app_rs485_master_init(void **p_priv)
 {
-	m_mb_mst_handle = mb_mst_init(&s_485_opts, APP_RS485_TASK_MASTER_PERIOD);
-	if (!m_mb_mst_handle) {
-		LOG_E("Init modbus slave failed");
+	struct rs485_master *mst = calloc(1, sizeof(struct rs485_master));
+	if (!mst) {
+		LOG_E("Malloc 485 master failed");
 		return false;
 	}
+	mst->timer_fd = -1;
+
+	// 每个串口一条总线, 各自拥有主机与轮询调度器
+	struct mb_bus_cfg cfg[PORT_NUM];
+	for (size_t i = 0; i < PORT_NUM; i++) {
+		mst->ports[i] = mb_serial_open(&port_table[i].serial);
+		if (!mst->ports[i])
+			goto err_close_ports;
+		mst->port_num++;
+
+		// 抓包失败不影响通信
+		if (port_table[i].capture_path &&
+			!mb_serial_capture(mst->ports[i], port_table[i].capture_path))
+			LOG_W("RS485 master capture %s failed", port_table[i].capture_path);
+
+		cfg[i] = (struct mb_bus_cfg) {
+			.name = port_table[i].serial.path,
+			.opts = mb_serial_opts(mst->ports[i]),
+			.slaves = port_table[i].slaves,
+			.slave_num = port_table[i].slave_num,
+			.poll_table = port_table[i].poll_table,
+			.poll_num = port_table[i].poll_num,
+		};
+	}
+
+	m_mb_bus_handle = mb_bus_init(cfg, PORT_NUM);
+	if (!m_mb_bus_handle) {
+		LOG_E("Init modbus bus failed");
+		goto err_close_ports;
+	}
+
+	deadline_init(mst);
+	serial_events_init(mst);
+
+	*p_priv = mst;
 
-	return _app_rs485_init(p_priv);
+	return true;
+
+err_close_ports:
+	while (mst->port_num)
+		mb_serial_close(mst->ports[--mst->port_num]);
+	free(mst);
+
+	return false;
 }
 
 /**
@@ -457,28 +413,19 @@ void app_rs485_master_deinit(void *priv)
 	if (!priv)
 		return;
 
-	struct rs485_dev *app_485 = priv;
-
-	app_485->running = false;
+	struct rs485_master *mst = priv;
 
-	// 通知 read_thread 退出
-	uint64_t val = 1;
-	ssize_t s = write(app_485->stop_fd, &val, sizeof(val));
-	if (s != sizeof(val)) {
-		LOG_E("Failed to write to eventfd: %s", strerror(errno));
-	}
+	serial_events_deinit(mst);
+	deadline_deinit(mst);
 
-	pthread_join(app_485->thread, NULL);
+	// 先销毁总线, 主机不再访问串口
+	mb_bus_destroy(m_mb_bus_handle);
+	m_mb_bus_handle = NULL;
 
-	queue_destroy(&app_485->rx_q);
-	close(app_485->stop_fd);
-	close(app_485->epoll_fd);
-	serial_deinit(app_485);
-	pthread_rwlock_destroy(&app_485->rw_lock);
-	free(app_485);
+	while (mst->port_num)
+		mb_serial_close(mst->ports[--mst->port_num]);
 
-	mb_mst_destroy(m_mb_mst_handle);
-	m_mb_mst_handle = NULL;
+	free(mst);
 }
 
 /**
@@ -493,5 +440,17 @@ void app_rs485_master_task(void *priv)
 
 	app_request_task();
 
-	mb_mst_poll(m_mb_mst_handle);
+	// 未注册到事件循环的串口在此轮询, 已注册时仍调用一次, 用于检查发送完成
+	mb_bus_poll(m_mb_bus_handle);
+
+	// 重发与超时由定时器在到期时刻触发
+	struct rs485_master *mst = priv;
+	deadline_arm(mst);
+
+	mst->report_ms += APP_RS485_TASK_MASTER_PERIOD;
+	if (mst->report_ms < HEALTH_REPORT_MS)
+		return;
+	mst->report_ms = 0;
+
+	health_report(mst);
 }
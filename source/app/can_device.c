@@ -27,6 +27,8 @@
  * 
  */
 
+#define _GNU_SOURCE // recvmmsg
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -41,41 +43,134 @@
 #include <errno.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/can/netlink.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <linux/errqueue.h>
+#include <time.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <fcntl.h>
 
 #include "utils/logger.h"
 
 #include "app/can_device.h"
 
+#define MGR_EVENTS (16)		  // 单次epoll_wait处理的事件数
+#define MGR_SLOT (UINT32_MAX) // 管理器自身fd(停止信号, 链路通知)的设备槽位
+
+#define TX_BACKOFF_NS (1000000) // 控制器队列满(ENOBUFS)后的重试间隔
+
+#define RX_CTRL_LEN (CMSG_SPACE(sizeof(struct scm_timestamping))) // 每帧的时间戳控制消息缓冲
+
+#define NL_BUF_LEN (4096) // rtnetlink接收缓冲
+#define NL_ATTR_LEN (256) // 链路配置请求的属性缓冲
+
+// 发送队列中的报文
+struct can_tx_msg {
+	struct canfd_frame frames[CAN_TX_MSG_FRAMES]; // 报文拆分后的帧
+	size_t num;									  // 帧数量
+	size_t sent;								  // 已发送帧数
+	uint32_t seq;								  // 入队序号, 同优先级先入先出
+	can_tx_done_cb cb;							  // 发送完成回调
+	void *arg;									  // 回调参数
+	bool used;									  // 已占用
+};
+
+// 待执行的发送完成回调, 在释放锁后执行
+struct can_tx_done {
+	can_tx_done_cb cb;
+	void *arg;
+	bool ok;
+};
+
+// 多接口管理器, 所有接口的fd注册在同一个epoll集合中, 事件以(设备槽位, fd)标识
+struct can_mgr {
+	int epfd;								   // epoll文件描述符
+	int stop_fd;							   // 停止信号文件描述符
+	int nl_fd;								   // rtnetlink链路通知套接字, 所有接口共用
+	bool own_thread;						   // 由管理器的读取线程处理事件
+	pthread_t thread;						   // 读取线程
+	pthread_mutex_t lock;					   // 设备表锁, 处理事件期间持有
+	struct can_device *devs[CAN_MGR_MAX_DEVS]; // 设备表
+};
+
 struct can_device {
 	const struct can_config *config; // 用户配置
 	int socket_fd;					 // CAN套接字文件描述符
-	int stop_fd;					 // 停止信号文件描述符
-	int epfd;						 // epoll文件描述符
-	pthread_t thread;				 // 读取线程
+	can_mgr_handle mgr;				 // 所属管理器
+	uint32_t slot;					 // 在管理器设备表中的槽位
+	bool own_mgr;					 // 管理器由 can_device_init 创建, 关闭设备时一起销毁
+	size_t mtu;						 // 发送帧长度, CAN_MTU 或 CANFD_MTU
+	size_t max_dlen;				 // 单帧最大有效载荷, CAN_MAX_DLEN 或 CANFD_MAX_DLEN
+	int ifindex;					 // 接口索引
+	struct can_link_stats link;		 // 链路状态, 受 stats_lock 保护
+
+	struct canfd_frame rx_frames[CAN_RX_BATCH];	// 批量接收的帧
+	struct iovec rx_iov[CAN_RX_BATCH];			// 每帧一个iovec
+	struct mmsghdr rx_msgs[CAN_RX_BATCH];		// recvmmsg消息数组
+	char rx_ctrl[CAN_RX_BATCH][RX_CTRL_LEN];	// 每帧的时间戳控制消息
+	struct can_rx_info rx_info[CAN_RX_BATCH];	// 与帧一一对应的接收信息
+	struct can_rx_stats rx_stats;				// 接收批量统计
+	pthread_mutex_t stats_lock;					// 统计锁, 读取线程写, 任务线程读
+
+	struct can_tx_msg tx_queue[CAN_TX_QUEUE_LEN]; // 发送队列
+	struct can_tx_msg *tx_cur;					  // 已发出部分帧的报文, 发完前不插入其他报文
+	uint32_t tx_seq;							  // 下一个入队序号
+	struct can_tx_stats tx_stats;				  // 发送统计
+	pthread_mutex_t tx_lock;					  // 发送队列锁, 任务线程入队, 读取线程发送
+	int tx_fd;									  // 入队通知, 唤醒读取线程发送
+	int tx_timer_fd;							  // ENOBUFS退避定时器
+	bool tx_wait_out;							  // 正在等待套接字可写
+	bool tx_backoff;							  // 正在退避
+	bool tx_link_down;							  // 链路断开(如bus-off), 恢复后继续发送
+
+	struct mmsghdr tx_msgs[CAN_TX_BATCH];	   // sendmmsg消息数组
+	struct iovec tx_iov[CAN_TX_BATCH];		   // 每帧一个iovec
+	struct can_tx_msg *tx_owner[CAN_TX_BATCH]; // 每帧所属的报文
 };
 
+/**
+ * @brief CAN FD 有效载荷长度向上取整到DLC可表示的长度: 0~8, 12, 16, 20, 24, 32, 48, 64
+ *
+ * @param len 有效载荷长度 0 ~ CANFD_MAX_DLEN
+ * @return uint8_t 取整后的长度
+ */
+static uint8_t canfd_round_len(uint8_t len)
+{
+	static const uint8_t dlc_len[] = { 8, 12, 16, 20, 24, 32, 48, 64 };
+
+	for (size_t i = 0; i < sizeof(dlc_len); i++)
+		if (len <= dlc_len[i])
+			return dlc_len[i] > 8 ? dlc_len[i] : len;
+
+	return CANFD_MAX_DLEN;
+}
+
 /**
  * @brief 构造一帧CAN帧
  *
  * @param CAN 句柄
+ * @param can_id CAN ID
  * @param frame 待填充的CAN帧
  * @param data 有效载荷数据
- * @param len 有效载荷长度 范围 0 到 CAN_MAX_DLEN (8)
+ * @param len 有效载荷长度 范围 0 到 CAN_MAX_DLEN (8), CAN FD 为 CANFD_MAX_DLEN (64)
  * @return true 构造成功
  * @return false 构造失败
  */
 static bool make_one_can_frame(
-	can_handle handle, struct can_frame *frame, const uint8_t *data, uint8_t len)
+	can_handle handle, uint32_t can_id, struct canfd_frame *frame, const uint8_t *data, uint8_t len)
 {
 	if (frame == NULL || handle == NULL) {
 		LOG_E("Invalid frame pointer");
 		return false;
 	}
 
-	if (len > CAN_MAX_DLEN) {
-		LOG_E("Data length %d exceeds maximum %d", len, CAN_MAX_DLEN);
+	if (len > handle->max_dlen) {
+		LOG_E("Data length %d exceeds maximum %zu", len, handle->max_dlen);
 		return false;
 	}
 
@@ -84,91 +179,1009 @@ static bool make_one_can_frame(
 		return false;
 	}
 
-	frame->can_id = handle->config->can_id;
-	frame->len = len;
+	// 经典帧的 flags 位置是填充字节, 必须为0
+	memset(frame, 0, sizeof(struct canfd_frame));
+	frame->can_id = can_id;
+	frame->len = handle->config->fd_mode ? canfd_round_len(len) : len;
+	if (handle->config->fd_mode && handle->config->brs)
+		frame->flags = CANFD_BRS;
+
+	// 填充有效载荷数据, 不足部分已补零
+	if (len > 0)
+		memcpy(frame->data, data, len);
+
+	return true;
+}
+
+/**
+ * @brief 配置CAN过滤器
+ *
+ * @param socket_fd CAN套接字
+ * @param filters 过滤器数组,包含多组CAN ID和掩码
+ * @param filter_count 过滤器数量
+ * @return true 成功
+ * @return false 失败
+ */
+static bool configure_can_filters(int socket_fd, struct can_filter *filters, size_t filter_count)
+{
+	if (socket_fd < 0) {
+		LOG_E("Invalid socket_fd");
+		return false;
+	}
+
+	if (!filters || filter_count == 0)
+		return true; // 没有过滤器,直接返回
+
+	if (setsockopt(socket_fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters,
+			filter_count * sizeof(struct can_filter)) < 0) {
+		LOG_E("setsockopt CAN_RAW_FILTER failed: %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief 批量大小对应的分布桶: 1, 2~3, 4~7, 8~15, 16~31, 32
+ *
+ * @param num 批量大小
+ * @return int 桶下标
+ */
+static int batch_hist_index(int num)
+{
+	int idx = 0;
+
+	while (num > 1 && idx < CAN_RX_HIST_NUM - 1) {
+		num >>= 1;
+		idx++;
+	}
+
+	return idx;
+}
+
+/**
+ * @brief 从控制消息中取出接收时间戳
+ *
+ * @param msg 接收的消息
+ * @param info 输出时间戳, 没有的字段不修改
+ * @return true 有软件时间戳
+ * @return false 内核未提供软件时间戳
+ */
+static bool parse_rx_ts(struct msghdr *msg, struct can_rx_info *info)
+{
+	bool has_sw = false;
+
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_TIMESTAMPING)
+			continue;
+
+		// ts[0]为软件时间戳, ts[2]为原始硬件时间戳
+		struct scm_timestamping stamp;
+		memcpy(&stamp, CMSG_DATA(cm), sizeof(stamp));
+		if (stamp.ts[0].tv_sec || stamp.ts[0].tv_nsec) {
+			info->sw_ns = stamp.ts[0].tv_sec * 1000000000ULL + stamp.ts[0].tv_nsec;
+			has_sw = true;
+		}
+		if (stamp.ts[2].tv_sec || stamp.ts[2].tv_nsec)
+			info->hw_ns = stamp.ts[2].tv_sec * 1000000000ULL + stamp.ts[2].tv_nsec;
+	}
+
+	return has_sw;
+}
+
+/**
+ * @brief 交给用户处理一批帧, 未设置批量回调时逐帧回调
+ *
+ * @param handle CAN句柄
+ * @param num 帧数量
+ */
+static void deliver_batch(can_handle handle, int num)
+{
+	const struct can_config *config = handle->config;
+	uint32_t no_ts = 0;
+	uint64_t now_ns = 0;
+	int valid = 0;
+
+	// 剔除长度不对的帧, 有效帧向前压缩, 保证回调拿到的是连续数组
+	for (int i = 0; i < num; i++) {
+		struct canfd_frame *frame = &handle->rx_frames[i];
+		unsigned int msg_len = handle->rx_msgs[i].msg_len;
+
+		if (msg_len == CANFD_MTU && config->fd_mode) {
+			frame->flags |= CANFD_FDF;
+		} else if (msg_len == CAN_MTU) {
+			frame->flags = 0; // 经典帧的填充字节
+		} else {
+			if (config->cb && !config->batch_cb)
+				config->cb(NULL, NULL);
+			continue;
+		}
+
+		// 内核未提供时间戳时以本批的读取时刻代替
+		struct can_rx_info *info = &handle->rx_info[valid];
+		info->ifindex = handle->ifindex;
+		info->hw_ns = 0;
+		if (!parse_rx_ts(&handle->rx_msgs[i].msg_hdr, info)) {
+			if (!now_ns) {
+				struct timespec now;
+				clock_gettime(CLOCK_REALTIME, &now);
+				now_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+			}
+			info->sw_ns = now_ns;
+			no_ts++;
+		}
+
+		if (valid != i)
+			handle->rx_frames[valid] = *frame;
+		valid++;
+	}
+
+	if (valid != num || no_ts) {
+		pthread_mutex_lock(&handle->stats_lock);
+		handle->rx_stats.errors += num - valid;
+		handle->rx_stats.no_ts += no_ts;
+		pthread_mutex_unlock(&handle->stats_lock);
+	}
+
+	if (!valid)
+		return;
+
+	if (config->batch_cb) {
+		config->batch_cb(handle->rx_frames, handle->rx_info, valid);
+		return;
+	}
+
+	if (config->cb)
+		for (int i = 0; i < valid; i++)
+			config->cb(&handle->rx_frames[i], &handle->rx_info[i]);
+}
+
+/**
+ * @brief 一次唤醒内读空套接字, 每次recvmmsg读取一批
+ *
+ * @param handle CAN句柄
+ */
+static void can_recv_batches(can_handle handle)
+{
+	struct can_rx_stats *st = &handle->rx_stats;
+
+	pthread_mutex_lock(&handle->stats_lock);
+	st->wakeups++;
+	pthread_mutex_unlock(&handle->stats_lock);
+
+	for (;;) {
+		// 内核会改写控制消息长度, 每次接收前恢复
+		for (int i = 0; i < CAN_RX_BATCH; i++)
+			handle->rx_msgs[i].msg_hdr.msg_controllen = RX_CTRL_LEN;
+
+		int n = recvmmsg(handle->socket_fd, handle->rx_msgs, CAN_RX_BATCH, MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				LOG_E("recvmmsg failed: %s", strerror(errno));
+				pthread_mutex_lock(&handle->stats_lock);
+				st->errors++;
+				pthread_mutex_unlock(&handle->stats_lock);
+				if (handle->config->cb && !handle->config->batch_cb)
+					handle->config->cb(NULL, NULL);
+			}
+			return;
+		}
+		if (!n)
+			return;
+
+		pthread_mutex_lock(&handle->stats_lock);
+		st->batches++;
+		st->frames += n;
+		st->hist[batch_hist_index(n)]++;
+		if ((uint32_t)n > st->max_batch)
+			st->max_batch = n;
+		pthread_mutex_unlock(&handle->stats_lock);
+
+		deliver_batch(handle, n);
+
+		// 不足一批说明已读空, 省去一次返回EAGAIN的系统调用
+		if (n < CAN_RX_BATCH)
+			return;
+	}
+}
+
+/**
+ * @brief 添加或修改监听的fd
+ *
+ * @param mgr 管理器
+ * @param op EPOLL_CTL_ADD / EPOLL_CTL_MOD
+ * @param slot 设备槽位, 管理器自身的fd为 MGR_SLOT
+ * @param fd 文件描述符
+ * @param events 监听的事件
+ * @return true 成功
+ * @return false 失败
+ */
+static bool mgr_watch(can_mgr_handle mgr, int op, uint32_t slot, int fd, uint32_t events)
+{
+	struct epoll_event ev = {
+		.events = events,
+		.data.u64 = ((uint64_t)slot << 32) | (uint32_t)fd,
+	};
+
+	return epoll_ctl(mgr->epfd, op, fd, &ev) == 0;
+}
+
+/**************************发送队列**************************/
+
+/**
+ * @brief 总线仲裁顺序的比较键, 越小越优先
+ *
+ * 先比较11位基本ID(标准帧ID, 扩展帧ID的高11位), 相同时标准帧优先(IDE位显性),
+ * 再比较扩展帧的低18位
+ *
+ * @param can_id CAN ID
+ * @return uint32_t 比较键: 基本ID(11位) | IDE(1位) | 扩展ID(18位)
+ */
+static uint32_t tx_arb_key(canid_t can_id)
+{
+	if (!(can_id & CAN_EFF_FLAG))
+		return (can_id & CAN_SFF_MASK) << 19;
+
+	uint32_t id = can_id & CAN_EFF_MASK;
+
+	return ((id >> 18) << 19) | (1U << 18) | (id & 0x3FFFF);
+}
+
+/**
+ * @brief 报文优先级比较, 按总线仲裁顺序, 仲裁键相同先入先出
+ *
+ * @param a 报文a
+ * @param b 报文b
+ * @return true a优先于b
+ */
+static bool tx_msg_before(const struct can_tx_msg *a, const struct can_tx_msg *b)
+{
+	uint32_t key_a = tx_arb_key(a->frames[0].can_id);
+	uint32_t key_b = tx_arb_key(b->frames[0].can_id);
+
+	if (key_a != key_b)
+		return key_a < key_b;
+
+	return (int32_t)(a->seq - b->seq) < 0;
+}
+
+/**
+ * @brief 按优先级取出待发送的帧组成一批, 已发出部分帧的报文排在最前
+ *
+ * @param handle CAN句柄
+ * @return int 本批帧数
+ */
+static int tx_build_batch(can_handle handle)
+{
+	bool picked[CAN_TX_QUEUE_LEN] = { false };
+	struct can_tx_msg *msg = handle->tx_cur;
+	int n = 0;
+
+	while (n < CAN_TX_BATCH) {
+		if (!msg) {
+			for (int i = 0; i < CAN_TX_QUEUE_LEN; i++) {
+				struct can_tx_msg *m = &handle->tx_queue[i];
+				if (m->used && !picked[i] && (!msg || tx_msg_before(m, msg)))
+					msg = m;
+			}
+			if (!msg)
+				break;
+		}
+		picked[msg - handle->tx_queue] = true;
+
+		for (size_t i = msg->sent; i < msg->num && n < CAN_TX_BATCH; i++, n++) {
+			handle->tx_iov[n].iov_base = &msg->frames[i];
+			handle->tx_iov[n].iov_len = handle->mtu;
+			handle->tx_msgs[n].msg_hdr.msg_iov = &handle->tx_iov[n];
+			handle->tx_msgs[n].msg_hdr.msg_iovlen = 1;
+			handle->tx_owner[n] = msg;
+		}
+		msg = NULL;
+	}
+
+	return n;
+}
+
+/**
+ * @brief 报文出队, 记录待执行的完成回调
+ *
+ * @param handle CAN句柄
+ * @param msg 报文
+ * @param ok 是否发送成功
+ * @param done 完成回调数组
+ * @param done_num 完成回调数量
+ */
+static void tx_finish(can_handle handle, struct can_tx_msg *msg, bool ok, struct can_tx_done *done,
+	size_t *done_num)
+{
+	if (msg->cb)
+		done[(*done_num)++] = (struct can_tx_done) { .cb = msg->cb, .arg = msg->arg, .ok = ok };
+
+	if (ok)
+		handle->tx_stats.messages++;
+	else
+		handle->tx_stats.errors++;
+	handle->tx_stats.queued--;
+
+	if (handle->tx_cur == msg)
+		handle->tx_cur = NULL;
+	msg->used = false;
+}
+
+/**
+ * @brief 开关套接字可写事件监听
+ *
+ * @param handle CAN句柄
+ * @param on 是否监听可写
+ */
+static void tx_wait_out(can_handle handle, bool on)
+{
+	if (handle->tx_wait_out == on)
+		return;
+
+	uint32_t events = EPOLLIN | (on ? EPOLLOUT : 0);
+	if (!mgr_watch(handle->mgr, EPOLL_CTL_MOD, handle->slot, handle->socket_fd, events))
+		LOG_E("Modify CAN socket epoll failed: %s", strerror(errno));
+	else
+		handle->tx_wait_out = on;
+}
+
+/**
+ * @brief 控制器队列满时启动退避定时器, CAN套接字在ENOBUFS时仍可能报告可写, 不能依赖EPOLLOUT
+ *
+ * @param handle CAN句柄
+ */
+static void tx_start_backoff(can_handle handle)
+{
+	struct itimerspec its = { .it_value.tv_nsec = TX_BACKOFF_NS };
+
+	if (timerfd_settime(handle->tx_timer_fd, 0, &its, NULL) < 0)
+		LOG_E("CAN tx backoff timer failed: %s", strerror(errno));
+	else
+		handle->tx_backoff = true;
+}
+
+/**
+ * @brief 批量发送队列中的帧, 直到队列为空或控制器队列满
+ *
+ * 链路断开(bus-off)期间不发送, 报文保留在队列中, 链路恢复后继续
+ *
+ * @param handle CAN句柄
+ */
+static void can_tx_drain(can_handle handle)
+{
+	struct can_tx_done done[CAN_TX_BATCH];
+	bool more = true;
+
+	while (more) {
+		size_t done_num = 0;
+
+		pthread_mutex_lock(&handle->tx_lock);
+
+		int n = handle->tx_link_down ? 0 : tx_build_batch(handle);
+		if (!n) {
+			tx_wait_out(handle, false);
+			pthread_mutex_unlock(&handle->tx_lock);
+			break;
+		}
+
+		int ret = sendmmsg(handle->socket_fd, handle->tx_msgs, n, MSG_DONTWAIT);
+		if (ret < 0) {
+			more = errno == EINTR;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				tx_wait_out(handle, true);
+			} else if (errno == ENOBUFS) {
+				handle->tx_stats.enobufs++;
+				tx_start_backoff(handle);
+			} else if (errno == ENETDOWN) {
+				// 链路通知到达前已断开, 保留报文, 收到链路恢复通知后继续发送
+				handle->tx_link_down = true;
+			} else if (errno != EINTR) {
+				// 无法恢复的错误, 丢弃当前报文, 避免一直重试
+				LOG_E("CAN sendmmsg failed: %s", strerror(errno));
+				tx_finish(handle, handle->tx_owner[0], false, done, &done_num);
+				more = true;
+			}
+		} else {
+			struct can_tx_stats *st = &handle->tx_stats;
+			st->batches++;
+			st->frames += ret;
+			if ((uint32_t)ret > st->max_batch)
+				st->max_batch = ret;
+
+			for (int i = 0; i < ret; i++) {
+				struct can_tx_msg *msg = handle->tx_owner[i];
+				if (++msg->sent == msg->num)
+					tx_finish(handle, msg, true, done, &done_num);
+			}
+
+			// 只有最后一个报文可能只发出部分帧, 剩余帧下一批优先发送
+			struct can_tx_msg *last = handle->tx_owner[ret - 1];
+			handle->tx_cur = last->used ? last : NULL;
+
+			// 部分发出时再试一次, 由返回的错误码决定等待方式
+			more = true;
+		}
+
+		pthread_mutex_unlock(&handle->tx_lock);
+
+		for (size_t i = 0; i < done_num; i++)
+			done[i].cb(done[i].ok, done[i].arg);
+	}
+}
+
+/**************************rtnetlink**************************/
+
+// 链路配置请求
+struct nl_link_req {
+	struct nlmsghdr n;		 // 消息头
+	struct ifinfomsg ifi;	 // 接口信息
+	char attrs[NL_ATTR_LEN]; // 属性
+};
+
+/**
+ * @brief 初始化链路配置请求
+ *
+ * @param req 请求
+ * @param ifindex 接口索引
+ */
+static void nl_req_init(struct nl_link_req *req, int ifindex)
+{
+	memset(req, 0, sizeof(struct nl_link_req));
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req->n.nlmsg_type = RTM_NEWLINK;
+	req->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req->n.nlmsg_seq = 1;
+	req->ifi.ifi_family = AF_UNSPEC;
+	req->ifi.ifi_index = ifindex;
+}
+
+/**
+ * @brief 追加属性
+ *
+ * @param req 请求
+ * @param type 属性类型
+ * @param data 属性数据, 嵌套属性为NULL
+ * @param len 属性长度
+ * @return struct rtattr* 属性, 用于结束嵌套; 缓冲不足返回NULL
+ */
+static struct rtattr *nl_attr_add(struct nl_link_req *req, int type, const void *data, size_t len)
+{
+	size_t off = NLMSG_ALIGN(req->n.nlmsg_len);
+
+	if (off + RTA_SPACE(len) > sizeof(struct nl_link_req))
+		return NULL;
+
+	struct rtattr *rta = (struct rtattr *)((char *)req + off);
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	if (len)
+		memcpy(RTA_DATA(rta), data, len);
+	req->n.nlmsg_len = off + RTA_SPACE(len);
+
+	return rta;
+}
+
+/**
+ * @brief 结束嵌套属性
+ *
+ * @param req 请求
+ * @param nest 嵌套属性
+ */
+static void nl_attr_end(struct nl_link_req *req, struct rtattr *nest)
+{
+	nest->rta_len = (char *)req + NLMSG_ALIGN(req->n.nlmsg_len) - (char *)nest;
+}
+
+/**
+ * @brief 发送请求并等待内核应答
+ *
+ * @param req 请求
+ * @param reply 查询请求的应答消息, 不需要时为NULL
+ * @param reply_len 应答缓冲长度, 超出的应答不拷贝
+ * @return true 成功
+ * @return false 失败, errno为失败原因
+ */
+static bool nl_transact(struct nl_link_req *req, struct nlmsghdr *reply, size_t reply_len)
+{
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return false;
+
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+	char buf[NL_BUF_LEN];
+	int err = 0;
+
+	if (sendto(fd, req, req->n.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		err = errno;
+		goto out;
+	}
+
+	for (;;) {
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err = errno;
+			goto out;
+		}
+
+		for (struct nlmsghdr *h = (struct nlmsghdr *)buf; NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+			if (h->nlmsg_seq != req->n.nlmsg_seq)
+				continue;
+
+			// 查询的应答先于确认到达
+			if (h->nlmsg_type != NLMSG_ERROR) {
+				if (reply && h->nlmsg_len <= reply_len)
+					memcpy(reply, h, h->nlmsg_len);
+				continue;
+			}
+
+			// 应答的 error 为0代表成功, 否则为负的错误码
+			err = -((struct nlmsgerr *)NLMSG_DATA(h))->error;
+			goto out;
+		}
+	}
+
+out:
+	close(fd);
+	errno = err;
+
+	return !err;
+}
+
+/**
+ * @brief 查询接口类型(IFLA_INFO_KIND), 如 "can"、"vcan"
+ *
+ * @param ifindex 接口索引
+ * @param kind 输出类型, 应答中没有类型时为空字符串
+ * @param len 类型缓冲长度
+ * @return true 成功
+ * @return false 失败
+ */
+static bool can_link_get_kind(int ifindex, char *kind, size_t len)
+{
+	struct nl_link_req req;
+	char buf[NL_BUF_LEN];
+	struct nlmsghdr *h = (struct nlmsghdr *)buf;
+
+	nl_req_init(&req, ifindex);
+	req.n.nlmsg_type = RTM_GETLINK;
+
+	kind[0] = '\0';
+	h->nlmsg_len = 0;
+	if (!nl_transact(&req, h, sizeof(buf)))
+		return false;
+	if (h->nlmsg_type != RTM_NEWLINK)
+		return true;
+
+	int attr_len = IFLA_PAYLOAD(h);
+	for (struct rtattr *rta = IFLA_RTA(NLMSG_DATA(h)); RTA_OK(rta, attr_len);
+		rta = RTA_NEXT(rta, attr_len)) {
+		if (rta->rta_type != IFLA_LINKINFO)
+			continue;
+
+		int info_len = RTA_PAYLOAD(rta);
+		for (struct rtattr *info = RTA_DATA(rta); RTA_OK(info, info_len);
+			info = RTA_NEXT(info, info_len)) {
+			if (info->rta_type != IFLA_INFO_KIND)
+				continue;
+
+			size_t n = strnlen(RTA_DATA(info), RTA_PAYLOAD(info));
+			if (n >= len)
+				n = len - 1;
+			memcpy(kind, RTA_DATA(info), n);
+			kind[n] = '\0';
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief 启用或关闭接口
+ *
+ * @param ifindex 接口索引
+ * @param up 是否启用
+ * @return true 成功
+ * @return false 失败
+ */
+static bool can_link_set_up(int ifindex, bool up)
+{
+	struct nl_link_req req;
+
+	nl_req_init(&req, ifindex);
+	req.ifi.ifi_change = IFF_UP;
+	req.ifi.ifi_flags = up ? IFF_UP : 0;
+
+	return nl_transact(&req, NULL, 0);
+}
+
+/**
+ * @brief 设置比特率、CAN FD 与bus-off自动重启延时, 接口需处于关闭状态
+ *
+ * @param config 用户配置
+ * @param ifindex 接口索引
+ * @return true 成功
+ * @return false 失败
+ */
+static bool can_link_configure(const struct can_config *config, int ifindex)
+{
+	struct nl_link_req req;
+	struct can_bittiming bt = { .bitrate = config->can_bitrate };
+	uint32_t restart_ms = config->restart_ms;
+
+	nl_req_init(&req, ifindex);
+
+	struct rtattr *info = nl_attr_add(&req, IFLA_LINKINFO, NULL, 0);
+	if (!info || !nl_attr_add(&req, IFLA_INFO_KIND, "can", strlen("can")))
+		goto err_space;
+
+	struct rtattr *data = nl_attr_add(&req, IFLA_INFO_DATA, NULL, 0);
+	if (!data || !nl_attr_add(&req, IFLA_CAN_BITTIMING, &bt, sizeof(bt)) ||
+		!nl_attr_add(&req, IFLA_CAN_RESTART_MS, &restart_ms, sizeof(restart_ms)))
+		goto err_space;
+
+	if (config->fd_mode) {
+		struct can_bittiming dbt = {
+			.bitrate = config->data_bitrate ? config->data_bitrate : config->can_bitrate,
+		};
+		struct can_ctrlmode cm = { .mask = CAN_CTRLMODE_FD, .flags = CAN_CTRLMODE_FD };
+		if (!nl_attr_add(&req, IFLA_CAN_DATA_BITTIMING, &dbt, sizeof(dbt)) ||
+			!nl_attr_add(&req, IFLA_CAN_CTRLMODE, &cm, sizeof(cm)))
+			goto err_space;
+	}
+
+	nl_attr_end(&req, data);
+	nl_attr_end(&req, info);
+
+	return nl_transact(&req, NULL, 0);
+
+err_space:
+	errno = EMSGSIZE;
+
+	return false;
+}
+
+/**
+ * @brief 立即重启bus-off的控制器
+ *
+ * @param ifindex 接口索引
+ * @return true 成功
+ * @return false 失败
+ */
+static bool can_link_restart(int ifindex)
+{
+	struct nl_link_req req;
+	uint32_t restart = 1;
+
+	nl_req_init(&req, ifindex);
+
+	struct rtattr *info = nl_attr_add(&req, IFLA_LINKINFO, NULL, 0);
+	if (!info || !nl_attr_add(&req, IFLA_INFO_KIND, "can", strlen("can")))
+		goto err_space;
+
+	struct rtattr *data = nl_attr_add(&req, IFLA_INFO_DATA, NULL, 0);
+	if (!data || !nl_attr_add(&req, IFLA_CAN_RESTART, &restart, sizeof(restart)))
+		goto err_space;
+
+	nl_attr_end(&req, data);
+	nl_attr_end(&req, info);
+
+	return nl_transact(&req, NULL, 0);
+
+err_space:
+	errno = EMSGSIZE;
+
+	return false;
+}
+
+/**
+ * @brief 配置并启用 CAN 接口, 比特率只能在接口关闭时修改, 因此先关闭再配置
+ *
+ * vcan 等非 "can" 类型的接口没有比特率与控制器设置, 只启用接口
+ *
+ * @param config 用户配置
+ * @return true 配置成功
+ * @return false 配置失败
+ */
+static bool setup_can_interface(const struct can_config *config)
+{
+	if (!config) {
+		LOG_E("Invalid args");
+		return false;
+	}
+
+	int ifindex = if_nametoindex(config->can_dev_name);
+	if (!ifindex) {
+		LOG_E("CAN interface %s not found: %s", config->can_dev_name, strerror(errno));
+		return false;
+	}
+
+	char kind[IFNAMSIZ];
+	if (!can_link_get_kind(ifindex, kind, sizeof(kind))) {
+		LOG_E("Query CAN interface %s failed: %s", config->can_dev_name, strerror(errno));
+		return false;
+	}
+
+	if (strcmp(kind, "can")) {
+		LOG_I("CAN interface %s kind '%s', skip bitrate config", config->can_dev_name, kind);
+		goto link_up;
+	}
+
+	if (!can_link_set_up(ifindex, false)) {
+		LOG_E("Bring down CAN interface %s failed: %s", config->can_dev_name, strerror(errno));
+		return false;
+	}
+
+	if (!can_link_configure(config, ifindex)) {
+		LOG_E("Configure CAN interface %s failed: %s", config->can_dev_name, strerror(errno));
+		return false;
+	}
+
+link_up:
+	if (!can_link_set_up(ifindex, true)) {
+		LOG_E("Bring up CAN interface %s failed: %s", config->can_dev_name, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief 关闭 CAN 接口
+ */
+static void shutdown_can_interface(const struct can_config *config)
+{
+	if (!config) {
+		LOG_E("Invalid args");
+		return;
+	}
+
+	int ifindex = if_nametoindex(config->can_dev_name);
+	if (!ifindex || !can_link_set_up(ifindex, false))
+		LOG_E("Bring down CAN interface %s failed: %s", config->can_dev_name, strerror(errno));
+}
+
+/**
+ * @brief 创建链路通知套接字, 订阅接口状态变化
+ *
+ * @return int 套接字, 失败返回-1
+ */
+static int can_link_monitor_open(void)
+{
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return -1;
+
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK, .nl_groups = RTMGRP_LINK };
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * @brief 从链路通知中解析控制器状态
+ *
+ * @param h 链路通知
+ * @param state 输出状态, 通知中没有时不修改
+ */
+static void parse_can_state(struct nlmsghdr *h, enum can_state *state)
+{
+	int len = IFLA_PAYLOAD(h);
+
+	for (struct rtattr *rta = IFLA_RTA(NLMSG_DATA(h)); RTA_OK(rta, len);
+		rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type != IFLA_LINKINFO)
+			continue;
+
+		int info_len = RTA_PAYLOAD(rta);
+		for (struct rtattr *info = RTA_DATA(rta); RTA_OK(info, info_len);
+			info = RTA_NEXT(info, info_len)) {
+			if (info->rta_type != IFLA_INFO_DATA)
+				continue;
+
+			int data_len = RTA_PAYLOAD(info);
+			for (struct rtattr *data = RTA_DATA(info); RTA_OK(data, data_len);
+				data = RTA_NEXT(data, data_len)) {
+				if (data->rta_type == IFLA_CAN_STATE)
+					*state = *(uint32_t *)RTA_DATA(data);
+			}
+		}
+	}
+}
+
+/**
+ * @brief 处理一条本接口的链路通知
+ *
+ * 记录状态变化; 进入bus-off且未配置驱动自动重启时立即重启;
+ * 链路断开时暂停发送, 链路恢复后继续发送保留的报文
+ *
+ * @param handle CAN句柄
+ * @param h 链路通知
+ */
+static void can_link_update(can_handle handle, struct nlmsghdr *h)
+{
+	const struct can_config *config = handle->config;
+	struct ifinfomsg *ifi = NLMSG_DATA(h);
+
+	pthread_mutex_lock(&handle->stats_lock);
+	struct can_link_stats *link = &handle->link;
+	enum can_state old_state = link->state;
+	bool was_running = link->running;
+
+	parse_can_state(h, &link->state);
+	link->running = ifi->ifi_flags & IFF_RUNNING;
+	link->link_events++;
+
+	enum can_state state = link->state;
+	bool running = link->running;
+	bool bus_off = state == CAN_STATE_BUS_OFF && old_state != CAN_STATE_BUS_OFF;
+	if (bus_off)
+		link->bus_off++;
+	pthread_mutex_unlock(&handle->stats_lock);
+
+	if (state != old_state) {
+		LOG_W("CAN %s state %d -> %d", config->can_dev_name, old_state, state);
+		if (config->state_cb)
+			config->state_cb(state);
+	}
+
+	if (bus_off && !config->restart_ms) {
+		if (can_link_restart(handle->ifindex)) {
+			pthread_mutex_lock(&handle->stats_lock);
+			handle->link.restarts++;
+			pthread_mutex_unlock(&handle->stats_lock);
+		} else {
+			LOG_E("Restart CAN %s failed: %s", config->can_dev_name, strerror(errno));
+		}
+	}
+
+	// bus-off时驱动关闭载波, 发送会进入控制器队列而无法发出, 暂停到链路恢复
+	if (!running && was_running) {
+		LOG_W("CAN %s link down", config->can_dev_name);
+
+		pthread_mutex_lock(&handle->tx_lock);
+		handle->tx_link_down = true;
+		pthread_mutex_unlock(&handle->tx_lock);
+	}
+
+	if (running && !was_running) {
+		LOG_I("CAN %s link up", config->can_dev_name);
+
+		pthread_mutex_lock(&handle->tx_lock);
+		bool resume = handle->tx_link_down;
+		handle->tx_link_down = false;
+		pthread_mutex_unlock(&handle->tx_lock);
+
+		if (resume)
+			can_tx_drain(handle);
+	}
+}
+
+/**
+ * @brief 读空链路通知套接字, 按接口索引交给对应设备
+ *
+ * @param mgr 管理器, 调用者持有设备表锁
+ */
+static void can_link_events(can_mgr_handle mgr)
+{
+	char buf[NL_BUF_LEN];
+
+	for (;;) {
+		ssize_t n = recv(mgr->nl_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			// ENOBUFS代表通知过多被内核丢弃, 以后续通知为准
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+				LOG_E("Read link notify failed: %s", strerror(errno));
+			break;
+		}
 
-	// 填充有效载荷数据
-	if (len > 0 && data != NULL) {
-		memcpy(frame->data, data, len);
-		if (len < CAN_MAX_DLEN)
-			memset(frame->data + len, 0, CAN_MAX_DLEN - len); // 不足8个补零
-	} else
-		memset(frame->data, 0, CAN_MAX_DLEN);
+		for (struct nlmsghdr *h = (struct nlmsghdr *)buf; NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+			if (h->nlmsg_type != RTM_NEWLINK)
+				continue;
 
-	return true;
+			struct ifinfomsg *ifi = NLMSG_DATA(h);
+			for (int i = 0; i < CAN_MGR_MAX_DEVS; i++) {
+				can_handle handle = mgr->devs[i];
+				if (handle && ifi->ifi_index == handle->ifindex)
+					can_link_update(handle, h);
+			}
+		}
+	}
 }
 
 /**
- * @brief 配置CAN过滤器
+ * @brief 处理设备的fd事件
  *
- * @param socket_fd CAN套接字
- * @param filters 过滤器数组,包含多组CAN ID和掩码
- * @param filter_count 过滤器数量
- * @return true 成功
- * @return false 失败
+ * @param handle CAN句柄
+ * @param trigger_fd 触发的fd
+ * @param events 触发的事件
  */
-static bool configure_can_filters(int socket_fd, struct can_filter *filters, size_t filter_count)
+static void can_epoll_fd_handle(can_handle handle, int trigger_fd, uint32_t events)
 {
-	if (socket_fd < 0) {
-		LOG_E("Invalid socket_fd");
-		return false;
-	}
+	if (handle->socket_fd == trigger_fd) {
+		// 接收事件, 批量读空后再等待
+		if (events & EPOLLIN)
+			can_recv_batches(handle);
 
-	if (!filters || filter_count == 0)
-		return true; // 没有过滤器,直接返回
+		// 等待的可写事件到来, 继续发送
+		if (events & EPOLLOUT) {
+			pthread_mutex_lock(&handle->tx_lock);
+			tx_wait_out(handle, false);
+			pthread_mutex_unlock(&handle->tx_lock);
+			can_tx_drain(handle);
+		}
+	} else if (handle->tx_fd == trigger_fd || handle->tx_timer_fd == trigger_fd) {
+		uint64_t u;
+		if (read(trigger_fd, &u, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+			LOG_E("Failed to read from tx fd: %s", strerror(errno));
 
-	if (setsockopt(socket_fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters,
-			filter_count * sizeof(struct can_filter)) < 0) {
-		LOG_E("setsockopt CAN_RAW_FILTER failed: %s", strerror(errno));
-		return false;
-	}
+		pthread_mutex_lock(&handle->tx_lock);
+		if (trigger_fd == handle->tx_timer_fd)
+			handle->tx_backoff = false;
+		bool waiting = handle->tx_wait_out || handle->tx_backoff || handle->tx_link_down;
+		pthread_mutex_unlock(&handle->tx_lock);
 
-	return true;
+		// 等待可写或退避期间新入队的报文随之一起发送
+		if (!waiting)
+			can_tx_drain(handle);
+	}
 }
 
 /**
- * @brief 处理监听的fd事件
- * 
- * @param handle CAN句柄
- * @param trigger_fd 触发的fd
+ * @brief 处理一批epoll事件
+ *
+ * @param mgr 管理器
+ * @param events 事件数组
+ * @param n 事件数量
  * @return true 处理完成继续等待
- * @return false 退出监听
+ * @return false 收到停止信号
  */
-static bool can_epoll_fd_handle(can_handle handle, int trigger_fd)
+static bool can_mgr_handle_events(can_mgr_handle mgr, struct epoll_event *events, int n)
 {
-	if (!handle || trigger_fd < 0)
-		return false;
+	bool running = true;
 
-	struct can_frame frame;
+	pthread_mutex_lock(&mgr->lock);
 
-	// 停止事件
-	if (handle->stop_fd == trigger_fd) {
-		uint64_t u;
-		if (read(handle->stop_fd, &u, sizeof(uint64_t)) < 0)
-			LOG_E("Failed to read from stop_fd: %s", strerror(errno));
-		return false; // 退出线程
-	} else if (handle->socket_fd == trigger_fd) {
-		// 接收事件
-
-		int nbytes = read(handle->socket_fd, &frame, sizeof(struct can_frame));
+	for (int i = 0; i < n; i++) {
+		uint32_t slot = events[i].data.u64 >> 32;
+		int fd = (int)(uint32_t)events[i].data.u64;
 
-		if (nbytes < 0)
-			handle->config->cb(NULL);
-		else if (nbytes == sizeof(struct can_frame) && handle->config && handle->config->cb)
-			handle->config->cb(&frame); // 接收到正常数据
-		else
-			handle->config->cb(NULL);
+		if (slot == MGR_SLOT) {
+			if (fd == mgr->nl_fd) {
+				can_link_events(mgr);
+			} else if (fd == mgr->stop_fd) {
+				uint64_t u;
+				if (read(mgr->stop_fd, &u, sizeof(uint64_t)) < 0)
+					LOG_E("Failed to read from stop_fd: %s", strerror(errno));
+				running = false;
+			}
+			continue;
+		}
 
-		return true; // 继续等待
+		// 本批事件取出后设备可能已关闭
+		can_handle handle = slot < CAN_MGR_MAX_DEVS ? mgr->devs[slot] : NULL;
+		if (handle)
+			can_epoll_fd_handle(handle, fd, events[i].events);
 	}
 
-	return false; // 未知fd, 继续等待
+	pthread_mutex_unlock(&mgr->lock);
+
+	return running;
 }
 
 /**
- * @brief 读取线程,监听CAN接收事件和停止通知
+ * @brief 读取线程, 监听所有接口的事件和停止通知
  *
- * @param arg 指向CAN句柄
+ * @param arg 指向管理器
  * @return void* 返回NULL
  */
 static void *can_read_thread_func(void *arg)
@@ -176,12 +1189,11 @@ static void *can_read_thread_func(void *arg)
 	if (!arg)
 		return NULL;
 
-	can_handle handle = arg;	  // CAN句柄
-	struct epoll_event events[2]; // epoll事件数组 (CAN接收事件和停止通知)
-	struct can_frame frame;		  // 读取的CAN帧
+	can_mgr_handle mgr = arg;			   // 管理器
+	struct epoll_event events[MGR_EVENTS]; // epoll事件数组
 
 	while (1) {
-		int n = epoll_wait(handle->epfd, events, 2, -1);
+		int n = epoll_wait(mgr->epfd, events, MGR_EVENTS, -1);
 		if (n < 0) {
 			if (errno == EINTR)
 				continue; // 被信号中断,继续等待
@@ -189,85 +1201,109 @@ static void *can_read_thread_func(void *arg)
 			break;
 		}
 
-		// 处理监听事件
-		for (int i = 0; i < n; i++) {
-			int trigger_fd = events[i].data.fd;
-			if (!can_epoll_fd_handle(handle, trigger_fd))
-				goto exit;
-		}
+		if (!can_mgr_handle_events(mgr, events, n))
+			break;
 	}
 
-exit:
 	return NULL;
 }
 
 /**
- * @brief 配置并启用 CAN 接口
+ * @brief 设备加入管理器, 注册CAN套接字、发送通知与退避定时器
  *
- * @return true 配置成功
- * @return false 配置失败
+ * @param mgr 管理器
+ * @param handle CAN句柄
+ * @return true 成功
+ * @return false 设备表已满或注册失败
  */
-static bool setup_can_interface(const struct can_config *config)
+static bool mgr_attach(can_mgr_handle mgr, can_handle handle)
 {
-	if (!config) {
-		LOG_E("Invalid args");
-		return false;
-	}
+	bool ok = false;
 
-	char cmd[256] = { 0 };
-	int ret;
+	pthread_mutex_lock(&mgr->lock);
 
-	// 设置 CAN 接口的比特率并启用接口
-	// 格式: ip link set <CAN_DEV_NAME> up type can bitrate <CAN_BITRATE>
-	snprintf(cmd, sizeof(cmd), "ip link set %s up type can bitrate %d", config->can_dev_name,
-		config->can_bitrate);
-	ret = system(cmd);
-	if (ret != 0) {
-		LOG_E("Failed to bring up CAN interface using command: %s", cmd);
-		return false;
+	uint32_t slot = 0;
+	while (slot < CAN_MGR_MAX_DEVS && mgr->devs[slot])
+		slot++;
+	if (slot == CAN_MGR_MAX_DEVS) {
+		LOG_E("CAN manager is full, max %d interfaces", CAN_MGR_MAX_DEVS);
+		goto out;
 	}
 
-	// 检查接口是否已启用
-	char operstate_path[256];
-	snprintf(operstate_path, sizeof(operstate_path), "/sys/class/net/%s/operstate",
-		config->can_dev_name);
-	int fd = open(operstate_path, O_RDONLY);
-	if (fd < 0) {
-		LOG_E("Failed to open operstate: %s", strerror(errno));
-		return false;
-	}
+	handle->mgr = mgr;
+	handle->slot = slot;
 
-	char state[16] = { 0 };
-	ssize_t n = read(fd, state, sizeof(state) - 1);
-	close(fd);
-	if (n <= 0) {
-		LOG_E("Failed to read CAN interface state");
-		return false;
-	}
-	state[strcspn(state, "\n")] = '\0';
-	if (strcmp(state, "up") != 0) {
-		LOG_E("CAN interface %s is not up, current state: %s", config->can_dev_name, state);
-		return false;
-	}
+	if (!mgr_watch(mgr, EPOLL_CTL_ADD, slot, handle->socket_fd, EPOLLIN))
+		goto err_log;
+	if (!mgr_watch(mgr, EPOLL_CTL_ADD, slot, handle->tx_fd, EPOLLIN))
+		goto err_del_socket;
+	if (!mgr_watch(mgr, EPOLL_CTL_ADD, slot, handle->tx_timer_fd, EPOLLIN))
+		goto err_del_tx;
 
-	return true;
+	mgr->devs[slot] = handle;
+	ok = true;
+	goto out;
+
+err_del_tx:
+	epoll_ctl(mgr->epfd, EPOLL_CTL_DEL, handle->tx_fd, NULL);
+
+err_del_socket:
+	epoll_ctl(mgr->epfd, EPOLL_CTL_DEL, handle->socket_fd, NULL);
+
+err_log:
+	LOG_E("Add CAN %s to epoll failed: %s", handle->config->can_dev_name, strerror(errno));
+
+out:
+	pthread_mutex_unlock(&mgr->lock);
+
+	return ok;
 }
 
 /**
- * @brief 关闭 CAN 接口
+ * @brief 设备退出管理器, 返回后读取线程/事件循环不再访问该设备
+ *
+ * @param handle CAN句柄
  */
-static void shutdown_can_interface(const struct can_config *config)
+static void mgr_detach(can_handle handle)
 {
-	if (!config) {
-		LOG_E("Invalid args");
-		return;
-	}
+	can_mgr_handle mgr = handle->mgr;
 
-	char cmd[256] = { 0 };
-	snprintf(cmd, sizeof(cmd), "ip link set %s down", config->can_dev_name);
-	if (system(cmd) != 0) {
-		LOG_E("Failed to bring down CAN interface using command: %s", cmd);
-	}
+	pthread_mutex_lock(&mgr->lock);
+	epoll_ctl(mgr->epfd, EPOLL_CTL_DEL, handle->socket_fd, NULL);
+	epoll_ctl(mgr->epfd, EPOLL_CTL_DEL, handle->tx_fd, NULL);
+	epoll_ctl(mgr->epfd, EPOLL_CTL_DEL, handle->tx_timer_fd, NULL);
+	mgr->devs[handle->slot] = NULL;
+	pthread_mutex_unlock(&mgr->lock);
+}
+
+/**
+ * @brief 启用套接字接收时间戳, 控制器支持时同时启用硬件时间戳
+ *
+ * @param socket_fd CAN套接字
+ * @param config 用户配置
+ */
+static void enable_rx_timestamps(int socket_fd, const struct can_config *config)
+{
+	struct hwtstamp_config hw_cfg = {
+		.tx_type = HWTSTAMP_TX_OFF,
+		.rx_filter = HWTSTAMP_FILTER_ALL,
+	};
+	struct ifreq ifr = { 0 };
+	bool hw = false;
+
+	strncpy(ifr.ifr_name, config->can_dev_name, IFNAMSIZ - 1);
+	ifr.ifr_data = (char *)&hw_cfg;
+	if (ioctl(socket_fd, SIOCSHWTSTAMP, &ifr) == 0 && hw_cfg.rx_filter != HWTSTAMP_FILTER_NONE)
+		hw = true;
+	else
+		LOG_I("CAN %s has no hardware timestamp, use software", config->can_dev_name);
+
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	if (hw)
+		flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	if (setsockopt(socket_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+		LOG_W("Enable CAN rx timestamp failed: %s", strerror(errno));
 }
 
 /**
@@ -279,10 +1315,12 @@ static void shutdown_can_interface(const struct can_config *config)
 static void cleanup(can_handle handle, int socket_fd)
 {
 	if (handle) {
-		if (handle->epfd > 0)
-			close(handle->epfd);
-		if (handle->stop_fd > 0)
-			close(handle->stop_fd);
+		if (handle->tx_fd > 0)
+			close(handle->tx_fd);
+		if (handle->tx_timer_fd > 0)
+			close(handle->tx_timer_fd);
+		pthread_mutex_destroy(&handle->stats_lock);
+		pthread_mutex_destroy(&handle->tx_lock);
 		free(handle);
 	}
 	if (socket_fd > 0)
@@ -290,15 +1328,20 @@ static void cleanup(can_handle handle, int socket_fd)
 }
 
 /**
- * @brief CAN设备初始化
+ * @brief 打开CAN接口并加入管理器, 与管理器中的其他接口共用读取线程或事件循环
  *
- * @param config 用户配置信息
- * @return true 初始化成功
- * @return false 初始化失败
+ * 通过rtnetlink配置接口比特率并启用, 初始化CAN套接字并绑定到接口, 注册到管理器的epoll
+ * 套接字启用 SO_TIMESTAMPING 接收时间戳, 控制器支持时同时启用硬件时间戳
+ * 回调中可以发送, 但不能打开或关闭同一管理器中的接口
+ *
+ * @param mgr 管理器
+ * @param config 用户配置信息, 每个接口一份, 需在设备关闭前保持有效
+ * @return can_handle 成功
+ * @return NULL 失败
  */
-can_handle can_device_init(const struct can_config *config)
+can_handle can_device_open(can_mgr_handle mgr, const struct can_config *config)
 {
-	if (!config) {
+	if (!mgr || !config) {
 		LOG_E("Invalid args");
 		return NULL;
 	}
@@ -336,6 +1379,24 @@ can_handle can_device_init(const struct can_config *config)
 		return NULL;
 	}
 
+	// CAN FD 需要接口MTU为 CANFD_MTU, 否则发送FD帧会失败
+	if (config->fd_mode) {
+		int enable = 1;
+		if (ioctl(socket_fd, SIOCGIFMTU, &ifr) < 0 || ifr.ifr_mtu != CANFD_MTU) {
+			LOG_E("CAN interface %s does not support CAN FD", config->can_dev_name);
+			cleanup(NULL, socket_fd);
+			shutdown_can_interface(config);
+			return NULL;
+		}
+
+		if (setsockopt(socket_fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) < 0) {
+			LOG_E("setsockopt CAN_RAW_FD_FRAMES failed: %s", strerror(errno));
+			cleanup(NULL, socket_fd);
+			shutdown_can_interface(config);
+			return NULL;
+		}
+	}
+
 	// 设置CAN套接字地址
 	memset(&addr, 0, sizeof(addr));
 	addr.can_family = AF_CAN;
@@ -376,51 +1437,68 @@ can_handle can_device_init(const struct can_config *config)
 	}
 	handle->config = config;
 	handle->socket_fd = socket_fd;
+	handle->mtu = config->fd_mode ? CANFD_MTU : CAN_MTU;
+	handle->max_dlen = config->fd_mode ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+	handle->ifindex = ifr.ifr_ifindex;
+	handle->link.state = CAN_STATE_ERROR_ACTIVE; // 刚启用的接口
+	handle->link.running = true;
+	pthread_mutex_init(&handle->stats_lock, NULL);
+	pthread_mutex_init(&handle->tx_lock, NULL);
 
-	// 创建停止事件文件描述符
-	handle->stop_fd = eventfd(0, EFD_NONBLOCK);
-	if (handle->stop_fd < 0) {
-		LOG_E("Create stop_fd failed: %s", strerror(errno));
-		cleanup(handle, socket_fd);
-		shutdown_can_interface(config);
-		return NULL;
+	// 接收数组固定指向句柄内的帧缓冲
+	for (int i = 0; i < CAN_RX_BATCH; i++) {
+		handle->rx_iov[i].iov_base = &handle->rx_frames[i];
+		handle->rx_iov[i].iov_len = sizeof(struct canfd_frame);
+		handle->rx_msgs[i].msg_hdr.msg_iov = &handle->rx_iov[i];
+		handle->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+		handle->rx_msgs[i].msg_hdr.msg_control = handle->rx_ctrl[i];
+		handle->rx_msgs[i].msg_hdr.msg_controllen = RX_CTRL_LEN;
 	}
 
-	// 创建epoll实例
-	handle->epfd = epoll_create1(0);
-	if (handle->epfd < 0) {
-		LOG_E("Create epoll failed: %s", strerror(errno));
+	// 接收时间戳失败不影响收发, 交付时以读取时刻代替
+	enable_rx_timestamps(socket_fd, config);
+
+	// 创建发送通知与退避定时器, 发送统一在管理器的读取线程/事件循环中进行
+	handle->tx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	handle->tx_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (handle->tx_fd < 0 || handle->tx_timer_fd < 0) {
+		LOG_E("Create tx fd failed: %s", strerror(errno));
 		cleanup(handle, socket_fd);
 		shutdown_can_interface(config);
 		return NULL;
 	}
 
-	// 添加CAN套接字到epoll
-	struct epoll_event ev = { .events = EPOLLIN, .data.fd = handle->socket_fd };
-	if (epoll_ctl(handle->epfd, EPOLL_CTL_ADD, handle->socket_fd, &ev) < 0) {
-		LOG_E("Add CAN socket to epoll failed: %s", strerror(errno));
+	// 加入管理器后开始收发
+	if (!mgr_attach(mgr, handle)) {
 		cleanup(handle, socket_fd);
 		shutdown_can_interface(config);
 		return NULL;
 	}
 
-	// 添加停止事件到epoll
-	struct epoll_event stop_event = { .events = EPOLLIN, .data.fd = handle->stop_fd };
-	if (epoll_ctl(handle->epfd, EPOLL_CTL_ADD, handle->stop_fd, &stop_event) < 0) {
-		LOG_E("Add stop_fd to epoll failed: %s", strerror(errno));
-		cleanup(handle, socket_fd);
-		shutdown_can_interface(config);
+	return handle;
+}
+
+/**
+ * @brief CAN设备初始化, 创建独占的管理器与读取线程
+ *
+ * 等同于 can_mgr_create(true) 后 can_device_open, 关闭设备时一起销毁管理器
+ *
+ * @param config 用户配置信息
+ * @return can_handle 成功
+ * @return NULL 失败
+ */
+can_handle can_device_init(const struct can_config *config)
+{
+	can_mgr_handle mgr = can_mgr_create(true);
+	if (!mgr)
 		return NULL;
-	}
 
-	// 创建读取线程
-	ret = pthread_create(&handle->thread, NULL, can_read_thread_func, handle);
-	if (ret != 0) {
-		LOG_E("Create read thread failed: %s", strerror(ret));
-		cleanup(handle, socket_fd);
-		shutdown_can_interface(config);
+	can_handle handle = can_device_open(mgr, config);
+	if (!handle) {
+		can_mgr_destroy(mgr);
 		return NULL;
 	}
+	handle->own_mgr = true;
 
 	return handle;
 }
@@ -428,7 +1506,8 @@ can_handle can_device_init(const struct can_config *config)
 /**
  * @brief 关闭CAN设备
  *
- * 停止线程,释放所有资源.
+ * 退出管理器, 释放设备资源; 由 can_device_init 创建时同时停止读取线程
+ * 不能在该设备所属管理器的回调中调用
  *
  * @param handle CAN句柄
  */
@@ -437,58 +1516,336 @@ void can_device_close(can_handle handle)
 	if (!handle)
 		return;
 
-	// 发送停止信号
-	uint64_t u = 1;
-	if (write(handle->stop_fd, &u, sizeof(uint64_t)) < 0 && errno != EAGAIN)
-		LOG_E("Write stop signal failed: %s", strerror(errno));
+	can_mgr_handle mgr = handle->mgr;
+
+	mgr_detach(handle);
 
-	pthread_join(handle->thread, NULL);
-	close(handle->epfd);
-	close(handle->stop_fd);
+	// 读取线程/事件循环已不再访问该设备, 未发完的报文以失败回调
+	struct can_tx_done done[CAN_TX_QUEUE_LEN];
+	size_t done_num = 0;
+	pthread_mutex_lock(&handle->tx_lock);
+	for (int i = 0; i < CAN_TX_QUEUE_LEN; i++)
+		if (handle->tx_queue[i].used)
+			tx_finish(handle, &handle->tx_queue[i], false, done, &done_num);
+	pthread_mutex_unlock(&handle->tx_lock);
+	for (size_t i = 0; i < done_num; i++)
+		done[i].cb(false, done[i].arg);
+
+	close(handle->tx_fd);
+	close(handle->tx_timer_fd);
 	close(handle->socket_fd);
 	shutdown_can_interface(handle->config);
 
+	bool own_mgr = handle->own_mgr;
+
+	pthread_mutex_destroy(&handle->stats_lock);
+	pthread_mutex_destroy(&handle->tx_lock);
 	free(handle);
+
+	if (own_mgr)
+		can_mgr_destroy(mgr);
 }
 
 /**
- * @brief CAN发送函数
+ * @brief 获取接口索引, 与接收信息中的 ifindex 对应
  *
- * @param handle can 句柄
+ * @param handle CAN句柄
+ * @return int 接口索引, 参数非法返回0
+ */
+int can_device_get_ifindex(can_handle handle)
+{
+	return handle ? handle->ifindex : 0;
+}
+
+/**
+ * @brief 创建多接口管理器, 所有接口共用一个epoll集合与链路通知套接字
+ *
+ * 网关桥接多路总线时, 多个接口共用一个读取线程, 或由主循环处理, 省去每个接口一个线程
+ *
+ * @param own_thread true: 创建一个读取线程处理所有接口;
+ *                   false: 由调用者将 can_mgr_get_fd 注册到事件循环, 可读时调用 can_mgr_poll
+ * @return can_mgr_handle 成功
+ * @return NULL 失败
+ */
+can_mgr_handle can_mgr_create(bool own_thread)
+{
+	can_mgr_handle mgr = calloc(1, sizeof(struct can_mgr));
+	if (!mgr) {
+		LOG_E("Malloc CAN manager failed");
+		return NULL;
+	}
+
+	mgr->own_thread = own_thread;
+	pthread_mutex_init(&mgr->lock, NULL);
+
+	mgr->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (mgr->epfd < 0) {
+		LOG_E("Create epoll failed: %s", strerror(errno));
+		goto err_free_mgr;
+	}
+
+	// 订阅链路通知, bus-off与恢复在处理事件时完成
+	mgr->nl_fd = can_link_monitor_open();
+	if (mgr->nl_fd < 0 || !mgr_watch(mgr, EPOLL_CTL_ADD, MGR_SLOT, mgr->nl_fd, EPOLLIN)) {
+		LOG_E("Subscribe link notify failed: %s", strerror(errno));
+		goto err_close_nl;
+	}
+
+	mgr->stop_fd = -1;
+	if (!own_thread)
+		return mgr;
+
+	mgr->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mgr->stop_fd < 0 || !mgr_watch(mgr, EPOLL_CTL_ADD, MGR_SLOT, mgr->stop_fd, EPOLLIN)) {
+		LOG_E("Create stop_fd failed: %s", strerror(errno));
+		goto err_close_stop;
+	}
+
+	int ret = pthread_create(&mgr->thread, NULL, can_read_thread_func, mgr);
+	if (ret != 0) {
+		LOG_E("Create read thread failed: %s", strerror(ret));
+		goto err_close_stop;
+	}
+
+	return mgr;
+
+err_close_stop:
+	if (mgr->stop_fd >= 0)
+		close(mgr->stop_fd);
+
+err_close_nl:
+	if (mgr->nl_fd >= 0)
+		close(mgr->nl_fd);
+	close(mgr->epfd);
+
+err_free_mgr:
+	pthread_mutex_destroy(&mgr->lock);
+	free(mgr);
+
+	return NULL;
+}
+
+/**
+ * @brief 销毁管理器, 停止读取线程; 需先关闭管理器中的所有接口
+ *
+ * @param mgr 管理器
+ */
+void can_mgr_destroy(can_mgr_handle mgr)
+{
+	if (!mgr)
+		return;
+
+	for (int i = 0; i < CAN_MGR_MAX_DEVS; i++)
+		if (mgr->devs[i])
+			LOG_W("CAN %s still open, close it before destroy manager",
+				mgr->devs[i]->config->can_dev_name);
+
+	if (mgr->own_thread) {
+		uint64_t u = 1;
+		if (write(mgr->stop_fd, &u, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+			LOG_E("Write stop signal failed: %s", strerror(errno));
+
+		pthread_join(mgr->thread, NULL);
+		close(mgr->stop_fd);
+	}
+
+	close(mgr->nl_fd);
+	close(mgr->epfd);
+	pthread_mutex_destroy(&mgr->lock);
+	free(mgr);
+}
+
+/**
+ * @brief 获取管理器的epoll描述符, 任一接口有事件时可读, 可注册到事件循环
+ *
+ * @param mgr 管理器
+ * @return int 描述符, 失败返回-1
+ */
+int can_mgr_get_fd(can_mgr_handle mgr)
+{
+	return mgr ? mgr->epfd : -1;
+}
+
+/**
+ * @brief 处理所有接口已就绪的事件, 不阻塞; 用于未创建读取线程的管理器
+ *
+ * 接收回调、发送完成回调与状态回调都在调用者线程中执行
+ *
+ * @param mgr 管理器
+ */
+void can_mgr_poll(can_mgr_handle mgr)
+{
+	if (!mgr || mgr->own_thread)
+		return;
+
+	struct epoll_event events[MGR_EVENTS];
+	int n;
+
+	// 一次最多取 MGR_EVENTS 个事件, 取满说明可能还有
+	do {
+		n = epoll_wait(mgr->epfd, events, MGR_EVENTS, 0);
+		if (n < 0) {
+			if (errno != EINTR)
+				LOG_E("epoll_wait failed: %s", strerror(errno));
+			return;
+		}
+		can_mgr_handle_events(mgr, events, n);
+	} while (n == MGR_EVENTS);
+}
+
+/**
+ * @brief 获取接收批量统计
+ *
+ * @param handle CAN句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零
+ * @return true 成功
+ * @return false 参数非法
+ */
+bool can_device_get_rx_stats(can_handle handle, struct can_rx_stats *out, bool reset)
+{
+	if (!handle || !out)
+		return false;
+
+	pthread_mutex_lock(&handle->stats_lock);
+	*out = handle->rx_stats;
+	if (reset)
+		memset(&handle->rx_stats, 0, sizeof(handle->rx_stats));
+	pthread_mutex_unlock(&handle->stats_lock);
+
+	return true;
+}
+
+/**
+ * @brief 获取发送统计
+ *
+ * @param handle CAN句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零, 当前排队数不清零
+ * @return true 成功
+ * @return false 参数非法
+ */
+bool can_device_get_tx_stats(can_handle handle, struct can_tx_stats *out, bool reset)
+{
+	if (!handle || !out)
+		return false;
+
+	pthread_mutex_lock(&handle->tx_lock);
+	*out = handle->tx_stats;
+	if (reset) {
+		uint32_t queued = handle->tx_stats.queued;
+		memset(&handle->tx_stats, 0, sizeof(handle->tx_stats));
+		handle->tx_stats.queued = queued;
+	}
+	pthread_mutex_unlock(&handle->tx_lock);
+
+	return true;
+}
+
+/**
+ * @brief 获取链路状态统计
+ *
+ * @param handle CAN句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零计数, 当前状态不清零
+ * @return true 成功
+ * @return false 参数非法
+ */
+bool can_device_get_link_stats(can_handle handle, struct can_link_stats *out, bool reset)
+{
+	if (!handle || !out)
+		return false;
+
+	pthread_mutex_lock(&handle->stats_lock);
+	*out = handle->link;
+	if (reset) {
+		handle->link.bus_off = 0;
+		handle->link.restarts = 0;
+		handle->link.link_events = 0;
+	}
+	pthread_mutex_unlock(&handle->stats_lock);
+
+	return true;
+}
+
+/**
+ * @brief CAN异步发送, 数据按8字节(CAN FD 64字节)拆分为多帧作为一个报文入队
+ *
+ * @param handle CAN句柄
+ * @param can_id CAN ID (11/29 bit, 扩展帧需带 CAN_EFF_FLAG)
  * @param data 数据缓冲
- * @param len 数据长度
- * @return true 发送成功
- * @return false 发送失败
+ * @param len 数据长度 1 ~ CAN_TX_MSG_FRAMES * CAN_MAX_DLEN (CAN FD 为 CANFD_MAX_DLEN)
+ * @param cb 发送完成回调 可为NULL
+ * @param arg 回调参数
+ * @return true 已入队
+ * @return false 参数非法或发送队列满
  */
-bool can_device_write(can_handle handle, uint8_t *data, size_t len)
+bool can_device_send(can_handle handle, uint32_t can_id, const uint8_t *data, size_t len,
+	can_tx_done_cb cb, void *arg)
 {
 	if (!handle || !data || len == 0) {
 		LOG_E("Invalid parameters: g_can_dev=%p, data=%p, len=%zu", handle, data, len);
 		return false;
 	}
 
-	struct can_frame frame;
-	size_t remaining = len;
-	size_t offset = 0;
+	size_t dlen = handle->max_dlen;
+	size_t num = (len + dlen - 1) / dlen;
+	if (num > CAN_TX_MSG_FRAMES) {
+		LOG_E("CAN message length %zu exceeds maximum %zu", len, CAN_TX_MSG_FRAMES * dlen);
+		return false;
+	}
 
-	// 逐帧发送
-	while (remaining > 0) {
-		size_t chunk_size = remaining > CAN_MAX_DLEN ? CAN_MAX_DLEN : remaining;
+	pthread_mutex_lock(&handle->tx_lock);
 
-		if (!make_one_can_frame(handle, &frame, data + offset, chunk_size)) {
-			LOG_E("Failed to construct CAN frame");
-			return false;
-		}
+	struct can_tx_msg *msg = NULL;
+	for (int i = 0; i < CAN_TX_QUEUE_LEN && !msg; i++)
+		if (!handle->tx_queue[i].used)
+			msg = &handle->tx_queue[i];
 
-		int nbytes = write(handle->socket_fd, &frame, sizeof(struct can_frame));
-		if (nbytes != sizeof(struct can_frame)) {
-			LOG_E("Failed to write CAN frame: %s", strerror(errno));
-			return false;
-		}
+	if (!msg) {
+		handle->tx_stats.overruns++;
+		pthread_mutex_unlock(&handle->tx_lock);
+		LOG_W("CAN tx queue full, drop message id 0x%x", can_id);
+		return false;
+	}
 
-		remaining -= chunk_size;
-		offset += chunk_size;
+	// 逐帧构造, 最后一帧不足部分补零
+	for (size_t i = 0, offset = 0; i < num; i++, offset += dlen) {
+		size_t chunk_size = len - offset > dlen ? dlen : len - offset;
+		make_one_can_frame(handle, can_id, &msg->frames[i], data + offset, chunk_size);
 	}
 
+	msg->num = num;
+	msg->sent = 0;
+	msg->seq = handle->tx_seq++;
+	msg->cb = cb;
+	msg->arg = arg;
+	msg->used = true;
+	handle->tx_stats.queued++;
+
+	pthread_mutex_unlock(&handle->tx_lock);
+
+	// 通知读取线程发送
+	uint64_t u = 1;
+	if (write(handle->tx_fd, &u, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+		LOG_E("Write tx notify failed: %s", strerror(errno));
+
 	return true;
 }
+
+/**
+ * @brief CAN发送函数, 使用配置的CAN ID异步发送
+ *
+ * @param handle can 句柄
+ * @param data 数据缓冲
+ * @param len 数据长度
+ * @return true 已入队
+ * @return false 参数非法或发送队列满
+ */
+bool can_device_write(can_handle handle, uint8_t *data, size_t len)
+{
+	if (!handle)
+		return false;
+
+	return can_device_send(handle, handle->config->can_id, data, len, NULL, NULL);
+}
@@ -0,0 +1,666 @@
+/**
+ * @file can_dispatch.c
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief CAN ID 分发表
+ * @version 1.0
+ * @date 2025-01-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "utils/logger.h"
+
+#include "app/can_dispatch.h"
+
+#define RING_MASK (CAN_DISPATCH_RING_LEN - 1)
+#define BUCKET_MASK (CAN_DISPATCH_EXT_BUCKETS - 1)
+#define SAMPLE_BATCH (32) // 时序样本攒够后加锁一次写入统计
+
+// 交付延时分布桶上界(us), 最后一个桶收纳更大的值
+static const uint32_t m_lat_bounds_us[CAN_DISPATCH_LAT_BUCKETS - 1] = {
+	100, 200, 500, 1000, 2000, 5000, 10000,
+};
+
+// 一个接口上某个CAN ID的时序状态, 不同总线上的同一ID分开统计
+struct timing_state {
+	bool used;					 // 已分配给接口
+	int ifindex;				 // 接口索引
+	struct can_id_timing timing; // 时序统计
+	uint64_t last_ns;			 // 上一帧的到达时刻
+	uint64_t last_gap_ns;		 // 上一个到达间隔
+	uint64_t jitter_ns;			 // 到达抖动估计
+};
+
+// 注册项, 注册后除时序统计外不再修改, 销毁时释放
+struct dispatch_entry {
+	uint32_t can_id;			 // CAN ID, 扩展帧带 CAN_EFF_FLAG
+	can_id_handler f_handle;	 // 处理函数
+	void *arg;					 // 处理函数参数
+	enum can_dispatch_mode mode; // 执行位置
+	struct dispatch_entry *next; // 同一哈希桶的下一项
+
+	// 按接口的时序状态, 受 stats_lock 保护
+	struct timing_state timing[CAN_MGR_MAX_DEVS];
+};
+
+// 环形队列中的延后帧
+struct dispatch_slot {
+	struct dispatch_entry *entry; // 处理函数
+	struct canfd_frame frame;	  // 帧拷贝
+	struct can_rx_info info;	  // 接收信息
+};
+
+// 待写入统计的时序样本
+struct timing_sample {
+	struct dispatch_entry *entry; // 注册项
+	int ifindex;				  // 接收接口
+	uint64_t arrival_ns;		  // 到达时刻, 0代表不记录到达间隔
+	uint64_t lat_ns;			  // 交付延时
+	bool delivered;				  // 已交付, 记录交付延时
+};
+
+struct can_dispatch {
+	struct dispatch_entry *std_table[CAN_SFF_MASK + 1];			  // 标准帧, 按ID直接索引
+	struct dispatch_entry *ext_buckets[CAN_DISPATCH_EXT_BUCKETS]; // 扩展帧哈希桶
+
+	struct dispatch_slot ring[CAN_DISPATCH_RING_LEN]; // 延后处理环形队列
+	atomic_size_t head;								  // 消费位置, 只由主循环修改
+	atomic_size_t tail;								  // 生产位置, 只由读取线程修改
+	atomic_flag producing;							  // 正在分发, 用于拒绝并发的生产者
+	int event_fd;									  // 入队通知
+
+	struct can_dispatch_stats stats; // 分发统计
+	pthread_mutex_t stats_lock;		 // 统计锁, 每批/每次执行加锁一次
+};
+
+/**
+ * @brief 扩展帧ID哈希
+ *
+ * @param can_id 29位ID
+ * @return size_t 桶下标
+ */
+static size_t ext_hash(uint32_t can_id)
+{
+	return ((can_id * 0x9E3779B1U) >> 16) & BUCKET_MASK;
+}
+
+/**
+ * @brief 查找帧的处理函数, 标准帧O(1)直接索引, 扩展帧哈希后在桶内查找
+ *
+ * @param handle 分发表句柄
+ * @param can_id 帧的CAN ID
+ * @return struct dispatch_entry* 注册项, NULL代表未注册
+ */
+static struct dispatch_entry *lookup(can_dispatch_handle handle, uint32_t can_id)
+{
+	if (can_id & CAN_ERR_FLAG)
+		return NULL;
+
+	if (!(can_id & CAN_EFF_FLAG))
+		return handle->std_table[can_id & CAN_SFF_MASK];
+
+	uint32_t id = can_id & CAN_EFF_MASK;
+	for (struct dispatch_entry *e = handle->ext_buckets[ext_hash(id)]; e; e = e->next)
+		if ((e->can_id & CAN_EFF_MASK) == id)
+			return e;
+
+	return NULL;
+}
+
+/**
+ * @brief 延后帧入队, 只在读取线程中调用
+ *
+ * @param handle 分发表句柄
+ * @param entry 注册项
+ * @param frame 帧
+ * @param info 接收信息
+ * @param depth 入队后的队列深度
+ * @return true 成功
+ * @return false 队列满
+ */
+static bool ring_push(can_dispatch_handle handle, struct dispatch_entry *entry,
+	const struct canfd_frame *frame, const struct can_rx_info *info, size_t *depth)
+{
+	size_t tail = atomic_load_explicit(&handle->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&handle->head, memory_order_acquire);
+
+	if (tail - head >= CAN_DISPATCH_RING_LEN)
+		return false;
+
+	struct dispatch_slot *slot = &handle->ring[tail & RING_MASK];
+	slot->entry = entry;
+	slot->frame = *frame;
+	slot->info = *info;
+
+	// 槽位写完后再发布, 消费者看到新的tail时数据已可见
+	atomic_store_explicit(&handle->tail, tail + 1, memory_order_release);
+	*depth = tail + 1 - head;
+
+	return true;
+}
+
+/**
+ * @brief 当前时刻, 与软件接收时间戳同为 CLOCK_REALTIME
+ *
+ * @return uint64_t 纳秒
+ */
+static uint64_t realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief 纳秒转微秒, 超出范围时取最大值
+ *
+ * @param ns 纳秒
+ * @return uint32_t 微秒
+ */
+static uint32_t ns_to_us(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+
+	return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+/**
+ * @brief 记录一次交付延时
+ *
+ * @param t 时序统计
+ * @param us 交付延时
+ */
+static void latency_record(struct can_id_timing *t, uint32_t us)
+{
+	size_t i = 0;
+
+	while (i < CAN_DISPATCH_LAT_BUCKETS - 1 && us > m_lat_bounds_us[i])
+		i++;
+	t->buckets[i]++;
+
+	if (!t->count || us < t->min_us)
+		t->min_us = us;
+	if (us > t->max_us)
+		t->max_us = us;
+	t->sum_us += us;
+	t->count++;
+}
+
+/**
+ * @brief 查找注册项在某个接口上的时序状态
+ *
+ * @param e 注册项
+ * @param ifindex 接口索引
+ * @param create 不存在时是否分配
+ * @return struct timing_state* 时序状态, NULL代表不存在或已分配满
+ */
+static struct timing_state *timing_find(struct dispatch_entry *e, int ifindex, bool create)
+{
+	struct timing_state *free_ts = NULL;
+
+	for (size_t i = 0; i < CAN_MGR_MAX_DEVS; i++) {
+		struct timing_state *ts = &e->timing[i];
+		if (ts->used && ts->ifindex == ifindex)
+			return ts;
+		if (!ts->used && !free_ts)
+			free_ts = ts;
+	}
+
+	if (!create || !free_ts)
+		return NULL;
+
+	free_ts->used = true;
+	free_ts->ifindex = ifindex;
+
+	return free_ts;
+}
+
+/**
+ * @brief 记录一次到达, 更新到达间隔与抖动
+ *
+ * @param e 时序状态
+ * @param arrival_ns 到达时刻
+ */
+static void arrival_record(struct timing_state *e, uint64_t arrival_ns)
+{
+	uint64_t last = e->last_ns;
+
+	// 同一时刻(如无内核时间戳时同批的帧)不计间隔
+	if (arrival_ns == last)
+		return;
+
+	e->last_ns = arrival_ns;
+
+	// 首帧或时钟回退(如硬件时间戳与软件时间戳切换)时重新开始
+	if (!last || arrival_ns < last) {
+		e->last_gap_ns = 0;
+		return;
+	}
+
+	uint64_t gap = arrival_ns - last;
+	struct can_id_timing *t = &e->timing;
+	uint32_t gap_us = ns_to_us(gap);
+
+	if (!t->gaps || gap_us < t->gap_min_us)
+		t->gap_min_us = gap_us;
+	if (gap_us > t->gap_max_us)
+		t->gap_max_us = gap_us;
+	t->gap_sum_us += gap_us;
+	t->gaps++;
+
+	// J += (|D| - J) / 16
+	if (e->last_gap_ns) {
+		uint64_t d = gap > e->last_gap_ns ? gap - e->last_gap_ns : e->last_gap_ns - gap;
+		e->jitter_ns = e->jitter_ns + d / 16 - e->jitter_ns / 16;
+	}
+	e->last_gap_ns = gap;
+}
+
+/**
+ * @brief 样本写入统计, 加锁一次
+ *
+ * @param handle 分发表句柄
+ * @param samples 样本数组
+ * @param num 样本数量
+ */
+static void timing_flush(
+	can_dispatch_handle handle, const struct timing_sample *samples, size_t num)
+{
+	if (!num)
+		return;
+
+	pthread_mutex_lock(&handle->stats_lock);
+	for (size_t i = 0; i < num; i++) {
+		const struct timing_sample *s = &samples[i];
+		struct timing_state *ts = timing_find(s->entry, s->ifindex, true);
+		if (!ts)
+			continue;
+		if (s->arrival_ns)
+			arrival_record(ts, s->arrival_ns);
+		if (s->delivered)
+			latency_record(&ts->timing, ns_to_us(s->lat_ns));
+	}
+	pthread_mutex_unlock(&handle->stats_lock);
+}
+
+/**
+ * @brief 交付延时, 时钟被调回时记为0
+ *
+ * @param info 接收信息
+ * @return uint64_t 纳秒
+ */
+static uint64_t delivery_ns(const struct can_rx_info *info)
+{
+	uint64_t now = realtime_ns();
+
+	return now > info->sw_ns ? now - info->sw_ns : 0;
+}
+
+/**
+ * @brief 通知主循环有延后帧
+ *
+ * @param handle 分发表句柄
+ */
+static void notify(can_dispatch_handle handle)
+{
+	uint64_t u = 1;
+	if (write(handle->event_fd, &u, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+		LOG_E("Write dispatch notify failed: %s", strerror(errno));
+}
+
+/**
+ * @brief 创建分发表
+ *
+ * @return can_dispatch_handle 成功
+ * @return NULL 失败
+ */
+can_dispatch_handle can_dispatch_create(void)
+{
+	can_dispatch_handle handle = calloc(1, sizeof(struct can_dispatch));
+	if (!handle) {
+		LOG_E("Malloc CAN dispatch failed");
+		return NULL;
+	}
+
+	handle->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (handle->event_fd < 0) {
+		LOG_E("Create dispatch eventfd failed: %s", strerror(errno));
+		goto err_free_handle;
+	}
+
+	atomic_init(&handle->head, 0);
+	atomic_init(&handle->tail, 0);
+	atomic_flag_clear(&handle->producing);
+	pthread_mutex_init(&handle->stats_lock, NULL);
+
+	return handle;
+
+err_free_handle:
+	free(handle);
+
+	return NULL;
+}
+
+/**
+ * @brief 销毁分发表, 未处理的延后帧直接丢弃
+ *
+ * @param handle 分发表句柄
+ */
+void can_dispatch_destroy(can_dispatch_handle handle)
+{
+	if (!handle)
+		return;
+
+	// 标准帧注册项只在直接索引表中出现一次
+	for (size_t i = 0; i <= CAN_SFF_MASK; i++)
+		free(handle->std_table[i]);
+
+	for (size_t i = 0; i < CAN_DISPATCH_EXT_BUCKETS; i++) {
+		struct dispatch_entry *e = handle->ext_buckets[i];
+		while (e) {
+			struct dispatch_entry *next = e->next;
+			free(e);
+			e = next;
+		}
+	}
+
+	close(handle->event_fd);
+	pthread_mutex_destroy(&handle->stats_lock);
+	free(handle);
+}
+
+/**
+ * @brief 注册CAN ID的处理函数, 同一ID重复注册时覆盖
+ *
+ * 标准帧直接按ID索引, 扩展帧按哈希查找; 需在开始分发(CAN设备初始化)前完成注册
+ *
+ * @param handle 分发表句柄
+ * @param can_id CAN ID, 扩展帧需带 CAN_EFF_FLAG
+ * @param f_handle 处理函数
+ * @param arg 处理函数参数
+ * @param mode 执行位置
+ * @return true 成功
+ * @return false 参数非法或内存不足
+ */
+bool can_dispatch_register(can_dispatch_handle handle, uint32_t can_id, can_id_handler f_handle,
+	void *arg, enum can_dispatch_mode mode)
+{
+	if (!handle || !f_handle || (can_id & CAN_ERR_FLAG)) {
+		LOG_E("Invalid dispatch register args");
+		return false;
+	}
+
+	bool is_ext = can_id & CAN_EFF_FLAG;
+	uint32_t id = can_id & (is_ext ? CAN_EFF_MASK : CAN_SFF_MASK);
+
+	struct dispatch_entry **slot;
+	if (is_ext) {
+		slot = &handle->ext_buckets[ext_hash(id)];
+		while (*slot && ((*slot)->can_id & CAN_EFF_MASK) != id)
+			slot = &(*slot)->next;
+	} else {
+		slot = &handle->std_table[id];
+	}
+
+	struct dispatch_entry *e = *slot;
+	if (!e) {
+		e = calloc(1, sizeof(struct dispatch_entry));
+		if (!e) {
+			LOG_E("Malloc dispatch entry failed");
+			return false;
+		}
+		*slot = e;
+	}
+
+	e->can_id = is_ext ? (id | CAN_EFF_FLAG) : id;
+	e->f_handle = f_handle;
+	e->arg = arg;
+	e->mode = mode;
+
+	return true;
+}
+
+/**
+ * @brief 分发一批帧, 在CAN读取线程中调用, 可直接作为批量接收回调的实现
+ *
+ * 延后处理的帧进入无锁环形队列(单生产者单消费者), 队列满时丢弃并计数, 不阻塞读取线程
+ * 一个分发表只能由一个管理器(一个读取线程)分发, 其他线程同时分发的整批帧被丢弃并计数
+ * 到达间隔优先使用硬件时间戳, 交付延时使用软件时间戳
+ *
+ * @param handle 分发表句柄
+ * @param frames 帧数组
+ * @param info 与帧数组一一对应的接收信息
+ * @param num 帧数量
+ */
+void can_dispatch_frames(can_dispatch_handle handle, const struct canfd_frame *frames,
+	const struct can_rx_info *info, size_t num)
+{
+	if (!handle || !frames || !info)
+		return;
+
+	// 环形队列只允许一个生产者
+	if (atomic_flag_test_and_set_explicit(&handle->producing, memory_order_acquire)) {
+		pthread_mutex_lock(&handle->stats_lock);
+		handle->stats.busy_drops += num;
+		pthread_mutex_unlock(&handle->stats_lock);
+		LOG_E("CAN dispatch used by more than one reader thread, drop %zu frames", num);
+		return;
+	}
+
+	uint32_t inline_num = 0, deferred = 0, overruns = 0, unhandled = 0;
+	size_t depth = 0, max_depth = 0;
+	struct timing_sample samples[SAMPLE_BATCH];
+	size_t sample_num = 0;
+
+	for (size_t i = 0; i < num; i++) {
+		struct dispatch_entry *e = lookup(handle, frames[i].can_id);
+		if (!e) {
+			unhandled++;
+			continue;
+		}
+
+		struct timing_sample *s = &samples[sample_num];
+		s->entry = e;
+		s->ifindex = info[i].ifindex;
+		s->arrival_ns = info[i].hw_ns ? info[i].hw_ns : info[i].sw_ns;
+		s->delivered = false;
+
+		if (e->mode == CAN_DISPATCH_INLINE) {
+			s->lat_ns = delivery_ns(&info[i]);
+			s->delivered = true;
+			e->f_handle(&frames[i], &info[i], e->arg);
+			inline_num++;
+		} else if (ring_push(handle, e, &frames[i], &info[i], &depth)) {
+			deferred++;
+			if (depth > max_depth)
+				max_depth = depth;
+		} else {
+			overruns++;
+		}
+
+		if (++sample_num == SAMPLE_BATCH) {
+			timing_flush(handle, samples, sample_num);
+			sample_num = 0;
+		}
+	}
+
+	// 每批只通知一次
+	if (deferred)
+		notify(handle);
+
+	timing_flush(handle, samples, sample_num);
+
+	atomic_flag_clear_explicit(&handle->producing, memory_order_release);
+
+	pthread_mutex_lock(&handle->stats_lock);
+	struct can_dispatch_stats *st = &handle->stats;
+	st->inline_frames += inline_num;
+	st->deferred_frames += deferred;
+	st->ring_overruns += overruns;
+	st->unhandled += unhandled;
+	if (max_depth > st->ring_max)
+		st->ring_max = max_depth;
+	pthread_mutex_unlock(&handle->stats_lock);
+
+	if (overruns)
+		LOG_W("CAN dispatch ring full, drop %u frames", overruns);
+}
+
+/**
+ * @brief 在主循环中执行延后处理的帧
+ *
+ * @param handle 分发表句柄
+ * @param max 最多处理的帧数, 0代表处理到队列为空
+ * @return size_t 处理的帧数
+ */
+size_t can_dispatch_run(can_dispatch_handle handle, size_t max)
+{
+	if (!handle)
+		return 0;
+
+	uint64_t u;
+	if (read(handle->event_fd, &u, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+		LOG_E("Read dispatch notify failed: %s", strerror(errno));
+
+	size_t head = atomic_load_explicit(&handle->head, memory_order_relaxed);
+	size_t done = 0;
+	struct timing_sample samples[SAMPLE_BATCH];
+	size_t sample_num = 0;
+
+	while (!max || done < max) {
+		size_t tail = atomic_load_explicit(&handle->tail, memory_order_acquire);
+		if (head == tail)
+			break;
+
+		// 处理完再释放槽位, 回调期间帧不会被覆盖
+		struct dispatch_slot *slot = &handle->ring[head & RING_MASK];
+		samples[sample_num] = (struct timing_sample){
+			.entry = slot->entry,
+			.ifindex = slot->info.ifindex,
+			.lat_ns = delivery_ns(&slot->info),
+			.delivered = true,
+		};
+		slot->entry->f_handle(&slot->frame, &slot->info, slot->entry->arg);
+		atomic_store_explicit(&handle->head, ++head, memory_order_release);
+		done++;
+
+		if (++sample_num == SAMPLE_BATCH) {
+			timing_flush(handle, samples, sample_num);
+			sample_num = 0;
+		}
+	}
+
+	timing_flush(handle, samples, sample_num);
+
+	// 本次未处理完, 保留通知
+	if (head != atomic_load_explicit(&handle->tail, memory_order_acquire))
+		notify(handle);
+
+	if (done) {
+		pthread_mutex_lock(&handle->stats_lock);
+		handle->stats.deferred_runs += done;
+		pthread_mutex_unlock(&handle->stats_lock);
+	}
+
+	return done;
+}
+
+/**
+ * @brief 获取延后处理通知描述符, 有帧入队时可读, 可注册到事件循环
+ *
+ * @param handle 分发表句柄
+ * @return int 描述符, 失败返回-1
+ */
+int can_dispatch_get_fd(can_dispatch_handle handle)
+{
+	return handle ? handle->event_fd : -1;
+}
+
+/**
+ * @brief 获取分发统计
+ *
+ * @param handle 分发表句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零
+ * @return true 成功
+ * @return false 参数非法
+ */
+bool can_dispatch_get_stats(can_dispatch_handle handle, struct can_dispatch_stats *out, bool reset)
+{
+	if (!handle || !out)
+		return false;
+
+	pthread_mutex_lock(&handle->stats_lock);
+	*out = handle->stats;
+	if (reset)
+		memset(&handle->stats, 0, sizeof(handle->stats));
+	pthread_mutex_unlock(&handle->stats_lock);
+
+	return true;
+}
+
+/**
+ * @brief 获取某个接口上CAN ID的交付延时与到达间隔统计
+ *
+ * @param handle 分发表句柄
+ * @param ifindex 接口索引, 与接收信息中的 ifindex 对应
+ * @param can_id CAN ID, 扩展帧需带 CAN_EFF_FLAG
+ * @param out 输出统计, 该接口上还没有收到帧时全为0
+ * @param reset 读取后是否清零, 抖动为滑动估计, 不清零
+ * @return true 成功
+ * @return false 参数非法或ID未注册
+ */
+bool can_dispatch_get_timing(can_dispatch_handle handle, int ifindex, uint32_t can_id,
+	struct can_id_timing *out, bool reset)
+{
+	if (!handle || !out)
+		return false;
+
+	struct dispatch_entry *e = lookup(handle, can_id);
+	if (!e)
+		return false;
+
+	pthread_mutex_lock(&handle->stats_lock);
+	struct timing_state *ts = timing_find(e, ifindex, false);
+	if (ts) {
+		*out = ts->timing;
+		out->jitter_us = ns_to_us(ts->jitter_ns);
+		if (reset)
+			memset(&ts->timing, 0, sizeof(ts->timing));
+	} else {
+		memset(out, 0, sizeof(struct can_id_timing));
+	}
+	pthread_mutex_unlock(&handle->stats_lock);
+
+	return true;
+}
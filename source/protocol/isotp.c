@@ -0,0 +1,709 @@
+/**
+ * @file isotp.c
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief ISO-TP (ISO 15765-2) CAN多帧传输层
+ * @version 1.0
+ * @date 2025-01-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "utils/logger.h"
+
+#include "protocol/isotp.h"
+
+#define PCI_SF (0x0) // 单帧
+#define PCI_FF (0x1) // 首帧
+#define PCI_CF (0x2) // 连续帧
+#define PCI_FC (0x3) // 流控帧
+
+#define DEFAULT_TIMEOUT_MS (1000) // 默认 N_Bs / N_Cr 超时
+
+// 发送状态
+enum tx_state {
+	TX_IDLE,	// 空闲
+	TX_WAIT_FC,	// 等待流控帧
+	TX_SENDING,	// 发送连续帧
+};
+
+// 接收状态
+enum rx_state {
+	RX_IDLE,	  // 空闲
+	RX_RECEIVING, // 接收连续帧
+};
+
+// 释放锁后执行的回调
+struct pending_cb {
+	bool sent;			 // 需要发送结束回调
+	bool sent_ok;		 // 发送是否成功
+	const uint8_t *data; // 收到的报文, NULL代表无
+	size_t len;			 // 收到的报文长度
+};
+
+struct isotp {
+	const struct isotp_cfg *cfg;   // 通道配置
+	const struct isotp_opts *opts; // 帧收发接口
+	pthread_mutex_t lock;		   // 接收在CAN读取线程, 轮询在任务线程
+	size_t frame_len;			   // 帧长, 8或64
+	uint64_t timeout_us;		   // N_Bs / N_Cr 超时
+
+	enum tx_state tx_state;	 // 发送状态
+	const uint8_t *tx_data;	 // 发送中的报文, 不拷贝
+	size_t tx_len;			 // 报文长度
+	size_t tx_off;			 // 已提交的字节数
+	uint8_t tx_sn;			 // 下一连续帧序号
+	uint8_t tx_bs;			 // 对端块大小, 0代表不分块
+	uint8_t tx_bs_cnt;		 // 当前块已提交的帧数
+	uint8_t tx_wft;			 // 连续收到的等待流控帧数
+	uint32_t tx_st_us;		 // 对端要求的连续帧间隔
+	uint64_t tx_next_us;	 // 下一连续帧的最早提交时刻
+	uint64_t tx_deadline_us; // 等待流控帧的截止时刻
+
+	uint8_t tx_buf[ISOTP_CF_BATCH * ISOTP_CANFD_DL]; // 帧拼接缓冲
+
+	enum rx_state rx_state;	 // 接收状态
+	uint8_t *rx_buf;		 // 重组缓冲
+	size_t rx_size;			 // 重组缓冲大小
+	bool rx_buf_owned;		 // 重组缓冲由本模块申请
+	size_t rx_len;			 // 报文长度
+	size_t rx_off;			 // 已接收的字节数
+	uint8_t rx_sn;			 // 期望的连续帧序号
+	uint8_t rx_bs_cnt;		 // 当前块已接收的帧数
+	uint64_t rx_deadline_us; // 等待连续帧的截止时刻
+
+	struct isotp_stats stats; // 统计
+};
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief STmin编码转为微秒, 保留值按最大的127ms处理
+ *
+ * @param st_min STmin编码
+ * @return uint32_t 微秒
+ */
+static uint32_t st_min_to_us(uint8_t st_min)
+{
+	if (st_min <= 0x7F)
+		return st_min * 1000;
+	if (st_min >= 0xF1 && st_min <= 0xF9)
+		return (st_min - 0xF0) * 100;
+
+	return 0x7F * 1000;
+}
+
+/**
+ * @brief 计算实际发送的帧长, 填充部分为 ISOTP_PAD_BYTE
+ *
+ * CAN FD 超过8字节的帧必须是DLC可表示的长度: 12, 16, 20, 24, 32, 48, 64
+ *
+ * @param handle 通道句柄
+ * @param buf 帧缓冲, 按需填充
+ * @param n 有效长度
+ * @return size_t 帧长
+ */
+static size_t pad_frame(isotp_handle handle, uint8_t *buf, size_t n)
+{
+	static const uint8_t dlc_len[] = { 12, 16, 20, 24, 32, 48, 64 };
+	size_t len = n;
+
+	if (n > ISOTP_CAN_DL) {
+		for (size_t i = 0; i < sizeof(dlc_len); i++) {
+			if (n <= dlc_len[i]) {
+				len = dlc_len[i];
+				break;
+			}
+		}
+	} else if (handle->cfg->padding) {
+		len = ISOTP_CAN_DL;
+	}
+
+	memset(buf + n, ISOTP_PAD_BYTE, len - n);
+
+	return len;
+}
+
+/**
+ * @brief 发送流控帧
+ *
+ * @param handle 通道句柄
+ * @param flag 流控状态
+ */
+static void send_fc(isotp_handle handle, enum isotp_fc_flag flag)
+{
+	uint8_t buf[ISOTP_CAN_DL];
+
+	buf[0] = (PCI_FC << 4) | flag;
+	buf[1] = handle->cfg->block_size;
+	buf[2] = handle->cfg->st_min;
+
+	size_t len = pad_frame(handle, buf, 3);
+	if (!handle->opts->f_send(handle->cfg->tx_id, buf, len, handle->opts->arg))
+		LOG_W("ISO-TP 0x%x flow control send failed", handle->cfg->tx_id);
+}
+
+/**
+ * @brief 结束发送
+ *
+ * @param handle 通道句柄
+ * @param ok 是否成功
+ * @param pending 待执行回调
+ */
+static void tx_finish(isotp_handle handle, bool ok, struct pending_cb *pending)
+{
+	if (ok) {
+		handle->stats.tx_msgs++;
+		handle->stats.tx_bytes += handle->tx_len;
+	} else {
+		handle->stats.tx_aborts++;
+		LOG_W("ISO-TP 0x%x send aborted at %zu/%zu", handle->cfg->tx_id, handle->tx_off,
+			handle->tx_len);
+	}
+
+	handle->tx_state = TX_IDLE;
+	handle->tx_data = NULL;
+	pending->sent = true;
+	pending->sent_ok = ok;
+}
+
+/**
+ * @brief 中止接收
+ *
+ * @param handle 通道句柄
+ * @param reason 原因
+ */
+static void rx_abort(isotp_handle handle, const char *reason)
+{
+	handle->stats.rx_aborts++;
+	handle->rx_state = RX_IDLE;
+	LOG_W("ISO-TP 0x%x receive aborted at %zu/%zu: %s", handle->cfg->rx_id, handle->rx_off,
+		handle->rx_len, reason);
+}
+
+/**
+ * @brief 提交连续帧, STmin为0时一次拼接多帧提交, 直到块结束、报文结束或发送队列满
+ *
+ * @param handle 通道句柄
+ * @param pending 待执行回调
+ */
+static void tx_pump(isotp_handle handle, struct pending_cb *pending)
+{
+	size_t data_len = handle->frame_len - 1; // 连续帧有效载荷
+
+	while (handle->tx_state == TX_SENDING) {
+		uint64_t now = now_us();
+		if (handle->tx_st_us && now < handle->tx_next_us)
+			break;
+
+		size_t remain = handle->tx_len - handle->tx_off;
+		size_t n = (remain + data_len - 1) / data_len;
+		if (handle->tx_st_us)
+			n = 1;
+		if (n > ISOTP_CF_BATCH)
+			n = ISOTP_CF_BATCH;
+		if (handle->tx_bs && n > (size_t)(handle->tx_bs - handle->tx_bs_cnt))
+			n = handle->tx_bs - handle->tx_bs_cnt;
+
+		// 按帧长依次拼接, 只有报文的最后一帧可能不满
+		size_t total = 0, off = handle->tx_off;
+		uint8_t sn = handle->tx_sn;
+		for (size_t i = 0; i < n; i++) {
+			uint8_t *frame = handle->tx_buf + total;
+			size_t chunk = handle->tx_len - off > data_len ? data_len : handle->tx_len - off;
+
+			frame[0] = (PCI_CF << 4) | sn;
+			memcpy(frame + 1, handle->tx_data + off, chunk);
+			total += chunk < data_len ? pad_frame(handle, frame, chunk + 1) : handle->frame_len;
+			off += chunk;
+			sn = (sn + 1) & 0x0F;
+		}
+
+		if (!handle->opts->f_send(handle->cfg->tx_id, handle->tx_buf, total, handle->opts->arg)) {
+			handle->stats.tx_retries++;
+			break; // 发送队列满, 轮询时重试
+		}
+
+		handle->tx_off = off;
+		handle->tx_sn = sn;
+		handle->tx_bs_cnt += n;
+		handle->tx_next_us = now + handle->tx_st_us;
+
+		if (handle->tx_off == handle->tx_len) {
+			tx_finish(handle, true, pending);
+		} else if (handle->tx_bs && handle->tx_bs_cnt >= handle->tx_bs) {
+			handle->tx_state = TX_WAIT_FC;
+			handle->tx_deadline_us = now + handle->timeout_us;
+		}
+	}
+}
+
+/**
+ * @brief 处理流控帧
+ *
+ * @param handle 通道句柄
+ * @param data 帧数据
+ * @param len 帧长度
+ * @param pending 待执行回调
+ */
+static void on_fc(isotp_handle handle, const uint8_t *data, size_t len, struct pending_cb *pending)
+{
+	if (handle->tx_state != TX_WAIT_FC || len < 3)
+		return;
+
+	switch (data[0] & 0x0F) {
+	case ISOTP_FC_CTS:
+		handle->tx_bs = data[1];
+		handle->tx_st_us = st_min_to_us(data[2]);
+		handle->tx_bs_cnt = 0;
+		handle->tx_wft = 0;
+		handle->tx_next_us = 0;
+		handle->tx_state = TX_SENDING;
+		tx_pump(handle, pending);
+		break;
+
+	case ISOTP_FC_WAIT:
+		if (++handle->tx_wft > ISOTP_MAX_WFT)
+			tx_finish(handle, false, pending);
+		else
+			handle->tx_deadline_us = now_us() + handle->timeout_us;
+		break;
+
+	default: // 溢出或非法状态
+		tx_finish(handle, false, pending);
+		break;
+	}
+}
+
+/**
+ * @brief 处理单帧
+ *
+ * @param handle 通道句柄
+ * @param data 帧数据
+ * @param len 帧长度
+ * @param pending 待执行回调
+ */
+static void on_sf(isotp_handle handle, const uint8_t *data, size_t len, struct pending_cb *pending)
+{
+	size_t dl = data[0] & 0x0F;
+	size_t off = 1;
+
+	// CAN FD 超过8字节的单帧, 长度在第二个字节
+	if (!dl && len > ISOTP_CAN_DL) {
+		dl = data[1];
+		off = 2;
+	}
+
+	if (!dl || off + dl > len)
+		return;
+
+	// 新的单帧中止未完成的接收
+	if (handle->rx_state == RX_RECEIVING)
+		rx_abort(handle, "interrupted by single frame");
+
+	handle->stats.rx_msgs++;
+	handle->stats.rx_bytes += dl;
+	pending->data = data + off;
+	pending->len = dl;
+}
+
+/**
+ * @brief 处理首帧, 报文超过重组缓冲时回复溢出
+ *
+ * @param handle 通道句柄
+ * @param data 帧数据
+ * @param len 帧长度
+ */
+static void on_ff(isotp_handle handle, const uint8_t *data, size_t len)
+{
+	size_t dl = ((size_t)(data[0] & 0x0F) << 8) | data[1];
+	size_t off = 2;
+
+	// 长度扩展, 32位长度
+	if (!dl) {
+		if (len < 7)
+			return;
+		dl = ((size_t)data[2] << 24) | ((size_t)data[3] << 16) | ((size_t)data[4] << 8) | data[5];
+		off = 6;
+	}
+
+	if (len <= off || dl <= len - off)
+		return;
+
+	if (handle->rx_state == RX_RECEIVING)
+		rx_abort(handle, "interrupted by first frame");
+
+	if (dl > handle->rx_size) {
+		handle->stats.rx_aborts++;
+		LOG_W("ISO-TP 0x%x message %zu exceeds buffer %zu", handle->cfg->rx_id, dl,
+			handle->rx_size);
+		send_fc(handle, ISOTP_FC_OVFLW);
+		return;
+	}
+
+	memcpy(handle->rx_buf, data + off, len - off);
+	handle->rx_len = dl;
+	handle->rx_off = len - off;
+	handle->rx_sn = 1;
+	handle->rx_bs_cnt = 0;
+	handle->rx_state = RX_RECEIVING;
+	handle->rx_deadline_us = now_us() + handle->timeout_us;
+
+	send_fc(handle, ISOTP_FC_CTS);
+}
+
+/**
+ * @brief 处理连续帧, 数据直接写入重组缓冲
+ *
+ * @param handle 通道句柄
+ * @param data 帧数据
+ * @param len 帧长度
+ * @param pending 待执行回调
+ */
+static void on_cf(isotp_handle handle, const uint8_t *data, size_t len, struct pending_cb *pending)
+{
+	if (handle->rx_state != RX_RECEIVING)
+		return;
+
+	if ((data[0] & 0x0F) != handle->rx_sn) {
+		rx_abort(handle, "wrong sequence number");
+		return;
+	}
+
+	size_t chunk = len - 1;
+	if (chunk > handle->rx_len - handle->rx_off)
+		chunk = handle->rx_len - handle->rx_off;
+
+	memcpy(handle->rx_buf + handle->rx_off, data + 1, chunk);
+	handle->rx_off += chunk;
+	handle->rx_sn = (handle->rx_sn + 1) & 0x0F;
+	handle->rx_deadline_us = now_us() + handle->timeout_us;
+
+	if (handle->rx_off == handle->rx_len) {
+		handle->rx_state = RX_IDLE;
+		handle->stats.rx_msgs++;
+		handle->stats.rx_bytes += handle->rx_len;
+		pending->data = handle->rx_buf;
+		pending->len = handle->rx_len;
+		return;
+	}
+
+	// 一块收完, 允许对端继续发送下一块
+	if (handle->cfg->block_size && ++handle->rx_bs_cnt >= handle->cfg->block_size) {
+		handle->rx_bs_cnt = 0;
+		send_fc(handle, ISOTP_FC_CTS);
+	}
+}
+
+/**
+ * @brief 释放锁后执行回调, 回调中可以再次发送
+ *
+ * @param handle 通道句柄
+ * @param pending 待执行回调
+ */
+static void run_pending(isotp_handle handle, const struct pending_cb *pending)
+{
+	const struct isotp_cfg *cfg = handle->cfg;
+
+	if (pending->data && cfg->on_recv)
+		cfg->on_recv(pending->data, pending->len, cfg->cb_arg);
+
+	if (pending->sent && cfg->on_sent)
+		cfg->on_sent(pending->sent_ok, cfg->cb_arg);
+}
+
+/**
+ * @brief 创建ISO-TP通道
+ *
+ * @param cfg 通道配置, 需在通道销毁前保持有效
+ * @param opts 帧收发接口, 需在通道销毁前保持有效
+ * @return isotp_handle 成功
+ * @return NULL 失败
+ */
+isotp_handle isotp_create(const struct isotp_cfg *cfg, const struct isotp_opts *opts)
+{
+	if (!cfg || !opts || !opts->f_send) {
+		LOG_E("Invalid ISO-TP config");
+		return NULL;
+	}
+
+	isotp_handle handle = calloc(1, sizeof(struct isotp));
+	if (!handle) {
+		LOG_E("Malloc ISO-TP failed");
+		return NULL;
+	}
+
+	handle->cfg = cfg;
+	handle->opts = opts;
+	handle->frame_len = cfg->fd ? ISOTP_CANFD_DL : ISOTP_CAN_DL;
+	handle->timeout_us = (uint64_t)(cfg->timeout_ms ? cfg->timeout_ms : DEFAULT_TIMEOUT_MS) * 1000;
+
+	if (cfg->rx_buf && cfg->rx_buf_size) {
+		handle->rx_buf = cfg->rx_buf;
+		handle->rx_size = cfg->rx_buf_size;
+	} else {
+		handle->rx_buf = malloc(ISOTP_MAX_LEN);
+		if (!handle->rx_buf) {
+			LOG_E("Malloc ISO-TP rx buffer failed");
+			goto err_free_handle;
+		}
+		handle->rx_size = ISOTP_MAX_LEN;
+		handle->rx_buf_owned = true;
+	}
+
+	pthread_mutex_init(&handle->lock, NULL);
+
+	return handle;
+
+err_free_handle:
+	free(handle);
+
+	return NULL;
+}
+
+/**
+ * @brief 销毁通道, 未完成的发送以失败回调
+ *
+ * @param handle 通道句柄
+ */
+void isotp_destroy(isotp_handle handle)
+{
+	if (!handle)
+		return;
+
+	struct pending_cb pending = { 0 };
+	if (handle->tx_state != TX_IDLE)
+		tx_finish(handle, false, &pending);
+	run_pending(handle, &pending);
+
+	if (handle->rx_buf_owned)
+		free(handle->rx_buf);
+	pthread_mutex_destroy(&handle->lock);
+	free(handle);
+}
+
+/**
+ * @brief 发送一个报文, 不拷贝数据, 发送结束回调之前调用者需保持数据有效
+ *
+ * 单帧报文提交后在返回前回调 on_sent
+ *
+ * @param handle 通道句柄
+ * @param data 报文数据
+ * @param len 报文长度 1 ~ UINT32_MAX, 超过 ISOTP_MAX_LEN 时使用长度扩展
+ * @return true 已开始发送
+ * @return false 参数非法, 上一个报文未发完或发送队列满
+ */
+bool isotp_send(isotp_handle handle, const uint8_t *data, size_t len)
+{
+	if (!handle || !data || !len || (uint64_t)len > UINT32_MAX)
+		return false;
+
+	struct pending_cb pending = { 0 };
+	uint8_t *buf = handle->tx_buf;
+	size_t frame_len = handle->frame_len;
+	size_t sf_max = frame_len == ISOTP_CAN_DL ? 7 : frame_len - 2;
+	bool ret = false;
+
+	pthread_mutex_lock(&handle->lock);
+
+	if (handle->tx_state != TX_IDLE)
+		goto out;
+
+	handle->tx_data = data;
+	handle->tx_len = len;
+
+	if (len <= sf_max) {
+		// 单帧, 超过7字节时(仅CAN FD)长度放在第二个字节
+		size_t off = len <= 7 ? 1 : 2;
+		buf[0] = (PCI_SF << 4) | (off == 1 ? len : 0);
+		buf[1] = len;
+		memcpy(buf + off, data, len);
+
+		ret = handle->opts->f_send(
+			handle->cfg->tx_id, buf, pad_frame(handle, buf, off + len), handle->opts->arg);
+		if (ret) {
+			handle->tx_off = len;
+			tx_finish(handle, true, &pending);
+		}
+		goto out;
+	}
+
+	// 首帧, 超过12位长度时使用32位长度扩展
+	size_t off;
+	if (len <= ISOTP_MAX_LEN) {
+		buf[0] = (PCI_FF << 4) | (len >> 8);
+		buf[1] = len & 0xFF;
+		off = 2;
+	} else {
+		buf[0] = PCI_FF << 4;
+		buf[1] = 0;
+		buf[2] = len >> 24;
+		buf[3] = len >> 16;
+		buf[4] = len >> 8;
+		buf[5] = len;
+		off = 6;
+	}
+	memcpy(buf + off, data, frame_len - off);
+
+	ret = handle->opts->f_send(handle->cfg->tx_id, buf, frame_len, handle->opts->arg);
+	if (!ret) {
+		handle->stats.tx_retries++;
+		goto out;
+	}
+
+	handle->tx_off = frame_len - off;
+	handle->tx_sn = 1;
+	handle->tx_wft = 0;
+	handle->tx_state = TX_WAIT_FC;
+	handle->tx_deadline_us = now_us() + handle->timeout_us;
+
+out:
+	if (!ret && handle->tx_state == TX_IDLE)
+		handle->tx_data = NULL;
+	pthread_mutex_unlock(&handle->lock);
+
+	run_pending(handle, &pending);
+
+	return ret;
+}
+
+/**
+ * @brief 输入一帧接收到的CAN帧
+ *
+ * 收到流控帧且允许发送时, 直接在调用线程中提交连续帧
+ *
+ * @param handle 通道句柄
+ * @param can_id CAN ID
+ * @param data 帧数据
+ * @param len 帧长度
+ * @return true 属于本通道
+ * @return false 不属于本通道
+ */
+bool isotp_on_frame(isotp_handle handle, uint32_t can_id, const uint8_t *data, size_t len)
+{
+	if (!handle || !data || can_id != handle->cfg->rx_id)
+		return false;
+
+	if (len < 2)
+		return true; // 本通道的非法帧, 丢弃
+
+	struct pending_cb pending = { 0 };
+
+	pthread_mutex_lock(&handle->lock);
+
+	switch (data[0] >> 4) {
+	case PCI_SF:
+		on_sf(handle, data, len, &pending);
+		break;
+	case PCI_FF:
+		on_ff(handle, data, len);
+		break;
+	case PCI_CF:
+		on_cf(handle, data, len, &pending);
+		break;
+	case PCI_FC:
+		on_fc(handle, data, len, &pending);
+		break;
+	default:
+		break;
+	}
+
+	pthread_mutex_unlock(&handle->lock);
+
+	run_pending(handle, &pending);
+
+	return true;
+}
+
+/**
+ * @brief 周期调用, 按STmin提交连续帧, 重试发送队列满时未提交的帧, 检查超时
+ *
+ * @param handle 通道句柄
+ */
+void isotp_poll(isotp_handle handle)
+{
+	if (!handle)
+		return;
+
+	struct pending_cb pending = { 0 };
+	uint64_t now = now_us();
+
+	pthread_mutex_lock(&handle->lock);
+
+	if (handle->tx_state == TX_WAIT_FC && now >= handle->tx_deadline_us)
+		tx_finish(handle, false, &pending); // N_Bs 超时
+	else if (handle->tx_state == TX_SENDING)
+		tx_pump(handle, &pending);
+
+	if (handle->rx_state == RX_RECEIVING && now >= handle->rx_deadline_us)
+		rx_abort(handle, "consecutive frame timeout"); // N_Cr 超时
+
+	pthread_mutex_unlock(&handle->lock);
+
+	run_pending(handle, &pending);
+}
+
+/**
+ * @brief 是否正在发送
+ *
+ * @param handle 通道句柄
+ * @return true 发送中
+ */
+bool isotp_busy(isotp_handle handle)
+{
+	if (!handle)
+		return false;
+
+	pthread_mutex_lock(&handle->lock);
+	bool busy = handle->tx_state != TX_IDLE;
+	pthread_mutex_unlock(&handle->lock);
+
+	return busy;
+}
+
+/**
+ * @brief 获取统计
+ *
+ * @param handle 通道句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零
+ */
+void isotp_get_stats(isotp_handle handle, struct isotp_stats *out, bool reset)
+{
+	if (!handle || !out)
+		return;
+
+	pthread_mutex_lock(&handle->lock);
+	*out = handle->stats;
+	if (reset)
+		memset(&handle->stats, 0, sizeof(handle->stats));
+	pthread_mutex_unlock(&handle->lock);
+}
@@ -0,0 +1,422 @@
+/**
+ * @file modbus_bus.c
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus多总线主机管理
+ * @version 1.0
+ * @date 2024-12-25
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils/logger.h"
+#include "protocol/modbus_bus.h"
+
+#define NO_BUS (0xFF) // 从机不属于任何总线
+
+// 单条总线
+struct bus_port {
+	const char *name;	   // 总线名称
+	mb_mst_handle mst;	   // 主机句柄
+	mb_poll_handle poll;   // 轮询调度句柄, 无轮询表与缓存表时为NULL
+	mb_cache_handle cache; // 寄存器缓存句柄, 无缓存表时为NULL
+};
+
+// 多总线管理句柄
+struct mb_bus {
+	struct bus_port buses[MB_BUS_MAX]; // 总线
+	size_t num;						   // 总线数量
+	uint8_t route[UINT8_MAX + 1];	   // 从机地址 -> 总线编号
+	uint64_t start_ms;				   // 初始化时刻
+};
+
+/**
+ * @brief 获取单调时钟(毫秒)
+ * 
+ * @return uint64_t 
+ */
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief 将从机加入总线路由
+ * 
+ * @param handle 多总线管理句柄
+ * @param slave_addr 从机地址
+ * @param bus 总线编号
+ * @return true 成功
+ * @return false 广播地址或已属于其他总线
+ */
+static bool route_add(mb_bus_handle handle, uint8_t slave_addr, size_t bus)
+{
+	if (!slave_addr) {
+		LOG_E("Modbus bus %s: broadcast address can not be routed", handle->buses[bus].name);
+		return false;
+	}
+
+	uint8_t owner = handle->route[slave_addr];
+	if (owner != NO_BUS && owner != bus) {
+		LOG_E("Modbus slave %u on both bus %s and %s", slave_addr, handle->buses[owner].name,
+			handle->buses[bus].name);
+		return false;
+	}
+
+	handle->route[slave_addr] = bus;
+	return true;
+}
+
+/**
+ * @brief 合并轮询表与缓存项创建总线的轮询调度器
+ * 
+ * @param port 总线
+ * @param cfg 总线配置
+ * @return true 成功或无需调度
+ * @return false 失败
+ */
+static bool bus_open_poll(struct bus_port *port, const struct mb_bus_cfg *cfg)
+{
+	size_t poll_num = cfg->poll_table ? cfg->poll_num : 0;
+	size_t cache_num = 0;
+	const struct mb_poll_entry *cache_table = mb_cache_poll_table(port->cache, &cache_num);
+	size_t num = poll_num + cache_num;
+
+	if (!num)
+		return true;
+
+	struct mb_poll_entry *table = calloc(num, sizeof(struct mb_poll_entry));
+	if (!table)
+		return false;
+
+	if (poll_num)
+		memcpy(table, cfg->poll_table, poll_num * sizeof(struct mb_poll_entry));
+	if (cache_num)
+		memcpy(&table[poll_num], cache_table, cache_num * sizeof(struct mb_poll_entry));
+
+	port->poll = mb_poll_init(port->mst, table, num);
+	free(table);
+
+	if (!port->poll) {
+		LOG_E("Modbus bus %s: init poll table failed", port->name);
+		return false;
+	}
+
+	// 缓存未命中或过期时向总线的调度器触发刷新
+	mb_cache_attach(port->cache, port->poll);
+
+	return true;
+}
+
+/**
+ * @brief 创建单条总线
+ * 
+ * @param handle 多总线管理句柄
+ * @param cfg 总线配置
+ * @param bus 总线编号
+ * @return true 成功
+ * @return false 失败
+ */
+static bool bus_open(mb_bus_handle handle, const struct mb_bus_cfg *cfg, size_t bus)
+{
+	struct bus_port *port = &handle->buses[bus];
+	port->name = cfg->name ? cfg->name : "?";
+
+	for (size_t i = 0; i < cfg->slave_num; i++) {
+		if (!route_add(handle, cfg->slaves[i], bus))
+			return false;
+	}
+
+	for (size_t i = 0; cfg->poll_table && i < cfg->poll_num; i++) {
+		if (!route_add(handle, cfg->poll_table[i].slave_addr, bus))
+			return false;
+	}
+
+	for (size_t i = 0; cfg->cache_table && i < cfg->cache_num; i++) {
+		if (!route_add(handle, cfg->cache_table[i].slave_addr, bus))
+			return false;
+	}
+
+	port->mst = mb_mst_init(cfg->opts, 1);
+	if (!port->mst) {
+		LOG_E("Modbus bus %s: init master failed", port->name);
+		return false;
+	}
+
+	if (cfg->cache_table && cfg->cache_num) {
+		port->cache = mb_cache_init(cfg->cache_table, cfg->cache_num);
+		if (!port->cache) {
+			LOG_E("Modbus bus %s: init cache table failed", port->name);
+			return false;
+		}
+	}
+
+	return bus_open_poll(port, cfg);
+}
+
+/**
+ * @brief 汇总一条总线上所有从机的统计及串口链路统计
+ * 
+ * @param handle 多总线管理句柄
+ * @param bus 总线编号
+ * @param stats 统计输出, 累加
+ */
+static void bus_sum_stats(mb_bus_handle handle, size_t bus, struct mb_bus_stats *stats)
+{
+	for (int addr = 1; addr <= UINT8_MAX; addr++) {
+		if (handle->route[addr] != bus)
+			continue;
+
+		struct mb_mst_slave_stats st;
+		if (!mb_mst_get_slave_stats(handle->buses[bus].mst, addr, &st))
+			continue;
+
+		stats->ok += st.ok;
+		stats->timeouts += st.timeouts;
+		stats->retries += st.retries;
+		stats->fast_fails += st.fast_fails;
+		stats->exceptions += st.exceptions;
+	}
+
+	struct mb_link_stats link;
+	mb_mst_get_link_stats(handle->buses[bus].mst, &link, false);
+
+	stats->crc_errors += link.crc_errors;
+	stats->resyncs += link.resyncs;
+	stats->tx_bytes += link.tx_bytes;
+	stats->rx_bytes += link.rx_bytes;
+	if (link.occupancy_pct > stats->occupancy_pct)
+		stats->occupancy_pct = link.occupancy_pct;
+}
+
+/***************************API***************************/
+
+/**
+ * @brief 为每条总线创建主机与轮询调度器并申请句柄
+ *
+ * @param cfg 总线配置数组
+ * @param num 总线数量 1 ~ MB_BUS_MAX
+ * @return mb_bus_handle 成功返回句柄,失败返回NULL
+ */
+mb_bus_handle mb_bus_init(const struct mb_bus_cfg *cfg, size_t num)
+{
+	if (!cfg || !num || num > MB_BUS_MAX)
+		return NULL;
+
+	for (size_t i = 0; i < num; i++) {
+		if (!cfg[i].opts)
+			return NULL;
+	}
+
+	struct mb_bus *handle = calloc(1, sizeof(struct mb_bus));
+	if (!handle)
+		return NULL;
+
+	memset(handle->route, NO_BUS, sizeof(handle->route));
+
+	for (size_t i = 0; i < num; i++) {
+		handle->num = i + 1;
+		if (!bus_open(handle, &cfg[i], i))
+			goto err_destroy;
+	}
+
+	handle->start_ms = now_ms();
+
+	return handle;
+
+err_destroy:
+	mb_bus_destroy(handle);
+	return NULL;
+}
+
+/**
+ * @brief 销毁所有总线的轮询调度器、主机与缓存并释放句柄
+ *
+ * @param handle 多总线管理句柄
+ */
+void mb_bus_destroy(mb_bus_handle handle)
+{
+	if (!handle)
+		return;
+
+	// 轮询调度器需在主机之前销毁, 缓存需在轮询调度器之后销毁
+	for (size_t i = 0; i < handle->num; i++) {
+		mb_poll_destroy(handle->buses[i].poll);
+		mb_mst_destroy(handle->buses[i].mst);
+		mb_cache_destroy(handle->buses[i].cache);
+	}
+
+	free(handle);
+}
+
+/**
+ * @brief 按从机地址提交请求到所属总线
+ *
+ * @param handle 多总线管理句柄
+ * @param request 请求结构体
+ * @return mb_mst_req_id 所属总线主机的请求标识, 从机不属于任何总线或提交失败返回0
+ */
+mb_mst_req_id mb_bus_request(mb_bus_handle handle, const struct mb_mst_request *request)
+{
+	if (!request)
+		return 0;
+
+	mb_mst_handle mst = mb_bus_route(handle, request->slave_addr);
+	if (!mst) {
+		LOG_W("Modbus slave %u is not on any bus", request->slave_addr);
+		return 0;
+	}
+
+	return mb_mst_pdu_request(mst, request);
+}
+
+/**
+ * @brief 获取从机所属总线的主机, 用于取消请求或查询从机状态
+ *
+ * @param handle 多总线管理句柄
+ * @param slave_addr 从机地址
+ * @return mb_mst_handle 不属于任何总线返回NULL
+ */
+mb_mst_handle mb_bus_route(mb_bus_handle handle, uint8_t slave_addr)
+{
+	if (!handle || handle->route[slave_addr] == NO_BUS)
+		return NULL;
+
+	return handle->buses[handle->route[slave_addr]].mst;
+}
+
+/**
+ * @brief 获取从机所属总线的寄存器缓存, 用于读取缓存或订阅变化
+ *
+ * @param handle 多总线管理句柄
+ * @param slave_addr 从机地址
+ * @return mb_cache_handle 不属于任何总线或所属总线无缓存表返回NULL
+ */
+mb_cache_handle mb_bus_cache(mb_bus_handle handle, uint8_t slave_addr)
+{
+	if (!handle || handle->route[slave_addr] == NO_BUS)
+		return NULL;
+
+	return handle->buses[handle->route[slave_addr]].cache;
+}
+
+/**
+ * @brief 轮询所有总线, 每条总线各自调度轮询表并处理收发, 互不等待
+ *
+ * @param handle 多总线管理句柄
+ */
+void mb_bus_poll(mb_bus_handle handle)
+{
+	if (!handle)
+		return;
+
+	// 主机与串口均为非阻塞, 一条总线等待回复时其他总线照常收发
+	for (size_t i = 0; i < handle->num; i++) {
+		mb_poll_schedule(handle->buses[i].poll);
+		mb_mst_poll(handle->buses[i].mst);
+	}
+}
+
+/**
+ * @brief 所有总线中最近的超时或轮询到期时间, 用于事件循环精确休眠
+ *
+ * @param handle 多总线管理句柄
+ * @return int 毫秒, 0代表需立即轮询, -1代表无请求
+ */
+int mb_bus_next_deadline(mb_bus_handle handle)
+{
+	if (!handle)
+		return -1;
+
+	int next = -1;
+	for (size_t i = 0; i < handle->num; i++) {
+		int wait[2] = {
+			mb_mst_next_deadline(handle->buses[i].mst),
+			mb_poll_next_deadline(handle->buses[i].poll),
+		};
+
+		for (size_t j = 0; j < 2; j++) {
+			if (wait[j] >= 0 && (next < 0 || wait[j] < next))
+				next = wait[j];
+		}
+	}
+
+	return next;
+}
+
+/**
+ * @brief 总线数量
+ *
+ * @param handle 多总线管理句柄
+ * @return size_t 
+ */
+size_t mb_bus_num(mb_bus_handle handle)
+{
+	return handle ? handle->num : 0;
+}
+
+/**
+ * @brief 获取总线名称
+ *
+ * @param handle 多总线管理句柄
+ * @param bus 总线编号
+ * @return const char* 编号无效返回NULL
+ */
+const char *mb_bus_name(mb_bus_handle handle, size_t bus)
+{
+	if (!handle || bus >= handle->num)
+		return NULL;
+
+	return handle->buses[bus].name;
+}
+
+/**
+ * @brief 获取总线统计
+ *
+ * @param handle 多总线管理句柄
+ * @param bus 总线编号, -1代表所有总线汇总
+ * @param stats 统计输出
+ * @return true 成功
+ * @return false 编号无效
+ */
+bool mb_bus_get_stats(mb_bus_handle handle, int bus, struct mb_bus_stats *stats)
+{
+	if (!handle || !stats || bus < -1 || bus >= (int)handle->num)
+		return false;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (size_t i = 0; i < handle->num; i++) {
+		if (bus < 0 || (size_t)bus == i)
+			bus_sum_stats(handle, i, stats);
+	}
+
+	stats->elapsed_ms = now_ms() - handle->start_ms;
+
+	return true;
+}
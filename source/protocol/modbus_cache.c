@@ -0,0 +1,397 @@
+/**
+ * @file modbus_cache.c
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus主机寄存器缓存
+ * @version 1.0
+ * @date 2024-12-26
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils/logger.h"
+#include "protocol/modbus_cache.h"
+
+struct mb_cache;
+
+// 缓存项及其数据
+struct cache_slot {
+	struct mb_cache *owner;		 // 所属缓存
+	struct mb_cache_entry entry; // 缓存项拷贝
+	uint16_t *vals;				 // 寄存器值
+	bool valid;					 // 至少读取成功过一次
+	uint64_t updated_ms;		 // 最后一次读取成功的时刻
+};
+
+// 订阅
+struct cache_sub {
+	uint8_t slave_addr;		// 从机地址
+	uint16_t reg_addr;		// 起始寄存器
+	uint16_t reg_len;		// 寄存器数量
+	mb_cache_notify notify; // 回调
+	void *arg;				// 用户私有数据
+};
+
+// 寄存器缓存句柄
+struct mb_cache {
+	mb_poll_handle poll;					 // 所属总线的轮询调度器, 未挂接时为NULL
+	struct cache_slot *slots;				 // 按从机、寄存器排序的缓存项
+	size_t num;								 // 缓存项数量
+	uint16_t *vals;							 // 所有缓存项的寄存器值
+	struct mb_poll_entry *poll_table;		 // 缓存项对应的轮询项
+	struct cache_sub subs[MB_CACHE_SUB_MAX]; // 订阅
+	size_t sub_num;							 // 订阅数量
+};
+
+/**
+ * @brief 获取单调时钟(毫秒)
+ * 
+ * @return uint64_t 
+ */
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief 缓存项按从机地址、起始寄存器升序比较
+ * 
+ * @param a 
+ * @param b 
+ * @return int 
+ */
+static int slot_cmp(const void *a, const void *b)
+{
+	const struct mb_cache_entry *ea = &((const struct cache_slot *)a)->entry;
+	const struct mb_cache_entry *eb = &((const struct cache_slot *)b)->entry;
+
+	if (ea->slave_addr != eb->slave_addr)
+		return ea->slave_addr - eb->slave_addr;
+	return ea->reg_addr < eb->reg_addr ? -1 : ea->reg_addr > eb->reg_addr;
+}
+
+/**
+ * @brief 检查缓存项是否合法
+ * 
+ * @param entry 
+ * @return true 
+ * @return false 
+ */
+static bool check_entry_valid(const struct mb_cache_entry *entry)
+{
+	if (!entry->ttl_ms || !entry->reg_len || entry->reg_len > MODBUS_RD_REG_NUM_MAX)
+		return false;
+
+	return (uint32_t)entry->reg_addr + entry->reg_len <= 0x10000;
+}
+
+/**
+ * @brief 通知订阅范围内值有变化的订阅者
+ * 
+ * @param handle 寄存器缓存句柄
+ * @param slot 刷新的缓存项
+ * @param changed 每个寄存器是否变化
+ */
+static void notify_subs(struct mb_cache *handle, struct cache_slot *slot, const bool *changed)
+{
+	const struct mb_cache_entry *entry = &slot->entry;
+	uint32_t end = (uint32_t)entry->reg_addr + entry->reg_len;
+
+	for (size_t i = 0; i < handle->sub_num; i++) {
+		const struct cache_sub *sub = &handle->subs[i];
+		uint32_t s_end = (uint32_t)sub->reg_addr + sub->reg_len;
+		if (sub->slave_addr != entry->slave_addr || sub->reg_addr >= end ||
+			s_end <= entry->reg_addr)
+			continue;
+
+		// 订阅范围与缓存项的交集
+		uint16_t first = sub->reg_addr > entry->reg_addr ? sub->reg_addr : entry->reg_addr;
+		uint16_t num = (s_end < end ? s_end : end) - first;
+		size_t offset = first - entry->reg_addr;
+
+		for (size_t j = 0; j < num; j++) {
+			if (changed[offset + j]) {
+				sub->notify(entry->slave_addr, first, &slot->vals[offset], num, sub->arg);
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * @brief 刷新回复, 更新缓存并通知变化
+ * 
+ * @param data 接收到的数据
+ * @param len 数据长度
+ * @param is_timeout 是否超时
+ * @param arg 缓存项
+ */
+static void slot_resp(uint8_t *data, size_t len, bool is_timeout, void *arg)
+{
+	struct cache_slot *slot = arg;
+
+	// 超时保留旧值, 过期后读取返回 MB_CACHE_STALE
+	if (is_timeout)
+		return;
+
+	bool changed[MODBUS_RD_REG_NUM_MAX];
+	bool any = false;
+
+	for (size_t i = 0; i < slot->entry.reg_len && (i + 1) * 2 <= len; i++) {
+		uint16_t val = COMBINE_U8_TO_U16(data[i * 2], data[i * 2 + 1]);
+		changed[i] = !slot->valid || val != slot->vals[i];
+		any |= changed[i];
+		slot->vals[i] = val;
+	}
+
+	slot->valid = true;
+	slot->updated_ms = now_ms();
+
+	if (any)
+		notify_subs(slot->owner, slot, changed);
+}
+
+/***************************API***************************/
+
+/**
+ * @brief 根据缓存表创建缓存并申请句柄
+ *
+ * @param table 缓存表, 内部会拷贝
+ * @param num 缓存项数量
+ * @return mb_cache_handle 成功返回句柄,失败返回NULL
+ */
+mb_cache_handle mb_cache_init(const struct mb_cache_entry *table, size_t num)
+{
+	if (!table || !num)
+		return NULL;
+
+	size_t total = 0;
+	for (size_t i = 0; i < num; i++) {
+		if (!check_entry_valid(&table[i])) {
+			LOG_E("Invalid cache entry %zu", i);
+			return NULL;
+		}
+		total += table[i].reg_len;
+	}
+
+	struct mb_cache *handle = calloc(1, sizeof(struct mb_cache));
+	if (!handle)
+		return NULL;
+
+	handle->slots = calloc(num, sizeof(struct cache_slot));
+	if (!handle->slots)
+		goto err_free_handle;
+
+	handle->vals = calloc(total, sizeof(uint16_t));
+	if (!handle->vals)
+		goto err_free_slots;
+
+	handle->poll_table = calloc(num, sizeof(struct mb_poll_entry));
+	if (!handle->poll_table)
+		goto err_free_vals;
+
+	for (size_t i = 0; i < num; i++)
+		handle->slots[i].entry = table[i];
+	handle->num = num;
+
+	// 读取时按地址顺序查找, 重叠的缓存项无法确定以哪个为准
+	qsort(handle->slots, num, sizeof(struct cache_slot), slot_cmp);
+
+	uint16_t *vals = handle->vals;
+	for (size_t i = 0; i < num; i++) {
+		struct cache_slot *slot = &handle->slots[i];
+		const struct mb_cache_entry *entry = &slot->entry;
+
+		if (i && slot[-1].entry.slave_addr == entry->slave_addr &&
+			(uint32_t)slot[-1].entry.reg_addr + slot[-1].entry.reg_len > entry->reg_addr) {
+			LOG_E("Cache slave %u reg %u overlaps", entry->slave_addr, entry->reg_addr);
+			goto err_free_poll_table;
+		}
+
+		slot->owner = handle;
+		slot->vals = vals;
+		vals += entry->reg_len;
+
+		handle->poll_table[i] = (struct mb_poll_entry){
+			.slave_addr = entry->slave_addr,
+			.reg_addr = entry->reg_addr,
+			.reg_len = entry->reg_len,
+			.period_ms = entry->period_ms,
+			.priority = entry->priority,
+			.timeout_ms = entry->timeout_ms,
+			.resp = slot_resp,
+			.arg = slot,
+		};
+	}
+
+	return handle;
+
+err_free_poll_table:
+	free(handle->poll_table);
+
+err_free_vals:
+	free(handle->vals);
+
+err_free_slots:
+	free(handle->slots);
+
+err_free_handle:
+	free(handle);
+
+	return NULL;
+}
+
+/**
+ * @brief 释放句柄, 需在挂接的轮询调度器销毁后调用
+ *
+ * @param handle 寄存器缓存句柄
+ */
+void mb_cache_destroy(mb_cache_handle handle)
+{
+	if (!handle)
+		return;
+
+	free(handle->poll_table);
+	free(handle->vals);
+	free(handle->slots);
+	free(handle);
+}
+
+/**
+ * @brief 获取缓存项对应的轮询项, 用于并入总线的轮询表
+ *
+ * @param handle 寄存器缓存句柄
+ * @param num 轮询项数量输出
+ * @return const struct mb_poll_entry* 轮询项, 在缓存销毁前有效
+ */
+const struct mb_poll_entry *mb_cache_poll_table(mb_cache_handle handle, size_t *num)
+{
+	if (!handle || !num)
+		return NULL;
+
+	*num = handle->num;
+	return handle->poll_table;
+}
+
+/**
+ * @brief 挂接刷新缓存项的轮询调度器, 读取未命中或过期时向其触发刷新
+ *
+ * @param handle 寄存器缓存句柄
+ * @param poll 轮询表包含 mb_cache_poll_table 的轮询调度器
+ */
+void mb_cache_attach(mb_cache_handle handle, mb_poll_handle poll)
+{
+	if (handle)
+		handle->poll = poll;
+}
+
+/**
+ * @brief 读取寄存器, 不访问总线, 未命中或过期时触发刷新
+ *
+ * @param handle 寄存器缓存句柄
+ * @param slave_addr 从机地址
+ * @param reg_addr 起始寄存器
+ * @param reg_len 寄存器数量
+ * @param vals 寄存器值输出, 未命中时内容不确定
+ * @return enum mb_cache_result 读取结果
+ */
+enum mb_cache_result mb_cache_read(mb_cache_handle handle, uint8_t slave_addr, uint16_t reg_addr,
+	uint16_t reg_len, uint16_t *vals)
+{
+	if (!handle || !vals || !reg_len)
+		return MB_CACHE_MISS;
+
+	enum mb_cache_result res = MB_CACHE_HIT;
+	uint32_t cur = reg_addr;
+	uint32_t end = (uint32_t)reg_addr + reg_len;
+	uint64_t now = now_ms();
+
+	for (size_t i = 0; i < handle->num && cur < end; i++) {
+		struct cache_slot *slot = &handle->slots[i];
+		const struct mb_cache_entry *entry = &slot->entry;
+		uint32_t s_end = (uint32_t)entry->reg_addr + entry->reg_len;
+
+		if (entry->slave_addr != slave_addr || s_end <= cur)
+			continue;
+		if (entry->reg_addr > cur)
+			break; // 中间有未缓存的寄存器
+
+		uint32_t num = (s_end < end ? s_end : end) - cur;
+
+		if (!slot->valid) {
+			res = MB_CACHE_MISS;
+			mb_poll_trigger(handle->poll, slave_addr, entry->reg_addr, entry->reg_len);
+		} else {
+			const uint16_t *src = &slot->vals[cur - entry->reg_addr];
+			memcpy(&vals[cur - reg_addr], src, num * sizeof(uint16_t));
+			if (now - slot->updated_ms >= entry->ttl_ms) {
+				if (res == MB_CACHE_HIT)
+					res = MB_CACHE_STALE;
+				mb_poll_trigger(handle->poll, slave_addr, entry->reg_addr, entry->reg_len);
+			}
+		}
+
+		cur += num;
+	}
+
+	return cur < end ? MB_CACHE_MISS : res;
+}
+
+/**
+ * @brief 订阅寄存器变化, 首次读取成功及之后值变化时回调
+ *
+ * @param handle 寄存器缓存句柄
+ * @param slave_addr 从机地址
+ * @param reg_addr 起始寄存器
+ * @param reg_len 寄存器数量
+ * @param notify 回调
+ * @param arg 用户私有数据, 回调时原样传回 可为NULL
+ * @return true 成功
+ * @return false 订阅已满或参数错误
+ */
+bool mb_cache_subscribe(mb_cache_handle handle, uint8_t slave_addr, uint16_t reg_addr,
+	uint16_t reg_len, mb_cache_notify notify, void *arg)
+{
+	if (!handle || !notify || !reg_len)
+		return false;
+
+	if (handle->sub_num >= MB_CACHE_SUB_MAX) {
+		LOG_W("Cache subscriptions full, slave %u reg %u dropped", slave_addr, reg_addr);
+		return false;
+	}
+
+	handle->subs[handle->sub_num++] = (struct cache_sub){
+		.slave_addr = slave_addr,
+		.reg_addr = reg_addr,
+		.reg_len = reg_len,
+		.notify = notify,
+		.arg = arg,
+	};
+
+	return true;
+}
@@ -0,0 +1,391 @@
+/**
+ * @file modbus_capture.c
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus串口抓包(pcap)与回放
+ * @version 1.0
+ * @date 2025-01-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "utils/logger.h"
+#include "protocol/modbus_capture.h"
+
+#define PCAP_MAGIC (0xa1b2c3d4) // 微秒时间戳
+#define PCAP_VERSION_MAJOR (2)
+#define PCAP_VERSION_MINOR (4)
+
+// pcap文件头
+struct pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+// pcap记录头
+struct pcap_rec_hdr {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+struct mb_cap {
+	FILE *fp; // 抓包文件
+};
+
+struct mb_replay {
+	FILE *fp;					  // 抓包文件
+	enum mb_cap_dir dir;		  // 送入协议层的方向
+	bool realtime;				  // 按记录的时间间隔送入
+	bool eof;					  // 已读完或文件损坏
+	uint8_t rec[MB_CAP_SNAPLEN];  // 当前记录数据, 不含方向字节
+	size_t rec_len;				  // 当前记录长度
+	size_t rec_off;				  // 当前记录已送入的长度
+	uint64_t ts_us;				  // 上一条记录的抓包时间戳
+	uint64_t rec_us;			  // 当前记录相对第一条记录的回放时刻
+	uint64_t start_us;			  // 开始回放的时刻, 0代表尚未开始
+	struct mb_replay_stats stats; // 回放统计
+	struct serial_opts opts;	  // 串口回调, arg指向本结构体
+};
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/***************************抓包***************************/
+
+/**
+ * @brief 创建pcap抓包文件, 写入文件头
+ *
+ * @param path 文件路径, 已存在时覆盖
+ * @return mb_cap_handle 成功返回句柄,失败返回NULL
+ */
+mb_cap_handle mb_cap_open(const char *path)
+{
+	if (!path)
+		return NULL;
+
+	struct mb_cap *handle = calloc(1, sizeof(struct mb_cap));
+	if (!handle) {
+		LOG_E("Malloc capture failed");
+		return NULL;
+	}
+
+	handle->fp = fopen(path, "wb");
+	if (!handle->fp) {
+		LOG_E("Open capture %s failed: %s", path, strerror(errno));
+		goto err_free;
+	}
+
+	struct pcap_file_hdr hdr = {
+		.magic = PCAP_MAGIC,
+		.version_major = PCAP_VERSION_MAJOR,
+		.version_minor = PCAP_VERSION_MINOR,
+		.snaplen = MB_CAP_SNAPLEN + 1,
+		.linktype = MB_CAP_DLT,
+	};
+	if (fwrite(&hdr, sizeof(hdr), 1, handle->fp) != 1) {
+		LOG_E("Write capture header failed");
+		goto err_close_fp;
+	}
+
+	return handle;
+
+err_close_fp:
+	fclose(handle->fp);
+
+err_free:
+	free(handle);
+
+	return NULL;
+}
+
+/**
+ * @brief 写入一条带时间戳的记录, 超过MB_CAP_SNAPLEN的部分截断
+ *
+ * 时间戳为系统时间, 便于与现场日志对照; 写入经过stdio缓冲, 不会每条记录都进入内核
+ *
+ * @param handle 抓包句柄
+ * @param dir 数据方向
+ * @param buf 数据
+ * @param len 数据长度
+ */
+void mb_cap_write(mb_cap_handle handle, enum mb_cap_dir dir, const uint8_t *buf, size_t len)
+{
+	if (!handle || !buf || !len)
+		return;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	size_t incl = len > MB_CAP_SNAPLEN ? MB_CAP_SNAPLEN : len;
+	struct pcap_rec_hdr rec = {
+		.ts_sec = (uint32_t)ts.tv_sec,
+		.ts_usec = (uint32_t)(ts.tv_nsec / 1000),
+		.incl_len = (uint32_t)incl + 1,
+		.orig_len = (uint32_t)len + 1,
+	};
+	uint8_t d = dir;
+
+	if (fwrite(&rec, sizeof(rec), 1, handle->fp) != 1 || fwrite(&d, 1, 1, handle->fp) != 1 ||
+		fwrite(buf, 1, incl, handle->fp) != incl)
+		LOG_E("Write capture record failed");
+}
+
+/**
+ * @brief 写入缓冲中的记录并关闭文件
+ *
+ * @param handle 抓包句柄
+ */
+void mb_cap_close(mb_cap_handle handle)
+{
+	if (!handle)
+		return;
+
+	if (fclose(handle->fp) != 0)
+		LOG_E("Close capture failed: %s", strerror(errno));
+	free(handle);
+}
+
+/***************************回放***************************/
+
+/**
+ * @brief 读取下一条指定方向的记录, 其他方向的记录跳过
+ *
+ * @param handle 回放句柄
+ * @return true 成功
+ * @return false 已读完或文件损坏
+ */
+static bool next_record(mb_replay_handle handle)
+{
+	struct pcap_rec_hdr hdr;
+	uint8_t dir;
+
+	while (fread(&hdr, sizeof(hdr), 1, handle->fp) == 1) {
+		if (!hdr.incl_len || hdr.incl_len > MB_CAP_SNAPLEN + 1) {
+			LOG_E("Capture record length %u invalid", hdr.incl_len);
+			return false;
+		}
+
+		size_t len = hdr.incl_len - 1;
+		if (fread(&dir, 1, 1, handle->fp) != 1 || fread(handle->rec, 1, len, handle->fp) != len)
+			return false;
+
+		if (dir != handle->dir)
+			continue;
+
+		handle->rec_len = len;
+		handle->rec_off = 0;
+
+		// 抓包时间戳为系统时间, 可能被校时回拨, 只累加非负的间隔, 回拨的记录立即送入
+		uint64_t ts_us = (uint64_t)hdr.ts_sec * 1000000 + hdr.ts_usec;
+		if (handle->stats.records && ts_us > handle->ts_us)
+			handle->rec_us += ts_us - handle->ts_us;
+		handle->ts_us = ts_us;
+		handle->stats.records++;
+
+		return true;
+	}
+
+	return false;
+}
+
+static bool replay_init(void *arg)
+{
+	(void)arg;
+
+	return true;
+}
+
+static void replay_dir_ctrl(enum modbus_serial_dir ctrl, void *arg)
+{
+	(void)ctrl;
+	(void)arg;
+}
+
+/**
+ * @brief 按顺序送入记录, 实时模式下记录未到时刻前不送入
+ *
+ * 一次只送入一条记录的数据, 保留原始的断包与粘包情况
+ *
+ * @param p_data 数据缓冲
+ * @param len 缓冲长度
+ * @param arg 回放句柄
+ * @return size_t 送入的长度
+ */
+static size_t replay_read(uint8_t *p_data, uint16_t len, void *arg)
+{
+	mb_replay_handle handle = arg;
+
+	if (handle->eof)
+		return 0;
+
+	if (handle->rec_off >= handle->rec_len && !next_record(handle)) {
+		handle->eof = true;
+		return 0;
+	}
+
+	if (!handle->start_us)
+		handle->start_us = now_us();
+
+	if (handle->realtime && now_us() - handle->start_us < handle->rec_us)
+		return 0;
+
+	size_t n = handle->rec_len - handle->rec_off;
+	if (n > len)
+		n = len;
+
+	memcpy(p_data, &handle->rec[handle->rec_off], n);
+	handle->rec_off += n;
+	handle->stats.rx_bytes += n;
+
+	return n;
+}
+
+static size_t replay_write(uint8_t *p_data, uint16_t len, void *arg)
+{
+	mb_replay_handle handle = arg;
+	(void)p_data;
+
+	handle->stats.tx_bytes += len;
+	handle->stats.tx_calls++;
+
+	return len;
+}
+
+/**
+ * @brief 打开抓包文件, 申请回放句柄
+ *
+ * @param path 抓包文件路径
+ * @param dir 送入协议层的数据方向
+ * @param realtime true: 按记录的时间间隔送入, false: 尽快送入
+ * @return mb_replay_handle 成功返回句柄,失败返回NULL
+ */
+mb_replay_handle mb_replay_open(const char *path, enum mb_cap_dir dir, bool realtime)
+{
+	if (!path)
+		return NULL;
+
+	struct mb_replay *handle = calloc(1, sizeof(struct mb_replay));
+	if (!handle) {
+		LOG_E("Malloc replay failed");
+		return NULL;
+	}
+
+	handle->fp = fopen(path, "rb");
+	if (!handle->fp) {
+		LOG_E("Open capture %s failed: %s", path, strerror(errno));
+		goto err_free;
+	}
+
+	// 只支持本模块写出的文件(本机字节序, 微秒时间戳)
+	struct pcap_file_hdr hdr;
+	if (fread(&hdr, sizeof(hdr), 1, handle->fp) != 1 || hdr.magic != PCAP_MAGIC ||
+		hdr.linktype != MB_CAP_DLT) {
+		LOG_E("Capture %s format unsupported", path);
+		goto err_close_fp;
+	}
+
+	handle->dir = dir;
+	handle->realtime = realtime;
+
+	handle->opts.f_init = replay_init;
+	handle->opts.f_dir_ctrl = replay_dir_ctrl;
+	handle->opts.f_read = replay_read;
+	handle->opts.f_write = replay_write;
+	handle->opts.arg = handle;
+
+	return handle;
+
+err_close_fp:
+	fclose(handle->fp);
+
+err_free:
+	free(handle);
+
+	return NULL;
+}
+
+/**
+ * @brief 关闭抓包文件并释放句柄
+ *
+ * @param handle 回放句柄
+ */
+void mb_replay_close(mb_replay_handle handle)
+{
+	if (!handle)
+		return;
+
+	fclose(handle->fp);
+	free(handle);
+}
+
+/**
+ * @brief 获取回放用的串口回调, 直接用于主机或从机初始化
+ *
+ * @param handle 回放句柄
+ * @return struct serial_opts* 串口回调, 与句柄同生命周期
+ */
+struct serial_opts *mb_replay_opts(mb_replay_handle handle)
+{
+	return handle ? &handle->opts : NULL;
+}
+
+/**
+ * @brief 判断是否已回放完所有记录
+ *
+ * @param handle 回放句柄
+ * @return true 已结束或文件损坏
+ * @return false 仍有记录
+ */
+bool mb_replay_done(mb_replay_handle handle)
+{
+	return !handle || handle->eof;
+}
+
+/**
+ * @brief 获取回放统计
+ *
+ * @param handle 回放句柄
+ * @param out 输出统计
+ */
+void mb_replay_get_stats(mb_replay_handle handle, struct mb_replay_stats *out)
+{
+	if (!handle || !out)
+		return;
+
+	*out = handle->stats;
+}
@@ -34,12 +34,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "protocol/modbus_master.h"
 
-#define REPEAT_IDX (0)	// 重发
-#define TIMEOUT_IDX (1) // 超时
-
 // 接收状态
 enum rx_state {
 	RX_STATE_ADDR = 0, // 从机地址
@@ -51,15 +49,13 @@ enum rx_state {
 	RX_STATE_REG,	  // 寄存器地址    (仅对 写 功能玛有效)
 	RX_STATE_REG_LEN, // 寄存器长度    (仅对 写 功能玛有效)
 
+	RX_STATE_EX_CODE, // 异常码        (仅对 异常响应 有效)
+
 	RX_STATE_CRC, // CRC校验
 };
 // 两倍最大帧长度 接收缓冲
 #define RX_BUFF_SIZE (MODBUS_FRAME_BYTES_MAX * 2)
 
-// 最大请求处理个数
-#define MAX_REQUEST (16)
-#define REQUEST_BUFFER (MAX_REQUEST * sizeof(struct mb_mst_request *))
-
 // 接收数据信息
 struct msg_info {
 	uint8_t pdu_in;		 // 接收索引
@@ -73,22 +69,262 @@ struct msg_info {
 	struct queue_info rx_q;				 // 接收队列
 	uint8_t rx_queue_buff[RX_BUFF_SIZE]; // 接收队列缓冲
 
-	struct queue_info tx_q;				   // 发送队列
-	uint8_t tx_queue_buff[REQUEST_BUFFER]; // 发送队列缓冲
-
 	uint8_t recv_crc[MODBUS_CRC_BYTES_NUM]; // 接收的CRC
 	uint8_t r_data[MODBUS_REG_NUM_MAX * 2]; // 读功能码接收的有效数据
 	uint8_t r_data_len;						// 有效数据长度
+	uint8_t ex_code;						// 异常响应的异常码, 0代表正常回复
+};
+
+// 请求池中的请求, 提交时拷贝请求与写数据, 调用者无需保持请求有效
+struct req_slot {
+	struct mb_mst_request req;				// 请求拷贝, data指向buf
+	uint8_t buf[MODBUS_WR_REG_NUM_MAX * 2];	// 写数据拷贝
+	mb_mst_req_id id;						// 请求标识, 0代表空闲
+	bool cancelled;							// 发送后被取消, 不再重发也不回调
+	uint8_t sends;							// 已发送次数
+	uint8_t max_sends;						// 最多发送次数, 探测请求只发送一次
+	uint64_t sent_us;						// 最近一次发送时刻
+	uint64_t deadline_us;					// 本次发送的超时时刻
+};
+
+// 每个从机的往返时间估计与熔断状态
+struct slave_stat {
+	bool has_rtt;					 // 已有往返时间样本
+	uint32_t srtt_us;				 // 平滑往返时间
+	uint32_t rttvar_us;				 // 往返时间偏差
+	uint32_t rtt_min_us;			 // 最小往返时间
+	uint32_t rtt_max_us;			 // 最大往返时间
+	uint32_t ok;					 // 成功次数
+	uint32_t timeouts;				 // 超时次数(重发完仍未回复)
+	uint32_t retries;				 // 重发次数
+	uint32_t fast_fails;			 // 熔断期间直接失败的次数
+	uint32_t exceptions;			 // 异常响应次数
+	uint32_t crc_errors;			 // 等待该从机回复时的CRC校验失败次数
+	uint32_t tx_frames;				 // 发送帧数, 含重发
+	uint32_t rx_frames;				 // 收到回复帧数, 含异常响应
+	uint64_t tx_bytes;				 // 发送字节数
+	uint64_t rx_bytes;				 // 回复帧字节数
+	uint8_t fails;					 // 连续超时次数
+	enum mb_mst_slave_health health; // 健康状态
+	uint32_t backoff_ms;			 // 当前探测间隔
+	uint64_t next_probe_us;			 // 下次探测时刻
 };
 
 // 主机句柄
 struct mb_mst {
-	struct serial_opts *opts;  // 用户回调指针
-	struct msg_info msg_state; // 接收信息
-	size_t period_ms;		   // 任务周期
-	bool is_sending;		   // 正在发送
+	struct serial_opts *opts;				 // 用户回调指针
+	struct msg_info msg_state;				 // 接收信息
+	struct req_slot pool[MB_MST_POOL_SIZE];	 // 请求池
+	uint8_t fifo[MB_MST_POOL_SIZE];			 // 按提交顺序排列的请求池下标, 队首为当前请求
+	uint8_t fifo_len;						 // 排队的请求数量
+	bool head_sent;							 // 队首请求已发送, 等待回复
+	mb_mst_req_id next_id;					 // 下一个请求标识
+	bool is_sending;						 // 正在发送
+	struct slave_stat slaves[UINT8_MAX + 1]; // 按从机地址索引
+	struct mb_link_stats link;				 // 链路统计
+	uint64_t link_start_us;					 // 链路统计起始时刻
+};
+
+// 队首请求结束原因
+enum head_end {
+	HEAD_END_REPLY,		// 收到正常回复
+	HEAD_END_EXCEPTION, // 收到异常响应, 从机在线但请求失败
+	HEAD_END_TIMEOUT,	// 重发完仍未回复或熔断中直接失败
 };
 
+/**
+ * @brief 获取单调时钟(微秒), 不受系统时间调整与任务周期抖动影响
+ * 
+ * @return uint64_t 
+ */
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 计算本次发送的超时时间: SRTT + 4 * RTTVAR, 每次重发加倍, 不超过请求的超时时间
+ * 
+ * 无往返时间样本时使用请求的超时时间
+ * 
+ * @param st 从机统计
+ * @param slot 请求
+ * @return uint64_t 微秒
+ */
+static uint64_t slave_rto_us(const struct slave_stat *st, const struct req_slot *slot)
+{
+	uint64_t max = (uint64_t)slot->req.timeout_ms * 1000;
+	if (!st->has_rtt)
+		return max;
+
+	uint64_t rto = st->srtt_us + 4 * (uint64_t)st->rttvar_us;
+	if (rto < MB_MST_RTO_MIN_MS * 1000)
+		rto = MB_MST_RTO_MIN_MS * 1000;
+
+	rto <<= slot->sends ? slot->sends - 1 : 0;
+
+	return rto < max ? rto : max;
+}
+
+/**
+ * @brief 收到回复, 更新往返时间估计(RFC 6298)并关闭熔断
+ * 
+ * 重发过的请求无法区分回复对应哪一次发送, 不作为样本
+ * 
+ * @param st 从机统计
+ * @param slot 请求
+ */
+static void slave_on_reply(struct slave_stat *st, const struct req_slot *slot)
+{
+	if (slot->sends == 1) {
+		uint64_t rtt64 = now_us() - slot->sent_us;
+		uint32_t rtt = rtt64 > UINT32_MAX ? UINT32_MAX : rtt64;
+
+		if (!st->has_rtt) {
+			st->has_rtt = true;
+			st->srtt_us = rtt;
+			st->rttvar_us = rtt / 2;
+			st->rtt_min_us = rtt;
+			st->rtt_max_us = rtt;
+		} else {
+			uint32_t err = st->srtt_us > rtt ? st->srtt_us - rtt : rtt - st->srtt_us;
+			st->rttvar_us = st->rttvar_us - st->rttvar_us / 4 + err / 4;
+			st->srtt_us = st->srtt_us - st->srtt_us / 8 + rtt / 8;
+			if (rtt < st->rtt_min_us)
+				st->rtt_min_us = rtt;
+			if (rtt > st->rtt_max_us)
+				st->rtt_max_us = rtt;
+		}
+	}
+
+	st->fails = 0;
+	st->backoff_ms = 0;
+	st->health = MB_MST_SLAVE_ONLINE;
+}
+
+/**
+ * @brief 重发完仍未回复, 连续超时达到阈值或探测失败时打开熔断, 探测间隔指数增长
+ * 
+ * @param st 从机统计
+ */
+static void slave_on_timeout(struct slave_stat *st)
+{
+	st->timeouts++;
+	if (st->fails < UINT8_MAX)
+		st->fails++;
+
+	if (st->health == MB_MST_SLAVE_PROBING) {
+		st->backoff_ms *= 2;
+		if (st->backoff_ms > MB_MST_PROBE_MAX_MS)
+			st->backoff_ms = MB_MST_PROBE_MAX_MS;
+	} else if (st->fails >= MB_MST_BREAKER_FAILS) {
+		st->backoff_ms = MB_MST_PROBE_MIN_MS;
+	} else {
+		return;
+	}
+
+	st->health = MB_MST_SLAVE_OFFLINE;
+	st->next_probe_us = now_us() + (uint64_t)st->backoff_ms * 1000;
+}
+
+/**
+ * @brief 获取队首请求
+ * 
+ * @param handle 
+ * @return struct req_slot* 无请求返回NULL
+ */
+static inline struct req_slot *head_slot(mb_mst_handle handle)
+{
+	return handle->fifo_len ? &handle->pool[handle->fifo[0]] : NULL;
+}
+
+/**
+ * @brief 查找请求在队列中的位置
+ * 
+ * @param handle 
+ * @param id 请求标识
+ * @return int 位置, 不存在返回-1
+ */
+static int find_slot(mb_mst_handle handle, mb_mst_req_id id)
+{
+	if (!id)
+		return -1;
+
+	for (int i = 0; i < handle->fifo_len; i++) {
+		if (handle->pool[handle->fifo[i]].id == id)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief 从队列中移除请求并归还请求池
+ * 
+ * @param handle 
+ * @param pos 队列中的位置
+ */
+static void release_slot(mb_mst_handle handle, int pos)
+{
+	handle->pool[handle->fifo[pos]].id = 0;
+
+	handle->fifo_len--;
+	memmove(&handle->fifo[pos], &handle->fifo[pos + 1], handle->fifo_len - pos);
+
+	if (!pos)
+		handle->head_sent = false;
+}
+
+/**
+ * @brief 队首请求完成, 先归还请求池再回调, 回调中可以再次提交请求
+ * 
+ * 异常响应与超时同样以失败回调, 但从机在线, 按收到回复更新统计且不再重发;
+ * 异常响应回调时数据为异常码, 长度为1
+ * 
+ * @param handle 
+ * @param end 结束原因
+ */
+static void finish_head(mb_mst_handle handle, enum head_end end)
+{
+	struct req_slot *slot = head_slot(handle);
+	struct slave_stat *st = &handle->slaves[slot->req.slave_addr];
+	bool is_timeout = end != HEAD_END_REPLY;
+
+	if (!slot->sends) {
+		st->fast_fails++;
+	} else if (end == HEAD_END_TIMEOUT) {
+		handle->link.timeouts++;
+		slave_on_timeout(st);
+	} else {
+		slave_on_reply(st, slot);
+		if (end == HEAD_END_REPLY)
+			st->ok++;
+	}
+
+	mb_mst_pdu_resp resp = slot->req.resp;
+	void *arg = slot->req.arg;
+	bool cancelled = slot->cancelled;
+
+	// 异常响应把异常码交给回调, 超时不带数据
+	uint8_t ex_code = handle->msg_state.ex_code;
+	uint8_t *data = handle->msg_state.r_data;
+	size_t len = handle->msg_state.r_data_len;
+	if (end == HEAD_END_EXCEPTION) {
+		data = &ex_code;
+		len = 1;
+	} else if (end == HEAD_END_TIMEOUT) {
+		data = NULL;
+		len = 0;
+	}
+
+	release_slot(handle, 0);
+
+	if (!cancelled)
+		resp(data, len, is_timeout, arg);
+}
+
 static bool _recv_parser(mb_mst_handle handle);		 // 解析数据
 static void _dispatch_rtu_msg(mb_mst_handle handle); // 处理数据
 
@@ -105,12 +341,17 @@ static inline size_t get_rx_queue_remain_data(const struct msg_info *p_msg)
 }
 
 /**
- * @brief 右移左滑动窗口
+ * @brief 右移左滑动窗口, 丢弃未完成的帧时记为一次重同步
  * 
- * @param p_msg 
+ * @param handle 主机句柄
  */
-static void rebase_parser(struct msg_info *p_msg)
+static void rebase_parser(mb_mst_handle handle)
 {
+	struct msg_info *p_msg = &handle->msg_state;
+
+	if (p_msg->state != RX_STATE_ADDR)
+		handle->link.resyncs++;
+
 	p_msg->state = RX_STATE_ADDR;
 	p_msg->rx_q.rd = p_msg->anchor + 1;
 
@@ -138,7 +379,7 @@ static void flush_parser(struct msg_info *p_msg)
  * @return true 
  * @return false 
  */
-static bool check_request_valid(struct mb_mst_request *request)
+static bool check_request_valid(const struct mb_mst_request *request)
 {
 	// 空指针 无响应回调 寄存器范围过大 未设置超时时间
 	if (!request || !request->resp || request->reg_len > MODBUS_REG_NUM_MAX || !request->timeout_ms)
@@ -151,8 +392,9 @@ static bool check_request_valid(struct mb_mst_request *request)
 	case MODBUS_FUN_WR_REG_MUL:
 		// 写功能码
 
-		// 无数据 数据长度为0 写入寄存器长度超过buffer最大长度
-		if (!request->data || !request->data_len || request->reg_len * 2 > request->data_len)
+		// 无数据 数据长度为0 写入寄存器长度超过buffer最大长度 超过单次写上限
+		if (!request->data || !request->data_len || request->reg_len * 2 > request->data_len ||
+			request->reg_len > MODBUS_WR_REG_NUM_MAX)
 			return false;
 
 		break;
@@ -173,14 +415,13 @@ static bool check_request_valid(struct mb_mst_request *request)
 static bool _recv_parser(mb_mst_handle handle)
 {
 	// 无请求不接收
-	if (!handle || is_queue_empty(&handle->msg_state.tx_q))
+	if (!handle || !handle->fifo_len)
 		return false;
 
 	uint8_t c;
 
 	struct msg_info *p_msg = &handle->msg_state;
-	struct mb_mst_request *request = NULL;
-	queue_peek(&handle->msg_state.tx_q, (uint8_t *)&request, 1); // 不出队 只查询
+	const struct mb_mst_request *request = &head_slot(handle)->req;
 
 	while (check_rx_queue_remain_data(p_msg)) {
 		c = get_rx_queue_remain_data(p_msg);
@@ -189,25 +430,38 @@ static bool _recv_parser(mb_mst_handle handle)
 		case RX_STATE_ADDR:
 			if (request->slave_addr == c) {
 				p_msg->state = RX_STATE_FUNC;
+				p_msg->ex_code = 0;
 				p_msg->cal_crc = crc16_update(0xffff, c);
 			} else
-				rebase_parser(p_msg);
+				rebase_parser(handle);
 			break;
 		case RX_STATE_FUNC:
-			if (c == MODBUS_FUN_RD_REG_MUL) {
+			// 功能码必须与请求一致, 或为该功能码的异常响应
+			if (c == (request->func | MODBUS_EXCEPTION_FLAG)) {
+				p_msg->state = RX_STATE_EX_CODE;
+				p_msg->cal_crc = crc16_update(p_msg->cal_crc, c);
+			} else if (c != request->func)
+				rebase_parser(handle);
+			else if (c == MODBUS_FUN_RD_REG_MUL) {
 				p_msg->state = RX_STATE_DATA_LEN;
 				p_msg->cal_crc = crc16_update(p_msg->cal_crc, c);
 
 			} else if (c == MODBUS_FUN_WR_REG_MUL) {
+				p_msg->r_data_len = 0;
 				p_msg->pdu_in = 0;
 				p_msg->pdu_len = MODBUS_REG_BYTES_NUM;
 				p_msg->state = RX_STATE_REG;
 				p_msg->cal_crc = crc16_update(p_msg->cal_crc, c);
 			} else
-				rebase_parser(p_msg);
+				rebase_parser(handle);
 			break;
 
 		case RX_STATE_DATA_LEN:
+			// 字节数必须与请求的寄存器数量一致, 防止越界写入接收缓冲
+			if (!c || c != request->reg_len * 2 || c > sizeof(p_msg->r_data)) {
+				rebase_parser(handle);
+				break;
+			}
 			p_msg->pdu_in = 0;
 			p_msg->pdu_len = c;
 			p_msg->state = RX_STATE_DATA;
@@ -247,15 +501,36 @@ static bool _recv_parser(mb_mst_handle handle)
 			}
 			break;
 
+		case RX_STATE_EX_CODE:
+			// 异常码为0不合法, 0代表正常回复
+			if (!c) {
+				rebase_parser(handle);
+				break;
+			}
+			p_msg->ex_code = c;
+			p_msg->r_data_len = 0;
+			p_msg->pdu_in = 0;
+			p_msg->pdu_len = MODBUS_CRC_BYTES_NUM;
+			p_msg->state = RX_STATE_CRC;
+			p_msg->cal_crc = crc16_update(p_msg->cal_crc, c);
+			break;
+
 		case RX_STATE_CRC:
 			p_msg->recv_crc[p_msg->pdu_in++] = c;
 			if (p_msg->pdu_in >= p_msg->pdu_len) {
+				struct slave_stat *st = &handle->slaves[request->slave_addr];
 				uint16_t recv_crc = COMBINE_U8_TO_U16(p_msg->recv_crc[1], p_msg->recv_crc[0]);
 				if (p_msg->cal_crc == recv_crc) {
+					st->rx_frames++;
+					st->rx_bytes += p_msg->forward - p_msg->anchor;
+					handle->link.rx_frames++;
 					flush_parser(p_msg);
 					return true;
-				} else
-					rebase_parser(p_msg);
+				} else {
+					st->crc_errors++;
+					handle->link.crc_errors++;
+					rebase_parser(handle);
+				}
 			}
 			break;
 		default:
@@ -272,50 +547,34 @@ static bool _recv_parser(mb_mst_handle handle)
  */
 static void _dispatch_rtu_msg(mb_mst_handle handle)
 {
-	if (!handle || is_queue_empty(&handle->msg_state.tx_q))
+	if (!handle || !handle->fifo_len)
 		return;
 
-	struct mb_mst_request *request = NULL;
-
-	// 出队请求
-	queue_get(&handle->msg_state.tx_q, (uint8_t *)&request, 1);
-	request->resp(
-		handle->msg_state.r_data, handle->msg_state.r_data_len, false); // 用户回调(未超时)
-}
-
-/**
- * @brief 检查当前请求回复是否超时
- * 
- * @param handle 主机句柄
- * @param request 请求包
- * @return true 超时
- * @return false 未超时
- */
-static bool check_timeout(mb_mst_handle handle, struct mb_mst_request *request)
-{
-	if (!handle || !check_request_valid(request))
-		return false;
-
-	bool ret = (request->_hide_[TIMEOUT_IDX] == 0) ? true : false; // 0超时 初始也算一次
+	uint8_t ex_code = handle->msg_state.ex_code;
+	if (!ex_code) {
+		finish_head(handle, HEAD_END_REPLY); // 用户回调(未超时)
+		return;
+	}
 
-	request->_hide_[TIMEOUT_IDX] += handle->period_ms;
-	if (request->_hide_[TIMEOUT_IDX] >= request->timeout_ms)
-		request->_hide_[TIMEOUT_IDX] = 0;
+	handle->slaves[head_slot(handle)->req.slave_addr].exceptions++;
+	handle->link.exceptions[ex_code < MODBUS_EX_CODE_NUM ? ex_code : 0]++;
 
-	return ret;
+	finish_head(handle, HEAD_END_EXCEPTION); // 用户回调(失败)
 }
 
 /**
  * @brief 发送请求
  * 
  * @param handle 主机句柄
- * @param request 请求包
+ * @param slot 请求
  */
-static void _request_pdu(mb_mst_handle handle, struct mb_mst_request *request)
+static void _request_pdu(mb_mst_handle handle, struct req_slot *slot)
 {
-	if (!handle || !check_request_valid(request))
+	if (!handle || !slot)
 		return;
 
+	const struct mb_mst_request *request = &slot->req;
+
 	uint8_t temp_buf[256] = { 0 };
 	uint16_t idx = 0;
 	temp_buf[idx++] = request->slave_addr;
@@ -340,40 +599,77 @@ static void _request_pdu(mb_mst_handle handle, struct mb_mst_request *request)
 	temp_buf[idx++] = GET_U8_LOW_FROM_U16(crc);
 	temp_buf[idx++] = GET_U8_HIGH_FROM_U16(crc);
 
-	handle->opts->f_dir_ctrl(modbus_serial_dir_tx_only); // 切换到发送模式
-	handle->opts->f_write(temp_buf, idx);
+	handle->opts->f_dir_ctrl(modbus_serial_dir_tx_only, handle->opts->arg); // 切换到发送模式
+	handle->opts->f_write(temp_buf, idx, handle->opts->arg);
+
+	struct slave_stat *st = &handle->slaves[request->slave_addr];
+	st->tx_frames++;
+	st->tx_bytes += idx;
+	handle->link.tx_frames++;
+	handle->link.tx_bytes += idx;
+
+	// 超时从发送时刻开始计算
+	handle->head_sent = true;
+	slot->sends++;
+	slot->sent_us = now_us();
+	slot->deadline_us = slot->sent_us + slave_rto_us(st, slot);
 
 	if (handle->opts->f_check_send)
 		handle->is_sending = true; // DMA发送
 	else
-		handle->opts->f_dir_ctrl(modbus_serial_dir_rx_only); // 轮训发送
+		handle->opts->f_dir_ctrl(modbus_serial_dir_rx_only, handle->opts->arg); // 轮训发送
 }
 
 /**
- * @brief 从发送队列中取出数据, 并发送
+ * @brief 发送队首请求; 超时则立即重发, 重发完后回调超时并发送下一个请求
  * 
  * @param handle 
  */
 static void master_write(mb_mst_handle handle)
 {
-	if (!handle || is_queue_empty(&handle->msg_state.tx_q))
+	if (!handle)
 		return;
 
-	struct mb_mst_request *request = NULL;
-	queue_peek(&handle->msg_state.tx_q, (uint8_t *)&request, 1); // 不出队 只查询
+	struct req_slot *slot = NULL;
+
+	while ((slot = head_slot(handle))) {
+		struct slave_stat *st = &handle->slaves[slot->req.slave_addr];
 
-	// 需要重发
-	if (request->_hide_[REPEAT_IDX] < MASTER_REPEATS) {
-		if (!check_timeout(handle, request))
+		// 新请求
+		if (!handle->head_sent) {
+			slot->sends = 0;
+			slot->max_sends = MASTER_REPEATS;
+
+			if (st->health == MB_MST_SLAVE_OFFLINE || st->health == MB_MST_SLAVE_PROBING) {
+				// 熔断中直接失败, 不占用总线
+				if (st->health == MB_MST_SLAVE_PROBING || now_us() < st->next_probe_us) {
+					finish_head(handle, HEAD_END_TIMEOUT); // 用户回调(超时)
+					continue;
+				}
+
+				// 到达探测时刻, 只发送一次
+				st->health = MB_MST_SLAVE_PROBING;
+				slot->max_sends = 1;
+			}
+
+			_request_pdu(handle, slot);
 			return;
+		}
 
-		_request_pdu(handle, request); // 每超时一次发送一次
-	} else {
-		// 重发完 才出队
-		request->_hide_[REPEAT_IDX] = 0;
-		queue_get(&handle->msg_state.tx_q, (uint8_t *)&request, 1);
-		request->resp(
-			handle->msg_state.r_data, handle->msg_state.r_data_len, true); // 用户回调(超时)
+		// 未超时
+		if (now_us() < slot->deadline_us)
+			return;
+
+		// 超时立即重发, 已取消的请求不再重发
+		if (!slot->cancelled && slot->sends < slot->max_sends) {
+			st->retries++;
+			handle->link.retries++;
+			_request_pdu(handle, slot);
+			return;
+		}
+
+		// 重发完 才出队, 继续发送下一个请求
+		finish_head(handle, HEAD_END_TIMEOUT); // 用户回调(超时)
 	}
 }
 
@@ -386,10 +682,12 @@ static void master_read(mb_mst_handle handle)
 
 	uint8_t temp_buf[MODBUS_FRAME_BYTES_MAX] = { 0 };
 
-	ptk_len = handle->opts->f_read(temp_buf, MODBUS_FRAME_BYTES_MAX);
+	ptk_len = handle->opts->f_read(temp_buf, MODBUS_FRAME_BYTES_MAX, handle->opts->arg);
 	if (!ptk_len) // 无数据
 		return;
 
+	handle->link.rx_bytes += ptk_len;
+
 	size_t ret_q = queue_add(&(handle->msg_state.rx_q), temp_buf, ptk_len);
 	if (ret_q != ptk_len)
 		return; // 空间不足
@@ -400,6 +698,10 @@ static void master_read(mb_mst_handle handle)
 		return;
 
 	_dispatch_rtu_msg(handle); // 处理数据帧, 调用用户回调注册表
+
+	// 收到回复后立即发送下一个请求, 不必等待下次轮询
+	if (!handle->is_sending)
+		master_write(handle);
 }
 
 /***************************API***************************/
@@ -408,11 +710,13 @@ static void master_read(mb_mst_handle handle)
  * @brief 主机初始化并申请句柄
  *
  * @param opts 读写等回调函数指针
- * @param period_ms 轮训周期
+ * @param period_ms 轮训周期(保留, 超时已改为单调时钟计时)
  * @return mb_mst_handle 成功返回句柄,失败返回NULL
  */
 mb_mst_handle mb_mst_init(struct serial_opts *opts, size_t period_ms)
 {
+	(void)period_ms;
+
 	bool ret = false;
 
 	if (!opts || !opts->f_init || !opts->f_read || !opts->f_write || !opts->f_dir_ctrl)
@@ -423,8 +727,9 @@ mb_mst_handle mb_mst_init(struct serial_opts *opts, size_t period_ms)
 		return NULL;
 
 	handle->opts = opts;
-	handle->period_ms = period_ms;
 	handle->is_sending = false;
+	handle->next_id = 1;
+	handle->link_start_us = now_us();
 
 	// 接收队列
 	ret = queue_init(
@@ -434,22 +739,14 @@ mb_mst_handle mb_mst_init(struct serial_opts *opts, size_t period_ms)
 		return NULL;
 	}
 
-	// 发送队列
-	ret = queue_init(&handle->msg_state.tx_q, sizeof(struct mb_mst_request *),
-		handle->msg_state.tx_queue_buff, MAX_REQUEST);
-	if (!ret) {
-		free(handle);
-		return NULL;
-	}
-
 	// 用户串口初始化
-	ret = opts->f_init();
+	ret = opts->f_init(opts->arg);
 	if (!ret) {
 		free(handle);
 		return NULL;
 	}
 
-	opts->f_dir_ctrl(modbus_serial_dir_rx_only);
+	opts->f_dir_ctrl(modbus_serial_dir_rx_only, opts->arg);
 
 	return handle;
 }
@@ -477,12 +774,14 @@ void mb_mst_poll(mb_mst_handle handle)
 	if (!handle)
 		return;
 
+	const struct serial_opts *opts = handle->opts;
+
 	// 发送中
-	if (handle->opts->f_check_send && handle->is_sending) {
-		bool complete = handle->opts->f_check_send();
+	if (opts->f_check_send && handle->is_sending) {
+		bool complete = opts->f_check_send(opts->arg);
 		if (complete) {
 			handle->is_sending = false;
-			handle->opts->f_dir_ctrl(modbus_serial_dir_rx_only); // 发送完成, 切回接收
+			opts->f_dir_ctrl(modbus_serial_dir_rx_only, opts->arg); // 发送完成, 切回接收
 		}
 		return;
 	}
@@ -493,17 +792,201 @@ void mb_mst_poll(mb_mst_handle handle)
 }
 
 /**
- * @brief 主机发送报文
+ * @brief 主机发送报文, 请求及写数据拷贝到请求池, 调用后请求可立即释放或修改
  * 
  * @param handle 主机句柄
  * @param request 请求结构体
+ * @return mb_mst_req_id 请求标识, 请求非法或请求池已满返回0
  */
-void mb_mst_pdu_request(mb_mst_handle handle, struct mb_mst_request *request)
+mb_mst_req_id mb_mst_pdu_request(mb_mst_handle handle, const struct mb_mst_request *request)
 {
 	if (!handle || !check_request_valid(request))
+		return 0;
+
+	if (handle->fifo_len >= MB_MST_POOL_SIZE) {
+		LOG_W("Modbus master request pool full, slave %u reg %u dropped", request->slave_addr,
+			request->reg_addr);
+		return 0;
+	}
+
+	uint8_t idx = 0;
+	while (handle->pool[idx].id)
+		idx++;
+
+	struct req_slot *slot = &handle->pool[idx];
+	slot->req = *request;
+	if (request->func == MODBUS_FUN_WR_REG_MUL) {
+		memcpy(slot->buf, request->data, request->reg_len * 2);
+		slot->req.data = slot->buf;
+		slot->req.data_len = request->reg_len * 2;
+	} else {
+		slot->req.data = NULL;
+		slot->req.data_len = 0;
+	}
+	slot->cancelled = false;
+	slot->sends = 0;
+
+	slot->id = handle->next_id++;
+	if (!handle->next_id)
+		handle->next_id = 1;
+
+	handle->fifo[handle->fifo_len++] = idx;
+
+	return slot->id;
+}
+
+/**
+ * @brief 取消请求, 取消后不会回调
+ * 
+ * 未发送的请求立即归还请求池; 已发送的请求不再重发, 等待本次超时后归还,
+ * 避免迟到的回复被下一个请求误收
+ * 
+ * @param handle 主机句柄
+ * @param id 请求标识
+ * @return true 已取消
+ * @return false 请求已完成或不存在
+ */
+bool mb_mst_cancel(mb_mst_handle handle, mb_mst_req_id id)
+{
+	if (!handle)
+		return false;
+
+	int pos = find_slot(handle, id);
+	if (pos < 0)
+		return false;
+
+	if (!pos && handle->head_sent)
+		handle->pool[handle->fifo[0]].cancelled = true;
+	else
+		release_slot(handle, pos);
+
+	return true;
+}
+
+/**
+ * @brief 查询请求状态
+ * 
+ * @param handle 主机句柄
+ * @param id 请求标识
+ * @return enum mb_mst_req_state 
+ */
+enum mb_mst_req_state mb_mst_req_state(mb_mst_handle handle, mb_mst_req_id id)
+{
+	if (!handle)
+		return MB_MST_REQ_NONE;
+
+	int pos = find_slot(handle, id);
+	if (pos < 0 || handle->pool[handle->fifo[pos]].cancelled)
+		return MB_MST_REQ_NONE;
+
+	return (!pos && handle->head_sent) ? MB_MST_REQ_IN_FLIGHT : MB_MST_REQ_QUEUED;
+}
+
+/**
+ * @brief 距离下一个超时的时间, 用于事件循环精确休眠到超时时刻
+ * 
+ * @param handle 主机句柄
+ * @return int 毫秒, 0代表已到期或有请求待发送需立即轮询, -1代表无请求
+ */
+int mb_mst_next_deadline(mb_mst_handle handle)
+{
+	if (!handle || !handle->fifo_len)
+		return -1;
+
+	if (!handle->head_sent)
+		return 0;
+
+	uint64_t deadline = head_slot(handle)->deadline_us;
+	uint64_t now = now_us();
+	if (now >= deadline)
+		return 0;
+
+	// 向上取整, 避免提前唤醒
+	uint64_t left = (deadline - now + 999) / 1000;
+	return left > INT32_MAX ? INT32_MAX : (int)left;
+}
+
+/**
+ * @brief 获取从机的健康状态与往返时间统计
+ * 
+ * @param handle 主机句柄
+ * @param slave_addr 从机地址
+ * @param stats 输出统计
+ * @return true 成功
+ * @return false 参数非法或从未向该从机发送请求
+ */
+bool mb_mst_get_slave_stats(
+	mb_mst_handle handle, uint8_t slave_addr, struct mb_mst_slave_stats *stats)
+{
+	if (!handle || !stats)
+		return false;
+
+	const struct slave_stat *st = &handle->slaves[slave_addr];
+	if (!st->ok && !st->timeouts && !st->fast_fails && !st->exceptions)
+		return false;
+
+	memset(stats, 0, sizeof(struct mb_mst_slave_stats));
+	stats->health = st->health;
+	stats->ok = st->ok;
+	stats->timeouts = st->timeouts;
+	stats->retries = st->retries;
+	stats->fast_fails = st->fast_fails;
+	stats->exceptions = st->exceptions;
+	stats->crc_errors = st->crc_errors;
+	stats->tx_frames = st->tx_frames;
+	stats->rx_frames = st->rx_frames;
+	stats->tx_bytes = st->tx_bytes;
+	stats->rx_bytes = st->rx_bytes;
+	if (handle->opts->baud)
+		stats->busy_us = MODBUS_RTU_WIRE_US(
+			st->tx_bytes + st->rx_bytes, st->tx_frames + st->rx_frames, handle->opts->baud);
+
+	if (st->has_rtt) {
+		stats->srtt_us = st->srtt_us;
+		stats->rttvar_us = st->rttvar_us;
+		stats->rtt_min_us = st->rtt_min_us;
+		stats->rtt_max_us = st->rtt_max_us;
+		stats->rto_us = st->srtt_us + 4 * st->rttvar_us;
+		if (stats->rto_us < MB_MST_RTO_MIN_MS * 1000)
+			stats->rto_us = MB_MST_RTO_MIN_MS * 1000;
+	}
+
+	if (st->health == MB_MST_SLAVE_OFFLINE) {
+		uint64_t now = now_us();
+		stats->next_probe_ms =
+			st->next_probe_us > now ? (st->next_probe_us - now + 999) / 1000 : 0;
+	}
+
+	return true;
+}
+
+/**
+ * @brief 获取串口链路统计, 并按配置的波特率估算总线占用率
+ *
+ * @param handle 主机句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零, 清零后重新计时
+ */
+void mb_mst_get_link_stats(mb_mst_handle handle, struct mb_link_stats *out, bool reset)
+{
+	if (!handle || !out)
 		return;
 
-	request->_hide_[REPEAT_IDX] = 0;
-	request->_hide_[TIMEOUT_IDX] = 0;
-	queue_add(&handle->msg_state.tx_q, (uint8_t *)&request, 1);
-}
\ No newline at end of file
+	uint64_t now = now_us();
+
+	*out = handle->link;
+	out->elapsed_us = now - handle->link_start_us;
+
+	uint32_t baud = handle->opts->baud;
+	if (baud && out->elapsed_us) {
+		out->busy_us = MODBUS_RTU_WIRE_US(
+			out->tx_bytes + out->rx_bytes, out->tx_frames + out->rx_frames, baud);
+		uint64_t pct = out->busy_us * 100 / out->elapsed_us;
+		out->occupancy_pct = pct > 100 ? 100 : (uint8_t)pct;
+	}
+
+	if (reset) {
+		memset(&handle->link, 0, sizeof(handle->link));
+		handle->link_start_us = now;
+	}
+}
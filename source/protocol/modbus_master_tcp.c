@@ -0,0 +1,991 @@
+/**
+ * @file modbus_master_tcp.c
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus主机 TCP(MBAP) 及 RTU over TCP 传输层
+ * @version 1.0
+ * @date 2024-12-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "utils/crc.h"
+#include "utils/logger.h"
+#include "protocol/modbus_master_tcp.h"
+
+// 单个连接的收发缓冲, 发送缓冲可容纳流水线上限的请求
+#define CONN_RX_BUFF_SIZE (MODBUS_TCP_FRAME_BYTES_MAX * 4)
+#define CONN_TX_BUFF_SIZE (MODBUS_TCP_FRAME_BYTES_MAX * MB_MST_TCP_PIPELINE)
+
+// MBAP头各字段偏移
+#define MBAP_TID_OFFSET (0)	 // 事务标识
+#define MBAP_PID_OFFSET (2)	 // 协议标识
+#define MBAP_LEN_OFFSET (4)	 // 后续字节数(单元标识 + PDU)
+#define MBAP_UNIT_OFFSET (6) // 单元标识
+
+#define NO_SLOT (-1) // 链表结束
+
+// 事务标识低8位为请求池下标
+_Static_assert(MB_MST_TCP_POOL_SIZE <= 256, "pool index must fit in the low byte of tid");
+
+// 请求状态
+enum slot_state {
+	SLOT_FREE = 0, // 空闲
+	SLOT_QUEUED,   // 排队等待发送
+	SLOT_SENT,	   // 已发送等待回复
+};
+
+// 请求池中的请求
+struct tcp_slot {
+	struct mb_mst_request req;				// 请求拷贝, data指向buf
+	uint8_t buf[MODBUS_WR_REG_NUM_MAX * 2];	// 写数据拷贝
+	mb_mst_req_id id;						// 请求标识
+	enum slot_state state;					// 状态
+	int conn;								// 所属连接
+	uint8_t gen;							// 发送代数, 作为事务标识高8位
+	uint16_t tid;							// 事务标识
+	int next;								// 同一连接排队链表的下一个
+	uint64_t deadline_us;					// 超时时刻, 提交时确定, 排队期间同样计时
+};
+
+// 服务端连接
+struct tcp_conn {
+	int fd;					   // 套接字, -1代表未连接
+	bool used;				   // 已添加
+	bool connecting;		   // 非阻塞连接中
+	enum mb_mst_tcp_mode mode; // 连接模式
+	struct sockaddr_in addr;   // 服务端地址
+	uint64_t retry_us;		   // 重连时刻
+	uint64_t connect_us;	   // 非阻塞连接超时时刻
+	int q_head;				   // 排队链表头
+	int q_tail;				   // 排队链表尾
+	size_t in_flight;		   // 在途事务数
+	int rtu_slot;			   // RTU模式下在途的请求
+
+	uint8_t rx_buf[CONN_RX_BUFF_SIZE]; // 接收缓冲
+	size_t rx_len;					   // 接收长度
+
+	uint8_t tx_buf[CONN_TX_BUFF_SIZE]; // 发送缓冲
+	size_t tx_len;					   // 待发送长度
+};
+
+// TCP主机
+struct mb_mst_tcp {
+	int epoll_fd;								// epoll描述符
+	struct tcp_conn conns[MB_MST_TCP_MAX_CONN];	// 服务端连接
+	struct tcp_slot pool[MB_MST_TCP_POOL_SIZE];	// 请求池
+	mb_mst_req_id next_id;						// 下一个请求标识
+};
+
+/**
+ * @brief 获取单调时钟(微秒)
+ * 
+ * @return uint64_t 
+ */
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 检查请求包是否合法
+ * 
+ * @param request 
+ * @return true 
+ * @return false 
+ */
+static bool check_request_valid(const struct mb_mst_request *request)
+{
+	if (!request || !request->resp || !request->reg_len || !request->timeout_ms)
+		return false;
+
+	switch (request->func) {
+	case MODBUS_FUN_RD_REG_MUL:
+		return request->reg_len <= MODBUS_RD_REG_NUM_MAX;
+	case MODBUS_FUN_WR_REG_MUL:
+		return request->data && request->reg_len <= MODBUS_WR_REG_NUM_MAX &&
+			   request->reg_len * 2 <= request->data_len;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief 同一时间允许在途的事务数
+ * 
+ * @param conn 
+ * @return size_t 
+ */
+static inline size_t conn_window(const struct tcp_conn *conn)
+{
+	return conn->mode == MB_MST_TCP_MODE_RTU ? 1 : MB_MST_TCP_PIPELINE;
+}
+
+/**
+ * @brief 归还请求池并回调, 先归还再回调, 回调中可以再次提交请求
+ * 
+ * @param handle TCP主机句柄
+ * @param slot 请求
+ * @param data 读功能码接收到的数据, 异常回复时为异常码
+ * @param len 数据长度, 异常回复时为1
+ * @param is_timeout 超时或异常回复
+ */
+static void slot_finish(
+	mb_mst_tcp_handle handle, struct tcp_slot *slot, uint8_t *data, size_t len, bool is_timeout)
+{
+	struct tcp_conn *conn = &handle->conns[slot->conn];
+	mb_mst_pdu_resp resp = slot->req.resp;
+	void *arg = slot->req.arg;
+
+	if (slot->state == SLOT_SENT && conn->in_flight)
+		conn->in_flight--;
+	if (conn->rtu_slot == slot - handle->pool)
+		conn->rtu_slot = NO_SLOT;
+
+	slot->state = SLOT_FREE;
+	slot->id = 0;
+
+	resp(data, len, is_timeout, arg);
+}
+
+/**
+ * @brief 从排队链表中取下所有请求
+ * 
+ * @param conn 
+ * @return int 原链表头
+ */
+static int conn_detach_queue(struct tcp_conn *conn)
+{
+	int head = conn->q_head;
+	conn->q_head = conn->q_tail = NO_SLOT;
+	return head;
+}
+
+/**
+ * @brief 从排队链表中摘除一个请求
+ * 
+ * @param handle TCP主机句柄
+ * @param conn 服务端连接
+ * @param idx 请求池下标
+ */
+static void conn_unlink(mb_mst_tcp_handle handle, struct tcp_conn *conn, int idx)
+{
+	int *link = &conn->q_head;
+	int prev = NO_SLOT;
+
+	while (*link != idx) {
+		prev = *link;
+		link = &handle->pool[*link].next;
+	}
+	*link = handle->pool[idx].next;
+	if (conn->q_tail == idx)
+		conn->q_tail = prev;
+}
+
+/**
+ * @brief 让已取下的排队请求全部失败
+ * 
+ * @param handle TCP主机句柄
+ * @param head 链表头
+ */
+static void fail_queue(mb_mst_tcp_handle handle, int head)
+{
+	while (head != NO_SLOT) {
+		struct tcp_slot *slot = &handle->pool[head];
+		head = slot->next;
+		if (slot->state == SLOT_QUEUED)
+			slot_finish(handle, slot, NULL, 0, true);
+	}
+}
+
+/**
+ * @brief 根据连接状态更新监听事件
+ *
+ * @param handle TCP主机句柄
+ * @param conn 服务端连接
+ */
+static void conn_update_events(mb_mst_tcp_handle handle, struct tcp_conn *conn)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	if (conn->tx_len || conn->connecting)
+		ev.events |= EPOLLOUT;
+	ev.data.u32 = conn - handle->conns;
+
+	if (epoll_ctl(handle->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0)
+		LOG_E("Modify modbus tcp master conn events failed: %s", strerror(errno));
+}
+
+/**
+ * @brief 关闭连接, 在途与排队的请求全部失败, 稍后重连
+ *
+ * @param handle TCP主机句柄
+ * @param conn 服务端连接
+ */
+static void conn_close(mb_mst_tcp_handle handle, struct tcp_conn *conn)
+{
+	if (conn->fd < 0)
+		return;
+
+	epoll_ctl(handle->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+
+	conn->fd = -1;
+	conn->connecting = false;
+	conn->rx_len = 0;
+	conn->tx_len = 0;
+	conn->retry_us = now_us() + MB_MST_TCP_RECONNECT_MS * 1000ULL;
+
+	int idx = conn - handle->conns;
+	int queued = conn_detach_queue(conn);
+
+	// 先标记再回调, 回调中提交的新请求不受影响
+	int sent[MB_MST_TCP_POOL_SIZE];
+	size_t sent_num = 0;
+	for (int i = 0; i < MB_MST_TCP_POOL_SIZE; i++) {
+		if (handle->pool[i].state == SLOT_SENT && handle->pool[i].conn == idx)
+			sent[sent_num++] = i;
+	}
+
+	for (size_t i = 0; i < sent_num; i++)
+		slot_finish(handle, &handle->pool[sent[i]], NULL, 0, true);
+	fail_queue(handle, queued);
+}
+
+/**
+ * @brief 发起非阻塞连接
+ *
+ * @param handle TCP主机句柄
+ * @param conn 服务端连接
+ * @return true 已连接或连接中
+ * @return false 失败
+ */
+static bool conn_open(mb_mst_tcp_handle handle, struct tcp_conn *conn)
+{
+	conn->retry_us = now_us() + MB_MST_TCP_RECONNECT_MS * 1000ULL;
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		LOG_E("Create modbus tcp master socket failed: %s", strerror(errno));
+		return false;
+	}
+
+	// 请求回复都是小包, 关闭Nagle降低延时
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+	conn->connecting = false;
+	if (connect(fd, (struct sockaddr *)&conn->addr, sizeof(conn->addr)) < 0) {
+		if (errno != EINPROGRESS) {
+			LOG_W("Connect modbus tcp server failed: %s", strerror(errno));
+			goto err_close;
+		}
+		conn->connecting = true;
+		conn->connect_us = now_us() + MB_MST_TCP_CONNECT_TIMEOUT_MS * 1000ULL;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP | (conn->connecting ? EPOLLOUT : 0);
+	ev.data.u32 = conn - handle->conns;
+	if (epoll_ctl(handle->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		LOG_E("Add modbus tcp master conn to epoll failed: %s", strerror(errno));
+		goto err_close;
+	}
+
+	conn->fd = fd;
+	conn->rx_len = 0;
+	conn->tx_len = 0;
+	conn->in_flight = 0;
+	conn->rtu_slot = NO_SLOT;
+
+	return true;
+
+err_close:
+	close(fd);
+	conn->connecting = false;
+	return false;
+}
+
+/**
+ * @brief 尽可能发送缓冲中的请求
+ *
+ * @param conn 服务端连接
+ * @return true 正常
+ * @return false 连接异常, 需要关闭
+ */
+static bool conn_flush(struct tcp_conn *conn)
+{
+	size_t sent = 0;
+
+	while (sent < conn->tx_len) {
+		ssize_t n = send(conn->fd, conn->tx_buf + sent, conn->tx_len - sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return false;
+		}
+		sent += n;
+	}
+
+	if (sent) {
+		conn->tx_len -= sent;
+		memmove(conn->tx_buf, conn->tx_buf + sent, conn->tx_len);
+	}
+
+	return true;
+}
+
+/**
+ * @brief 读取服务端数据
+ *
+ * @param conn 服务端连接
+ * @return true 正常
+ * @return false 对端关闭或连接异常, 需要关闭
+ */
+static bool conn_read(struct tcp_conn *conn)
+{
+	while (conn->rx_len < CONN_RX_BUFF_SIZE) {
+		size_t room = CONN_RX_BUFF_SIZE - conn->rx_len;
+		ssize_t n = recv(conn->fd, conn->rx_buf + conn->rx_len, room, 0);
+		if (n == 0)
+			return false; // 对端关闭
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+		conn->rx_len += n;
+	}
+
+	return true;
+}
+
+/**
+ * @brief 在发送缓冲末尾追加一帧请求
+ *
+ * @param conn 服务端连接
+ * @param slot 请求
+ */
+static void conn_append_request(struct tcp_conn *conn, const struct tcp_slot *slot)
+{
+	const struct mb_mst_request *req = &slot->req;
+	uint8_t *out = conn->tx_buf + conn->tx_len;
+	uint16_t idx = 0;
+
+	if (conn->mode == MB_MST_TCP_MODE_MBAP) {
+		uint16_t pdu_len = 5 + (req->func == MODBUS_FUN_WR_REG_MUL ? 1 + req->reg_len * 2 : 0);
+
+		out[idx++] = GET_U8_HIGH_FROM_U16(slot->tid);
+		out[idx++] = GET_U8_LOW_FROM_U16(slot->tid);
+		out[idx++] = GET_U8_HIGH_FROM_U16(MODBUS_TCP_PROTOCOL_ID);
+		out[idx++] = GET_U8_LOW_FROM_U16(MODBUS_TCP_PROTOCOL_ID);
+		out[idx++] = GET_U8_HIGH_FROM_U16(pdu_len + 1);
+		out[idx++] = GET_U8_LOW_FROM_U16(pdu_len + 1);
+	}
+
+	out[idx++] = req->slave_addr;
+	out[idx++] = req->func;
+	out[idx++] = GET_U8_HIGH_FROM_U16(req->reg_addr);
+	out[idx++] = GET_U8_LOW_FROM_U16(req->reg_addr);
+	out[idx++] = GET_U8_HIGH_FROM_U16(req->reg_len);
+	out[idx++] = GET_U8_LOW_FROM_U16(req->reg_len);
+
+	if (req->func == MODBUS_FUN_WR_REG_MUL) {
+		out[idx++] = req->reg_len * 2;
+		memcpy(&out[idx], req->data, req->reg_len * 2);
+		idx += req->reg_len * 2;
+	}
+
+	if (conn->mode == MB_MST_TCP_MODE_RTU) {
+		uint16_t crc = crc16_update_bytes(0xFFFF, out, idx);
+		out[idx++] = GET_U8_LOW_FROM_U16(crc);
+		out[idx++] = GET_U8_HIGH_FROM_U16(crc);
+	}
+
+	conn->tx_len += idx;
+}
+
+/**
+ * @brief 在窗口与发送缓冲允许的范围内发送排队的请求
+ *
+ * @param handle TCP主机句柄
+ * @param conn 服务端连接
+ * @return true 正常
+ * @return false 连接异常, 需要关闭
+ */
+static bool conn_pump(mb_mst_tcp_handle handle, struct tcp_conn *conn)
+{
+	if (conn->fd < 0 || conn->connecting)
+		return true;
+
+	while (conn->q_head != NO_SLOT && conn->in_flight < conn_window(conn) &&
+		   CONN_TX_BUFF_SIZE - conn->tx_len >= MODBUS_TCP_FRAME_BYTES_MAX) {
+		int idx = conn->q_head;
+		struct tcp_slot *slot = &handle->pool[idx];
+
+		conn->q_head = slot->next;
+		if (conn->q_head == NO_SLOT)
+			conn->q_tail = NO_SLOT;
+
+		slot->gen++;
+		slot->tid = ((uint16_t)slot->gen << 8) | idx;
+		slot->state = SLOT_SENT;
+
+		conn_append_request(conn, slot);
+		conn->in_flight++;
+		if (conn->mode == MB_MST_TCP_MODE_RTU)
+			conn->rtu_slot = idx;
+	}
+
+	return conn_flush(conn);
+}
+
+/**
+ * @brief 校验回复PDU并回调
+ *
+ * @param handle TCP主机句柄
+ * @param slot 对应的请求
+ * @param pdu 回复PDU(功能码 + 数据)
+ * @param pdu_len PDU长度
+ */
+static void deliver(mb_mst_tcp_handle handle, struct tcp_slot *slot, uint8_t *pdu, size_t pdu_len)
+{
+	const struct mb_mst_request *req = &slot->req;
+
+	if (pdu[0] == (req->func | MODBUS_EXCEPTION_FLAG)) {
+		LOG_W("Modbus tcp slave %u exception 0x%02x", req->slave_addr, pdu_len > 1 ? pdu[1] : 0);
+		if (pdu_len != 2 || !pdu[1])
+			goto err_fail;
+		slot_finish(handle, slot, &pdu[1], 1, true); // 异常码交给回调
+		return;
+	}
+
+	if (pdu[0] != req->func)
+		goto err_fail;
+
+	if (req->func == MODBUS_FUN_RD_REG_MUL) {
+		if (pdu_len < 2 || pdu[1] != req->reg_len * 2 || pdu_len != 2u + pdu[1])
+			goto err_fail;
+		slot_finish(handle, slot, &pdu[2], pdu[1], false);
+		return;
+	}
+
+	if (pdu_len != 5 || COMBINE_U8_TO_U16(pdu[1], pdu[2]) != req->reg_addr ||
+		COMBINE_U8_TO_U16(pdu[3], pdu[4]) != req->reg_len)
+		goto err_fail;
+	slot_finish(handle, slot, &pdu[1], 0, false);
+	return;
+
+err_fail:
+	slot_finish(handle, slot, NULL, 0, true);
+}
+
+/**
+ * @brief 解析MBAP回复, 按事务标识匹配请求, 可乱序
+ *
+ * @param handle TCP主机句柄
+ * @param conn 服务端连接
+ * @return true 正常
+ * @return false 协议错误, 需要关闭
+ */
+static bool conn_process_mbap(mb_mst_tcp_handle handle, struct tcp_conn *conn)
+{
+	size_t offset = 0;
+	int idx = conn - handle->conns;
+
+	while (conn->rx_len - offset >= MODBUS_TCP_MBAP_BYTES_NUM) {
+		uint8_t *adu = conn->rx_buf + offset;
+		uint16_t pid = COMBINE_U8_TO_U16(adu[MBAP_PID_OFFSET], adu[MBAP_PID_OFFSET + 1]);
+		uint16_t len = COMBINE_U8_TO_U16(adu[MBAP_LEN_OFFSET], adu[MBAP_LEN_OFFSET + 1]);
+
+		// MBAP非法, TCP流无法再同步, 直接断开
+		if (pid != MODBUS_TCP_PROTOCOL_ID || len < 2 || len > MODBUS_PDU_BYTES_MAX + 1) {
+			LOG_W("Invalid MBAP header, pid:0x%04x len:%u", pid, len);
+			return false;
+		}
+
+		if (conn->rx_len - offset < (size_t)MBAP_UNIT_OFFSET + len)
+			break; // 断包, 等待后续数据
+
+		offset += MBAP_UNIT_OFFSET + len;
+
+		// 超时或取消后迟到的回复直接丢弃
+		uint16_t tid = COMBINE_U8_TO_U16(adu[MBAP_TID_OFFSET], adu[MBAP_TID_OFFSET + 1]);
+		if ((tid & 0xFF) >= MB_MST_TCP_POOL_SIZE)
+			continue;
+		struct tcp_slot *slot = &handle->pool[tid & 0xFF];
+		if (slot->state != SLOT_SENT || slot->conn != idx || slot->tid != tid ||
+			adu[MBAP_UNIT_OFFSET] != slot->req.slave_addr)
+			continue;
+
+		deliver(handle, slot, &adu[MODBUS_TCP_MBAP_BYTES_NUM], len - 1);
+	}
+
+	if (offset) {
+		conn->rx_len -= offset;
+		memmove(conn->rx_buf, conn->rx_buf + offset, conn->rx_len);
+	}
+
+	return true;
+}
+
+/**
+ * @brief 解析RTU over TCP回复, 按在途请求推算帧长, CRC错误时丢弃缓冲等待超时
+ *
+ * @param handle TCP主机句柄
+ * @param conn 服务端连接
+ */
+static void conn_process_rtu(mb_mst_tcp_handle handle, struct tcp_conn *conn)
+{
+	// 无在途请求, 丢弃
+	if (conn->rtu_slot == NO_SLOT) {
+		conn->rx_len = 0;
+		return;
+	}
+
+	struct tcp_slot *slot = &handle->pool[conn->rtu_slot];
+	uint8_t *p = conn->rx_buf;
+	size_t frame_len = 0;
+
+	if (conn->rx_len < 3)
+		return;
+
+	if (p[0] != slot->req.slave_addr)
+		goto err_drop;
+
+	if (p[1] == (slot->req.func | MODBUS_EXCEPTION_FLAG)) {
+		frame_len = 3 + MODBUS_CRC_BYTES_NUM;
+	} else if (p[1] == MODBUS_FUN_RD_REG_MUL) {
+		// 字节数由服务端给出, 与请求不符时不能用于推算帧长
+		if (slot->req.func != MODBUS_FUN_RD_REG_MUL || p[2] != slot->req.reg_len * 2)
+			goto err_drop;
+		frame_len = 3 + p[2] + MODBUS_CRC_BYTES_NUM;
+	} else if (p[1] == MODBUS_FUN_WR_REG_MUL) {
+		frame_len = 6 + MODBUS_CRC_BYTES_NUM;
+	} else {
+		goto err_drop;
+	}
+
+	if (conn->rx_len < frame_len)
+		return; // 断包, 等待后续数据
+
+	uint16_t crc = crc16_update_bytes(0xFFFF, p, frame_len - MODBUS_CRC_BYTES_NUM);
+	if (crc != COMBINE_U8_TO_U16(p[frame_len - 1], p[frame_len - 2]))
+		goto err_drop;
+
+	// 回调中可能发送新请求, 先拷贝PDU再移出缓冲
+	uint8_t pdu[MODBUS_PDU_BYTES_MAX];
+	size_t pdu_len = frame_len - 1 - MODBUS_CRC_BYTES_NUM;
+	memcpy(pdu, &p[1], pdu_len);
+
+	conn->rx_len -= frame_len;
+	memmove(conn->rx_buf, conn->rx_buf + frame_len, conn->rx_len);
+
+	deliver(handle, slot, pdu, pdu_len);
+	return;
+
+err_drop:
+	LOG_W("Invalid modbus rtu over tcp frame, drop %zu bytes", conn->rx_len);
+	conn->rx_len = 0;
+}
+
+/**
+ * @brief 处理单个连接的事件
+ *
+ * @param handle TCP主机句柄
+ * @param conn 服务端连接
+ * @param events 触发的事件
+ */
+static void conn_handle(mb_mst_tcp_handle handle, struct tcp_conn *conn, uint32_t events)
+{
+	if (conn->fd < 0)
+		return;
+
+	if (events & EPOLLERR)
+		goto err_close;
+
+	// 非阻塞连接完成
+	if (conn->connecting && (events & EPOLLOUT)) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+			LOG_W("Connect modbus tcp server failed: %s", strerror(err ? err : errno));
+			goto err_close;
+		}
+		conn->connecting = false;
+	}
+
+	if ((events & EPOLLOUT) && !conn_flush(conn))
+		goto err_close;
+
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+		bool alive = conn_read(conn);
+
+		if (conn->mode == MB_MST_TCP_MODE_RTU)
+			conn_process_rtu(handle, conn);
+		else if (!conn_process_mbap(handle, conn))
+			goto err_close;
+
+		if (!alive || conn->fd < 0)
+			goto err_close; // 对端关闭
+	}
+
+	if (!conn_pump(handle, conn))
+		goto err_close;
+
+	conn_update_events(handle, conn);
+	return;
+
+err_close:
+	conn_close(handle, conn);
+}
+
+/**
+ * @brief 连接、在途与排队请求的超时处理
+ *
+ * @param handle TCP主机句柄
+ * @param now 当前时刻
+ */
+static void check_timeouts(mb_mst_tcp_handle handle, uint64_t now)
+{
+	// 服务端不响应SYN时不等内核放弃连接, 关闭后按间隔重连
+	for (size_t i = 0; i < MB_MST_TCP_MAX_CONN; i++) {
+		struct tcp_conn *conn = &handle->conns[i];
+		if (conn->fd >= 0 && conn->connecting && now >= conn->connect_us) {
+			LOG_W("Connect modbus tcp server timeout");
+			conn_close(handle, conn);
+		}
+	}
+
+	for (int i = 0; i < MB_MST_TCP_POOL_SIZE; i++) {
+		struct tcp_slot *slot = &handle->pool[i];
+		if (slot->state == SLOT_FREE || now < slot->deadline_us)
+			continue;
+
+		struct tcp_conn *conn = &handle->conns[slot->conn];
+
+		// 等待连接或流水线窗口的请求从排队链表摘除
+		if (slot->state == SLOT_QUEUED)
+			conn_unlink(handle, conn, i);
+		else if (conn->mode == MB_MST_TCP_MODE_RTU)
+			conn->rx_len = 0; // RTU模式没有事务标识, 丢弃可能残留的半帧, 避免与下一个回复混淆
+
+		slot_finish(handle, slot, NULL, 0, true);
+	}
+}
+
+/***************************API***************************/
+
+/**
+ * @brief TCP主机初始化并申请句柄, 所有连接共用一个epoll
+ *
+ * @return mb_mst_tcp_handle 成功返回句柄,失败返回NULL
+ */
+mb_mst_tcp_handle mb_mst_tcp_init(void)
+{
+	struct mb_mst_tcp *handle = calloc(1, sizeof(struct mb_mst_tcp));
+	if (!handle)
+		return NULL;
+
+	handle->next_id = 1;
+	for (size_t i = 0; i < MB_MST_TCP_MAX_CONN; i++) {
+		handle->conns[i].fd = -1;
+		handle->conns[i].q_head = NO_SLOT;
+		handle->conns[i].q_tail = NO_SLOT;
+		handle->conns[i].rtu_slot = NO_SLOT;
+	}
+
+	handle->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (handle->epoll_fd < 0) {
+		LOG_E("Create modbus tcp master epoll failed: %s", strerror(errno));
+		free(handle);
+		return NULL;
+	}
+
+	return handle;
+}
+
+/**
+ * @brief 关闭所有连接并释放句柄, 未完成的请求不回调
+ *
+ * @param handle TCP主机句柄
+ */
+void mb_mst_tcp_destroy(mb_mst_tcp_handle handle)
+{
+	if (!handle)
+		return;
+
+	for (size_t i = 0; i < MB_MST_TCP_MAX_CONN; i++) {
+		if (handle->conns[i].fd >= 0)
+			close(handle->conns[i].fd);
+	}
+
+	close(handle->epoll_fd);
+	free(handle);
+}
+
+/**
+ * @brief 添加一个连接, 非阻塞连接, 断线后自动重连
+ *
+ * @param handle TCP主机句柄
+ * @param ip 服务端IPv4地址
+ * @param port 服务端端口, 通常为 MODBUS_TCP_DEFAULT_PORT
+ * @param mode 连接模式
+ * @return int 连接编号, 失败返回-1
+ */
+int mb_mst_tcp_connect(
+	mb_mst_tcp_handle handle, const char *ip, uint16_t port, enum mb_mst_tcp_mode mode)
+{
+	if (!handle || !ip)
+		return -1;
+
+	struct tcp_conn *conn = NULL;
+	for (size_t i = 0; i < MB_MST_TCP_MAX_CONN; i++) {
+		if (!handle->conns[i].used) {
+			conn = &handle->conns[i];
+			break;
+		}
+	}
+	if (!conn) {
+		LOG_W("Too many modbus tcp master connections");
+		return -1;
+	}
+
+	memset(&conn->addr, 0, sizeof(conn->addr));
+	conn->addr.sin_family = AF_INET;
+	conn->addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &conn->addr.sin_addr) != 1) {
+		LOG_E("Invalid modbus tcp server ip: %s", ip);
+		return -1;
+	}
+
+	conn->used = true;
+	conn->mode = mode;
+
+	// 连接失败也保留, 之后按间隔重连
+	conn_open(handle, conn);
+
+	return conn - handle->conns;
+}
+
+/**
+ * @brief 在指定连接上发送请求, 请求及写数据拷贝到请求池
+ *
+ * @param handle TCP主机句柄
+ * @param conn 连接编号
+ * @param request 请求结构体
+ * @return mb_mst_req_id 请求标识, 请求非法、连接不存在或请求池已满返回0
+ */
+mb_mst_req_id mb_mst_tcp_request(
+	mb_mst_tcp_handle handle, int conn, const struct mb_mst_request *request)
+{
+	if (!handle || conn < 0 || conn >= MB_MST_TCP_MAX_CONN || !handle->conns[conn].used ||
+		!check_request_valid(request))
+		return 0;
+
+	int idx = 0;
+	while (idx < MB_MST_TCP_POOL_SIZE && handle->pool[idx].state != SLOT_FREE)
+		idx++;
+	if (idx >= MB_MST_TCP_POOL_SIZE) {
+		LOG_W("Modbus tcp master request pool full, slave %u reg %u dropped",
+			request->slave_addr, request->reg_addr);
+		return 0;
+	}
+
+	struct tcp_slot *slot = &handle->pool[idx];
+	slot->req = *request;
+	if (request->func == MODBUS_FUN_WR_REG_MUL) {
+		memcpy(slot->buf, request->data, request->reg_len * 2);
+		slot->req.data = slot->buf;
+		slot->req.data_len = request->reg_len * 2;
+	} else {
+		slot->req.data = NULL;
+		slot->req.data_len = 0;
+	}
+	slot->state = SLOT_QUEUED;
+	slot->conn = conn;
+	slot->next = NO_SLOT;
+	slot->deadline_us = now_us() + (uint64_t)request->timeout_ms * 1000;
+
+	slot->id = handle->next_id++;
+	if (!handle->next_id)
+		handle->next_id = 1;
+
+	struct tcp_conn *c = &handle->conns[conn];
+	if (c->q_tail == NO_SLOT)
+		c->q_head = idx;
+	else
+		handle->pool[c->q_tail].next = idx;
+	c->q_tail = idx;
+
+	// 已连接则立即发送; 连接异常由epoll事件在轮询中处理, 这里不回调
+	if (c->fd >= 0 && !c->connecting) {
+		conn_pump(handle, c);
+		conn_update_events(handle, c);
+	}
+
+	return slot->id;
+}
+
+/**
+ * @brief 取消请求, 取消后不会回调, 已发送的请求迟到的回复会被丢弃
+ *
+ * @param handle TCP主机句柄
+ * @param id 请求标识
+ * @return true 已取消
+ * @return false 请求已完成或不存在
+ */
+bool mb_mst_tcp_cancel(mb_mst_tcp_handle handle, mb_mst_req_id id)
+{
+	if (!handle || !id)
+		return false;
+
+	for (int i = 0; i < MB_MST_TCP_POOL_SIZE; i++) {
+		struct tcp_slot *slot = &handle->pool[i];
+		if (slot->state == SLOT_FREE || slot->id != id)
+			continue;
+
+		struct tcp_conn *conn = &handle->conns[slot->conn];
+
+		if (slot->state == SLOT_QUEUED) {
+			conn_unlink(handle, conn, i);
+		} else {
+			if (conn->in_flight)
+				conn->in_flight--;
+			if (conn->rtu_slot == i)
+				conn->rtu_slot = NO_SLOT;
+		}
+
+		slot->state = SLOT_FREE;
+		slot->id = 0;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief TCP主机轮询, 不阻塞, 处理所有就绪的连接、超时与重连
+ *
+ * @param handle TCP主机句柄
+ */
+void mb_mst_tcp_poll(mb_mst_tcp_handle handle)
+{
+	if (!handle)
+		return;
+
+	struct epoll_event events[MB_MST_TCP_MAX_CONN];
+	int nfds = epoll_wait(handle->epoll_fd, events, MB_MST_TCP_MAX_CONN, 0);
+	for (int i = 0; i < nfds; i++)
+		conn_handle(handle, &handle->conns[events[i].data.u32], events[i].events);
+
+	uint64_t now = now_us();
+	check_timeouts(handle, now);
+
+	for (size_t i = 0; i < MB_MST_TCP_MAX_CONN; i++) {
+		struct tcp_conn *conn = &handle->conns[i];
+		if (!conn->used || conn->q_head == NO_SLOT)
+			continue;
+
+		if (conn->fd >= 0) {
+			// 超时腾出窗口后继续发送
+			if (!conn_pump(handle, conn))
+				conn_close(handle, conn);
+			else if (!conn->connecting)
+				conn_update_events(handle, conn);
+			continue;
+		}
+
+		// 未连接: 到达重连时刻则重连, 否则排队的请求直接失败
+		if (now >= conn->retry_us && conn_open(handle, conn))
+			continue;
+
+		fail_queue(handle, conn_detach_queue(conn));
+	}
+}
+
+/**
+ * @brief 获取内部epoll描述符, 可注册到外部事件循环, 可读时调用 mb_mst_tcp_poll
+ *
+ * @param handle TCP主机句柄
+ * @return int epoll描述符, 失败返回-1
+ */
+int mb_mst_tcp_get_fd(mb_mst_tcp_handle handle)
+{
+	return handle ? handle->epoll_fd : -1;
+}
+
+/**
+ * @brief 距离下一个超时或重连的时间, 用于事件循环精确休眠
+ *
+ * @param handle TCP主机句柄
+ * @return int 毫秒, 0代表需立即轮询, -1代表无请求
+ */
+int mb_mst_tcp_next_deadline(mb_mst_tcp_handle handle)
+{
+	if (!handle)
+		return -1;
+
+	uint64_t next = UINT64_MAX;
+	for (int i = 0; i < MB_MST_TCP_POOL_SIZE; i++) {
+		const struct tcp_slot *slot = &handle->pool[i];
+		if (slot->state != SLOT_FREE && slot->deadline_us < next)
+			next = slot->deadline_us;
+	}
+
+	// 未连接的排队请求需在重连时刻处理, 连接中需在连接超时时刻处理
+	for (size_t i = 0; i < MB_MST_TCP_MAX_CONN; i++) {
+		const struct tcp_conn *conn = &handle->conns[i];
+		if (conn->used && conn->fd < 0 && conn->q_head != NO_SLOT && conn->retry_us < next)
+			next = conn->retry_us;
+		if (conn->fd >= 0 && conn->connecting && conn->connect_us < next)
+			next = conn->connect_us;
+	}
+
+	if (next == UINT64_MAX)
+		return -1;
+
+	uint64_t now = now_us();
+	if (now >= next)
+		return 0;
+
+	uint64_t left = (next - now + 999) / 1000;
+	return left > INT32_MAX ? INT32_MAX : (int)left;
+}
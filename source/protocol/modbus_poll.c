@@ -0,0 +1,434 @@
+/**
+ * @file modbus_poll.c
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus主机周期轮询调度
+ * @version 1.0
+ * @date 2024-12-22
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils/logger.h"
+#include "protocol/modbus_poll.h"
+
+// 读请求占用总线的字节数: 请求帧 + 回复帧(地址 功能码 字节数 数据 CRC)
+#define RD_REQ_BYTES (6 + MODBUS_CRC_BYTES_NUM)
+#define RD_RESP_BYTES(n) (3 + (n) * 2 + MODBUS_CRC_BYTES_NUM)
+#define RD_BUS_BYTES(n) (RD_REQ_BYTES + RD_RESP_BYTES(n))
+
+struct mb_poll;
+
+// 合并后的读请求
+struct poll_group {
+	struct mb_poll *owner;		// 所属调度器
+	struct mb_mst_request req;	// 请求模板, 提交时由主机拷贝
+	size_t first;				// 成员在排序表中的起始位置
+	size_t count;				// 成员数量
+	uint32_t period_ms;			// 成员中最短的周期
+	uint8_t priority;			// 成员中最高的优先级
+	uint64_t next_due_ms;		// 下次到期时刻
+};
+
+// 轮询调度句柄
+struct mb_poll {
+	mb_mst_handle mst;			  // 主机句柄
+	struct mb_poll_entry *table;  // 按从机、寄存器排序后的轮询表拷贝
+	size_t num;					  // 轮询项数量
+	struct poll_group *groups;	  // 合并后的请求
+	size_t group_num;			  // 请求数量
+	struct poll_group *in_flight; // 在途请求, 同一时间只有一个
+	mb_mst_req_id in_flight_id;	  // 在途请求标识
+};
+
+/**
+ * @brief 获取单调时钟(毫秒)
+ * 
+ * @return uint64_t 
+ */
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief 按从机地址、起始寄存器、数量升序比较
+ * 
+ * @param a 
+ * @param b 
+ * @return int 
+ */
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct mb_poll_entry *ea = a;
+	const struct mb_poll_entry *eb = b;
+
+	if (ea->slave_addr != eb->slave_addr)
+		return ea->slave_addr - eb->slave_addr;
+	if (ea->reg_addr != eb->reg_addr)
+		return ea->reg_addr < eb->reg_addr ? -1 : 1;
+	return ea->reg_len - eb->reg_len;
+}
+
+/**
+ * @brief 检查轮询项是否合法
+ * 
+ * @param entry 
+ * @return true 
+ * @return false 
+ */
+static bool check_entry_valid(const struct mb_poll_entry *entry)
+{
+	if (!entry->resp)
+		return false;
+
+	if (!entry->reg_len || entry->reg_len > MODBUS_RD_REG_NUM_MAX)
+		return false;
+
+	return (uint32_t)entry->reg_addr + entry->reg_len <= 0x10000;
+}
+
+/**
+ * @brief 判断轮询项能否并入请求
+ * 
+ * 同一从机, 相邻或重叠, 不超过单次读上限, 且合并后总线占用不增加
+ * 
+ * 总线占用按每秒传输的字节数估算, 周期相差很大的寄存器段合并后按短周期读取, 反而增加占用
+ * 按需读取的轮询项只与按需读取的合并, 一次读取多段比分多次读取占用少
+ * 
+ * @param group 请求
+ * @param entry 轮询项
+ * @return true 可以合并
+ * @return false 不能合并
+ */
+static bool can_merge(const struct poll_group *group, const struct mb_poll_entry *entry)
+{
+	if (entry->slave_addr != group->req.slave_addr)
+		return false;
+
+	uint32_t g_end = (uint32_t)group->req.reg_addr + group->req.reg_len;
+	uint32_t e_end = (uint32_t)entry->reg_addr + entry->reg_len;
+	if (entry->reg_addr > g_end)
+		return false;
+
+	uint32_t m_end = e_end > g_end ? e_end : g_end;
+	uint32_t m_len = m_end - group->req.reg_addr;
+	if (m_len > MODBUS_RD_REG_NUM_MAX)
+		return false;
+
+	if (!group->period_ms || !entry->period_ms)
+		return !group->period_ms && !entry->period_ms;
+
+	uint64_t pg = group->period_ms;
+	uint64_t pe = entry->period_ms;
+	uint64_t pm = pg < pe ? pg : pe;
+
+	// RD_BUS_BYTES(m_len) / pm <= RD_BUS_BYTES(g_len) / pg + RD_BUS_BYTES(e_len) / pe
+	uint64_t merged = RD_BUS_BYTES(m_len) * pg * pe;
+	uint64_t split =
+		(RD_BUS_BYTES(group->req.reg_len) * pe + RD_BUS_BYTES(entry->reg_len) * pg) * pm;
+
+	return merged <= split;
+}
+
+/**
+ * @brief 请求回复, 按成员拆分数据后回调, 并立即调度下一个请求
+ * 
+ * @param data 接收到的数据
+ * @param len 数据长度
+ * @param is_timeout 是否超时
+ * @param arg 请求
+ */
+static void group_resp(uint8_t *data, size_t len, bool is_timeout, void *arg)
+{
+	struct poll_group *group = arg;
+	struct mb_poll *handle = group->owner;
+
+	handle->in_flight = NULL;
+
+	if (!is_timeout && len != group->req.reg_len * 2u) {
+		LOG_W("Poll slave %u reg %u: bad length %zu", group->req.slave_addr, group->req.reg_addr,
+			len);
+		is_timeout = true;
+	}
+
+	for (size_t i = 0; i < group->count; i++) {
+		struct mb_poll_entry *entry = &handle->table[group->first + i];
+
+		if (is_timeout) {
+			entry->resp(NULL, 0, true, entry->arg);
+			continue;
+		}
+
+		size_t offset = (entry->reg_addr - group->req.reg_addr) * 2u;
+		entry->resp(data + offset, entry->reg_len * 2u, false, entry->arg);
+	}
+
+	// 总线空闲后立即发送下一个到期请求
+	mb_poll_schedule(handle);
+}
+
+/**
+ * @brief 合并轮询表生成请求
+ * 
+ * @param handle 
+ */
+static void plan_groups(struct mb_poll *handle)
+{
+	struct poll_group *group = NULL;
+
+	for (size_t i = 0; i < handle->num; i++) {
+		const struct mb_poll_entry *entry = &handle->table[i];
+
+		if (group && can_merge(group, entry)) {
+			uint32_t g_end = (uint32_t)group->req.reg_addr + group->req.reg_len;
+			uint32_t e_end = (uint32_t)entry->reg_addr + entry->reg_len;
+			if (e_end > g_end)
+				group->req.reg_len = e_end - group->req.reg_addr;
+			if (entry->period_ms < group->period_ms)
+				group->period_ms = entry->period_ms;
+			if (entry->priority < group->priority)
+				group->priority = entry->priority;
+			if (entry->timeout_ms > group->req.timeout_ms)
+				group->req.timeout_ms = entry->timeout_ms;
+			group->count++;
+			continue;
+		}
+
+		group = &handle->groups[handle->group_num++];
+		group->owner = handle;
+		group->first = i;
+		group->count = 1;
+		group->period_ms = entry->period_ms;
+		group->priority = entry->priority;
+		group->req = (struct mb_mst_request){
+			.timeout_ms = entry->timeout_ms ? entry->timeout_ms : MB_POLL_TIMEOUT_MS,
+			.slave_addr = entry->slave_addr,
+			.func = MODBUS_FUN_RD_REG_MUL,
+			.reg_addr = entry->reg_addr,
+			.reg_len = entry->reg_len,
+			.resp = group_resp,
+			.arg = group,
+		};
+	}
+}
+
+/***************************API***************************/
+
+/**
+ * @brief 根据轮询表生成合并后的读请求并申请句柄
+ *
+ * @param mst 主机句柄
+ * @param table 轮询表, 内部会拷贝
+ * @param num 轮询项数量
+ * @return mb_poll_handle 成功返回句柄,失败返回NULL
+ */
+mb_poll_handle mb_poll_init(mb_mst_handle mst, const struct mb_poll_entry *table, size_t num)
+{
+	if (!mst || !table || !num)
+		return NULL;
+
+	for (size_t i = 0; i < num; i++) {
+		if (!check_entry_valid(&table[i])) {
+			LOG_E("Invalid poll entry %zu", i);
+			return NULL;
+		}
+	}
+
+	struct mb_poll *handle = calloc(1, sizeof(struct mb_poll));
+	if (!handle)
+		return NULL;
+
+	handle->table = malloc(num * sizeof(struct mb_poll_entry));
+	if (!handle->table)
+		goto err_free_handle;
+
+	handle->groups = calloc(num, sizeof(struct poll_group));
+	if (!handle->groups)
+		goto err_free_table;
+
+	memcpy(handle->table, table, num * sizeof(struct mb_poll_entry));
+	handle->num = num;
+	handle->mst = mst;
+
+	// 就地排序拷贝的表, 同一从机相邻的寄存器段排在一起才能合并
+	qsort(handle->table, num, sizeof(struct mb_poll_entry), entry_cmp);
+
+	plan_groups(handle);
+
+	// 周期请求立即开始, 按需请求等待触发
+	uint64_t now = now_ms();
+	for (size_t i = 0; i < handle->group_num; i++)
+		handle->groups[i].next_due_ms = handle->groups[i].period_ms ? now : UINT64_MAX;
+
+	LOG_I("Poll table: %zu entries -> %zu requests", num, handle->group_num);
+
+	return handle;
+
+err_free_table:
+	free(handle->table);
+
+err_free_handle:
+	free(handle);
+
+	return NULL;
+}
+
+/**
+ * @brief 释放句柄, 在途请求会被取消, 需在主机销毁前调用
+ *
+ * @param handle 轮询调度句柄
+ */
+void mb_poll_destroy(mb_poll_handle handle)
+{
+	if (!handle)
+		return;
+
+	if (handle->in_flight)
+		mb_mst_cancel(handle->mst, handle->in_flight_id);
+
+	free(handle->groups);
+	free(handle->table);
+	free(handle);
+}
+
+/**
+ * @brief 调度轮询, 同一时间只向主机提交一个请求, 优先级最高、最早到期的先发送
+ *
+ * @param handle 轮询调度句柄
+ */
+void mb_poll_schedule(mb_poll_handle handle)
+{
+	if (!handle || handle->in_flight)
+		return;
+
+	uint64_t now = now_ms();
+	struct poll_group *best = NULL;
+
+	for (size_t i = 0; i < handle->group_num; i++) {
+		struct poll_group *group = &handle->groups[i];
+		if (group->next_due_ms > now)
+			continue;
+
+		if (!best || group->priority < best->priority ||
+			(group->priority == best->priority && group->next_due_ms < best->next_due_ms))
+			best = group;
+	}
+
+	if (!best)
+		return;
+
+	// 请求池已满时主机会打印告警, 下次调度重试
+	handle->in_flight_id = mb_mst_pdu_request(handle->mst, &best->req);
+	if (!handle->in_flight_id)
+		return;
+	handle->in_flight = best;
+
+	if (!best->period_ms) {
+		best->next_due_ms = UINT64_MAX; // 按需请求, 等待下次触发
+		return;
+	}
+
+	// 按周期推进, 落后超过一个周期时从当前重新计时, 避免积压后连续发送
+	best->next_due_ms += best->period_ms;
+	if (best->next_due_ms <= now)
+		best->next_due_ms = now + best->period_ms;
+}
+
+/**
+ * @brief 距离下一个请求到期的时间, 用于事件循环精确休眠
+ *
+ * @param handle 轮询调度句柄
+ * @return int 毫秒, 0代表已有请求到期, -1代表请求在途或无请求
+ */
+int mb_poll_next_deadline(mb_poll_handle handle)
+{
+	if (!handle || handle->in_flight || !handle->group_num)
+		return -1;
+
+	uint64_t next = UINT64_MAX;
+	for (size_t i = 0; i < handle->group_num; i++) {
+		if (handle->groups[i].next_due_ms < next)
+			next = handle->groups[i].next_due_ms;
+	}
+
+	if (next == UINT64_MAX)
+		return -1;
+
+	uint64_t now = now_ms();
+	if (next <= now)
+		return 0;
+
+	return next - now > INT32_MAX ? INT32_MAX : (int)(next - now);
+}
+
+/**
+ * @brief 触发覆盖指定寄存器的请求立即到期, 用于按需读取或提前刷新
+ *
+ * @param handle 轮询调度句柄
+ * @param slave_addr 从机地址
+ * @param reg_addr 起始寄存器
+ * @param reg_len 寄存器数量
+ * @return true 已触发或覆盖的请求正在传输
+ * @return false 轮询表中没有覆盖这些寄存器的请求
+ */
+bool mb_poll_trigger(
+	mb_poll_handle handle, uint8_t slave_addr, uint16_t reg_addr, uint16_t reg_len)
+{
+	if (!handle || !reg_len)
+		return false;
+
+	uint32_t end = (uint32_t)reg_addr + reg_len;
+	uint64_t now = now_ms();
+	bool found = false;
+
+	for (size_t i = 0; i < handle->group_num; i++) {
+		struct poll_group *group = &handle->groups[i];
+		uint32_t g_end = (uint32_t)group->req.reg_addr + group->req.reg_len;
+		if (group->req.slave_addr != slave_addr || group->req.reg_addr >= end || g_end <= reg_addr)
+			continue;
+
+		// 正在传输的请求回复后即为最新数据, 不必重复读取
+		if (group != handle->in_flight && group->next_due_ms > now)
+			group->next_due_ms = now;
+		found = true;
+	}
+
+	return found;
+}
+
+/**
+ * @brief 合并后的请求数量
+ *
+ * @param handle 轮询调度句柄
+ * @return size_t 
+ */
+size_t mb_poll_request_num(mb_poll_handle handle)
+{
+	return handle ? handle->group_num : 0;
+}
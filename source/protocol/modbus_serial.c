@@ -0,0 +1,760 @@
+/**
+ * @file modbus_serial.c
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus RTU 串口传输层(RS485)
+ * @version 1.0
+ * @date 2025-01-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/serial.h>
+#include <linux/tty_flags.h>
+
+#include "utils/logger.h"
+#include "utils/queue.h"
+#include "protocol/modbus_serial.h"
+
+#define TX_BUF_LEN 4096 // 发送环形缓冲, 可缓存多帧最大帧
+#define TX_CHUNK 256	// 单次从环形缓冲取出写入驱动的字节数
+
+// 串口
+struct mb_serial {
+	int fd;								// 串口文件描述符
+	struct mb_serial_cfg cfg;			// 串口配置
+	enum mb_serial_dir_mode dir_mode;	// 实际使用的方向控制方式
+	struct termios original_tio;		// 原始termios设置
+	struct serial_rs485 original_rs485;	// 原始RS485设置, 仅内核RS485模式有效
+	struct serial_struct original_ser;	// 原始驱动设置, 仅低延时接收生效时有效
+	bool low_latency;					// 低延时接收已生效
+	char trig_path[PATH_MAX];			// 接收FIFO触发深度的sysfs路径, 空代表未修改
+	unsigned int original_trig;			// 原始接收FIFO触发深度
+	uint32_t char_us;					// 单字符线上时间
+	struct mb_serial_rx_stats rx_stats;	// 接收唤醒统计
+	mb_cap_handle cap;					// 抓包, NULL代表未抓包
+	struct serial_opts opts;			// Modbus串口回调, arg指向本结构体
+
+	struct queue_info tx_q;		// 发送队列, 驱动写满时缓存剩余字节
+	uint8_t tx_buf[TX_BUF_LEN]; // 发送队列缓冲
+	et_handle loop;				// 注册的事件循环, NULL代表未注册, 由f_check_send续写
+	epoll_fd_handler f_event;	// 用户的串口事件处理
+	void *event_arg;			// 用户的事件处理参数
+	bool wait_out;				// 正在监听可写事件
+};
+
+// 波特率与termios速率对应表
+static const struct {
+	uint32_t baud;
+	speed_t speed;
+} m_speed_table[] = {
+	{ 1200, B1200 },
+	{ 2400, B2400 },
+	{ 4800, B4800 },
+	{ 9600, B9600 },
+	{ 19200, B19200 },
+	{ 38400, B38400 },
+	{ 57600, B57600 },
+	{ 115200, B115200 },
+	{ 230400, B230400 },
+	{ 460800, B460800 },
+	{ 921600, B921600 },
+	{ 1000000, B1000000 },
+	{ 2000000, B2000000 },
+	{ 4000000, B4000000 },
+};
+
+/**
+ * @brief 波特率转换为termios速率
+ *
+ * @param baud 波特率
+ * @param speed 输出速率
+ * @return true 成功
+ * @return false 不支持的波特率
+ */
+static bool baud_to_speed(uint32_t baud, speed_t *speed)
+{
+	for (size_t i = 0; i < sizeof(m_speed_table) / sizeof(m_speed_table[0]); i++) {
+		if (m_speed_table[i].baud == baud) {
+			*speed = m_speed_table[i].speed;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief 配置波特率、校验位、停止位及原始模式
+ *
+ * @param handle 串口句柄
+ * @return true 成功
+ * @return false 失败
+ */
+static bool line_config(mb_serial_handle handle)
+{
+	const struct mb_serial_cfg *cfg = &handle->cfg;
+	struct termios options;
+	speed_t speed;
+
+	if (!baud_to_speed(cfg->baud, &speed)) {
+		LOG_E("Serial %s unsupported baud rate %u", cfg->path, cfg->baud);
+		return false;
+	}
+
+	// 获取当前串口配置并保存
+	if (tcgetattr(handle->fd, &handle->original_tio) != 0) {
+		LOG_E("tcgetattr failed: %s", strerror(errno));
+		return false;
+	}
+
+	options = handle->original_tio;
+	cfmakeraw(&options); // 原始模式, 不处理回显、换行及流控字符
+
+	options.c_cflag |= (CLOCAL | CREAD); // 启用串口接收和本地模式
+	options.c_cflag &= ~CRTSCTS;		 // 禁用硬件流控制, RTS用于方向控制
+	options.c_cflag &= ~CSIZE;			 // 清除数据位设置
+	options.c_cflag |= CS8;				 // 设置数据位为8位
+
+	// 校验位, 收到校验错误的字节直接丢弃, 由CRC兜底
+	options.c_cflag &= ~(PARENB | PARODD);
+	options.c_iflag &= ~INPCK;
+	if (cfg->parity != MB_SERIAL_PARITY_NONE) {
+		options.c_cflag |= PARENB;
+		if (cfg->parity == MB_SERIAL_PARITY_ODD)
+			options.c_cflag |= PARODD;
+		options.c_iflag |= INPCK | IGNPAR;
+	}
+
+	// 停止位
+	if (cfg->stop_bits == 2)
+		options.c_cflag |= CSTOPB;
+	else
+		options.c_cflag &= ~CSTOPB;
+
+	// 非阻塞读取, 有数据立即返回
+	options.c_cc[VMIN] = 0;
+	options.c_cc[VTIME] = 0;
+
+	if (cfsetispeed(&options, speed) != 0 || cfsetospeed(&options, speed) != 0) {
+		LOG_E("Setting baud rate failed: %s", strerror(errno));
+		return false;
+	}
+
+	// 应用设置
+	if (tcsetattr(handle->fd, TCSANOW, &options) != 0) {
+		LOG_E("tcsetattr failed: %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief 配置方向控制: 优先内核RS485模式, 其次手动切换RTS
+ *
+ * @param handle 串口句柄
+ */
+static void dir_config(mb_serial_handle handle)
+{
+	const struct mb_serial_cfg *cfg = &handle->cfg;
+
+	handle->dir_mode = MB_SERIAL_DIR_NONE;
+	if (!cfg->rs485)
+		return;
+
+	// 内核RS485模式, 驱动在发送前拉起RTS, 发送完成并延时后释放
+	if (ioctl(handle->fd, TIOCGRS485, &handle->original_rs485) == 0) {
+		struct serial_rs485 rs485 = handle->original_rs485;
+
+		rs485.flags |= SER_RS485_ENABLED;
+		rs485.flags &= ~(SER_RS485_RTS_ON_SEND | SER_RS485_RTS_AFTER_SEND | SER_RS485_RX_DURING_TX);
+		rs485.flags |= cfg->rts_invert ? SER_RS485_RTS_AFTER_SEND : SER_RS485_RTS_ON_SEND;
+		rs485.delay_rts_before_send = cfg->rts_before_send_ms;
+		rs485.delay_rts_after_send = cfg->rts_after_send_ms;
+
+		if (ioctl(handle->fd, TIOCSRS485, &rs485) == 0) {
+			handle->dir_mode = MB_SERIAL_DIR_KERNEL;
+			return;
+		}
+	}
+
+	// 驱动不支持RS485模式, 检查能否手动控制RTS
+	int bits;
+	if (ioctl(handle->fd, TIOCMGET, &bits) == 0) {
+		LOG_W("Serial %s no kernel rs485 mode, toggle RTS manually", cfg->path);
+		handle->dir_mode = MB_SERIAL_DIR_RTS;
+		return;
+	}
+
+	LOG_W("Serial %s no RTS control, direction left to transceiver", cfg->path);
+}
+
+/**
+ * @brief 低延时接收: 驱动收到数据后直接推送到线路规程, 不经工作队列延后唤醒
+ *
+ * @param handle 串口句柄
+ */
+static void low_latency_config(mb_serial_handle handle)
+{
+	if (!handle->cfg.low_latency)
+		return;
+
+	if (ioctl(handle->fd, TIOCGSERIAL, &handle->original_ser) != 0) {
+		LOG_W("Serial %s no low latency support: %s", handle->cfg.path, strerror(errno));
+		return;
+	}
+
+	struct serial_struct ser = handle->original_ser;
+	ser.flags |= ASYNC_LOW_LATENCY;
+	if (ioctl(handle->fd, TIOCSSERIAL, &ser) != 0) {
+		LOG_W("Serial %s set low latency failed: %s", handle->cfg.path, strerror(errno));
+		return;
+	}
+
+	handle->low_latency = true;
+}
+
+/**
+ * @brief 读写接收FIFO触发深度的sysfs节点
+ *
+ * @param path sysfs路径
+ * @param val 写入时为输入, 读取时为输出
+ * @param wr 是否写入
+ * @return true 成功
+ * @return false 失败
+ */
+static bool trig_access(const char *path, unsigned int *val, bool wr)
+{
+	FILE *fp = fopen(path, wr ? "w" : "r");
+	if (!fp)
+		return false;
+
+	bool ok = wr ? fprintf(fp, "%u", *val) > 0 : fscanf(fp, "%u", val) == 1;
+
+	// 写入在关闭时才提交给驱动
+	if (fclose(fp) != 0)
+		ok = false;
+
+	return ok;
+}
+
+/**
+ * @brief 设置UART接收FIFO触发深度, 深度越小中断越早, 首字节等待越短
+ *
+ * @param handle 串口句柄
+ */
+static void rx_trig_config(mb_serial_handle handle)
+{
+	const struct mb_serial_cfg *cfg = &handle->cfg;
+
+	if (!cfg->rx_trig_bytes)
+		return;
+
+	// 设备路径可能是符号链接, 按实际设备名查找sysfs节点
+	char real[PATH_MAX];
+	if (!realpath(cfg->path, real))
+		return;
+
+	const char *name = strrchr(real, '/');
+	char path[PATH_MAX];
+	int n = snprintf(path, sizeof(path), "/sys/class/tty/%s/rx_trig_bytes", name ? name + 1 : real);
+	if (n < 0 || (size_t)n >= sizeof(path))
+		return;
+
+	unsigned int trig = cfg->rx_trig_bytes;
+	if (!trig_access(path, &handle->original_trig, false) || !trig_access(path, &trig, true)) {
+		LOG_W("Serial %s set rx trigger %u failed", cfg->path, trig);
+		return;
+	}
+
+	// 记录路径, 关闭时恢复原始深度
+	strcpy(handle->trig_path, path);
+}
+
+/**
+ * @brief 手动设置RTS电平
+ *
+ * @param handle 串口句柄
+ * @param send 是否为发送电平
+ */
+static void rts_set(mb_serial_handle handle, bool send)
+{
+	int bits = TIOCM_RTS;
+	bool active = send != handle->cfg.rts_invert;
+
+	if (ioctl(handle->fd, active ? TIOCMBIS : TIOCMBIC, &bits) != 0)
+		LOG_E("Serial %s set RTS failed: %s", handle->cfg.path, strerror(errno));
+}
+
+/**************************发送队列**************************/
+
+/**
+ * @brief 按发送队列是否为空开关可写事件监听
+ *
+ * @param handle 串口句柄
+ * @param on 是否监听可写事件
+ */
+static void tx_wait_out(mb_serial_handle handle, bool on)
+{
+	if (!handle->loop || handle->wait_out == on)
+		return;
+
+	unsigned int events = EPOLLIN | (on ? EPOLLOUT : 0);
+	if (epoll_timer_mod_fd(handle->loop, handle->fd, events))
+		handle->wait_out = on;
+}
+
+/**
+ * @brief 发送队列中的数据写入驱动, 驱动写满时保留剩余数据
+ *
+ * @param handle 串口句柄
+ * @return true 队列已清空
+ * @return false 队列仍有数据
+ */
+static bool tx_flush(mb_serial_handle handle)
+{
+	uint8_t chunk[TX_CHUNK];
+
+	while (!is_queue_empty(&handle->tx_q)) {
+		size_t len = queue_peek(&handle->tx_q, chunk, sizeof(chunk));
+
+		ssize_t ret = write(handle->fd, chunk, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				LOG_E("Serial %s write failed: %s", handle->cfg.path, strerror(errno));
+			return false;
+		}
+
+		queue_get(&handle->tx_q, chunk, ret); // 丢弃已写入的字节
+		if ((size_t)ret < len)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief 注册到事件循环的串口事件, 可写时续写发送队列, 清空后再通知用户检查发送完成
+ *
+ * @param fd 串口描述符
+ * @param events 触发的事件
+ * @param arg 串口句柄
+ */
+static void serial_event(int fd, unsigned int events, void *arg)
+{
+	mb_serial_handle handle = arg;
+
+	if (events & EPOLLOUT) {
+		if (!tx_flush(handle) && !(events & ~EPOLLOUT))
+			return;
+		tx_wait_out(handle, !is_queue_empty(&handle->tx_q));
+	}
+
+	handle->f_event(fd, events, handle->event_arg);
+}
+
+/**************************串口回调**************************/
+
+static bool serial_init(void *arg)
+{
+	mb_serial_handle handle = arg;
+
+	return handle->fd >= 0;
+}
+
+/**
+ * @brief 切换收发方向, 内核RS485模式由驱动切换, 只有手动模式需要处理
+ *
+ * @param ctrl 方向
+ * @param arg 串口句柄
+ */
+static void serial_dir_ctrl(enum modbus_serial_dir ctrl, void *arg)
+{
+	mb_serial_handle handle = arg;
+
+	if (handle->dir_mode != MB_SERIAL_DIR_RTS)
+		return;
+
+	bool send = ctrl == modbus_serial_dir_tx_only;
+	rts_set(handle, send);
+
+	if (send && handle->cfg.rts_before_send_ms)
+		usleep(handle->cfg.rts_before_send_ms * 1000);
+}
+
+static size_t serial_read(uint8_t *p_data, uint16_t len, void *arg)
+{
+	mb_serial_handle handle = arg;
+
+	// 非阻塞读取, 由事件循环在可读时调用
+	ssize_t ret = read(handle->fd, p_data, len);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			LOG_E("Serial %s read failed: %s", handle->cfg.path, strerror(errno));
+		return 0;
+	}
+
+	if (ret > 0) {
+		struct mb_serial_rx_stats *st = &handle->rx_stats;
+		uint32_t delay_us = (uint32_t)(ret - 1) * handle->char_us;
+
+		st->wakeups++;
+		st->bytes += ret;
+		st->delay_sum_us += delay_us;
+		if ((uint32_t)ret > st->max_burst)
+			st->max_burst = ret;
+		if (delay_us > st->delay_max_us)
+			st->delay_max_us = delay_us;
+
+		mb_cap_write(handle->cap, MB_CAP_DIR_RX, p_data, ret);
+	}
+
+	return ret;
+}
+
+static size_t serial_write(uint8_t *p_data, uint16_t len, void *arg)
+{
+	return mb_serial_write(arg, p_data, len);
+}
+
+/**
+ * @brief 判断发送是否完成
+ *
+ * 未注册事件循环时在此续写发送队列; 发送队列或驱动输出队列非空时直接返回, 不阻塞轮询;
+ * 都清空后只剩UART FIFO中的少量字节, 再由tcdrain等待移位寄存器发送完最后一位,
+ * 手动模式下按换向时间延时后再切回接收
+ *
+ * @param arg 串口句柄
+ * @return true 发送完成
+ * @return false 发送中
+ */
+static bool serial_check_send(void *arg)
+{
+	mb_serial_handle handle = arg;
+	int pending = 0;
+
+	if (!tx_flush(handle)) {
+		tx_wait_out(handle, true);
+		return false;
+	}
+
+	if (ioctl(handle->fd, TIOCOUTQ, &pending) == 0 && pending > 0)
+		return false;
+
+	if (tcdrain(handle->fd) != 0 && errno != ENOTTY)
+		LOG_W("Serial %s tcdrain failed: %s", handle->cfg.path, strerror(errno));
+
+	if (handle->dir_mode == MB_SERIAL_DIR_RTS && handle->cfg.rts_after_send_ms)
+		usleep(handle->cfg.rts_after_send_ms * 1000);
+
+	return true;
+}
+
+/***************************API***************************/
+
+/**
+ * @brief 打开并配置串口, 申请句柄
+ *
+ * @param cfg 串口配置, 只在调用期间使用
+ * @return mb_serial_handle 成功返回句柄,失败返回NULL
+ */
+mb_serial_handle mb_serial_open(const struct mb_serial_cfg *cfg)
+{
+	if (!cfg || !cfg->path || (cfg->stop_bits > 2))
+		return NULL;
+
+	struct mb_serial *handle = calloc(1, sizeof(struct mb_serial));
+	if (!handle) {
+		LOG_E("Malloc serial failed");
+		return NULL;
+	}
+
+	handle->cfg = *cfg;
+
+	if (!queue_init(&handle->tx_q, 1, handle->tx_buf, TX_BUF_LEN)) {
+		LOG_E("Init serial tx queue failed");
+		goto err_free;
+	}
+
+	// 打开串口
+	handle->fd = open(cfg->path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (handle->fd < 0) {
+		LOG_E("Open device:%s failed: %s", cfg->path, strerror(errno));
+		goto err_destroy_queue;
+	}
+
+	// 配置串口
+	if (!line_config(handle))
+		goto err_close_fd;
+
+	dir_config(handle);
+	if (handle->dir_mode == MB_SERIAL_DIR_RTS)
+		rts_set(handle, false); // 默认接收
+
+	// 低延时相关设置失败不影响收发, 只是唤醒更晚
+	low_latency_config(handle);
+	rx_trig_config(handle);
+	handle->char_us = MODBUS_RTU_CHAR_BITS * 1000000 / cfg->baud;
+
+	tcflush(handle->fd, TCIOFLUSH); // 丢弃配置前收到的数据
+
+	handle->opts.f_init = serial_init;
+	handle->opts.f_write = serial_write;
+	handle->opts.f_read = serial_read;
+	handle->opts.f_dir_ctrl = serial_dir_ctrl;
+	handle->opts.f_check_send = serial_check_send;
+	handle->opts.arg = handle;
+	handle->opts.baud = cfg->baud;
+
+	return handle;
+
+err_close_fd:
+	close(handle->fd);
+
+err_destroy_queue:
+	queue_destroy(&handle->tx_q);
+
+err_free:
+	free(handle);
+
+	return NULL;
+}
+
+/**
+ * @brief 等待发送完成, 恢复原始配置并关闭串口
+ *
+ * @param handle 串口句柄
+ */
+void mb_serial_close(mb_serial_handle handle)
+{
+	if (!handle)
+		return;
+
+	mb_serial_detach(handle);
+	mb_serial_capture(handle, NULL);
+
+	// 发送队列剩余数据尽量写入驱动, 写不下的丢弃
+	if (!tx_flush(handle))
+		LOG_W("Serial %s drop unsent data", handle->cfg.path);
+
+	// 确保所有数据已传输
+	if (tcdrain(handle->fd) != 0)
+		LOG_E("tcdrain failed: %s", strerror(errno));
+
+	// 清空输入和输出缓冲区
+	if (tcflush(handle->fd, TCIOFLUSH) != 0)
+		LOG_E("tcflush failed: %s", strerror(errno));
+
+	if (handle->dir_mode == MB_SERIAL_DIR_KERNEL &&
+		ioctl(handle->fd, TIOCSRS485, &handle->original_rs485) != 0)
+		LOG_E("Restore rs485 failed: %s", strerror(errno));
+
+	if (handle->low_latency && ioctl(handle->fd, TIOCSSERIAL, &handle->original_ser) != 0)
+		LOG_E("Restore low latency failed: %s", strerror(errno));
+
+	if (handle->trig_path[0] && !trig_access(handle->trig_path, &handle->original_trig, true))
+		LOG_E("Restore rx trigger failed");
+
+	// 恢复原始termios设置
+	if (tcsetattr(handle->fd, TCSANOW, &handle->original_tio) != 0)
+		LOG_E("tcsetattr restore failed: %s", strerror(errno));
+
+	close(handle->fd);
+	queue_destroy(&handle->tx_q);
+	free(handle);
+}
+
+/**
+ * @brief 获取绑定到本串口的Modbus串口回调, 可直接用于主机或从机初始化
+ *
+ * @param handle 串口句柄
+ * @return struct serial_opts* 串口回调, 与句柄同生命周期
+ */
+struct serial_opts *mb_serial_opts(mb_serial_handle handle)
+{
+	return handle ? &handle->opts : NULL;
+}
+
+/**
+ * @brief 获取串口描述符, 可注册到外部事件循环, 可读时轮询主机或从机
+ *
+ * @param handle 串口句柄
+ * @return int 文件描述符, 失败返回-1
+ */
+int mb_serial_get_fd(mb_serial_handle handle)
+{
+	return handle ? handle->fd : -1;
+}
+
+/**
+ * @brief 注册到事件循环, 可读时调用用户处理函数, 可写时由本模块续写发送队列
+ *
+ * 发送队列清空后也会调用一次用户处理函数, 用于检查发送完成, 此时events含EPOLLOUT
+ *
+ * @param handle 串口句柄
+ * @param loop 事件循环
+ * @param f_handle 用户处理函数, 一般为轮询主机或从机
+ * @param arg 用户处理函数参数
+ * @return true 成功
+ * @return false 失败
+ */
+bool mb_serial_attach(
+	mb_serial_handle handle, et_handle loop, epoll_fd_handler f_handle, void *arg)
+{
+	if (!handle || !loop || !f_handle || handle->loop)
+		return false;
+
+	handle->f_event = f_handle;
+	handle->event_arg = arg;
+
+	bool wait_out = !is_queue_empty(&handle->tx_q);
+	unsigned int events = EPOLLIN | (wait_out ? EPOLLOUT : 0);
+	if (!epoll_timer_add_fd(loop, handle->fd, events, serial_event, handle))
+		return false;
+
+	handle->loop = loop;
+	handle->wait_out = wait_out;
+
+	return true;
+}
+
+/**
+ * @brief 从事件循环注销, 之后发送队列由f_check_send续写
+ *
+ * @param handle 串口句柄
+ */
+void mb_serial_detach(mb_serial_handle handle)
+{
+	if (!handle || !handle->loop)
+		return;
+
+	epoll_timer_remove_fd(handle->loop, handle->fd);
+	handle->loop = NULL;
+	handle->wait_out = false;
+}
+
+/**
+ * @brief 获取实际使用的方向控制方式
+ *
+ * @param handle 串口句柄
+ * @return enum mb_serial_dir_mode
+ */
+enum mb_serial_dir_mode mb_serial_dir_mode(mb_serial_handle handle)
+{
+	return handle ? handle->dir_mode : MB_SERIAL_DIR_NONE;
+}
+
+/**
+ * @brief 开始或停止抓包, 收发数据以pcap格式写入文件
+ *
+ * @param handle 串口句柄
+ * @param path 抓包文件路径, NULL代表停止抓包
+ * @return true 成功
+ * @return false 失败
+ */
+bool mb_serial_capture(mb_serial_handle handle, const char *path)
+{
+	if (!handle)
+		return false;
+
+	mb_cap_close(handle->cap);
+	handle->cap = NULL;
+
+	if (!path)
+		return true;
+
+	handle->cap = mb_cap_open(path);
+
+	return handle->cap != NULL;
+}
+
+/**
+ * @brief 获取接收唤醒统计
+ *
+ * @param handle 串口句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零
+ */
+void mb_serial_get_rx_stats(mb_serial_handle handle, struct mb_serial_rx_stats *out, bool reset)
+{
+	if (!handle || !out)
+		return;
+
+	*out = handle->rx_stats;
+
+	if (reset)
+		memset(&handle->rx_stats, 0, sizeof(handle->rx_stats));
+}
+
+/**
+ * @brief 非阻塞写入, 不切换方向, 用于Modbus以外的透传数据
+ *
+ * 驱动写满时剩余数据进入发送队列, 保证不截断且不阻塞, 队列按顺序续写
+ *
+ * @param handle 串口句柄
+ * @param buf 数据缓冲
+ * @param len 数据长度
+ * @return size_t 写入驱动与进入发送队列的总长度, 发送队列满时小于len
+ */
+size_t mb_serial_write(mb_serial_handle handle, const uint8_t *buf, size_t len)
+{
+	if (!handle || !buf || !len)
+		return 0;
+
+	size_t written = 0;
+
+	mb_cap_write(handle->cap, MB_CAP_DIR_TX, buf, len);
+
+	// 队列中有数据时必须排在其后, 保证顺序
+	if (is_queue_empty(&handle->tx_q)) {
+		ssize_t ret = write(handle->fd, buf, len);
+		if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+			LOG_E("Serial %s write failed: %s", handle->cfg.path, strerror(errno));
+			return 0;
+		}
+		written = ret > 0 ? (size_t)ret : 0;
+	}
+
+	if (written == len)
+		return len;
+
+	size_t queued = queue_add(&handle->tx_q, buf + written, len - written);
+	if (queued < len - written)
+		LOG_W("Serial %s tx queue full, drop %zu bytes", handle->cfg.path, len - written - queued);
+
+	tx_wait_out(handle, true);
+
+	return written + queued;
+}
@@ -32,6 +32,8 @@
 #include "protocol/modbus_slave.h"
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 // 接收状态
 enum rx_state {
@@ -87,21 +89,55 @@ struct msg_info {
 	} pdu; // 数据帧
 };
 
+// 从机单元
+struct mb_slv_unit {
+	uint8_t addr;					// 从机地址
+	struct mb_slv_work *work_table; // 响应处理表
+	size_t table_num;				// 响应处理表数量
+	struct mb_slv_unit_stats stats; // 单元统计
+};
+
+// 网关转发中的请求
+struct gw_pending {
+	bool used;								 // 占用标志
+	mb_slv_handle slv;						 // 所属从机
+	struct mb_mst_request req;				 // 下游请求, 用于组织回复
+	mb_mst_req_id id;						 // 下游请求标识
+	struct mb_slv_reply_ctx ctx;			 // 回复上下文
+};
+
 // 从机
 struct mb_slv {
-	uint8_t slave_addr;		  // 从机地址
 	struct serial_opts *opts; // 回调指针
 
+	struct mb_slv_unit units[MB_SLV_MAX_UNITS]; // 服务的单元
+	size_t unit_num;							// 单元数量
+	uint8_t unit_index[UINT8_MAX + 1];			// 地址 -> 单元下标+1, 0代表未注册
+
+	mb_mst_handle gateway;								 // 网关下游主机
+	uint32_t gw_timeout_ms;								 // 下游超时时间
+	struct gw_pending gw_pending[MB_SLV_GW_MAX_PENDING]; // 转发中的请求
+	bool rtu_gw_busy;									 // RTU侧有请求转发中
+
 	uint16_t data_in_out[MODBUS_REG_NUM_MAX]; // 用户交互缓冲
 
 	bool is_sending; // 正在发送
 
 	struct msg_info msg_state; // 接收信息
 
+	uint64_t rx_start_us;		   // 当前帧首字节的读取时刻
+	struct mb_slv_latency latency; // 请求到回复延时统计
+
+	uint8_t ex_code;		   // 当前请求的异常码, 0代表处理成功
+	struct mb_link_stats link; // 链路统计
+	uint64_t link_start_us;	   // 链路统计起始时刻
+
 	uint8_t modbus_frame_buff[MODBUS_FRAME_BYTES_MAX]; // 回复缓冲
+};
 
-	struct mb_slv_work *work_table; // 响应处理表
-	size_t table_num;				// 响应处理表数量
+// 延时直方图各桶上限(微秒), 最后一桶不设上限
+static const uint32_t m_lat_bounds_us[MB_SLV_LAT_BUCKETS - 1] = {
+	100, 200, 500, 1000, 2000, 5000, 10000,
 };
 
 static bool _recv_parser(mb_slv_handle handle);			 // 解析数据
@@ -120,12 +156,82 @@ static inline size_t get_rx_queue_remain_data(const struct msg_info *p_msg)
 }
 
 /**
- * @brief 右移左滑动窗口
+ * @brief 查找地址对应的单元
  * 
- * @param p_msg 
+ * @param handle 从机句柄
+ * @param addr 从机地址, MODBUS_TCP_UNIT_ID_ANY 对应第一个单元
+ * @return const struct mb_slv_unit* 未注册返回NULL
+ */
+static const struct mb_slv_unit *find_unit(mb_slv_handle handle, uint8_t addr)
+{
+	if (addr == MODBUS_TCP_UNIT_ID_ANY)
+		return handle->unit_num ? &handle->units[0] : NULL;
+
+	uint8_t idx = handle->unit_index[addr];
+
+	return idx ? &handle->units[idx - 1] : NULL;
+}
+
+/**
+ * @brief 地址是否需要接收: 本机单元, 或网关模式下的非广播地址
+ * 
+ * @param handle 从机句柄
+ * @param addr 从机地址
+ * @return true 接收
+ * @return false 忽略
+ */
+static bool accept_addr(mb_slv_handle handle, uint8_t addr)
+{
+	return handle->unit_index[addr] || (handle->gateway && addr != 0);
+}
+
+/**
+ * @brief 获取单调时钟(微秒)
+ * 
+ * @return uint64_t 
+ */
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 记录一次请求到回复的延时
+ * 
+ * @param lat 延时统计
+ * @param us 延时(微秒)
+ */
+static void latency_record(struct mb_slv_latency *lat, uint64_t us)
+{
+	uint32_t v = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+	size_t i = 0;
+
+	while (i < MB_SLV_LAT_BUCKETS - 1 && v > m_lat_bounds_us[i])
+		i++;
+	lat->buckets[i]++;
+
+	if (!lat->count || v < lat->min_us)
+		lat->min_us = v;
+	if (v > lat->max_us)
+		lat->max_us = v;
+	lat->sum_us += v;
+	lat->count++;
+}
+
+/**
+ * @brief 右移左滑动窗口, 丢弃未完成的帧时记为一次重同步
+ *
+ * @param handle 从机句柄
  */
-static void rebase_parser(struct msg_info *p_msg)
+static void rebase_parser(mb_slv_handle handle)
 {
+	struct msg_info *p_msg = &handle->msg_state;
+
+	if (p_msg->state != RX_STATE_ADDR)
+		handle->link.resyncs++;
+
 	p_msg->state = RX_STATE_ADDR;
 	p_msg->rx_q.rd = p_msg->anchor + 1;
 
@@ -160,23 +266,21 @@ static uint8_t get_pdu_mini_len(uint8_t func)
 }
 
 /**
- * @brief 获取需要接收的数据长度
+ * @brief 获取写功能码需要额外接收的数据长度
  * 
- * @param p_msg 
- * @return uint8_t 
+ * @param write 写数据帧信息
+ * @return uint8_t 数据长度, 0代表帧非法
  */
-static uint8_t get_pdu_extern_len(const struct msg_info *p_msg)
+static uint8_t get_pdu_extern_len(const struct pdu_write *write)
 {
-	uint16_t len = 0;
-	uint16_t reg_num;
+	uint16_t len = write->len;
+	uint16_t reg_num = COMBINE_U8_TO_U16(write->num_h, write->num_l);
 
-	if (p_msg->func != MODBUS_FUN_RD_REG_MUL) {
-		len += p_msg->pdu.write.len;
-		reg_num = COMBINE_U8_TO_U16(p_msg->pdu.write.num_h, p_msg->pdu.write.num_l);
+	// 字节数与寄存器数不符, 或整帧超过接收缓冲
+	if ((len != (reg_num << 1)) ||
+		(sizeof(struct pdu_write) + len + MODBUS_CRC_BYTES_NUM > MODBUS_FRAME_BYTES_MAX))
+		len = 0;
 
-		if ((p_msg->pdu.write.len != (reg_num << 1)) || (len > MODBUS_FRAME_BYTES_MAX))
-			len = 0;
-	}
 	return len;
 }
 
@@ -202,12 +306,12 @@ static bool _recv_parser(mb_slv_handle handle)
 		++p_msg->forward;
 		switch (p_msg->state) {
 		case RX_STATE_ADDR:
-			if (handle->slave_addr == c) {
+			if (accept_addr(handle, c)) {
 				handle->msg_state.addr = c;
 				p_msg->state = RX_STATE_FUNC;
 				p_msg->cal_crc = crc16_update(0xffff, c);
 			} else
-				rebase_parser(p_msg);
+				rebase_parser(handle);
 			break;
 		case RX_STATE_FUNC:
 			if (MODBUS_FUNC_CHECK_VALID(c)) {
@@ -217,7 +321,7 @@ static bool _recv_parser(mb_slv_handle handle)
 				p_msg->pdu_len = get_pdu_mini_len(c);
 				p_msg->cal_crc = crc16_update(p_msg->cal_crc, c);
 			} else
-				rebase_parser(p_msg);
+				rebase_parser(handle);
 			break;
 		case RX_STATE_INFO:
 			p_msg->pdu.data[p_msg->pdu_in++] = c;
@@ -228,9 +332,9 @@ static bool _recv_parser(mb_slv_handle handle)
 					p_msg->state = RX_STATE_CRC;
 					break;
 				} else {
-					pdu_ex_len = get_pdu_extern_len(p_msg);
+					pdu_ex_len = get_pdu_extern_len(&p_msg->pdu.write);
 					if (!pdu_ex_len)
-						rebase_parser(p_msg);
+						rebase_parser(handle);
 					else {
 						p_msg->pdu_len += pdu_ex_len;
 						p_msg->state = RX_STATE_DATA;
@@ -254,8 +358,10 @@ static bool _recv_parser(mb_slv_handle handle)
 						p_msg->pdu.data[p_msg->pdu_in - 1], p_msg->pdu.data[p_msg->pdu_in - 2])) {
 					flush_parser(p_msg);
 					return true;
-				} else
-					rebase_parser(p_msg);
+				} else {
+					handle->link.crc_errors++;
+					rebase_parser(handle);
+				}
 			}
 			break;
 		default:
@@ -265,30 +371,56 @@ static bool _recv_parser(mb_slv_handle handle)
 	return false;
 }
 
+/**
+ * @brief 用户回调的响应码转换为标准异常码
+ *
+ * @param res 响应码
+ * @return uint8_t 异常码, 0代表成功或不回复
+ */
+static uint8_t resp_to_ex_code(uint8_t res)
+{
+	switch (res) {
+	case MODBUS_RESP_SUCCESS:
+	case MODBUS_RESP_NOT_REPLY:
+		return 0;
+	case MODBUS_RESP_ERR_FUNC:
+		return MODBUS_EX_ILLEGAL_FUNCTION;
+	case MODBUS_RESP_ERR_REG:
+		return MODBUS_EX_ILLEGAL_ADDRESS;
+	case MODBUS_RESP_ERR_REGNUM:
+		return MODBUS_EX_ILLEGAL_VALUE;
+	default:
+		return MODBUS_EX_DEVICE_FAILURE;
+	}
+}
+
 /**
  * @brief 处理注册回调
  *
  * @param handle 从机句柄
+ * @param unit 目标单元
+ * @param func 功能码
+ * @param reg 寄存器地址
+ * @param reg_num 寄存器数量
  * @return uint8_t 参考头文件响应码
  */
-static uint8_t _rtu_handle(mb_slv_handle handle)
+static uint8_t _work_handle(mb_slv_handle handle, const struct mb_slv_unit *unit, uint8_t func,
+	uint16_t reg, uint16_t reg_num)
 {
-	if (!handle)
+	if (!handle || !unit)
 		return MODBUS_RESP_ERR_OTHER;
 
 	struct mb_slv_work *work = NULL; // 注册回调处理
 
 	int res = MODBUS_RESP_ERR_OTHER;
 
-	uint8_t addr = handle->msg_state.addr;
-	uint8_t func = handle->msg_state.func;
-	uint16_t reg = handle->msg_state.pdu.read.reg_h << 8 | handle->msg_state.pdu.read.reg_l;
-	uint16_t reg_num = handle->msg_state.pdu.read.num_h << 8 | handle->msg_state.pdu.read.num_l;
+	handle->ex_code = MODBUS_EX_ILLEGAL_ADDRESS; // 没有处理表覆盖该寄存器区间
 
-	for (size_t i = 0; i < handle->table_num; i++) {
-		work = &handle->work_table[i];
+	for (size_t i = 0; i < unit->table_num; i++) {
+		work = &unit->work_table[i];
 		if (work && work->resp && MODBUS_CHECK_REG_RANGE(reg, reg_num, work->start, work->end)) {
 			res = work->resp(func, reg, reg_num, handle->data_in_out); // 用户回调处理
+			handle->ex_code = resp_to_ex_code(res);
 			break;
 		}
 	}
@@ -300,94 +432,283 @@ static uint8_t _rtu_handle(mb_slv_handle handle)
  * @brief 处理读功能码
  *
  * @param handle 从机句柄
- * @return uint16_t 响应长度
+ * @param unit 目标单元
+ * @param read 读数据帧
+ * @param resp 响应PDU缓冲
+ * @return uint16_t 响应PDU长度
  */
-static uint16_t _packet_ack_read_frame(mb_slv_handle handle)
+static uint16_t _packet_ack_read_pdu(mb_slv_handle handle, const struct mb_slv_unit *unit,
+	const struct pdu_read *read, uint8_t *resp)
 {
-	if (!handle)
-		return 0;
-
 	uint16_t pkt_len = 0;
-	uint16_t crc = 0xffff;
 	uint16_t *p;
 
-	uint16_t reg =
-		COMBINE_U8_TO_U16(handle->msg_state.pdu.read.reg_h, handle->msg_state.pdu.read.reg_l);
-	uint16_t reg_num =
-		COMBINE_U8_TO_U16(handle->msg_state.pdu.read.num_h, handle->msg_state.pdu.read.num_l);
+	uint16_t reg = COMBINE_U8_TO_U16(read->reg_h, read->reg_l);
+	uint16_t reg_num = COMBINE_U8_TO_U16(read->num_h, read->num_l);
 
-	uint8_t *pdata_out = handle->modbus_frame_buff; // 存储回复的数据
+	if (!reg_num || reg_num > MODBUS_RD_REG_NUM_MAX) {
+		handle->ex_code = MODBUS_EX_ILLEGAL_VALUE;
+		return 0;
+	}
 
-	pdata_out[pkt_len++] = handle->msg_state.addr;
-	if (_rtu_handle(handle) == MODBUS_RESP_SUCCESS) {
-		p = handle->data_in_out; // 用户响应的数据
+	if (_work_handle(handle, unit, MODBUS_FUN_RD_REG_MUL, reg, reg_num) != MODBUS_RESP_SUCCESS)
+		return 0;
 
-		pdata_out[pkt_len++] = MODBUS_FUN_RD_REG_MUL; // 读功能码
-		pdata_out[pkt_len++] = (reg_num << 1);		  // 数据长度
+	p = handle->data_in_out; // 用户响应的数据
 
-		for (uint16_t i = 0; i < reg_num; i++, p++) {
-			pdata_out[pkt_len++] = GET_U8_HIGH_FROM_U16(*p);
-			pdata_out[pkt_len++] = GET_U8_LOW_FROM_U16(*p);
-		}
-	} else
+	resp[pkt_len++] = MODBUS_FUN_RD_REG_MUL; // 读功能码
+	resp[pkt_len++] = (reg_num << 1);		 // 数据长度
+
+	for (uint16_t i = 0; i < reg_num; i++, p++) {
+		resp[pkt_len++] = GET_U8_HIGH_FROM_U16(*p);
+		resp[pkt_len++] = GET_U8_LOW_FROM_U16(*p);
+	}
+
+	return pkt_len;
+}
+
+/**
+ * @brief 处理写功能码
+ *
+ * @param handle 从机句柄
+ * @param unit 目标单元
+ * @param write 写数据帧, 其后紧跟写入数据
+ * @param resp 响应PDU缓冲
+ * @return uint16_t 响应PDU长度
+ */
+static uint16_t _packet_ack_write_pdu(mb_slv_handle handle, const struct mb_slv_unit *unit,
+	const struct pdu_write *write, uint8_t *resp)
+{
+	uint16_t pkt_len = 0;
+
+	uint16_t reg = COMBINE_U8_TO_U16(write->reg_h, write->reg_l);
+	uint16_t reg_num = COMBINE_U8_TO_U16(write->num_h, write->num_l);
+
+	if (!reg_num || reg_num > MODBUS_WR_REG_NUM_MAX) {
+		handle->ex_code = MODBUS_EX_ILLEGAL_VALUE;
 		return 0;
+	}
 
-	crc = crc16_update_bytes(crc, pdata_out, pkt_len);
+	// 写入数据
+	const uint8_t *p = (const uint8_t *)write + sizeof(struct pdu_write);
+	for (uint16_t i = 0; i < reg_num; i++, p += 2)
+		handle->data_in_out[i] = COMBINE_U8_TO_U16(p[0], p[1]);
 
-	pdata_out[pkt_len++] = GET_U8_LOW_FROM_U16(crc);
-	pdata_out[pkt_len++] = GET_U8_HIGH_FROM_U16(crc);
+	if (_work_handle(handle, unit, MODBUS_FUN_WR_REG_MUL, reg, reg_num) != MODBUS_RESP_SUCCESS)
+		return 0;
+
+	resp[pkt_len++] = MODBUS_FUN_WR_REG_MUL;
+	resp[pkt_len++] = GET_U8_HIGH_FROM_U16(reg);
+	resp[pkt_len++] = GET_U8_LOW_FROM_U16(reg);
+	resp[pkt_len++] = GET_U8_HIGH_FROM_U16(reg_num);
+	resp[pkt_len++] = GET_U8_LOW_FROM_U16(reg_num);
 
 	return pkt_len;
 }
 
 /**
- * @brief 处理写功能码
+ * @brief 处理对应功能码, RTU/TCP共用
  *
  * @param handle 从机句柄
- * @return uint16_t 响应长度
+ * @param unit 目标单元
+ * @param func 功能码
+ * @param body 功能码之后的数据, 调用前需保证长度合法
+ * @param resp 响应PDU缓冲
+ * @return uint16_t 响应PDU长度, 0代表不回复
  */
-static uint16_t _packet_ack_write_frame(mb_slv_handle handle)
+static uint16_t _dispatch_pdu(mb_slv_handle handle, const struct mb_slv_unit *unit, uint8_t func,
+	const uint8_t *body, uint8_t *resp)
 {
-	if (!handle)
+	switch (func) {
+	case MODBUS_FUN_RD_REG_MUL: // 读功能码
+		return _packet_ack_read_pdu(handle, unit, (const struct pdu_read *)body, resp);
+
+	case MODBUS_FUN_WR_REG_MUL: // 写功能码
+		return _packet_ack_write_pdu(handle, unit, (const struct pdu_write *)body, resp);
+
+	default:
 		return 0;
+	}
+}
 
-	uint16_t pkt_len = 0;
-	uint16_t crc = 0xffff;
+/**
+ * @brief 下游主机回复, 组装响应PDU并通过回复上下文回传
+ *
+ * 下游回复的异常码原样转发, 超时或回复无效时回复网关目标无响应(0x0B)
+ *
+ * @param data 读功能码接收到的数据, 下游异常时为异常码
+ * @param len 数据长度, 下游异常时为1
+ * @param is_timeout 下游超时或回复异常
+ * @param arg 转发中的请求
+ */
+static void _gateway_resp(uint8_t *data, size_t len, bool is_timeout, void *arg)
+{
+	struct gw_pending *pending = arg;
+	struct mb_mst_request *req = &pending->req;
+
+	uint8_t pdu[MODBUS_PDU_BYTES_MAX];
+	uint16_t pdu_len = 0;
+
+	if (is_timeout) {
+		pdu[pdu_len++] = req->func | MODBUS_EXCEPTION_FLAG;
+		pdu[pdu_len++] = (len == 1 && data[0]) ? data[0] : MODBUS_EX_GW_TARGET_FAILED;
+	} else if (req->func == MODBUS_FUN_RD_REG_MUL) {
+		if (len > MODBUS_PDU_BYTES_MAX - 2)
+			len = MODBUS_PDU_BYTES_MAX - 2;
+		pdu[pdu_len++] = MODBUS_FUN_RD_REG_MUL;
+		pdu[pdu_len++] = len;
+		memcpy(&pdu[pdu_len], data, len);
+		pdu_len += len;
+	} else {
+		pdu[pdu_len++] = MODBUS_FUN_WR_REG_MUL;
+		pdu[pdu_len++] = GET_U8_HIGH_FROM_U16(req->reg_addr);
+		pdu[pdu_len++] = GET_U8_LOW_FROM_U16(req->reg_addr);
+		pdu[pdu_len++] = GET_U8_HIGH_FROM_U16(req->reg_len);
+		pdu[pdu_len++] = GET_U8_LOW_FROM_U16(req->reg_len);
+	}
 
-	int ret_flag = MODBUS_RESP_ERR_OTHER; // 用户响应结果
+	// 先释放再回调, 回调中可以立即发起新的转发
+	struct mb_slv_reply_ctx ctx = pending->ctx;
+	pending->used = false;
 
-	uint16_t reg =
-		COMBINE_U8_TO_U16(handle->msg_state.pdu.write.reg_h, handle->msg_state.pdu.write.reg_l);
-	uint16_t reg_num =
-		COMBINE_U8_TO_U16(handle->msg_state.pdu.write.num_h, handle->msg_state.pdu.write.num_l);
+	ctx.cb(ctx.arg, ctx.tag, pdu, pdu_len);
+}
 
-	uint8_t *pdata_out = handle->modbus_frame_buff; // 存储响应数据
+/**
+ * @brief 把未注册单元的请求转发给下游主机
+ *
+ * @param handle 从机句柄
+ * @param unit_id 目标单元地址
+ * @param func 功能码
+ * @param body 功能码之后的数据, 调用前需保证长度合法
+ * @param ctx 回复上下文
+ * @return true 已转发
+ * @return false 转发失败
+ */
+static bool _gateway_forward(mb_slv_handle handle, uint8_t unit_id, uint8_t func,
+	const uint8_t *body, const struct mb_slv_reply_ctx *ctx)
+{
+	struct gw_pending *pending = NULL;
+	for (size_t i = 0; i < MB_SLV_GW_MAX_PENDING; i++) {
+		if (!handle->gw_pending[i].used) {
+			pending = &handle->gw_pending[i];
+			break;
+		}
+	}
+	if (!pending)
+		return false; // 转发已满, 丢弃
+
+	const struct pdu_read *read = (const struct pdu_read *)body; // 读写帧头部布局相同
+	uint16_t reg_num = COMBINE_U8_TO_U16(read->num_h, read->num_l);
+	uint16_t num_max =
+		(func == MODBUS_FUN_RD_REG_MUL) ? MODBUS_RD_REG_NUM_MAX : MODBUS_WR_REG_NUM_MAX;
+	if (!reg_num || reg_num > num_max)
+		return false;
 
-	uint8_t func = handle->msg_state.func;
+	struct mb_mst_request *req = &pending->req;
+	memset(req, 0, sizeof(struct mb_mst_request));
+	req->timeout_ms = handle->gw_timeout_ms;
+	req->slave_addr = unit_id;
+	req->func = func;
+	req->reg_addr = COMBINE_U8_TO_U16(read->reg_h, read->reg_l);
+	req->reg_len = reg_num;
+	req->resp = _gateway_resp;
+	req->arg = pending;
+
+	// 写数据由主机拷贝到请求池
+	if (func == MODBUS_FUN_WR_REG_MUL) {
+		const struct pdu_write *write = (const struct pdu_write *)body;
+		req->data = (uint8_t *)body + sizeof(struct pdu_write);
+		req->data_len = write->len;
+	}
 
-	pdata_out[pkt_len++] = handle->msg_state.addr;
+	pending->slv = handle;
+	pending->ctx = *ctx;
+	pending->used = true;
 
-	ret_flag = _rtu_handle(handle); // 注册回调处理
+	pending->id = mb_mst_pdu_request(handle->gateway, req);
+	if (!pending->id) {
+		pending->used = false;
+		return false;
+	}
 
-	if (ret_flag == MODBUS_RESP_SUCCESS) {
-		pdata_out[pkt_len++] = MODBUS_FUN_WR_REG_MUL;
-		pdata_out[pkt_len++] = GET_U8_HIGH_FROM_U16(reg);
-		pdata_out[pkt_len++] = GET_U8_LOW_FROM_U16(reg);
+	return true;
+}
 
-		pdata_out[pkt_len++] = GET_U8_HIGH_FROM_U16(reg_num);
-		pdata_out[pkt_len++] = GET_U8_LOW_FROM_U16(reg_num);
-	} else
+/**
+ * @brief 处理请求PDU: 本机单元直接处理, 其他单元在网关模式下转发
+ *
+ * @param handle 从机句柄
+ * @param unit_id 单元地址
+ * @param func 功能码
+ * @param body 功能码之后的数据, 调用前需保证长度合法
+ * @param resp 响应PDU缓冲
+ * @param ctx 回复上下文, NULL代表不允许转发
+ * @return uint16_t 响应PDU长度, 0代表不回复, MB_SLV_PDU_PENDING代表已转发
+ */
+static uint16_t _process_pdu(mb_slv_handle handle, uint8_t unit_id, uint8_t func,
+	const uint8_t *body, uint8_t *resp, const struct mb_slv_reply_ctx *ctx)
+{
+	const struct mb_slv_unit *unit = find_unit(handle, unit_id);
+	if (unit)
+		return _dispatch_pdu(handle, unit, func, body, resp);
+
+	if (!handle->gateway || !ctx || !ctx->cb || unit_id == 0)
 		return 0;
 
-	crc = crc16_update_bytes(crc, pdata_out, pkt_len);
-	pdata_out[pkt_len++] = GET_U8_LOW_FROM_U16(crc);
-	pdata_out[pkt_len++] = GET_U8_HIGH_FROM_U16(crc);
+	return _gateway_forward(handle, unit_id, func, body, ctx) ? MB_SLV_PDU_PENDING : 0;
+}
 
-	return pkt_len;
+/**
+ * @brief RTU回复主机
+ *
+ * @param handle 从机句柄
+ * @param frame 完整RTU帧
+ * @param len 帧长度
+ */
+static void _rtu_reply(mb_slv_handle handle, uint8_t *frame, uint16_t len)
+{
+	handle->opts->f_dir_ctrl(modbus_serial_dir_tx_only, handle->opts->arg);
+	handle->opts->f_write(frame, len, handle->opts->arg); // 回复主机
+
+	handle->link.tx_frames++;
+	handle->link.tx_bytes += len;
+
+	if (handle->opts->f_check_send)
+		handle->is_sending = true; // DMA发送
+	else
+		handle->opts->f_dir_ctrl(modbus_serial_dir_rx_only, handle->opts->arg); // 轮训发送
 }
 
 /**
- * @brief 处理对应功能码
+ * @brief RTU侧网关转发完成, 打包并回复主机
+ *
+ * @param arg 从机句柄
+ * @param tag 从机地址
+ * @param pdu 响应PDU
+ * @param pdu_len 响应PDU长度
+ */
+static void _rtu_gateway_reply(void *arg, uint32_t tag, const uint8_t *pdu, uint16_t pdu_len)
+{
+	mb_slv_handle handle = arg;
+	uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+	uint16_t len = 0;
+
+	handle->rtu_gw_busy = false;
+
+	frame[len++] = (uint8_t)tag;
+	memcpy(&frame[len], pdu, pdu_len);
+	len += pdu_len;
+
+	uint16_t crc = crc16_update_bytes(0xffff, frame, len);
+	frame[len++] = GET_U8_LOW_FROM_U16(crc);
+	frame[len++] = GET_U8_HIGH_FROM_U16(crc);
+
+	_rtu_reply(handle, frame, len);
+}
+
+/**
+ * @brief 处理RTU帧并打包回复
  *
  * @param handle 从机句柄
  * @return uint16_t 回复响应的数据长度
@@ -397,33 +718,80 @@ static uint16_t _dispatch_rtu_msg(mb_slv_handle handle)
 	if (!handle)
 		return 0;
 
-	uint16_t ptk_len = 0;  // 处理结果长度
-	uint16_t reg, reg_num; // 寄存器地址, 长度
-	uint8_t data_len;
-
-	const uint8_t *p;
+	uint16_t ptk_len = 0;
+	uint16_t crc;
 
 	struct msg_info *p_msg = &handle->msg_state; // 接收数据
+	uint8_t *pdata_out = handle->modbus_frame_buff; // 存储回复的数据
 
-	switch (p_msg->func) {
-	case MODBUS_FUN_RD_REG_MUL:
-		return _packet_ack_read_frame(handle); // 读功能码
+	pdata_out[ptk_len++] = p_msg->addr;
 
-	case MODBUS_FUN_WR_REG_MUL:
-		data_len = p_msg->pdu.write.len;
+	// RTU半双工, 同一时间只转发一个请求
+	struct mb_slv_reply_ctx ctx = {
+		.cb = _rtu_gateway_reply,
+		.arg = handle,
+		.tag = p_msg->addr,
+	};
 
-		// 写入数据
-		p = &p_msg->pdu.data[sizeof(struct pdu_write)];
-		for (uint8_t i = 0, j = 0; i < data_len; i += 2, j++) {
-			handle->data_in_out[j] = (*p++ << 8);
-			handle->data_in_out[j] |= *p++;
-		}
+	// 网关转发的地址没有对应单元, 不做单元统计
+	uint8_t idx = handle->unit_index[p_msg->addr];
+	struct mb_slv_unit_stats *unit_st = idx ? &handle->units[idx - 1].stats : NULL;
+	if (unit_st)
+		unit_st->rx_frames++;
 
-		return _packet_ack_write_frame(handle); // 写功能码
+	handle->ex_code = 0;
 
-	default:
+	uint16_t pdu_len = _process_pdu(handle, p_msg->addr, p_msg->func, p_msg->pdu.data,
+		&pdata_out[ptk_len], handle->rtu_gw_busy ? NULL : &ctx);
+	if (pdu_len == MB_SLV_PDU_PENDING) {
+		handle->rtu_gw_busy = true;
 		return 0;
 	}
+
+	if (handle->ex_code) {
+		handle->link.exceptions[handle->ex_code]++;
+		if (unit_st)
+			unit_st->exceptions++;
+	}
+
+	if (!pdu_len)
+		return 0;
+	ptk_len += pdu_len;
+
+	if (unit_st)
+		unit_st->tx_frames++;
+
+	crc = crc16_update_bytes(0xffff, pdata_out, ptk_len);
+	pdata_out[ptk_len++] = GET_U8_LOW_FROM_U16(crc);
+	pdata_out[ptk_len++] = GET_U8_HIGH_FROM_U16(crc);
+
+	return ptk_len;
+}
+
+/**
+ * @brief 校验一帧完整PDU是否合法
+ *
+ * @param pdu 请求PDU(功能码 + 数据)
+ * @param pdu_len PDU长度
+ * @return true 合法
+ * @return false 非法
+ */
+static bool _check_pdu(const uint8_t *pdu, uint16_t pdu_len)
+{
+	if (pdu_len < MODBUS_FUNC_BYTES_NUM)
+		return false;
+
+	uint8_t func = pdu[0];
+	uint8_t mini_len = get_pdu_mini_len(func);
+	if (!mini_len || pdu_len < MODBUS_FUNC_BYTES_NUM + mini_len)
+		return false;
+
+	if (func == MODBUS_FUN_RD_REG_MUL)
+		return pdu_len == MODBUS_FUNC_BYTES_NUM + mini_len;
+
+	uint8_t ex_len = get_pdu_extern_len((const struct pdu_write *)&pdu[MODBUS_FUNC_BYTES_NUM]);
+
+	return ex_len && (pdu_len == MODBUS_FUNC_BYTES_NUM + mini_len + ex_len);
 }
 
 /***************************API***************************/
@@ -450,10 +818,13 @@ mb_slv_handle mb_slv_init(
 		return NULL;
 
 	handle->opts = opts;
-	handle->work_table = work_table;
-	handle->table_num = table_num;
-	handle->slave_addr = slv_addr;
 	handle->is_sending = false;
+	handle->link_start_us = now_us();
+
+	if (!mb_slv_add_unit(handle, slv_addr, work_table, table_num)) {
+		free(handle);
+		return NULL;
+	}
 
 	ret = queue_init(
 		&handle->msg_state.rx_q, sizeof(uint8_t), handle->msg_state.rx_queue_buff, RX_BUFF_SIZE);
@@ -462,13 +833,13 @@ mb_slv_handle mb_slv_init(
 		return NULL;
 	}
 
-	ret = opts->f_init();
+	ret = opts->f_init(opts->arg);
 	if (!ret) {
 		free(handle);
 		return NULL;
 	}
 
-	opts->f_dir_ctrl(modbus_serial_dir_rx_only);
+	opts->f_dir_ctrl(modbus_serial_dir_rx_only, opts->arg);
 
 	return handle;
 }
@@ -483,6 +854,12 @@ void mb_slv_destroy(mb_slv_handle handle)
 	if (!handle)
 		return;
 
+	// 取消转发中的下游请求, 避免回调访问已释放的句柄
+	for (size_t i = 0; i < MB_SLV_GW_MAX_PENDING; i++) {
+		if (handle->gw_pending[i].used)
+			mb_mst_cancel(handle->gateway, handle->gw_pending[i].id);
+	}
+
 	free(handle);
 }
 
@@ -496,37 +873,218 @@ void mb_slv_poll(mb_slv_handle handle)
 	if (!handle)
 		return;
 
+	struct msg_info *p_msg = &handle->msg_state;
+
+	const struct serial_opts *opts = handle->opts;
+
 	// DMA才需要检查发送中
-	if (handle->opts->f_check_send && handle->is_sending) {
-		bool complete = handle->opts->f_check_send();
-		if (complete) {
-			handle->is_sending = false;
-			handle->opts->f_dir_ctrl(modbus_serial_dir_rx_only); // 发送完成, 切回接收
-		}
+	if (opts->f_check_send && handle->is_sending) {
+		bool complete = opts->f_check_send(opts->arg);
+		if (!complete)
+			return;
+
+		handle->is_sending = false;
+		opts->f_dir_ctrl(modbus_serial_dir_rx_only, opts->arg); // 发送完成, 切回接收
+	}
+
+	size_t ptk_len = opts->f_read(handle->modbus_frame_buff, MODBUS_FRAME_BYTES_MAX, opts->arg);
+	if (ptk_len) {
+		handle->link.rx_bytes += ptk_len;
+
+		// 解析器空闲, 本次读取的数据为新帧开始
+		if (p_msg->anchor == p_msg->rx_q.wr)
+			handle->rx_start_us = now_us();
+
+		size_t ret_q = queue_add(&p_msg->rx_q, handle->modbus_frame_buff, ptk_len);
+		if (ret_q != ptk_len)
+			return; // 空间不足
+	}
+
+	// 粘包时一次处理所有完整帧, 避免剩余帧等到下次收到数据
+	while (_recv_parser(handle)) {
+		handle->link.rx_frames++;
+
+		ptk_len = _dispatch_rtu_msg(handle);
+		if (!ptk_len)
+			continue; // 无回复数据
+
+		_rtu_reply(handle, handle->modbus_frame_buff, ptk_len);
+		latency_record(&handle->latency, now_us() - handle->rx_start_us);
+
+		if (handle->is_sending)
+			break; // DMA发送中, 剩余帧在发送完成后处理
+	}
+}
+
+/**
+ * @brief 为从机句柄增加一个单元(从机地址), 每个单元拥有独立的处理表
+ *
+ * @param handle 从机句柄
+ * @param slv_addr 从机地址
+ * @param work_table 任务处理表
+ * @param table_num 任务处理表数量
+ * @return true 成功
+ * @return false 地址已存在或单元数量已满
+ */
+bool mb_slv_add_unit(
+	mb_slv_handle handle, uint8_t slv_addr, struct mb_slv_work *work_table, uint16_t table_num)
+{
+	// 0为广播地址, 0xFF为TCP通配
+	if (!handle || slv_addr == 0 || slv_addr == MODBUS_TCP_UNIT_ID_ANY)
+		return false;
+
+	if (handle->unit_index[slv_addr] || handle->unit_num >= MB_SLV_MAX_UNITS)
+		return false;
+
+	struct mb_slv_unit *unit = &handle->units[handle->unit_num++];
+	unit->addr = slv_addr;
+	unit->work_table = work_table;
+	unit->table_num = table_num;
+
+	handle->unit_index[slv_addr] = handle->unit_num;
+
+	return true;
+}
+
+/**
+ * @brief 开启网关模式, 未注册的单元地址转发给下游主机并回传响应
+ *
+ * 下游主机的生命周期必须长于从机: 从机销毁时会取消转发中的下游请求, 因此须先销毁从机再销毁主机
+ *
+ * @param handle 从机句柄
+ * @param mst 下游主机句柄, NULL代表关闭网关, 须在从机销毁后再销毁
+ * @param timeout_ms 下游请求超时时间
+ */
+void mb_slv_set_gateway(mb_slv_handle handle, mb_mst_handle mst, uint32_t timeout_ms)
+{
+	if (!handle)
 		return;
+
+	handle->gateway = mst;
+	handle->gw_timeout_ms = timeout_ms;
+}
+
+/**
+ * @brief 处理一帧完整的请求PDU, 供RTU以外的传输层(如Modbus TCP)共用同一处理表
+ *
+ * @param handle 从机句柄
+ * @param unit_id 单元标识(从机地址), MODBUS_TCP_UNIT_ID_ANY 代表不区分
+ * @param pdu 请求PDU(功能码 + 数据), 不含地址/MBAP头及CRC
+ * @param pdu_len 请求PDU长度
+ * @param resp 响应PDU缓冲, 长度不小于 MODBUS_PDU_BYTES_MAX
+ * @param ctx 异步回复上下文, NULL代表不允许网关转发
+ * @return uint16_t 响应PDU长度, 0代表不回复, MB_SLV_PDU_PENDING代表已转发待回调
+ */
+uint16_t mb_slv_pdu_process(mb_slv_handle handle, uint8_t unit_id, const uint8_t *pdu,
+	uint16_t pdu_len, uint8_t *resp, const struct mb_slv_reply_ctx *ctx)
+{
+	if (!handle || !pdu || !resp)
+		return 0;
+
+	if (!_check_pdu(pdu, pdu_len))
+		return 0;
+
+	return _process_pdu(handle, unit_id, pdu[0], &pdu[MODBUS_FUNC_BYTES_NUM], resp, ctx);
+}
+
+/**
+ * @brief 取消回复上下文匹配的网关转发, 被取消的请求不再回调
+ *
+ * 传输层在释放回复上下文引用的资源(如TCP连接)前调用, 避免转发完成时访问已释放的内存
+ *
+ * @param handle 从机句柄
+ * @param cb 回复回调
+ * @param arg 用户数据, NULL代表匹配该回调的所有转发
+ * @return size_t 取消的请求数
+ */
+size_t mb_slv_cancel_reply(mb_slv_handle handle, mb_slv_reply_cb cb, const void *arg)
+{
+	if (!handle || !cb)
+		return 0;
+
+	size_t num = 0;
+	for (size_t i = 0; i < MB_SLV_GW_MAX_PENDING; i++) {
+		struct gw_pending *pending = &handle->gw_pending[i];
+		if (!pending->used || pending->ctx.cb != cb || (arg && pending->ctx.arg != arg))
+			continue;
+
+		mb_mst_cancel(handle->gateway, pending->id);
+		pending->used = false;
+		num++;
 	}
 
-	size_t ptk_len = handle->opts->f_read(handle->modbus_frame_buff, MODBUS_FRAME_BYTES_MAX);
-	if (!ptk_len) // 无数据
+	return num;
+}
+
+/**
+ * @brief 获取RTU请求到回复的延时统计(不含网关转发的请求)
+ *
+ * @param handle 从机句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零
+ */
+void mb_slv_get_latency(mb_slv_handle handle, struct mb_slv_latency *out, bool reset)
+{
+	if (!handle || !out)
 		return;
 
-	size_t ret_q = queue_add(&(handle->msg_state.rx_q), handle->modbus_frame_buff, ptk_len);
-	if (ret_q != ptk_len)
-		return; // 空间不足
+	*out = handle->latency;
+	if (reset)
+		memset(&handle->latency, 0, sizeof(handle->latency));
+}
 
-	bool ret_parser = _recv_parser(handle);
-	if (!ret_parser)
-		return; // 无完整帧
+/**
+ * @brief 获取RTU串口链路统计, 并按配置的波特率估算总线占用率
+ *
+ * 从机不回复异常响应, 异常码统计的是处理失败的请求
+ *
+ * @param handle 从机句柄
+ * @param out 输出统计
+ * @param reset 读取后是否清零, 清零后重新计时
+ */
+void mb_slv_get_link_stats(mb_slv_handle handle, struct mb_link_stats *out, bool reset)
+{
+	if (!handle || !out)
+		return;
 
-	ptk_len = _dispatch_rtu_msg(handle);
-	if (!ptk_len)
-		return; // 无回复数据
+	uint64_t now = now_us();
 
-	handle->opts->f_dir_ctrl(modbus_serial_dir_tx_only);
-	handle->opts->f_write(handle->modbus_frame_buff, ptk_len); // 回复主机
+	*out = handle->link;
+	out->elapsed_us = now - handle->link_start_us;
 
-	if (handle->opts->f_check_send)
-		handle->is_sending = true; // DMA发送
-	else
-		handle->opts->f_dir_ctrl(modbus_serial_dir_rx_only); // 轮训发送
+	uint32_t baud = handle->opts->baud;
+	if (baud && out->elapsed_us) {
+		out->busy_us = MODBUS_RTU_WIRE_US(
+			out->tx_bytes + out->rx_bytes, out->tx_frames + out->rx_frames, baud);
+		uint64_t pct = out->busy_us * 100 / out->elapsed_us;
+		out->occupancy_pct = pct > 100 ? 100 : (uint8_t)pct;
+	}
+
+	if (reset) {
+		memset(&handle->link, 0, sizeof(handle->link));
+		handle->link_start_us = now;
+	}
+}
+
+/**
+ * @brief 获取单元(从机地址)的RTU收发统计
+ *
+ * @param handle 从机句柄
+ * @param slv_addr 从机地址
+ * @param out 输出统计
+ * @return true 成功
+ * @return false 参数非法或地址未注册
+ */
+bool mb_slv_get_unit_stats(mb_slv_handle handle, uint8_t slv_addr, struct mb_slv_unit_stats *out)
+{
+	if (!handle || !out)
+		return false;
+
+	uint8_t idx = handle->unit_index[slv_addr];
+	if (!idx)
+		return false;
+
+	*out = handle->units[idx - 1].stats;
+
+	return true;
 }
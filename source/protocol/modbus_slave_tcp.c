@@ -0,0 +1,554 @@
+/**
+ * @file modbus_slave_tcp.c
+ * @author wenshuyu (wsy2161826815@163.com)
+ * @brief modbus从机 TCP(MBAP) 传输层
+ * @version 1.0
+ * @date 2024-12-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE // accept4
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "utils/logger.h"
+#include "protocol/modbus_slave_tcp.h"
+
+// 单个连接的收发缓冲, 发送缓冲可容纳多帧以支持流水线请求及网关转发中的回复
+#define CONN_RX_BUFF_SIZE (MODBUS_TCP_FRAME_BYTES_MAX * 2)
+#define CONN_TX_BUFF_SIZE (MODBUS_TCP_FRAME_BYTES_MAX * 8)
+
+// MBAP头各字段偏移
+#define MBAP_TID_OFFSET (0)	 // 事务标识
+#define MBAP_PID_OFFSET (2)	 // 协议标识
+#define MBAP_LEN_OFFSET (4)	 // 后续字节数(单元标识 + PDU)
+#define MBAP_UNIT_OFFSET (6) // 单元标识
+
+struct mb_slv_tcp;
+
+// 客户端连接
+struct tcp_conn {
+	struct mb_slv_tcp *owner; // 所属TCP从机
+	int fd;					  // 套接字, -1代表空闲
+	uint8_t gen;			  // 连接代数, 关闭后递增, 用于丢弃旧连接的网关回复
+	size_t pending;			  // 网关转发中的请求数
+
+	uint8_t rx_buf[CONN_RX_BUFF_SIZE]; // 接收缓冲
+	size_t rx_len;					   // 接收长度
+
+	uint8_t tx_buf[CONN_TX_BUFF_SIZE]; // 发送缓冲
+	size_t tx_len;					   // 待发送长度
+};
+
+// TCP从机
+struct mb_slv_tcp {
+	mb_slv_handle slv; // 共用的从机句柄
+	int listen_fd;	   // 监听套接字
+	int epoll_fd;	   // epoll描述符
+
+	struct tcp_conn conns[MB_SLV_TCP_MAX_CONN]; // 客户端连接
+};
+
+/**
+ * @brief 发送缓冲是否还能容纳新请求的回复, 需为转发中的请求预留空间
+ *
+ * @param conn 客户端连接
+ * @return true 可以
+ * @return false 不可以
+ */
+static bool conn_tx_has_room(const struct tcp_conn *conn)
+{
+	return CONN_TX_BUFF_SIZE - conn->tx_len >= (conn->pending + 1) * MODBUS_TCP_FRAME_BYTES_MAX;
+}
+
+/**
+ * @brief 根据发送缓冲状态更新监听事件
+ * 
+ * 发送缓冲容纳不下一帧回复时暂停读取, 等待可写, 形成背压
+ *
+ * @param handle TCP从机句柄
+ * @param conn 客户端连接
+ */
+static void conn_update_events(mb_slv_tcp_handle handle, struct tcp_conn *conn)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+
+	ev.events = EPOLLRDHUP;
+	if (conn->tx_len)
+		ev.events |= EPOLLOUT;
+	if (conn_tx_has_room(conn))
+		ev.events |= EPOLLIN;
+	ev.data.ptr = conn;
+
+	if (epoll_ctl(handle->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0)
+		LOG_E("Modify modbus tcp conn events failed: %s", strerror(errno));
+}
+
+/**
+ * @brief 关闭客户端连接
+ *
+ * @param handle TCP从机句柄
+ * @param conn 客户端连接
+ */
+static void conn_close(mb_slv_tcp_handle handle, struct tcp_conn *conn)
+{
+	if (conn->fd < 0)
+		return;
+
+	epoll_ctl(handle->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+
+	conn->fd = -1;
+	conn->gen++;
+	conn->pending = 0;
+	conn->rx_len = 0;
+	conn->tx_len = 0;
+}
+
+/**
+ * @brief 尽可能发送缓冲中的回复
+ *
+ * @param conn 客户端连接
+ * @return true 正常
+ * @return false 连接异常, 需要关闭
+ */
+static bool conn_flush(struct tcp_conn *conn)
+{
+	size_t sent = 0;
+
+	while (sent < conn->tx_len) {
+		ssize_t n = send(conn->fd, conn->tx_buf + sent, conn->tx_len - sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return false;
+		}
+		sent += n;
+	}
+
+	if (sent) {
+		conn->tx_len -= sent;
+		memmove(conn->tx_buf, conn->tx_buf + sent, conn->tx_len);
+	}
+
+	return true;
+}
+
+/**
+ * @brief 读取客户端数据
+ *
+ * @param conn 客户端连接
+ * @return true 正常
+ * @return false 对端关闭或连接异常, 需要关闭
+ */
+static bool conn_read(struct tcp_conn *conn)
+{
+	while (conn->rx_len < CONN_RX_BUFF_SIZE) {
+		ssize_t n =
+			recv(conn->fd, conn->rx_buf + conn->rx_len, CONN_RX_BUFF_SIZE - conn->rx_len, 0);
+		if (n == 0)
+			return false; // 对端关闭
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+		conn->rx_len += n;
+	}
+
+	return true;
+}
+
+/**
+ * @brief 在发送缓冲末尾追加一帧回复
+ *
+ * @param conn 客户端连接
+ * @param tid 事务标识
+ * @param unit_id 单元标识
+ * @param pdu 响应PDU, 可以已在发送缓冲的目标位置
+ * @param pdu_len 响应PDU长度
+ */
+static void conn_append_reply(
+	struct tcp_conn *conn, uint16_t tid, uint8_t unit_id, const uint8_t *pdu, uint16_t pdu_len)
+{
+	uint8_t *out = conn->tx_buf + conn->tx_len;
+
+	out[MBAP_TID_OFFSET] = GET_U8_HIGH_FROM_U16(tid);
+	out[MBAP_TID_OFFSET + 1] = GET_U8_LOW_FROM_U16(tid);
+	out[MBAP_PID_OFFSET] = GET_U8_HIGH_FROM_U16(MODBUS_TCP_PROTOCOL_ID);
+	out[MBAP_PID_OFFSET + 1] = GET_U8_LOW_FROM_U16(MODBUS_TCP_PROTOCOL_ID);
+	out[MBAP_LEN_OFFSET] = GET_U8_HIGH_FROM_U16(pdu_len + 1);
+	out[MBAP_LEN_OFFSET + 1] = GET_U8_LOW_FROM_U16(pdu_len + 1);
+	out[MBAP_UNIT_OFFSET] = unit_id;
+
+	if (pdu != &out[MODBUS_TCP_MBAP_BYTES_NUM])
+		memcpy(&out[MODBUS_TCP_MBAP_BYTES_NUM], pdu, pdu_len);
+
+	conn->tx_len += MODBUS_TCP_MBAP_BYTES_NUM + pdu_len;
+}
+
+static void conn_service(mb_slv_tcp_handle handle, struct tcp_conn *conn);
+
+/**
+ * @brief 网关转发完成, 回复对应连接
+ *
+ * @param arg 客户端连接
+ * @param tag 事务标识(高16位) | 单元标识(8位) | 连接代数(低8位)
+ * @param pdu 响应PDU
+ * @param pdu_len 响应PDU长度
+ */
+static void conn_gateway_reply(void *arg, uint32_t tag, const uint8_t *pdu, uint16_t pdu_len)
+{
+	struct tcp_conn *conn = arg;
+
+	// 连接已关闭或已被新客户端复用
+	if (conn->fd < 0 || conn->gen != (uint8_t)tag)
+		return;
+
+	if (conn->pending)
+		conn->pending--;
+
+	conn_append_reply(conn, tag >> 16, (tag >> 8) & 0xff, pdu, pdu_len);
+	conn_service(conn->owner, conn);
+}
+
+/**
+ * @brief 解析接收缓冲中所有完整的ADU并打包回复
+ *
+ * 同一连接上可连续收到多个事务(流水线), 按顺序处理, 回复中原样带回事务标识
+ *
+ * @param handle TCP从机句柄
+ * @param conn 客户端连接
+ * @return true 正常
+ * @return false 协议错误, 需要关闭
+ */
+static bool conn_process(mb_slv_tcp_handle handle, struct tcp_conn *conn)
+{
+	size_t offset = 0;
+
+	while (conn->rx_len - offset >= MODBUS_TCP_MBAP_BYTES_NUM) {
+		// 发送缓冲不足, 剩余请求等可写后再处理
+		if (!conn_tx_has_room(conn))
+			break;
+
+		const uint8_t *adu = conn->rx_buf + offset;
+		uint16_t pid = COMBINE_U8_TO_U16(adu[MBAP_PID_OFFSET], adu[MBAP_PID_OFFSET + 1]);
+		uint16_t len = COMBINE_U8_TO_U16(adu[MBAP_LEN_OFFSET], adu[MBAP_LEN_OFFSET + 1]);
+
+		// MBAP非法, TCP流无法再同步, 直接断开
+		if (pid != MODBUS_TCP_PROTOCOL_ID || len < 2 || len > MODBUS_PDU_BYTES_MAX + 1) {
+			LOG_W("Invalid MBAP header, pid:0x%04x len:%u", pid, len);
+			return false;
+		}
+
+		if (conn->rx_len - offset < (size_t)MBAP_UNIT_OFFSET + len)
+			break; // 断包, 等待后续数据
+
+		uint16_t tid = COMBINE_U8_TO_U16(adu[MBAP_TID_OFFSET], adu[MBAP_TID_OFFSET + 1]);
+		uint8_t unit_id = adu[MBAP_UNIT_OFFSET];
+
+		struct mb_slv_reply_ctx ctx = {
+			.cb = conn_gateway_reply,
+			.arg = conn,
+			.tag = ((uint32_t)tid << 16) | ((uint32_t)unit_id << 8) | conn->gen,
+		};
+
+		// 回复直接写在发送缓冲的PDU位置, 省去一次拷贝
+		uint8_t *out = conn->tx_buf + conn->tx_len + MODBUS_TCP_MBAP_BYTES_NUM;
+		uint16_t resp_len = mb_slv_pdu_process(
+			handle->slv, unit_id, &adu[MODBUS_TCP_MBAP_BYTES_NUM], len - 1, out, &ctx);
+		if (resp_len == MB_SLV_PDU_PENDING)
+			conn->pending++;
+		else if (resp_len)
+			conn_append_reply(conn, tid, unit_id, out, resp_len);
+
+		offset += MBAP_UNIT_OFFSET + len;
+	}
+
+	if (offset) {
+		conn->rx_len -= offset;
+		memmove(conn->rx_buf, conn->rx_buf + offset, conn->rx_len);
+	}
+
+	return true;
+}
+
+/**
+ * @brief 接受所有等待中的新连接
+ *
+ * @param handle TCP从机句柄
+ */
+static void accept_clients(mb_slv_tcp_handle handle)
+{
+	while (1) {
+		int fd = accept4(handle->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LOG_E("Accept modbus tcp client failed: %s", strerror(errno));
+			return;
+		}
+
+		struct tcp_conn *conn = NULL;
+		for (size_t i = 0; i < MB_SLV_TCP_MAX_CONN; i++) {
+			if (handle->conns[i].fd < 0) {
+				conn = &handle->conns[i];
+				break;
+			}
+		}
+
+		if (!conn) {
+			LOG_W("Too many modbus tcp clients, reject");
+			close(fd);
+			continue;
+		}
+
+		// 请求回复都是小包, 关闭Nagle降低回复延时
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = conn;
+		if (epoll_ctl(handle->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			LOG_E("Add modbus tcp client to epoll failed: %s", strerror(errno));
+			close(fd);
+			continue;
+		}
+
+		conn->fd = fd;
+		conn->rx_len = 0;
+		conn->tx_len = 0;
+	}
+}
+
+/**
+ * @brief 处理接收缓冲中的请求, 发送回复并更新监听事件
+ *
+ * @param handle TCP从机句柄
+ * @param conn 客户端连接
+ */
+static void conn_service(mb_slv_tcp_handle handle, struct tcp_conn *conn)
+{
+	if (!conn_process(handle, conn) || !conn_flush(conn))
+		goto err_close;
+
+	// 发送缓冲腾出空间后继续处理之前积压的请求
+	if (conn->rx_len && !conn_process(handle, conn))
+		goto err_close;
+
+	conn_update_events(handle, conn);
+	return;
+
+err_close:
+	conn_close(handle, conn);
+}
+
+/**
+ * @brief 处理单个连接的事件
+ *
+ * @param handle TCP从机句柄
+ * @param conn 客户端连接
+ * @param events 触发的事件
+ */
+static void conn_handle(mb_slv_tcp_handle handle, struct tcp_conn *conn, uint32_t events)
+{
+	if (conn->fd < 0)
+		return;
+
+	if (events & EPOLLERR)
+		goto err_close;
+
+	if ((events & EPOLLOUT) && !conn_flush(conn))
+		goto err_close;
+
+	if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !conn_read(conn))
+		goto err_close; // 对端关闭
+
+	conn_service(handle, conn);
+	return;
+
+err_close:
+	conn_close(handle, conn);
+}
+
+/***************************API***************************/
+
+/**
+ * @brief TCP从机初始化并申请句柄
+ *
+ * @param slv 从机句柄
+ * @param ip 监听地址, NULL代表监听所有网卡
+ * @param port 监听端口, 通常为 MODBUS_TCP_DEFAULT_PORT
+ * @return mb_slv_tcp_handle 成功返回句柄,失败返回NULL
+ */
+mb_slv_tcp_handle mb_slv_tcp_init(mb_slv_handle slv, const char *ip, uint16_t port)
+{
+	if (!slv)
+		return NULL;
+
+	struct mb_slv_tcp *handle = calloc(1, sizeof(struct mb_slv_tcp));
+	if (!handle)
+		return NULL;
+
+	handle->slv = slv;
+	handle->epoll_fd = -1;
+	for (size_t i = 0; i < MB_SLV_TCP_MAX_CONN; i++) {
+		handle->conns[i].owner = handle;
+		handle->conns[i].fd = -1;
+	}
+
+	// 创建监听套接字
+	handle->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (handle->listen_fd < 0) {
+		LOG_E("Create modbus tcp socket failed: %s", strerror(errno));
+		goto err_free;
+	}
+
+	int on = 1;
+	setsockopt(handle->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (ip && inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+		LOG_E("Invalid modbus tcp listen ip: %s", ip);
+		goto err_close_listen;
+	}
+
+	if (bind(handle->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		LOG_E("Bind modbus tcp port %u failed: %s", port, strerror(errno));
+		goto err_close_listen;
+	}
+
+	if (listen(handle->listen_fd, MB_SLV_TCP_MAX_CONN) < 0) {
+		LOG_E("Listen modbus tcp failed: %s", strerror(errno));
+		goto err_close_listen;
+	}
+
+	// 创建epoll实例
+	handle->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (handle->epoll_fd < 0) {
+		LOG_E("Create modbus tcp epoll failed: %s", strerror(errno));
+		goto err_close_listen;
+	}
+
+	// 监听套接字以NULL区分
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(handle->epoll_fd, EPOLL_CTL_ADD, handle->listen_fd, &ev) < 0) {
+		LOG_E("Add modbus tcp listen fd to epoll failed: %s", strerror(errno));
+		goto err_close_epoll;
+	}
+
+	return handle;
+
+err_close_epoll:
+	close(handle->epoll_fd);
+
+err_close_listen:
+	close(handle->listen_fd);
+
+err_free:
+	free(handle);
+
+	return NULL;
+}
+
+/**
+ * @brief 关闭所有连接并释放句柄
+ *
+ * @param handle TCP从机句柄
+ */
+void mb_slv_tcp_destroy(mb_slv_tcp_handle handle)
+{
+	if (!handle)
+		return;
+
+	// 转发中的请求引用了连接, 须在释放前取消
+	for (size_t i = 0; i < MB_SLV_TCP_MAX_CONN; i++) {
+		mb_slv_cancel_reply(handle->slv, conn_gateway_reply, &handle->conns[i]);
+		conn_close(handle, &handle->conns[i]);
+	}
+
+	close(handle->epoll_fd);
+	close(handle->listen_fd);
+	free(handle);
+}
+
+/**
+ * @brief TCP从机轮询, 不阻塞, 处理所有就绪的连接
+ *
+ * @param handle TCP从机句柄
+ */
+void mb_slv_tcp_poll(mb_slv_tcp_handle handle)
+{
+	if (!handle)
+		return;
+
+	struct epoll_event events[MB_SLV_TCP_MAX_CONN + 1];
+
+	int nfds = epoll_wait(handle->epoll_fd, events, MB_SLV_TCP_MAX_CONN + 1, 0);
+	if (nfds < 0) {
+		if (errno != EINTR)
+			LOG_E("Modbus tcp epoll_wait failed: %s", strerror(errno));
+		return;
+	}
+
+	for (int i = 0; i < nfds; i++) {
+		struct tcp_conn *conn = events[i].data.ptr;
+		if (!conn)
+			accept_clients(handle);
+		else
+			conn_handle(handle, conn, events[i].events);
+	}
+}
+
+/**
+ * @brief 获取内部epoll描述符, 可注册到外部事件循环, 可读时调用 mb_slv_tcp_poll
+ *
+ * @param handle TCP从机句柄
+ * @return int epoll描述符, 失败返回-1
+ */
+int mb_slv_tcp_get_fd(mb_slv_tcp_handle handle)
+{
+	return handle ? handle->epoll_fd : -1;
+}
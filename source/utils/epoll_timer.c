@@ -47,8 +47,15 @@
 #define MAX_EVENTS 64
 #endif
 
+// 事件源类型, 作为 epoll data.ptr 所指结构的第一个成员
+enum et_source {
+	ET_SOURCE_TIMER = 0, // 定时器任务
+	ET_SOURCE_FD,		 // 外部描述符
+};
+
 // 任务实例
 struct timer_task {
+	enum et_source source;					   // 事件源类型
 	const struct epoll_timer_task *ept_task_f; // 函数指针
 	int timer_fd;							   // 定时器描述符
 	void *priv;								   // 私有数据
@@ -57,6 +64,17 @@ struct timer_task {
 	struct timer_task *next;
 };
 
+// 外部描述符实例
+struct fd_watch {
+	enum et_source source;	  // 事件源类型
+	int fd;					  // 描述符
+	epoll_fd_handler f_handle; // 处理函数
+	void *arg;				  // 处理函数参数
+	bool removed;			  // 已移除(等待本轮事件处理结束后释放)
+
+	struct fd_watch *next;
+};
+
 // epoll_timer结构
 struct epoll_timer {
 	struct timer_task *task_list; // 任务链表
@@ -64,8 +82,46 @@ struct epoll_timer {
 	int stop_eventfd;			  // 停止任务描述符
 	pthread_mutex_t lock;		  // 互斥锁
 	bool running;				  // 运行标志
+
+	struct fd_watch *fd_list;	 // 外部描述符链表
+	struct fd_watch *fd_garbage; // 事件处理中被移除的描述符, 本轮结束后释放
+	pthread_mutex_t fd_lock;	 // 描述符链表互斥锁(任务去初始化时持有lock, 因此单独加锁)
 };
 
+static __thread et_handle m_self = NULL; // 当前线程所属的句柄
+
+/**
+ * @brief 设置当前线程所属的句柄
+ *
+ * @param handle 句柄
+ * @return et_handle 之前的句柄, 用于恢复
+ */
+static et_handle set_self(et_handle handle)
+{
+	et_handle old = m_self;
+	m_self = handle;
+	return old;
+}
+
+/**
+ * @brief 释放本轮事件处理中被移除的描述符实例
+ *
+ * @param handle 句柄
+ */
+static void free_fd_garbage(et_handle handle)
+{
+	pthread_mutex_lock(&handle->fd_lock);
+	struct fd_watch *w = handle->fd_garbage;
+	handle->fd_garbage = NULL;
+	pthread_mutex_unlock(&handle->fd_lock);
+
+	while (w) {
+		struct fd_watch *next = w->next;
+		free(w);
+		w = next;
+	}
+}
+
 /**
  * @brief 创建epoll监听句柄
  *
@@ -87,6 +143,11 @@ et_handle epoll_timer_create(void)
 		goto err_free_handle;
 	}
 
+	if (pthread_mutex_init(&handle->fd_lock, NULL) != 0) {
+		LOG_E("Failed to initialize mutex.");
+		goto err_free_lock;
+	}
+
 	// 创建epoll实例,使用EPOLL_CLOEXEC
 	handle->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 	if (handle->epoll_fd < 0) {
@@ -116,18 +177,21 @@ et_handle epoll_timer_create(void)
 
 	return handle;
 
-// 错误处理
-err_free_handle:
-	free(handle);
-
-err_free_mutex:
-	pthread_mutex_destroy(&handle->lock);
+// 错误处理, 按申请的逆序释放
+err_free_stop_fd:
+	close(handle->stop_eventfd);
 
 err_free_epoll:
 	close(handle->epoll_fd);
 
-err_free_stop_fd:
-	close(handle->stop_eventfd);
+err_free_mutex:
+	pthread_mutex_destroy(&handle->fd_lock);
+
+err_free_lock:
+	pthread_mutex_destroy(&handle->lock);
+
+err_free_handle:
+	free(handle);
 
 	return NULL;
 }
@@ -145,13 +209,8 @@ void epoll_timer_destroy(et_handle handle)
 	// 先停止事件监听
 	epoll_timer_stop(handle);
 
-	// 关闭停止事件fd
-	close(handle->stop_eventfd);
-
-	// 关闭epoll描述符
-	if (handle->epoll_fd >= 0)
-		close(handle->epoll_fd);
-
+	// 任务去初始化时可能移除自己注册的描述符, 因此先销毁任务再关闭epoll
+	et_handle old_self = set_self(handle);
 	pthread_mutex_lock(&handle->lock);
 
 	// 遍历任务链表并销毁每个任务
@@ -176,7 +235,26 @@ void epoll_timer_destroy(et_handle handle)
 
 	handle->task_list = NULL;
 	pthread_mutex_unlock(&handle->lock);
+	set_self(old_self);
+
+	// 释放未移除的外部描述符实例(描述符由调用者关闭)
+	struct fd_watch *w = handle->fd_list;
+	while (w) {
+		struct fd_watch *next = w->next;
+		free(w);
+		w = next;
+	}
+	handle->fd_list = NULL;
+	free_fd_garbage(handle);
 
+	// 关闭停止事件fd
+	close(handle->stop_eventfd);
+
+	// 关闭epoll描述符
+	if (handle->epoll_fd >= 0)
+		close(handle->epoll_fd);
+
+	pthread_mutex_destroy(&handle->fd_lock);
 	pthread_mutex_destroy(&handle->lock); // 销毁互斥锁
 
 	free(handle); // 释放句柄
@@ -206,9 +284,14 @@ bool epoll_timer_add_task(et_handle handle, const struct epoll_timer_task *task_
 	memset(new_task, 0, sizeof(struct timer_task));
 	new_task->timer_fd = -1;
 
+	new_task->source = ET_SOURCE_TIMER;
+
 	// 任务初始化
 	if (task_info->f_init) {
-		if (!task_info->f_init(&new_task->priv)) {
+		et_handle old_self = set_self(handle);
+		bool ret = task_info->f_init(&new_task->priv);
+		set_self(old_self);
+		if (!ret) {
 			LOG_E("%s init failed", task_info->task_name);
 			goto err_free_new_task;
 		} else
@@ -282,7 +365,9 @@ err_close_timer_fd:
 
 err_free_new_task:
 	if (task_info->f_deinit) {
+		et_handle old_self = set_self(handle);
 		task_info->f_deinit(new_task->priv);
+		set_self(old_self);
 		LOG_E("%s has deinited", task_info->task_name);
 	}
 
@@ -326,8 +411,11 @@ bool epoll_timer_remove_task(et_handle handle, const struct epoll_timer_task *ta
 			}
 
 			// 调用去初始化函数
-			if (task->ept_task_f->f_deinit)
+			if (task->ept_task_f->f_deinit) {
+				et_handle old_self = set_self(handle);
 				task->ept_task_f->f_deinit(task->priv);
+				set_self(old_self);
+			}
 
 			// 移除任务链表
 			if (task->prev)
@@ -354,6 +442,153 @@ bool epoll_timer_remove_task(et_handle handle, const struct epoll_timer_task *ta
 	return false;
 }
 
+/**
+ * @brief 添加描述符到监听事件, 就绪时在事件循环线程中立即调用处理函数
+ *
+ * @param handle epoll句柄
+ * @param fd 描述符(由调用者管理)
+ * @param events 监听的epoll事件, 如 EPOLLIN
+ * @param f_handle 处理函数
+ * @param arg 处理函数参数
+ * @return true 成功
+ * @return false 失败
+ */
+bool epoll_timer_add_fd(
+	et_handle handle, int fd, unsigned int events, epoll_fd_handler f_handle, void *arg)
+{
+	if (!handle || fd < 0 || !f_handle) {
+		LOG_E("Invalid arguments to epoll_timer_add_fd.");
+		return false;
+	}
+
+	struct fd_watch *w = malloc(sizeof(struct fd_watch));
+	if (!w) {
+		LOG_E("Failed to allocate memory for fd watch.");
+		return false;
+	}
+	memset(w, 0, sizeof(struct fd_watch));
+	w->source = ET_SOURCE_FD;
+	w->fd = fd;
+	w->f_handle = f_handle;
+	w->arg = arg;
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = w;
+
+	pthread_mutex_lock(&handle->fd_lock);
+	if (epoll_ctl(handle->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		pthread_mutex_unlock(&handle->fd_lock);
+		LOG_E("Failed to add fd %d to epoll: %s", fd, strerror(errno));
+		free(w);
+		return false;
+	}
+
+	w->next = handle->fd_list;
+	handle->fd_list = w;
+	pthread_mutex_unlock(&handle->fd_lock);
+
+	return true;
+}
+
+/**
+ * @brief 修改描述符的监听事件
+ *
+ * @param handle epoll句柄
+ * @param fd 描述符
+ * @param events 监听的epoll事件
+ * @return true 成功
+ * @return false 失败
+ */
+bool epoll_timer_mod_fd(et_handle handle, int fd, unsigned int events)
+{
+	if (!handle || fd < 0) {
+		LOG_E("Invalid arguments to epoll_timer_mod_fd.");
+		return false;
+	}
+
+	bool ret = false;
+
+	pthread_mutex_lock(&handle->fd_lock);
+	for (struct fd_watch *w = handle->fd_list; w; w = w->next) {
+		if (w->fd != fd)
+			continue;
+
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.ptr = w;
+		if (epoll_ctl(handle->epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0)
+			LOG_E("Failed to modify fd %d in epoll: %s", fd, strerror(errno));
+		else
+			ret = true;
+		break;
+	}
+	pthread_mutex_unlock(&handle->fd_lock);
+
+	return ret;
+}
+
+/**
+ * @brief 从监听事件中移除描述符, 不会关闭描述符
+ *
+ * @param handle epoll句柄
+ * @param fd 描述符
+ * @return true 成功
+ * @return false 失败
+ */
+bool epoll_timer_remove_fd(et_handle handle, int fd)
+{
+	if (!handle || fd < 0) {
+		LOG_E("Invalid arguments to epoll_timer_remove_fd.");
+		return false;
+	}
+
+	pthread_mutex_lock(&handle->fd_lock);
+	struct fd_watch **pp = &handle->fd_list;
+	while (*pp && (*pp)->fd != fd)
+		pp = &(*pp)->next;
+
+	struct fd_watch *w = *pp;
+	if (!w) {
+		pthread_mutex_unlock(&handle->fd_lock);
+		LOG_E("Fd %d not found for removal.", fd);
+		return false;
+	}
+	*pp = w->next;
+
+	if (epoll_ctl(handle->epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0)
+		LOG_E("Failed to remove fd %d from epoll: %s", fd, strerror(errno));
+
+	// 本轮已取出的事件可能仍引用该实例, 延后到本轮结束释放
+	w->removed = true;
+	w->next = handle->fd_garbage;
+	handle->fd_garbage = w;
+	pthread_mutex_unlock(&handle->fd_lock);
+
+	// 不在事件循环线程中, 循环未运行时直接释放
+	if (m_self != handle) {
+		pthread_mutex_lock(&handle->lock);
+		bool running = handle->running;
+		pthread_mutex_unlock(&handle->lock);
+		if (!running)
+			free_fd_garbage(handle);
+	}
+
+	return true;
+}
+
+/**
+ * @brief 获取当前线程所属的epoll句柄
+ *
+ * @return et_handle 不在回调中返回NULL
+ */
+et_handle epoll_timer_self(void)
+{
+	return m_self;
+}
+
 /**
  * @brief 停止事件监听
  *
@@ -402,6 +637,7 @@ int epoll_timer_run(et_handle handle)
 	pthread_mutex_unlock(&handle->lock);
 
 	struct epoll_event events[MAX_EVENTS]; // 最大监听事件
+	et_handle old_self = set_self(handle);
 
 	while (1) {
 		// 等待事件触发
@@ -432,16 +668,27 @@ int epoll_timer_run(et_handle handle)
 				pthread_mutex_lock(&handle->lock);
 				handle->running = false;
 				pthread_mutex_unlock(&handle->lock);
+				free_fd_garbage(handle);
+				set_self(old_self);
 				return 0; // 0 正常返回
 			}
 
+			if (!events[i].data.ptr) {
+				LOG_E("Invalid task pointer in epoll event.");
+				continue;
+			}
+
+			// 外部描述符事件, 立即处理
+			if (*(enum et_source *)events[i].data.ptr == ET_SOURCE_FD) {
+				struct fd_watch *w = (struct fd_watch *)events[i].data.ptr;
+				if (!w->removed)
+					w->f_handle(w->fd, events[i].events, w->arg);
+				continue;
+			}
+
 			// 可以读事件
 			if (events[i].events & EPOLLIN) {
 				struct timer_task *task = (struct timer_task *)events[i].data.ptr;
-				if (!task) {
-					LOG_E("Invalid task pointer in epoll event.");
-					continue;
-				}
 
 				uint64_t expirations;
 				ssize_t s = read(task->timer_fd, &expirations, sizeof(expirations));
@@ -454,10 +701,16 @@ int epoll_timer_run(et_handle handle)
 					task->ept_task_f->f_entry(task->priv); // 执行任务
 			}
 		}
+
+		// 释放本轮被移除的描述符实例
+		if (handle->fd_garbage)
+			free_fd_garbage(handle);
 	}
 
 	pthread_mutex_lock(&handle->lock);
 	handle->running = false;
 	pthread_mutex_unlock(&handle->lock);
+	free_fd_garbage(handle);
+	set_self(old_self);
 	return 1; // 1:错误退出
 }
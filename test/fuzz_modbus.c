@@ -0,0 +1,183 @@
+#include "utils/logger.h"
+#include "protocol/modbus_master.h"
+#include "protocol/modbus_slave.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Modbus 主从机接收解析模糊测试
+//
+// libFuzzer: clang 编译时链接 -fsanitize=fuzzer,address, 入口为 LLVMFuzzerTestOneInput
+// AFL 等: 定义 FUZZ_STANDALONE, 用例从文件参数或标准输入读取
+
+#define SLAVE_ADDR 0x06 // 测试从机地址
+
+static const uint8_t *m_in;  // 当前输入
+static size_t m_in_len;      // 输入长度
+static size_t m_in_pos;      // 已读位置
+static size_t m_chunk;       // 每次读取长度, 模拟断包
+
+static void dir_ctrl(enum modbus_serial_dir dir, void *arg)
+{
+    (void)dir;
+    (void)arg;
+}
+
+static bool serial_init(void *arg)
+{
+    (void)arg;
+    return true;
+}
+
+static size_t fuzz_read(uint8_t *p, uint16_t len, void *arg)
+{
+    (void)arg;
+    size_t n = m_in_len - m_in_pos;
+    if (n > m_chunk)
+        n = m_chunk;
+    if (n > len)
+        n = len;
+    memcpy(p, m_in + m_in_pos, n);
+    m_in_pos += n;
+    return n;
+}
+
+static size_t fuzz_write(uint8_t *p, uint16_t len, void *arg)
+{
+    (void)p;
+    (void)arg;
+
+    // 回复不可能超过最大帧长度
+    if (len > MODBUS_FRAME_BYTES_MAX)
+        abort();
+    return len;
+}
+
+static struct serial_opts m_opts = {
+    .f_dir_ctrl = dir_ctrl,
+    .f_init = serial_init,
+    .f_read = fuzz_read,
+    .f_write = fuzz_write,
+};
+
+static uint16_t m_regs[MODBUS_REG_NUM_MAX * 2];
+
+static uint8_t reg_handle(uint8_t func, uint16_t reg, uint16_t reg_num, uint16_t *p_in_out)
+{
+    if (reg_num > MODBUS_REG_NUM_MAX)
+        abort();
+
+    if (func == MODBUS_FUN_RD_REG_MUL)
+        memcpy(p_in_out, &m_regs[reg % MODBUS_REG_NUM_MAX], reg_num * sizeof(uint16_t));
+    else
+        memcpy(&m_regs[reg % MODBUS_REG_NUM_MAX], p_in_out, reg_num * sizeof(uint16_t));
+
+    return MODBUS_RESP_SUCCESS;
+}
+
+static struct mb_slv_work m_work[] = {
+    {
+        .start = 0,
+        .end = 0xFFFF,
+        .resp = reg_handle,
+    },
+};
+
+static mb_mst_handle m_mst;
+static struct mb_mst_request m_req;
+static bool m_req_done;
+
+static void mst_resp(uint8_t *data, size_t len, bool is_timeout, void *arg)
+{
+    (void)arg;
+
+    if (is_timeout) {
+        m_req_done = true;
+        return;
+    }
+
+    if (len != m_req.reg_len * 2u)
+        abort();
+    m_regs[0] = data[len - 1];
+
+    // 输入未读完则继续请求, 解析剩余输入
+    if (m_in_pos < m_in_len && !mb_mst_pdu_request(m_mst, &m_req))
+        abort();
+    if (m_in_pos >= m_in_len)
+        m_req_done = true;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (!size)
+        return 0;
+
+    logger_set_level(LOG_LEVEL_NONE);
+
+    // 首字节决定分段长度与主机请求的寄存器数量
+    m_chunk = 1 + data[0] % 64;
+    m_in = data + 1;
+    m_in_len = size - 1;
+
+    // 从机
+    mb_slv_handle slv = mb_slv_init(&m_opts, SLAVE_ADDR, m_work, 1);
+    if (!slv)
+        abort();
+    mb_slv_add_unit(slv, SLAVE_ADDR + 1, m_work, 1);
+    m_in_pos = 0;
+    for (size_t i = 0; m_in_pos < m_in_len || i < 8; i++)
+        mb_slv_poll(slv);
+    mb_slv_destroy(slv);
+
+    // 主机: 请求持续挂起直到输入读完, 输入作为回复
+    // 超时按单调时钟计算, 超时设大使结果与运行速度无关
+    m_mst = mb_mst_init(&m_opts, 1);
+    if (!m_mst)
+        abort();
+
+    m_req = (struct mb_mst_request){
+        .timeout_ms = 60000,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_RD_REG_MUL,
+        .reg_addr = 0,
+        .reg_len = 1 + data[0] % MODBUS_RD_REG_NUM_MAX,
+        .resp = mst_resp,
+    };
+    if (!mb_mst_pdu_request(m_mst, &m_req))
+        abort();
+    m_in_pos = 0;
+    m_req_done = false;
+    for (size_t i = 0; !m_req_done && (m_in_pos < m_in_len || i < 8); i++)
+        mb_mst_poll(m_mst);
+    mb_mst_destroy(m_mst);
+
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static int run_file(FILE *fp)
+{
+    static uint8_t buf[1 << 16];
+    size_t len = fread(buf, 1, sizeof(buf), fp);
+
+    return LLVMFuzzerTestOneInput(buf, len);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+        return run_file(stdin);
+
+    for (int i = 1; i < argc; i++) {
+        FILE *fp = fopen(argv[i], "rb");
+        if (!fp) {
+            perror(argv[i]);
+            return 1;
+        }
+        run_file(fp);
+        fclose(fp);
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,412 @@
+#include "unity.h"
+#include "utils/logger.h"
+#include "app/can_dispatch.h"
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+
+#define STD_ID 0x123          // 标准帧ID
+#define EXT_BASE 0x18DA0000   // 扩展帧ID起始
+#define EXT_NUM 200           // 扩展帧注册数量, 多于哈希桶数, 必有冲突
+#define IFINDEX 3             // 接收接口索引
+#define LAT_SLACK_US 50000    // 交付延时上限的容差, 覆盖调度抖动
+
+// 处理函数调用记录
+struct call_log {
+    int calls;
+    uint32_t can_id;
+    void *arg;
+    uint8_t data0;
+    int ifindex;
+};
+
+static struct call_log m_log;
+
+static can_dispatch_handle m_disp;
+
+static void handler(const struct canfd_frame *frame, const struct can_rx_info *info, void *arg)
+{
+    m_log.calls++;
+    m_log.can_id = frame->can_id;
+    m_log.arg = arg;
+    m_log.data0 = frame->data[0];
+    m_log.ifindex = info->ifindex;
+}
+
+// 组一帧, 接收信息不带时间戳
+static void make_frame(struct canfd_frame *frame, struct can_rx_info *info, uint32_t can_id,
+    uint8_t data0)
+{
+    memset(frame, 0, sizeof(*frame));
+    frame->can_id = can_id;
+    frame->len = 8;
+    frame->data[0] = data0;
+
+    memset(info, 0, sizeof(*info));
+    info->ifindex = IFINDEX;
+}
+
+// 分发单帧
+static void dispatch_one(uint32_t can_id, uint8_t data0)
+{
+    struct canfd_frame frame;
+    struct can_rx_info info;
+
+    make_frame(&frame, &info, can_id, data0);
+    can_dispatch_frames(m_disp, &frame, &info, 1);
+}
+
+// 以硬件时间戳分发单帧
+static void dispatch_hw(uint64_t hw_ns)
+{
+    struct canfd_frame frame;
+    struct can_rx_info info;
+
+    make_frame(&frame, &info, STD_ID, 0);
+    info.hw_ns = hw_ns;
+    can_dispatch_frames(m_disp, &frame, &info, 1);
+}
+
+// 当前时刻, 与软件接收时间戳同为 CLOCK_REALTIME
+static uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 延后处理通知是否可读
+static bool notify_pending(void)
+{
+    struct pollfd pfd = { .fd = can_dispatch_get_fd(m_disp), .events = POLLIN };
+
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+void setUp(void)
+{
+    logger_set_level(LOG_LEVEL_ERROR);
+    memset(&m_log, 0, sizeof(m_log));
+    m_disp = can_dispatch_create();
+    TEST_ASSERT_NOT_NULL(m_disp);
+}
+
+void tearDown(void)
+{
+    can_dispatch_destroy(m_disp);
+}
+
+// 标准帧直接索引, 扩展帧哈希冲突时在桶内按完整ID区分, 错误帧与未注册ID不分发
+void test_dispatch_lookup(void)
+{
+    static int args[EXT_NUM];
+
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, STD_ID, handler, &args[0], CAN_DISPATCH_INLINE));
+    for (int i = 0; i < EXT_NUM; i++)
+        TEST_ASSERT_TRUE(can_dispatch_register(m_disp, (EXT_BASE + i) | CAN_EFF_FLAG, handler,
+            &args[i], CAN_DISPATCH_INLINE));
+    TEST_ASSERT_FALSE(can_dispatch_register(m_disp, STD_ID | CAN_ERR_FLAG, handler, NULL,
+        CAN_DISPATCH_INLINE));
+    TEST_ASSERT_FALSE(can_dispatch_register(m_disp, STD_ID, NULL, NULL, CAN_DISPATCH_INLINE));
+
+    dispatch_one(STD_ID, 0x11);
+    TEST_ASSERT_EQUAL_INT(1, m_log.calls);
+    TEST_ASSERT_EQUAL_HEX32(STD_ID, m_log.can_id);
+    TEST_ASSERT_EQUAL_PTR(&args[0], m_log.arg);
+    TEST_ASSERT_EQUAL_HEX8(0x11, m_log.data0);
+    TEST_ASSERT_EQUAL_INT(IFINDEX, m_log.ifindex);
+
+    // 每个扩展帧ID都找到自己的处理参数
+    for (int i = 0; i < EXT_NUM; i++) {
+        dispatch_one((EXT_BASE + i) | CAN_EFF_FLAG, (uint8_t)i);
+        TEST_ASSERT_EQUAL_INT(i + 2, m_log.calls);
+        TEST_ASSERT_EQUAL_PTR(&args[i], m_log.arg);
+    }
+
+    // 标准帧与同值的扩展帧互不匹配, 错误帧不分发
+    int calls = m_log.calls;
+    dispatch_one(STD_ID | CAN_EFF_FLAG, 0);
+    dispatch_one(STD_ID + 1, 0);
+    dispatch_one((EXT_BASE + EXT_NUM) | CAN_EFF_FLAG, 0);
+    dispatch_one(STD_ID | CAN_ERR_FLAG, 0);
+    TEST_ASSERT_EQUAL_INT(calls, m_log.calls);
+
+    struct can_dispatch_stats st;
+    TEST_ASSERT_TRUE(can_dispatch_get_stats(m_disp, &st, false));
+    TEST_ASSERT_EQUAL_UINT32(EXT_NUM + 1, st.inline_frames);
+    TEST_ASSERT_EQUAL_UINT32(4, st.unhandled);
+}
+
+// 同一ID重复注册覆盖处理函数参数与执行位置, 不产生重复的注册项
+void test_dispatch_reregister(void)
+{
+    int a, b;
+    uint32_t ext_id = EXT_BASE | CAN_EFF_FLAG;
+
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, STD_ID, handler, &a, CAN_DISPATCH_DEFERRED));
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, STD_ID, handler, &b, CAN_DISPATCH_INLINE));
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, ext_id, handler, &a, CAN_DISPATCH_INLINE));
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, ext_id, handler, &b, CAN_DISPATCH_DEFERRED));
+
+    dispatch_one(STD_ID, 0);
+    TEST_ASSERT_EQUAL_INT(1, m_log.calls);
+    TEST_ASSERT_EQUAL_PTR(&b, m_log.arg);
+
+    dispatch_one(ext_id, 0);
+    TEST_ASSERT_EQUAL_INT(1, m_log.calls);
+    TEST_ASSERT_EQUAL_UINT(1, can_dispatch_run(m_disp, 0));
+    TEST_ASSERT_EQUAL_INT(2, m_log.calls);
+    TEST_ASSERT_EQUAL_PTR(&b, m_log.arg);
+}
+
+// 立即处理在分发时调用, 延后处理拷贝帧与接收信息, 在主循环中调用
+void test_dispatch_inline_deferred(void)
+{
+    int a, b;
+    uint32_t ext_id = EXT_BASE | CAN_EFF_FLAG;
+
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, STD_ID, handler, &a, CAN_DISPATCH_INLINE));
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, ext_id, handler, &b, CAN_DISPATCH_DEFERRED));
+
+    struct canfd_frame frames[2];
+    struct can_rx_info info[2];
+    make_frame(&frames[0], &info[0], ext_id, 0x22);
+    make_frame(&frames[1], &info[1], STD_ID, 0x11);
+    can_dispatch_frames(m_disp, frames, info, 2);
+
+    TEST_ASSERT_EQUAL_INT(1, m_log.calls);
+    TEST_ASSERT_EQUAL_PTR(&a, m_log.arg);
+
+    // 分发返回后原帧可被复用
+    memset(frames, 0, sizeof(frames));
+    memset(info, 0, sizeof(info));
+
+    TEST_ASSERT_EQUAL_UINT(1, can_dispatch_run(m_disp, 0));
+    TEST_ASSERT_EQUAL_INT(2, m_log.calls);
+    TEST_ASSERT_EQUAL_PTR(&b, m_log.arg);
+    TEST_ASSERT_EQUAL_HEX32(ext_id, m_log.can_id);
+    TEST_ASSERT_EQUAL_HEX8(0x22, m_log.data0);
+    TEST_ASSERT_EQUAL_INT(IFINDEX, m_log.ifindex);
+    TEST_ASSERT_EQUAL_UINT(0, can_dispatch_run(m_disp, 0));
+
+    struct can_dispatch_stats st;
+    TEST_ASSERT_TRUE(can_dispatch_get_stats(m_disp, &st, true));
+    TEST_ASSERT_EQUAL_UINT32(1, st.inline_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, st.deferred_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, st.deferred_runs);
+    TEST_ASSERT_EQUAL_UINT32(1, st.ring_max);
+    TEST_ASSERT_TRUE(can_dispatch_get_stats(m_disp, &st, false));
+    TEST_ASSERT_EQUAL_UINT32(0, st.inline_frames);
+}
+
+// 环形队列满时丢弃并计数, 不阻塞分发; 处理后恢复入队
+void test_dispatch_ring_overrun(void)
+{
+    static struct canfd_frame frames[CAN_DISPATCH_RING_LEN + 10];
+    static struct can_rx_info info[CAN_DISPATCH_RING_LEN + 10];
+    size_t num = CAN_DISPATCH_RING_LEN + 10;
+
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, STD_ID, handler, NULL, CAN_DISPATCH_DEFERRED));
+    for (size_t i = 0; i < num; i++)
+        make_frame(&frames[i], &info[i], STD_ID, (uint8_t)i);
+
+    can_dispatch_frames(m_disp, frames, info, num);
+    TEST_ASSERT_EQUAL_INT(0, m_log.calls);
+
+    struct can_dispatch_stats st;
+    TEST_ASSERT_TRUE(can_dispatch_get_stats(m_disp, &st, false));
+    TEST_ASSERT_EQUAL_UINT32(CAN_DISPATCH_RING_LEN, st.deferred_frames);
+    TEST_ASSERT_EQUAL_UINT32(10, st.ring_overruns);
+    TEST_ASSERT_EQUAL_UINT32(CAN_DISPATCH_RING_LEN, st.ring_max);
+
+    // 队列满时的帧被丢弃, 处理顺序与入队顺序一致
+    TEST_ASSERT_EQUAL_UINT(CAN_DISPATCH_RING_LEN, can_dispatch_run(m_disp, 0));
+    TEST_ASSERT_EQUAL_HEX8((CAN_DISPATCH_RING_LEN - 1) & 0xFF, m_log.data0);
+
+    dispatch_one(STD_ID, 0x5A);
+    TEST_ASSERT_EQUAL_UINT(1, can_dispatch_run(m_disp, 0));
+    TEST_ASSERT_EQUAL_HEX8(0x5A, m_log.data0);
+    TEST_ASSERT_TRUE(can_dispatch_get_stats(m_disp, &st, false));
+    TEST_ASSERT_EQUAL_UINT32(10, st.ring_overruns);
+}
+
+// 有延后帧入队时通知可读, 达到单次处理上限时保留通知
+void test_dispatch_notify(void)
+{
+    TEST_ASSERT_TRUE(can_dispatch_get_fd(m_disp) >= 0);
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, STD_ID, handler, NULL, CAN_DISPATCH_INLINE));
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, STD_ID + 1, handler, NULL,
+        CAN_DISPATCH_DEFERRED));
+
+    // 只有立即处理的帧不通知
+    dispatch_one(STD_ID, 0);
+    TEST_ASSERT_FALSE(notify_pending());
+
+    for (int i = 0; i < 5; i++)
+        dispatch_one(STD_ID + 1, (uint8_t)i);
+    TEST_ASSERT_TRUE(notify_pending());
+
+    TEST_ASSERT_EQUAL_UINT(2, can_dispatch_run(m_disp, 2));
+    TEST_ASSERT_TRUE(notify_pending());
+    TEST_ASSERT_EQUAL_HEX8(1, m_log.data0);
+
+    TEST_ASSERT_EQUAL_UINT(3, can_dispatch_run(m_disp, 0));
+    TEST_ASSERT_FALSE(notify_pending());
+    TEST_ASSERT_EQUAL_HEX8(4, m_log.data0);
+
+    // 处理数恰好等于上限且队列已空时不再通知
+    dispatch_one(STD_ID + 1, 5);
+    TEST_ASSERT_EQUAL_UINT(1, can_dispatch_run(m_disp, 1));
+    TEST_ASSERT_FALSE(notify_pending());
+}
+
+// 交付延时: 按桶上界分布, 最小/最大/总和, 按接口统计, 读取后清零
+void test_dispatch_latency(void)
+{
+    // 每个延时刚超过上一个桶的上界; 接收时刻在未来时延时记为0
+    const uint32_t lat_us[CAN_DISPATCH_LAT_BUCKETS] = {
+        0, 110, 210, 510, 1010, 2010, 5010, 10010,
+    };
+    uint64_t lat_sum = 0;
+
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, STD_ID, handler, NULL, CAN_DISPATCH_INLINE));
+
+    for (int i = 0; i < CAN_DISPATCH_LAT_BUCKETS; i++) {
+        struct canfd_frame frame;
+        struct can_rx_info info;
+        make_frame(&frame, &info, STD_ID, 0);
+        info.sw_ns = i ? realtime_ns() - lat_us[i] * 1000ULL : realtime_ns() + 1000000000ULL;
+        can_dispatch_frames(m_disp, &frame, &info, 1);
+        lat_sum += lat_us[i];
+    }
+
+    struct can_id_timing t;
+    TEST_ASSERT_TRUE(can_dispatch_get_timing(m_disp, IFINDEX, STD_ID, &t, false));
+    TEST_ASSERT_EQUAL_UINT32(CAN_DISPATCH_LAT_BUCKETS, t.count);
+    for (int i = 0; i < CAN_DISPATCH_LAT_BUCKETS; i++)
+        TEST_ASSERT_EQUAL_UINT32(1, t.buckets[i]);
+    TEST_ASSERT_EQUAL_UINT32(0, t.min_us);
+    TEST_ASSERT_TRUE(t.max_us >= lat_us[CAN_DISPATCH_LAT_BUCKETS - 1]);
+    TEST_ASSERT_TRUE(t.max_us < lat_us[CAN_DISPATCH_LAT_BUCKETS - 1] + LAT_SLACK_US);
+    TEST_ASSERT_TRUE(t.sum_us >= lat_sum);
+    TEST_ASSERT_TRUE(t.sum_us < lat_sum + CAN_DISPATCH_LAT_BUCKETS * LAT_SLACK_US);
+
+    // 没有时间戳的帧不记录到达间隔
+    TEST_ASSERT_EQUAL_UINT32(0, t.gaps);
+
+    // 其他接口上没有收到帧, 未注册的ID失败
+    TEST_ASSERT_TRUE(can_dispatch_get_timing(m_disp, IFINDEX + 1, STD_ID, &t, false));
+    TEST_ASSERT_EQUAL_UINT32(0, t.count);
+    TEST_ASSERT_FALSE(can_dispatch_get_timing(m_disp, IFINDEX, STD_ID + 1, &t, false));
+
+    TEST_ASSERT_TRUE(can_dispatch_get_timing(m_disp, IFINDEX, STD_ID, &t, true));
+    TEST_ASSERT_EQUAL_UINT32(CAN_DISPATCH_LAT_BUCKETS, t.count);
+    TEST_ASSERT_TRUE(can_dispatch_get_timing(m_disp, IFINDEX, STD_ID, &t, false));
+    TEST_ASSERT_EQUAL_UINT32(0, t.count);
+    TEST_ASSERT_EQUAL_UINT32(0, t.max_us);
+    TEST_ASSERT_EQUAL_UINT32(0, t.buckets[CAN_DISPATCH_LAT_BUCKETS - 1]);
+}
+
+// 按RFC 3550的递推计算抖动(ns): J += |D|/16 - J/16
+static uint64_t jitter_next(uint64_t jitter, uint64_t gap, uint64_t last_gap)
+{
+    uint64_t d = gap > last_gap ? gap - last_gap : last_gap - gap;
+
+    return jitter + d / 16 - jitter / 16;
+}
+
+// 到达间隔与抖动: 硬件时间戳优先, 同一时刻不计间隔, 时钟回退重新开始, 清零不影响抖动
+void test_dispatch_jitter(void)
+{
+    const uint32_t gap_us[] = { 1000, 1000, 3000, 1000, 2000, 2000 };
+    const size_t gap_num = sizeof(gap_us) / sizeof(gap_us[0]);
+    struct canfd_frame frames[16];
+    struct can_rx_info info[16];
+    size_t num = 0;
+    uint64_t hw = 1000000000ULL;
+    uint64_t jitter = 0;
+
+    TEST_ASSERT_TRUE(can_dispatch_register(m_disp, STD_ID, handler, NULL, CAN_DISPATCH_DEFERRED));
+
+    make_frame(&frames[num], &info[num], STD_ID, 0);
+    info[num++].hw_ns = hw;
+    for (size_t i = 0; i < gap_num; i++) {
+        hw += gap_us[i] * 1000ULL;
+        make_frame(&frames[num], &info[num], STD_ID, 0);
+        info[num++].hw_ns = hw;
+        if (i)
+            jitter = jitter_next(jitter, gap_us[i] * 1000ULL, gap_us[i - 1] * 1000ULL);
+
+        // 另一接口上的同一ID交错到达, 不影响本接口的间隔
+        make_frame(&frames[num], &info[num], STD_ID, 0);
+        info[num].ifindex = IFINDEX + 1;
+        info[num++].hw_ns = hw - 300000;
+    }
+
+    // 与上一帧同一时刻, 不计间隔
+    make_frame(&frames[num], &info[num], STD_ID, 0);
+    info[num++].hw_ns = hw;
+
+    for (size_t i = 0; i < num; i++)
+        info[i].sw_ns = realtime_ns();
+    can_dispatch_frames(m_disp, frames, info, num);
+
+    // 到达间隔在分发时记录, 不等延后处理
+    struct can_id_timing t;
+    TEST_ASSERT_TRUE(can_dispatch_get_timing(m_disp, IFINDEX, STD_ID, &t, true));
+    TEST_ASSERT_EQUAL_UINT32(0, t.count);
+    TEST_ASSERT_EQUAL_UINT32(gap_num, t.gaps);
+    TEST_ASSERT_EQUAL_UINT32(1000, t.gap_min_us);
+    TEST_ASSERT_EQUAL_UINT32(3000, t.gap_max_us);
+    TEST_ASSERT_EQUAL_UINT32(10000, t.gap_sum_us);
+    TEST_ASSERT_EQUAL_UINT32(jitter / 1000, t.jitter_us);
+    TEST_ASSERT_TRUE(t.jitter_us > 0);
+
+    TEST_ASSERT_TRUE(can_dispatch_get_timing(m_disp, IFINDEX + 1, STD_ID, &t, false));
+    TEST_ASSERT_EQUAL_UINT32(gap_num - 1, t.gaps);
+    TEST_ASSERT_EQUAL_UINT32(jitter / 1000, t.jitter_us);
+
+    // 清零后抖动保留, 下一帧仍与清零前的最后一帧计算间隔
+    TEST_ASSERT_TRUE(can_dispatch_get_timing(m_disp, IFINDEX, STD_ID, &t, false));
+    TEST_ASSERT_EQUAL_UINT32(0, t.gaps);
+    TEST_ASSERT_EQUAL_UINT32(jitter / 1000, t.jitter_us);
+
+    TEST_ASSERT_EQUAL_UINT(num, can_dispatch_run(m_disp, 0));
+    TEST_ASSERT_TRUE(can_dispatch_get_timing(m_disp, IFINDEX, STD_ID, &t, false));
+    TEST_ASSERT_EQUAL_UINT32(gap_num + 2, t.count);
+
+    jitter = jitter_next(jitter, 1000000, gap_us[gap_num - 1] * 1000ULL);
+    hw += 1000000;
+    dispatch_hw(hw);
+    TEST_ASSERT_TRUE(can_dispatch_get_timing(m_disp, IFINDEX, STD_ID, &t, false));
+    TEST_ASSERT_EQUAL_UINT32(1, t.gaps);
+    TEST_ASSERT_EQUAL_UINT32(1000, t.gap_sum_us);
+    TEST_ASSERT_EQUAL_UINT32(jitter / 1000, t.jitter_us);
+
+    // 时钟回退不计间隔, 回退后的第一个间隔不更新抖动
+    dispatch_hw(hw - 5000000);
+    dispatch_hw(hw - 4500000);
+    TEST_ASSERT_TRUE(can_dispatch_get_timing(m_disp, IFINDEX, STD_ID, &t, false));
+    TEST_ASSERT_EQUAL_UINT32(2, t.gaps);
+    TEST_ASSERT_EQUAL_UINT32(500, t.gap_min_us);
+    TEST_ASSERT_EQUAL_UINT32(jitter / 1000, t.jitter_us);
+}
+
+// Unity 测试主函数
+int main(void)
+{
+    UNITY_BEGIN();
+
+    // 单元测试注册
+    RUN_TEST(test_dispatch_lookup);
+    RUN_TEST(test_dispatch_reregister);
+    RUN_TEST(test_dispatch_inline_deferred);
+    RUN_TEST(test_dispatch_ring_overrun);
+    RUN_TEST(test_dispatch_notify);
+    RUN_TEST(test_dispatch_latency);
+    RUN_TEST(test_dispatch_jitter);
+
+    return UNITY_END();
+}
@@ -0,0 +1,321 @@
+#include "unity.h"
+#include "utils/logger.h"
+#include "protocol/isotp.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ID_A 0x7E0        // A 发送 / B 接收
+#define ID_B 0x7E8        // B 发送 / A 接收
+#define BUS_FRAMES 4096   // 总线缓冲帧数
+#define BIG_LEN 5000      // 长度扩展测试报文长度
+
+// 模拟总线: 提交的帧按帧长拆分后排队, 由测试循环投递给对端
+struct bus_frame {
+    uint32_t can_id;
+    uint8_t data[ISOTP_CANFD_DL];
+    size_t len;
+};
+
+struct bus {
+    struct bus_frame frames[BUS_FRAMES];
+    size_t head, tail;
+    size_t frame_len;   // 拆分帧长, 与 can_device_send 一致
+    size_t submits;     // f_send 调用次数
+    int fail_left;      // 剩余模拟发送队列满的次数, 只对A发出的帧生效
+    int drop_cf;        // 丢弃的连续帧序号, -1 不丢弃
+};
+
+static struct bus m_bus;
+
+// 接收端结果
+struct peer {
+    uint8_t data[BIG_LEN];
+    size_t len;
+    int recv_calls;
+    int sent_ok;
+    int sent_fail;
+};
+
+static struct peer m_a, m_b;
+
+static bool bus_send(uint32_t can_id, const uint8_t *data, size_t len, void *arg)
+{
+    (void)arg;
+
+    if (can_id == ID_A && m_bus.fail_left > 0) {
+        m_bus.fail_left--;
+        return false;
+    }
+
+    m_bus.submits++;
+    for (size_t off = 0; off < len; off += m_bus.frame_len) {
+        struct bus_frame *f = &m_bus.frames[m_bus.tail++ % BUS_FRAMES];
+        f->can_id = can_id;
+        f->len = len - off > m_bus.frame_len ? m_bus.frame_len : len - off;
+        memcpy(f->data, data + off, f->len);
+    }
+
+    return true;
+}
+
+static const struct isotp_opts m_opts = { .f_send = bus_send };
+
+static void on_recv(const uint8_t *data, size_t len, void *arg)
+{
+    struct peer *p = arg;
+    memcpy(p->data, data, len);
+    p->len = len;
+    p->recv_calls++;
+}
+
+static void on_sent(bool ok, void *arg)
+{
+    struct peer *p = arg;
+    if (ok)
+        p->sent_ok++;
+    else
+        p->sent_fail++;
+}
+
+// 投递总线上的帧直到空闲, 每轮调用一次轮询
+static void bus_run(isotp_handle a, isotp_handle b, int max_rounds)
+{
+    for (int i = 0; i < max_rounds; i++) {
+        while (m_bus.head != m_bus.tail) {
+            struct bus_frame f = m_bus.frames[m_bus.head++ % BUS_FRAMES];
+            bool is_cf = (f.data[0] >> 4) == 2;
+            if (is_cf && m_bus.drop_cf >= 0 && (f.data[0] & 0x0F) == m_bus.drop_cf) {
+                m_bus.drop_cf = -1;
+                continue;
+            }
+            if (!isotp_on_frame(a, f.can_id, f.data, f.len))
+                isotp_on_frame(b, f.can_id, f.data, f.len);
+        }
+        isotp_poll(a);
+        isotp_poll(b);
+        if (!isotp_busy(a) && !isotp_busy(b) && m_bus.head == m_bus.tail)
+            return;
+    }
+}
+
+static void fill(uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        buf[i] = (uint8_t)(i * 7 + 3);
+}
+
+static void cfg_pair(struct isotp_cfg *ca, struct isotp_cfg *cb, bool fd)
+{
+    memset(ca, 0, sizeof(*ca));
+    ca->tx_id = ID_A;
+    ca->rx_id = ID_B;
+    ca->fd = fd;
+    ca->padding = true;
+    ca->on_recv = on_recv;
+    ca->on_sent = on_sent;
+    ca->cb_arg = &m_a;
+
+    *cb = *ca;
+    cb->tx_id = ID_B;
+    cb->rx_id = ID_A;
+    cb->cb_arg = &m_b;
+}
+
+void setUp(void)
+{
+    logger_set_level(LOG_LEVEL_ERROR);
+    memset(&m_bus, 0, sizeof(m_bus));
+    m_bus.frame_len = ISOTP_CAN_DL;
+    m_bus.drop_cf = -1;
+    memset(&m_a, 0, sizeof(m_a));
+    memset(&m_b, 0, sizeof(m_b));
+}
+
+void tearDown(void)
+{
+}
+
+// 单帧: 填充到8字节, 接收端直接拿到帧内数据
+void test_isotp_single_frame(void)
+{
+    struct isotp_cfg ca, cb;
+    cfg_pair(&ca, &cb, false);
+    isotp_handle a = isotp_create(&ca, &m_opts);
+    isotp_handle b = isotp_create(&cb, &m_opts);
+
+    uint8_t msg[7];
+    fill(msg, sizeof(msg));
+    TEST_ASSERT_TRUE(isotp_send(a, msg, sizeof(msg)));
+    TEST_ASSERT_EQUAL_INT(1, m_a.sent_ok);
+    TEST_ASSERT_EQUAL_UINT32(ISOTP_CAN_DL, m_bus.frames[0].len);
+    TEST_ASSERT_EQUAL_HEX8(0x07, m_bus.frames[0].data[0]);
+
+    bus_run(a, b, 10);
+    TEST_ASSERT_EQUAL_INT(1, m_b.recv_calls);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(msg), m_b.len);
+    TEST_ASSERT_EQUAL_MEMORY(msg, m_b.data, sizeof(msg));
+
+    isotp_destroy(a);
+    isotp_destroy(b);
+}
+
+// 多帧: 4095字节, 块大小4, 连续帧按块拼接提交, 序号回绕
+void test_isotp_multi_frame_block_size(void)
+{
+    struct isotp_cfg ca, cb;
+    cfg_pair(&ca, &cb, false);
+    cb.block_size = 4;
+    isotp_handle a = isotp_create(&ca, &m_opts);
+    isotp_handle b = isotp_create(&cb, &m_opts);
+
+    static uint8_t msg[ISOTP_MAX_LEN];
+    fill(msg, sizeof(msg));
+    TEST_ASSERT_TRUE(isotp_send(a, msg, sizeof(msg)));
+    TEST_ASSERT_FALSE(isotp_send(a, msg, 8)); // 上一个报文未发完
+
+    bus_run(a, b, 1000);
+    TEST_ASSERT_EQUAL_INT(1, m_a.sent_ok);
+    TEST_ASSERT_EQUAL_INT(1, m_b.recv_calls);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(msg), m_b.len);
+    TEST_ASSERT_EQUAL_MEMORY(msg, m_b.data, sizeof(msg));
+
+    // 首帧6字节, 其余585帧, 每块4帧一次提交, 再加上B回复的流控帧
+    size_t cf = (sizeof(msg) - 6 + 6) / 7;
+    size_t blocks = (cf + 3) / 4;
+    TEST_ASSERT_EQUAL_UINT32(1 + blocks + blocks, m_bus.submits);
+
+    struct isotp_stats st;
+    isotp_get_stats(a, &st, false);
+    TEST_ASSERT_EQUAL_UINT32(1, st.tx_msgs);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(msg), (uint32_t)st.tx_bytes);
+
+    isotp_destroy(a);
+    isotp_destroy(b);
+}
+
+// CAN FD: 64字节帧, 1000字节报文16帧, 单帧最多62字节
+void test_isotp_fd(void)
+{
+    struct isotp_cfg ca, cb;
+    cfg_pair(&ca, &cb, true);
+    m_bus.frame_len = ISOTP_CANFD_DL;
+    isotp_handle a = isotp_create(&ca, &m_opts);
+    isotp_handle b = isotp_create(&cb, &m_opts);
+
+    uint8_t msg[1000];
+    fill(msg, sizeof(msg));
+
+    TEST_ASSERT_TRUE(isotp_send(a, msg, 62));
+    TEST_ASSERT_EQUAL_UINT32(ISOTP_CANFD_DL, m_bus.frames[0].len);
+    bus_run(a, b, 10);
+    TEST_ASSERT_EQUAL_UINT32(62, m_b.len);
+    TEST_ASSERT_EQUAL_MEMORY(msg, m_b.data, 62);
+
+    size_t before = m_bus.tail;
+    TEST_ASSERT_TRUE(isotp_send(a, msg, sizeof(msg)));
+    bus_run(a, b, 100);
+    TEST_ASSERT_EQUAL_INT(2, m_b.recv_calls);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(msg), m_b.len);
+    TEST_ASSERT_EQUAL_MEMORY(msg, m_b.data, sizeof(msg));
+
+    // 首帧62字节 + 15个连续帧(63字节), 最后一帧938-882=56字节, 填充到64
+    TEST_ASSERT_EQUAL_UINT32(1 + 1 + 15, m_bus.tail - before);
+    TEST_ASSERT_EQUAL_UINT32(ISOTP_CANFD_DL, m_bus.frames[(m_bus.tail - 1) % BUS_FRAMES].len);
+
+    isotp_destroy(a);
+    isotp_destroy(b);
+}
+
+// 长度扩展与外部重组缓冲, 超过缓冲时回复溢出
+void test_isotp_escape_and_overflow(void)
+{
+    struct isotp_cfg ca, cb;
+    cfg_pair(&ca, &cb, false);
+    static uint8_t rx_buf[BIG_LEN];
+    cb.rx_buf = rx_buf;
+    cb.rx_buf_size = sizeof(rx_buf);
+    isotp_handle a = isotp_create(&ca, &m_opts);
+    isotp_handle b = isotp_create(&cb, &m_opts);
+
+    static uint8_t msg[BIG_LEN + 1];
+    fill(msg, sizeof(msg));
+
+    TEST_ASSERT_TRUE(isotp_send(a, msg, BIG_LEN));
+    TEST_ASSERT_EQUAL_HEX8(0x10, m_bus.frames[0].data[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x00, m_bus.frames[0].data[1]);
+    bus_run(a, b, 1000);
+    TEST_ASSERT_EQUAL_INT(1, m_b.recv_calls);
+    TEST_ASSERT_EQUAL_UINT32(BIG_LEN, m_b.len);
+    TEST_ASSERT_EQUAL_MEMORY(msg, rx_buf, BIG_LEN);
+
+    // 超过接收缓冲, 发送端收到溢出流控帧后失败
+    TEST_ASSERT_TRUE(isotp_send(a, msg, BIG_LEN + 1));
+    bus_run(a, b, 100);
+    TEST_ASSERT_EQUAL_INT(1, m_a.sent_fail);
+    TEST_ASSERT_EQUAL_INT(1, m_b.recv_calls);
+    TEST_ASSERT_FALSE(isotp_busy(a));
+
+    isotp_destroy(a);
+    isotp_destroy(b);
+}
+
+// 发送队列满重试, 序号错误中止接收, 流控超时中止发送
+void test_isotp_errors(void)
+{
+    struct isotp_cfg ca, cb;
+    cfg_pair(&ca, &cb, false);
+    ca.timeout_ms = 20;
+    cb.timeout_ms = 20;
+    isotp_handle a = isotp_create(&ca, &m_opts);
+    isotp_handle b = isotp_create(&cb, &m_opts);
+
+    uint8_t msg[200];
+    fill(msg, sizeof(msg));
+
+    // 连续帧提交失败3次后在轮询中重试成功
+    struct isotp_stats st;
+    TEST_ASSERT_TRUE(isotp_send(a, msg, sizeof(msg)));
+    m_bus.fail_left = 3;
+    bus_run(a, b, 100);
+    TEST_ASSERT_EQUAL_INT(1, m_b.recv_calls);
+    TEST_ASSERT_EQUAL_MEMORY(msg, m_b.data, sizeof(msg));
+    isotp_get_stats(a, &st, true);
+    TEST_ASSERT_EQUAL_UINT32(3, st.tx_retries);
+
+    // 丢掉序号为5的连续帧, 接收端中止
+    m_bus.drop_cf = 5;
+    TEST_ASSERT_TRUE(isotp_send(a, msg, sizeof(msg)));
+    bus_run(a, b, 100);
+    TEST_ASSERT_EQUAL_INT(1, m_b.recv_calls);
+    isotp_get_stats(b, &st, true);
+    TEST_ASSERT_EQUAL_UINT32(1, st.rx_aborts);
+
+    // 对端不回复流控帧, 超时后发送失败
+    int fails = m_a.sent_fail;
+    TEST_ASSERT_TRUE(isotp_send(a, msg, sizeof(msg)));
+    m_bus.head = m_bus.tail; // 丢弃首帧
+    struct timespec ts = { .tv_nsec = 30 * 1000000 };
+    nanosleep(&ts, NULL);
+    isotp_poll(a);
+    TEST_ASSERT_EQUAL_INT(fails + 1, m_a.sent_fail);
+    TEST_ASSERT_FALSE(isotp_busy(a));
+
+    isotp_destroy(a);
+    isotp_destroy(b);
+}
+
+// Unity 测试主函数
+int main(void)
+{
+    UNITY_BEGIN();
+
+    // 单元测试注册
+    RUN_TEST(test_isotp_single_frame);
+    RUN_TEST(test_isotp_multi_frame_block_size);
+    RUN_TEST(test_isotp_fd);
+    RUN_TEST(test_isotp_escape_and_overflow);
+    RUN_TEST(test_isotp_errors);
+
+    return UNITY_END();
+}
@@ -0,0 +1,2201 @@
+#include "unity.h"
+#include "app/modbus_priv_reg.h"
+#include "utils/crc.h"
+#include "utils/logger.h"
+#include "protocol/modbus_bus.h"
+#include "protocol/modbus_cache.h"
+#include "protocol/modbus_capture.h"
+#include "protocol/modbus_master.h"
+#include "protocol/modbus_master_tcp.h"
+#include "protocol/modbus_poll.h"
+#include "protocol/modbus_serial.h"
+#include "protocol/modbus_slave.h"
+#include "protocol/modbus_slave_tcp.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SLAVE_ADDR 0x06    // 测试从机地址
+#define SLAVE_REG_NUM 200  // 测试寄存器数量
+#define LINK_SIZE 8192     // 内存链路缓冲
+#define THROUGHPUT_NUM 5000 // 吞吐测试帧数
+#define PTY_NUM 500         // 伪终端测试帧数
+#define NOISE_ROUNDS 2000   // 随机噪声轮数
+#define TCP_NUM 20000       // TCP流水线测试帧数
+#define TCP_PORT 15502      // TCP测试端口
+#define SLAVE2_ADDR 0x07    // 第二条总线上的从机地址
+#define UNIT2_ADDR 0x08     // 同一从机上的第二个单元地址
+#define GW_TIMEOUT_MS 20    // 网关下游超时时间
+#define BUS_NUM 200         // 多总线测试每条总线的帧数
+#define WAKEUP_NUM 200      // 串口接收唤醒延时测试次数
+#define CAPTURE_NUM 20      // 抓包回放测试帧数
+
+#define CAPTURE_PATH "/tmp/test_modbus_capture.pcap" // 抓包测试文件
+
+// 内存单向链路
+struct link {
+    uint8_t buf[LINK_SIZE];
+    size_t rd;
+    size_t wr;
+};
+
+static struct link m_m2s;  // 主机 -> 从机
+static struct link m_s2m;  // 从机 -> 主机
+static struct link m_m2s2; // 第二条总线 主机 -> 从机
+static struct link m_s2m2; // 第二条总线 从机 -> 主机
+
+static uint16_t m_regs[SLAVE_REG_NUM]; // 从机寄存器
+static uint32_t m_slv_calls;     // 从机处理函数调用次数
+
+static int m_pty_mst = -1; // 伪终端主机侧
+static int m_pty_slv = -1; // 伪终端从机侧
+
+static size_t link_put(struct link *l, const uint8_t *p, size_t len)
+{
+    if (l->rd == l->wr)
+        l->rd = l->wr = 0;
+    if (len > LINK_SIZE - l->wr)
+        len = LINK_SIZE - l->wr;
+    memcpy(&l->buf[l->wr], p, len);
+    l->wr += len;
+    return len;
+}
+
+static size_t link_get(struct link *l, uint8_t *p, size_t len)
+{
+    size_t n = l->wr - l->rd;
+    if (len > n)
+        len = n;
+    memcpy(p, &l->buf[l->rd], len);
+    l->rd += len;
+    return len;
+}
+
+static size_t link_len(const struct link *l)
+{
+    return l->wr - l->rd;
+}
+
+static void link_reset(void)
+{
+    memset(&m_m2s, 0, sizeof(m_m2s));
+    memset(&m_s2m, 0, sizeof(m_s2m));
+    memset(&m_m2s2, 0, sizeof(m_m2s2));
+    memset(&m_s2m2, 0, sizeof(m_s2m2));
+}
+
+static uint64_t now_ns(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/***************************串口回调***************************/
+
+// 内存链路的一端, 作为串口回调参数
+struct link_end {
+    struct link *rx; // 本端接收
+    struct link *tx; // 本端发送
+};
+
+static struct link_end m_slv_end = { &m_m2s, &m_s2m };
+static struct link_end m_mst_end = { &m_s2m, &m_m2s };
+static struct link_end m_slv2_end = { &m_m2s2, &m_s2m2 };
+static struct link_end m_mst2_end = { &m_s2m2, &m_m2s2 };
+
+static void dir_ctrl(enum modbus_serial_dir dir, void *arg)
+{
+    (void)dir;
+    (void)arg;
+}
+
+static bool serial_init(void *arg)
+{
+    (void)arg;
+    return true;
+}
+
+static size_t end_read(uint8_t *p, uint16_t len, void *arg)
+{
+    struct link_end *end = arg;
+    return link_get(end->rx, p, len);
+}
+
+static size_t end_write(uint8_t *p, uint16_t len, void *arg)
+{
+    struct link_end *end = arg;
+    return link_put(end->tx, p, len);
+}
+
+// arg 指向保存描述符的变量
+static size_t fd_read(uint8_t *p, uint16_t len, void *arg)
+{
+    ssize_t ret = read(*(int *)arg, p, len);
+    return ret < 0 ? 0 : ret;
+}
+
+static size_t fd_write(uint8_t *p, uint16_t len, void *arg)
+{
+    int fd = *(int *)arg;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t ret = write(fd, p + done, len - done);
+        if (ret > 0)
+            done += ret;
+    }
+    return done;
+}
+
+static struct serial_opts m_slv_opts = {
+    .f_dir_ctrl = dir_ctrl,
+    .f_init = serial_init,
+    .f_read = end_read,
+    .f_write = end_write,
+    .arg = &m_slv_end,
+};
+
+static struct serial_opts m_mst_opts = {
+    .f_dir_ctrl = dir_ctrl,
+    .f_init = serial_init,
+    .f_read = end_read,
+    .f_write = end_write,
+    .arg = &m_mst_end,
+};
+
+static struct serial_opts m_slv2_opts = {
+    .f_dir_ctrl = dir_ctrl,
+    .f_init = serial_init,
+    .f_read = end_read,
+    .f_write = end_write,
+    .arg = &m_slv2_end,
+};
+
+static struct serial_opts m_mst2_opts = {
+    .f_dir_ctrl = dir_ctrl,
+    .f_init = serial_init,
+    .f_read = end_read,
+    .f_write = end_write,
+    .arg = &m_mst2_end,
+};
+
+static struct serial_opts m_pty_slv_opts = {
+    .f_dir_ctrl = dir_ctrl,
+    .f_init = serial_init,
+    .f_read = fd_read,
+    .f_write = fd_write,
+    .arg = &m_pty_slv,
+};
+
+static struct serial_opts m_pty_mst_opts = {
+    .f_dir_ctrl = dir_ctrl,
+    .f_init = serial_init,
+    .f_read = fd_read,
+    .f_write = fd_write,
+    .arg = &m_pty_mst,
+};
+
+/***************************从机处理***************************/
+
+static uint8_t reg_handle(uint8_t func, uint16_t reg, uint16_t reg_num, uint16_t *p_in_out)
+{
+    m_slv_calls++;
+
+    if (reg + reg_num > SLAVE_REG_NUM)
+        return MODBUS_RESP_ERR_REG;
+
+    if (func == MODBUS_FUN_RD_REG_MUL)
+        memcpy(p_in_out, &m_regs[reg], reg_num * sizeof(uint16_t));
+    else
+        memcpy(&m_regs[reg], p_in_out, reg_num * sizeof(uint16_t));
+
+    return MODBUS_RESP_SUCCESS;
+}
+
+static struct mb_slv_work m_work[] = {
+    {
+        .start = 0,
+        .end = SLAVE_REG_NUM,
+        .resp = reg_handle,
+    },
+};
+
+/***************************帧构造***************************/
+
+static size_t append_crc(uint8_t *frame, size_t len)
+{
+    uint16_t crc = crc16_update_bytes(0xffff, frame, len);
+    frame[len++] = GET_U8_LOW_FROM_U16(crc);
+    frame[len++] = GET_U8_HIGH_FROM_U16(crc);
+    return len;
+}
+
+// 读多个寄存器请求
+static size_t build_read(uint8_t *frame, uint8_t addr, uint16_t reg, uint16_t num)
+{
+    size_t len = 0;
+    frame[len++] = addr;
+    frame[len++] = MODBUS_FUN_RD_REG_MUL;
+    frame[len++] = GET_U8_HIGH_FROM_U16(reg);
+    frame[len++] = GET_U8_LOW_FROM_U16(reg);
+    frame[len++] = GET_U8_HIGH_FROM_U16(num);
+    frame[len++] = GET_U8_LOW_FROM_U16(num);
+    return append_crc(frame, len);
+}
+
+// 写多个寄存器请求, 寄存器值为 seed + i
+static size_t build_write(uint8_t *frame, uint8_t addr, uint16_t reg, uint16_t num, uint16_t seed)
+{
+    size_t len = 0;
+    frame[len++] = addr;
+    frame[len++] = MODBUS_FUN_WR_REG_MUL;
+    frame[len++] = GET_U8_HIGH_FROM_U16(reg);
+    frame[len++] = GET_U8_LOW_FROM_U16(reg);
+    frame[len++] = GET_U8_HIGH_FROM_U16(num);
+    frame[len++] = GET_U8_LOW_FROM_U16(num);
+    frame[len++] = num * 2;
+    for (uint16_t i = 0; i < num; i++) {
+        frame[len++] = GET_U8_HIGH_FROM_U16(seed + i);
+        frame[len++] = GET_U8_LOW_FROM_U16(seed + i);
+    }
+    return append_crc(frame, len);
+}
+
+// 读请求回复的长度
+static size_t read_resp_len(uint16_t num)
+{
+    return 3 + num * 2 + MODBUS_CRC_BYTES_NUM;
+}
+
+/***************************主机回调***************************/
+
+static uint32_t m_mst_ok;      // 主机收到回复次数
+static uint32_t m_mst_timeout; // 主机超时次数
+static uint8_t m_mst_data[MODBUS_PDU_BYTES_MAX];
+static size_t m_mst_len;
+
+static void mst_resp(uint8_t *data, size_t len, bool is_timeout, void *arg)
+{
+    (void)arg;
+
+    if (is_timeout) {
+        m_mst_timeout++;
+        return;
+    }
+
+    m_mst_ok++;
+    m_mst_len = len;
+    memcpy(m_mst_data, data, len);
+}
+
+/***************************测试用例***************************/
+
+static mb_slv_handle m_slv = NULL;
+
+void setUp(void)
+{
+    logger_set_level(LOG_LEVEL_WARN);
+    link_reset();
+    for (int i = 0; i < SLAVE_REG_NUM; i++)
+        m_regs[i] = i;
+    m_slv_calls = 0;
+    m_mst_ok = 0;
+    m_mst_timeout = 0;
+    m_mst_len = 0;
+
+    m_slv = mb_slv_init(&m_slv_opts, SLAVE_ADDR, m_work, 1);
+    TEST_ASSERT_NOT_NULL(m_slv);
+}
+
+void tearDown(void)
+{
+    mb_slv_destroy(m_slv);
+    m_slv = NULL;
+}
+
+// 粘包: 一次读取到多帧, 一次轮询全部回复
+void test_slave_sticky_frames()
+{
+    uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+
+    for (int i = 0; i < 8; i++) {
+        size_t len = build_read(frame, SLAVE_ADDR, i, 4);
+        link_put(&m_m2s, frame, len);
+    }
+
+    mb_slv_poll(m_slv);
+
+    TEST_ASSERT_EQUAL_UINT32(8, m_slv_calls);
+    TEST_ASSERT_EQUAL(8 * read_resp_len(4), link_len(&m_s2m));
+}
+
+// 断包: 逐字节到达, 最后一个字节到达后才回复
+void test_slave_fragmented_frames()
+{
+    uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+    size_t len = build_write(frame, SLAVE_ADDR, 10, 20, 0x1234);
+
+    for (size_t i = 0; i < len; i++) {
+        TEST_ASSERT_EQUAL(0, link_len(&m_s2m));
+        link_put(&m_m2s, &frame[i], 1);
+        mb_slv_poll(m_slv);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(1, m_slv_calls);
+    TEST_ASSERT_EQUAL(8, link_len(&m_s2m)); // 写回复: 地址 功能码 寄存器 数量 CRC
+    for (int i = 0; i < 20; i++)
+        TEST_ASSERT_EQUAL_HEX16(0x1234 + i, m_regs[10 + i]);
+}
+
+// 错帧: CRC错误 截断帧 地址错误 非法功能码, 只回复合法帧
+void test_slave_corrupted_frames()
+{
+    uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+    size_t len;
+    uint32_t valid = 0;
+
+    // CRC错误
+    len = build_read(frame, SLAVE_ADDR, 0, 2);
+    frame[len - 1] ^= 0x01;
+    link_put(&m_m2s, frame, len);
+
+    // 截断帧 + 合法帧
+    len = build_write(frame, SLAVE_ADDR, 0, 4, 0);
+    link_put(&m_m2s, frame, len - 3);
+    len = build_read(frame, SLAVE_ADDR, 0, 2);
+    link_put(&m_m2s, frame, len);
+    valid++;
+
+    // 其他从机
+    len = build_read(frame, SLAVE_ADDR + 1, 0, 2);
+    link_put(&m_m2s, frame, len);
+
+    // 非法功能码 + 合法帧
+    len = build_read(frame, SLAVE_ADDR, 0, 2);
+    frame[1] = 0x2B;
+    link_put(&m_m2s, frame, len);
+    len = build_write(frame, SLAVE_ADDR, 0, 2, 0x55);
+    link_put(&m_m2s, frame, len);
+    valid++;
+
+    for (int i = 0; i < 8; i++)
+        mb_slv_poll(m_slv);
+
+    TEST_ASSERT_EQUAL_UINT32(valid, m_slv_calls);
+    TEST_ASSERT_EQUAL(read_resp_len(2) + 8, link_len(&m_s2m));
+}
+
+// 随机噪声: 统计噪声后重新同步所需的字节数与时间
+void test_slave_random_noise_resync()
+{
+    uint8_t noise[64];
+    uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+    size_t len = build_read(frame, SLAVE_ADDR, 0, 1);
+    size_t max_bytes = 0;
+    uint64_t sum_bytes = 0;
+    uint64_t max_ns = 0;
+    uint64_t sum_ns = 0;
+
+    srand(1);
+    for (int round = 0; round < NOISE_ROUNDS; round++) {
+        size_t n = 1 + rand() % sizeof(noise);
+        for (size_t i = 0; i < n; i++)
+            noise[i] = rand();
+        link_put(&m_m2s, noise, n);
+        mb_slv_poll(m_slv);
+        link_reset();
+
+        // 不断发送合法帧直到收到回复
+        size_t bytes = 0;
+        uint64_t start = now_ns(CLOCK_MONOTONIC);
+        while (!link_len(&m_s2m)) {
+            TEST_ASSERT_TRUE_MESSAGE(bytes < 2 * MODBUS_FRAME_BYTES_MAX, "parser never resynced");
+            link_put(&m_m2s, frame, len);
+            bytes += len;
+            mb_slv_poll(m_slv);
+        }
+        uint64_t ns = now_ns(CLOCK_MONOTONIC) - start;
+
+        link_reset();
+        sum_bytes += bytes;
+        sum_ns += ns;
+        if (bytes > max_bytes)
+            max_bytes = bytes;
+        if (ns > max_ns)
+            max_ns = ns;
+    }
+
+    printf("resync: avg %.1f bytes max %zu bytes, avg %.2f us max %.2f us\n",
+        (double)sum_bytes / NOISE_ROUNDS, max_bytes, sum_ns / 1000.0 / NOISE_ROUNDS,
+        max_ns / 1000.0);
+}
+
+// 主机: 字节数超出请求的回复被丢弃, 不越界
+void test_master_bad_byte_count()
+{
+    mb_mst_handle mst = mb_mst_init(&m_mst_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+
+    struct mb_mst_request req = {
+        .timeout_ms = 1000,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_RD_REG_MUL,
+        .reg_addr = 0,
+        .reg_len = 2,
+        .resp = mst_resp,
+    };
+    TEST_ASSERT_TRUE(mb_mst_pdu_request(mst, &req));
+    mb_mst_poll(mst); // 发出请求
+    link_reset();
+
+    // 声明255字节数据的回复
+    uint8_t frame[300];
+    size_t len = 0;
+    frame[len++] = SLAVE_ADDR;
+    frame[len++] = MODBUS_FUN_RD_REG_MUL;
+    frame[len++] = 0xFF;
+    for (int i = 0; i < 0xFF; i++)
+        frame[len++] = i;
+    len = append_crc(frame, len);
+    link_put(&m_s2m, frame, len);
+
+    // 合法回复
+    len = 0;
+    frame[len++] = SLAVE_ADDR;
+    frame[len++] = MODBUS_FUN_RD_REG_MUL;
+    frame[len++] = 4;
+    frame[len++] = 0x12;
+    frame[len++] = 0x34;
+    frame[len++] = 0x56;
+    frame[len++] = 0x78;
+    len = append_crc(frame, len);
+    link_put(&m_s2m, frame, len);
+
+    for (int i = 0; i < 4; i++)
+        mb_mst_poll(mst);
+
+    TEST_ASSERT_EQUAL_UINT32(1, m_mst_ok);
+    TEST_ASSERT_EQUAL(4, m_mst_len);
+    TEST_ASSERT_EQUAL_HEX8(0x78, m_mst_data[3]);
+
+    mb_mst_destroy(mst);
+}
+
+// 主机超时: 按单调时钟计时, 到期立即重发, 重发完后回调超时
+void test_master_timeout_retry()
+{
+    mb_mst_handle mst = mb_mst_init(&m_mst_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+    TEST_ASSERT_EQUAL(-1, mb_mst_next_deadline(mst));
+
+    struct mb_mst_request req = {
+        .timeout_ms = 20,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_RD_REG_MUL,
+        .reg_addr = 0,
+        .reg_len = 2,
+        .resp = mst_resp,
+    };
+    TEST_ASSERT_TRUE(mb_mst_pdu_request(mst, &req));
+    TEST_ASSERT_EQUAL(0, mb_mst_next_deadline(mst)); // 待发送
+
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+    mb_mst_poll(mst);
+    TEST_ASSERT_EQUAL(8, link_len(&m_m2s));
+
+    int wait = mb_mst_next_deadline(mst);
+    TEST_ASSERT_TRUE(wait > 0 && wait <= 20);
+
+    // 从机不回复, 按下一个超时时刻休眠
+    while (!m_mst_timeout) {
+        wait = mb_mst_next_deadline(mst);
+        TEST_ASSERT_TRUE(wait >= 0);
+        usleep(wait * 1000);
+        mb_mst_poll(mst);
+    }
+    uint64_t elapsed_ms = (now_ns(CLOCK_MONOTONIC) - start) / 1000000;
+
+    TEST_ASSERT_EQUAL(8 * MASTER_REPEATS, link_len(&m_m2s));
+    TEST_ASSERT_EQUAL_UINT32(0, m_mst_ok);
+    TEST_ASSERT_EQUAL(-1, mb_mst_next_deadline(mst));
+    TEST_ASSERT_TRUE(elapsed_ms >= 20 * MASTER_REPEATS);
+    TEST_ASSERT_TRUE(elapsed_ms < 20 * MASTER_REPEATS + 40);
+
+    mb_mst_destroy(mst);
+}
+
+// 主机请求池: 拷贝提交, 池满报错, 取消后不回调不重发
+void test_master_request_pool()
+{
+    mb_mst_handle mst = mb_mst_init(&m_mst_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+
+    uint8_t wr_data[4] = { 0xAB, 0xCD, 0x12, 0x34 };
+    struct mb_mst_request wr = {
+        .timeout_ms = 1000,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_WR_REG_MUL,
+        .reg_addr = 10,
+        .reg_len = 2,
+        .data = wr_data,
+        .data_len = sizeof(wr_data),
+        .resp = mst_resp,
+    };
+
+    mb_mst_req_id ids[MB_MST_POOL_SIZE];
+    ids[0] = mb_mst_pdu_request(mst, &wr);
+    TEST_ASSERT_NOT_EQUAL(0, ids[0]);
+
+    // 提交后修改请求与数据不影响已提交的请求, 同一请求可重复提交
+    memset(wr_data, 0, sizeof(wr_data));
+    wr.reg_addr = 20;
+    for (int i = 1; i < MB_MST_POOL_SIZE; i++) {
+        ids[i] = mb_mst_pdu_request(mst, &wr);
+        TEST_ASSERT_NOT_EQUAL(0, ids[i]);
+        TEST_ASSERT_NOT_EQUAL(ids[i - 1], ids[i]);
+    }
+    TEST_ASSERT_EQUAL(0, mb_mst_pdu_request(mst, &wr)); // 池满
+
+    TEST_ASSERT_EQUAL(MB_MST_REQ_QUEUED, mb_mst_req_state(mst, ids[0]));
+    TEST_ASSERT_TRUE(mb_mst_cancel(mst, ids[1]));
+    TEST_ASSERT_FALSE(mb_mst_cancel(mst, ids[1]));
+    TEST_ASSERT_EQUAL(MB_MST_REQ_NONE, mb_mst_req_state(mst, ids[1]));
+
+    mb_mst_poll(mst);
+    TEST_ASSERT_EQUAL(MB_MST_REQ_IN_FLIGHT, mb_mst_req_state(mst, ids[0]));
+
+    for (int i = 0; i < 1000 && m_mst_ok < MB_MST_POOL_SIZE - 1; i++) {
+        mb_mst_poll(mst);
+        mb_slv_poll(m_slv);
+    }
+    TEST_ASSERT_EQUAL_UINT32(MB_MST_POOL_SIZE - 1, m_mst_ok);
+    TEST_ASSERT_EQUAL_UINT32(MB_MST_POOL_SIZE - 1, m_slv_calls);
+    TEST_ASSERT_EQUAL_UINT32(0, m_mst_timeout);
+    TEST_ASSERT_EQUAL_HEX16(0xABCD, m_regs[10]);
+    TEST_ASSERT_EQUAL_HEX16(0x1234, m_regs[11]);
+    TEST_ASSERT_EQUAL_HEX16(0, m_regs[20]);
+    TEST_ASSERT_EQUAL(MB_MST_REQ_NONE, mb_mst_req_state(mst, ids[0]));
+
+    // 取消已发送的请求: 不重发, 超时后归还且不回调
+    struct mb_mst_request rd = {
+        .timeout_ms = 10,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_RD_REG_MUL,
+        .reg_addr = 0,
+        .reg_len = 2,
+        .resp = mst_resp,
+    };
+    link_reset();
+    mb_mst_req_id id = mb_mst_pdu_request(mst, &rd);
+    mb_mst_poll(mst);
+    TEST_ASSERT_TRUE(mb_mst_cancel(mst, id));
+    usleep(15 * 1000);
+    mb_mst_poll(mst);
+    TEST_ASSERT_EQUAL(8, link_len(&m_m2s));
+    TEST_ASSERT_EQUAL(-1, mb_mst_next_deadline(mst));
+    TEST_ASSERT_EQUAL_UINT32(0, m_mst_timeout);
+
+    mb_mst_destroy(mst);
+}
+
+// 从机链路统计: 收发字节与帧数 CRC错误 重同步 处理失败按异常码统计 按波特率估算占用
+void test_slave_link_stats()
+{
+    uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+    size_t len;
+    size_t rx_bytes = 0;
+
+    // 合法帧
+    len = build_read(frame, SLAVE_ADDR, 0, 2);
+    link_put(&m_m2s, frame, len);
+    rx_bytes += len;
+
+    // CRC错误, CRC字节不含从机地址, 重新解析时不会误同步
+    len = build_read(frame, SLAVE_ADDR, 0, 2);
+    frame[len - 2] = 0;
+    frame[len - 1] = 0;
+    link_put(&m_m2s, frame, len);
+    rx_bytes += len;
+
+    // 非法功能码, 丢弃地址后重同步
+    uint8_t junk[] = { SLAVE_ADDR, 0x07 };
+    link_put(&m_m2s, junk, sizeof(junk));
+    rx_bytes += sizeof(junk);
+
+    // 寄存器越界, 处理失败不回复
+    len = build_read(frame, SLAVE_ADDR, SLAVE_REG_NUM - 2, 4);
+    link_put(&m_m2s, frame, len);
+    rx_bytes += len;
+
+    mb_slv_poll(m_slv);
+    TEST_ASSERT_EQUAL(read_resp_len(2), link_len(&m_s2m));
+
+    m_slv_opts.baud = 9600;
+    struct mb_link_stats st;
+    mb_slv_get_link_stats(m_slv, &st, true);
+    m_slv_opts.baud = 0;
+
+    TEST_ASSERT_EQUAL(rx_bytes, st.rx_bytes);
+    TEST_ASSERT_EQUAL(read_resp_len(2), st.tx_bytes);
+    TEST_ASSERT_EQUAL_UINT32(2, st.rx_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, st.tx_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, st.crc_errors);
+    TEST_ASSERT_EQUAL_UINT32(2, st.resyncs);
+    TEST_ASSERT_EQUAL_UINT32(1, st.exceptions[MODBUS_EX_ILLEGAL_ADDRESS]);
+    TEST_ASSERT_EQUAL(MODBUS_RTU_WIRE_US(rx_bytes + read_resp_len(2), 3, 9600), st.busy_us);
+    TEST_ASSERT_TRUE(st.occupancy_pct > 0 && st.occupancy_pct <= 100);
+
+    struct mb_slv_unit_stats unit;
+    TEST_ASSERT_TRUE(mb_slv_get_unit_stats(m_slv, SLAVE_ADDR, &unit));
+    TEST_ASSERT_EQUAL_UINT32(2, unit.rx_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, unit.tx_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, unit.exceptions);
+    TEST_ASSERT_FALSE(mb_slv_get_unit_stats(m_slv, SLAVE_ADDR + 1, &unit));
+
+    // 读取时清零
+    mb_slv_get_link_stats(m_slv, &st, false);
+    TEST_ASSERT_EQUAL(0, st.rx_bytes);
+    TEST_ASSERT_EQUAL_UINT32(0, st.crc_errors);
+    TEST_ASSERT_EQUAL(0, st.occupancy_pct);
+}
+
+// 主机链路统计: 异常响应立即失败不重发, 按异常码及从机统计
+void test_master_link_stats()
+{
+    mb_mst_handle mst = mb_mst_init(&m_mst_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+
+    struct mb_mst_request req = {
+        .timeout_ms = 1000,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_RD_REG_MUL,
+        .reg_addr = 0,
+        .reg_len = 2,
+        .resp = mst_resp,
+    };
+    TEST_ASSERT_TRUE(mb_mst_pdu_request(mst, &req));
+    mb_mst_poll(mst); // 发出请求
+    TEST_ASSERT_EQUAL(8, link_len(&m_m2s));
+    link_reset();
+
+    // CRC错误的回复
+    uint8_t frame[16];
+    size_t len = 0;
+    frame[len++] = SLAVE_ADDR;
+    frame[len++] = MODBUS_FUN_RD_REG_MUL;
+    frame[len++] = 4;
+    frame[len++] = 0x12;
+    frame[len++] = 0x34;
+    frame[len++] = 0x56;
+    frame[len++] = 0x78;
+    frame[len++] = 0;
+    frame[len++] = 0;
+    link_put(&m_s2m, frame, len);
+    size_t rx_bytes = len;
+
+    // 异常响应: 非法寄存器地址
+    len = 0;
+    frame[len++] = SLAVE_ADDR;
+    frame[len++] = MODBUS_FUN_RD_REG_MUL | MODBUS_EXCEPTION_FLAG;
+    frame[len++] = MODBUS_EX_ILLEGAL_ADDRESS;
+    len = append_crc(frame, len);
+    link_put(&m_s2m, frame, len);
+    rx_bytes += len;
+
+    for (int i = 0; i < 4; i++)
+        mb_mst_poll(mst);
+
+    TEST_ASSERT_EQUAL_UINT32(0, m_mst_ok);
+    TEST_ASSERT_EQUAL_UINT32(1, m_mst_timeout); // 以失败回调
+    TEST_ASSERT_EQUAL(0, link_len(&m_m2s));     // 不重发
+    TEST_ASSERT_EQUAL(-1, mb_mst_next_deadline(mst));
+
+    m_mst_opts.baud = 9600;
+    struct mb_link_stats st;
+    mb_mst_get_link_stats(mst, &st, false);
+    struct mb_mst_slave_stats slv;
+    TEST_ASSERT_TRUE(mb_mst_get_slave_stats(mst, SLAVE_ADDR, &slv));
+    m_mst_opts.baud = 0;
+
+    TEST_ASSERT_EQUAL(8, st.tx_bytes);
+    TEST_ASSERT_EQUAL(rx_bytes, st.rx_bytes);
+    TEST_ASSERT_EQUAL_UINT32(1, st.tx_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, st.rx_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, st.crc_errors);
+    TEST_ASSERT_EQUAL_UINT32(1, st.resyncs);
+    TEST_ASSERT_EQUAL_UINT32(0, st.timeouts);
+    TEST_ASSERT_EQUAL_UINT32(0, st.retries);
+    TEST_ASSERT_EQUAL_UINT32(1, st.exceptions[MODBUS_EX_ILLEGAL_ADDRESS]);
+    TEST_ASSERT_EQUAL(MODBUS_RTU_WIRE_US(8 + rx_bytes, 2, 9600), st.busy_us);
+
+    TEST_ASSERT_EQUAL(MB_MST_SLAVE_ONLINE, slv.health);
+    TEST_ASSERT_EQUAL_UINT32(0, slv.ok);
+    TEST_ASSERT_EQUAL_UINT32(1, slv.exceptions);
+    TEST_ASSERT_EQUAL_UINT32(1, slv.crc_errors);
+    TEST_ASSERT_EQUAL_UINT32(1, slv.tx_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, slv.rx_frames);
+    TEST_ASSERT_EQUAL(8, slv.tx_bytes);
+    TEST_ASSERT_EQUAL(len, slv.rx_bytes);
+    TEST_ASSERT_EQUAL(MODBUS_RTU_WIRE_US(8 + len, 2, 9600), slv.busy_us);
+
+    mb_mst_destroy(mst);
+}
+
+/***************************轮询调度***************************/
+
+static uint32_t m_poll_calls[4];  // 各轮询项回调次数
+static uint16_t m_poll_first[4];  // 各轮询项收到的首个寄存器值
+static uint32_t m_poll_timeout;   // 轮询超时次数
+
+static void poll_resp(uint8_t *data, size_t len, bool is_timeout, void *arg)
+{
+    size_t idx = (size_t)arg;
+
+    if (is_timeout) {
+        m_poll_timeout++;
+        return;
+    }
+
+    TEST_ASSERT_TRUE(len >= 2);
+    m_poll_calls[idx]++;
+    m_poll_first[idx] = (data[0] << 8) | data[1];
+}
+
+// 轮询表合并: 同一从机相邻/重叠合并, 不跨从机, 不超过125个, 周期悬殊不合并
+void test_poll_plan()
+{
+    mb_mst_handle mst = mb_mst_init(&m_mst_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+
+    struct mb_poll_entry table[] = {
+        { .slave_addr = 6, .reg_addr = 10, .reg_len = 10, .period_ms = 100, .resp = poll_resp },
+        { .slave_addr = 6, .reg_addr = 0, .reg_len = 10, .period_ms = 100, .resp = poll_resp },
+        { .slave_addr = 6, .reg_addr = 15, .reg_len = 10, .period_ms = 200, .resp = poll_resp },
+        { .slave_addr = 7, .reg_addr = 20, .reg_len = 5, .period_ms = 100, .resp = poll_resp },
+    };
+    mb_poll_handle poll = mb_poll_init(mst, table, 4);
+    TEST_ASSERT_NOT_NULL(poll);
+    TEST_ASSERT_EQUAL(2, mb_poll_request_num(poll)); // 6:0~24, 7:20~24
+    mb_poll_destroy(poll);
+
+    // 超过单次读上限
+    struct mb_poll_entry big[] = {
+        { .slave_addr = 6, .reg_addr = 0, .reg_len = 100, .period_ms = 100, .resp = poll_resp },
+        { .slave_addr = 6, .reg_addr = 100, .reg_len = 30, .period_ms = 100, .resp = poll_resp },
+    };
+    poll = mb_poll_init(mst, big, 2);
+    TEST_ASSERT_EQUAL(2, mb_poll_request_num(poll));
+    mb_poll_destroy(poll);
+
+    // 周期相差很大, 合并后按短周期读取长段, 总线占用反而增加
+    struct mb_poll_entry slow[] = {
+        { .slave_addr = 6, .reg_addr = 0, .reg_len = 2, .period_ms = 10, .resp = poll_resp },
+        { .slave_addr = 6, .reg_addr = 2, .reg_len = 100, .period_ms = 10000, .resp = poll_resp },
+    };
+    poll = mb_poll_init(mst, slow, 2);
+    TEST_ASSERT_EQUAL(2, mb_poll_request_num(poll));
+    mb_poll_destroy(poll);
+
+    // 非法项
+    struct mb_poll_entry bad = { .slave_addr = 6, .reg_len = 126, .period_ms = 1, .resp = poll_resp };
+    TEST_ASSERT_NULL(mb_poll_init(mst, &bad, 1));
+
+    mb_mst_destroy(mst);
+}
+
+// 轮询调度: 合并请求的回复按项拆分, 优先级高的先发送, 按周期重复
+void test_poll_schedule()
+{
+    memset(m_poll_calls, 0, sizeof(m_poll_calls));
+    m_poll_timeout = 0;
+
+    mb_mst_handle mst = mb_mst_init(&m_mst_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+
+    struct mb_poll_entry table[] = {
+        { .slave_addr = SLAVE_ADDR, .reg_addr = 40, .reg_len = 4, .period_ms = 20,
+            .resp = poll_resp, .arg = (void *)0 },
+        { .slave_addr = SLAVE_ADDR, .reg_addr = 44, .reg_len = 8, .period_ms = 20,
+            .resp = poll_resp, .arg = (void *)1 },
+        { .slave_addr = SLAVE_ADDR, .reg_addr = 150, .reg_len = 2, .period_ms = 20, .priority = 0,
+            .resp = poll_resp, .arg = (void *)2 },
+    };
+    table[0].priority = table[1].priority = 1;
+
+    mb_poll_handle poll = mb_poll_init(mst, table, 3);
+    TEST_ASSERT_NOT_NULL(poll);
+    TEST_ASSERT_EQUAL(2, mb_poll_request_num(poll));
+
+    // 首个请求为优先级最高的项
+    mb_poll_schedule(poll);
+    mb_mst_poll(mst);
+    uint8_t frame[16];
+    TEST_ASSERT_EQUAL(8, link_get(&m_m2s, frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL(150, (frame[2] << 8) | frame[3]);
+    m_m2s.rd = 0; // 重新交给从机处理
+
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+    while (now_ns(CLOCK_MONOTONIC) - start < 110 * 1000000ULL) {
+        mb_poll_schedule(poll);
+        mb_mst_poll(mst);
+        mb_slv_poll(m_slv);
+        mb_mst_poll(mst);
+
+        int wait = mb_poll_next_deadline(poll);
+        if (wait > 0)
+            usleep(wait * 1000);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(0, m_poll_timeout);
+    TEST_ASSERT_EQUAL_UINT32(m_poll_calls[0], m_poll_calls[1]); // 合并后同时回调
+    TEST_ASSERT_TRUE(m_poll_calls[0] >= 5 && m_poll_calls[0] <= 7);
+    TEST_ASSERT_TRUE(m_poll_calls[2] >= 5 && m_poll_calls[2] <= 7);
+    TEST_ASSERT_EQUAL_HEX16(40, m_poll_first[0]);
+    TEST_ASSERT_EQUAL_HEX16(44, m_poll_first[1]);
+
+    mb_poll_destroy(poll);
+    mb_mst_destroy(mst);
+}
+
+// 寄存器块描述表: 升序不重叠, 从机处理表项的范围取自描述表
+void test_priv_reg_table()
+{
+#define PRIV_REG_BLOCK_BOUNDS(blk, s, e, t, last) { (s), (e) },
+    static const uint16_t bounds[PRIV_REG_BLOCK_NUM][2] = {
+        MODBUS_PRIV_REG_BLOCKS(PRIV_REG_BLOCK_BOUNDS)
+    };
+#undef PRIV_REG_BLOCK_BOUNDS
+
+    for (int i = 1; i < PRIV_REG_BLOCK_NUM; i++)
+        TEST_ASSERT_TRUE(bounds[i - 1][1] <= bounds[i][0]);
+
+    struct mb_slv_work work = PRIV_REG_WORK(55000_55229, reg_handle);
+    TEST_ASSERT_EQUAL(bounds[PRIV_REG_BLOCK_55000_55229][0], work.start);
+    TEST_ASSERT_EQUAL(bounds[PRIV_REG_BLOCK_55000_55229][1], work.end);
+    TEST_ASSERT_EQUAL(226, PRIV_REG_SIZE(55000_55229));
+    TEST_ASSERT_EQUAL(69, PRIV_REG_OFFSET(1000_1199, REG_1000_1199_LOAD_STATUS));
+}
+
+static uint32_t m_notify_calls;            // 订阅回调次数
+static uint16_t m_notify_reg;              // 订阅回调起始寄存器
+static uint16_t m_notify_vals[SLAVE_REG_NUM]; // 订阅回调寄存器值
+static uint16_t m_notify_len;              // 订阅回调寄存器数量
+
+static void cache_notify(uint8_t slave_addr, uint16_t reg_addr, const uint16_t *vals,
+    uint16_t reg_len, void *arg)
+{
+    (void)slave_addr;
+    (void)arg;
+
+    m_notify_calls++;
+    m_notify_reg = reg_addr;
+    m_notify_len = reg_len;
+    memcpy(m_notify_vals, vals, reg_len * sizeof(uint16_t));
+}
+
+// 调度缓存刷新直到总线空闲
+static void cache_run(mb_bus_handle bus)
+{
+    for (int i = 0; i < 32; i++) {
+        mb_bus_poll(bus);
+        mb_slv_poll(m_slv);
+    }
+}
+
+// 寄存器缓存: 由总线的轮询调度器刷新, 新鲜期内从内存读取, 未命中或过期按需刷新, 值变化才通知订阅者
+void test_cache_ttl_notify()
+{
+    const struct mb_cache_entry table[] = {
+        { .slave_addr = SLAVE_ADDR, .reg_addr = 4, .reg_len = 4, .ttl_ms = 1000 },
+        { .slave_addr = SLAVE_ADDR, .reg_addr = 0, .reg_len = 4, .ttl_ms = 50 },
+    };
+    struct mb_bus_cfg cfg = {
+        .name = "cache",
+        .opts = &m_mst_opts,
+        .cache_table = table,
+        .cache_num = 2,
+    };
+    mb_bus_handle bus = mb_bus_init(&cfg, 1);
+    TEST_ASSERT_NOT_NULL(bus);
+    TEST_ASSERT_NULL(mb_bus_cache(bus, SLAVE_ADDR + 1));
+
+    mb_cache_handle cache = mb_bus_cache(bus, SLAVE_ADDR);
+    TEST_ASSERT_NOT_NULL(cache);
+    TEST_ASSERT_TRUE(mb_cache_subscribe(cache, SLAVE_ADDR, 2, 4, cache_notify, NULL));
+
+    // 按需缓存项不主动读取
+    uint16_t vals[8];
+    TEST_ASSERT_EQUAL(-1, mb_bus_next_deadline(bus));
+    cache_run(bus);
+    TEST_ASSERT_EQUAL_UINT32(0, m_slv_calls);
+
+    // 未命中触发刷新, 相邻的两项合并为一次读取, 订阅跨越两项, 各通知一次
+    m_notify_calls = 0;
+    TEST_ASSERT_EQUAL(MB_CACHE_MISS, mb_cache_read(cache, SLAVE_ADDR, 0, 8, vals));
+    TEST_ASSERT_EQUAL(0, mb_bus_next_deadline(bus));
+    cache_run(bus);
+    TEST_ASSERT_EQUAL_UINT32(1, m_slv_calls);
+    TEST_ASSERT_EQUAL_UINT32(2, m_notify_calls);
+
+    TEST_ASSERT_EQUAL(MB_CACHE_HIT, mb_cache_read(cache, SLAVE_ADDR, 0, 8, vals));
+    for (int i = 0; i < 8; i++)
+        TEST_ASSERT_EQUAL_UINT16(i, vals[i]);
+
+    // 新鲜期内从内存读取, 不访问总线
+    m_regs[5] = 0x1234;
+    TEST_ASSERT_EQUAL(MB_CACHE_HIT, mb_cache_read(cache, SLAVE_ADDR, 3, 3, vals));
+    TEST_ASSERT_EQUAL_UINT16(5, vals[2]);
+    cache_run(bus);
+    TEST_ASSERT_EQUAL_UINT32(1, m_slv_calls);
+
+    // 过期返回旧值并刷新, 只通知值有变化的缓存项与订阅范围的交集
+    usleep(60 * 1000);
+    TEST_ASSERT_EQUAL(MB_CACHE_STALE, mb_cache_read(cache, SLAVE_ADDR, 0, 8, vals));
+    TEST_ASSERT_EQUAL_UINT16(5, vals[5]);
+    cache_run(bus);
+    TEST_ASSERT_EQUAL_UINT32(2, m_slv_calls);
+    TEST_ASSERT_EQUAL_UINT32(3, m_notify_calls);
+    TEST_ASSERT_EQUAL_UINT16(4, m_notify_reg);
+    TEST_ASSERT_EQUAL_UINT16(2, m_notify_len);
+    TEST_ASSERT_EQUAL_UINT16(0x1234, m_notify_vals[1]);
+
+    TEST_ASSERT_EQUAL(MB_CACHE_HIT, mb_cache_read(cache, SLAVE_ADDR, 0, 8, vals));
+    TEST_ASSERT_EQUAL_UINT16(0x1234, vals[5]);
+
+    // 值未变化的刷新不通知
+    usleep(60 * 1000);
+    TEST_ASSERT_EQUAL(MB_CACHE_STALE, mb_cache_read(cache, SLAVE_ADDR, 0, 1, vals));
+    cache_run(bus);
+    TEST_ASSERT_EQUAL_UINT32(3, m_slv_calls);
+    TEST_ASSERT_EQUAL_UINT32(3, m_notify_calls);
+
+    // 不在缓存表中的寄存器始终未命中, 不访问总线
+    TEST_ASSERT_EQUAL(MB_CACHE_MISS, mb_cache_read(cache, SLAVE_ADDR, 6, 4, vals));
+    TEST_ASSERT_EQUAL(MB_CACHE_MISS, mb_cache_read(cache, SLAVE_ADDR + 1, 0, 1, vals));
+    cache_run(bus);
+    TEST_ASSERT_EQUAL_UINT32(3, m_slv_calls);
+
+    // 重叠的缓存项
+    const struct mb_cache_entry overlap[] = {
+        { .slave_addr = SLAVE_ADDR, .reg_addr = 0, .reg_len = 4, .ttl_ms = 50 },
+        { .slave_addr = SLAVE_ADDR, .reg_addr = 3, .reg_len = 4, .ttl_ms = 50 },
+    };
+    cfg.cache_table = overlap;
+    TEST_ASSERT_NULL(mb_bus_init(&cfg, 1));
+
+    mb_bus_destroy(bus);
+}
+
+// 执行一次主从机请求, 返回是否收到回复
+static bool transact(mb_mst_handle mst, struct mb_mst_request *req, uint32_t max_loops)
+{
+    uint32_t done = m_mst_ok + m_mst_timeout;
+
+    if (!mb_mst_pdu_request(mst, req))
+        return false;
+
+    for (uint32_t i = 0; i < max_loops && m_mst_ok + m_mst_timeout == done; i++) {
+        mb_mst_poll(mst);
+        mb_slv_poll(m_slv);
+    }
+
+    return m_mst_ok + m_mst_timeout != done;
+}
+
+// 主从机吞吐: 读写交替, 统计每秒帧数与每帧CPU时间
+static void run_throughput(struct serial_opts *mst_opts, uint32_t num, uint32_t max_loops,
+    const char *name)
+{
+    uint8_t wr_data[MODBUS_WR_REG_NUM_MAX * 2];
+    for (size_t i = 0; i < sizeof(wr_data); i++)
+        wr_data[i] = i;
+
+    mb_mst_handle mst = mb_mst_init(mst_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+
+    // 超时设长, 避免慢链路上重发
+    struct mb_mst_request rd = {
+        .timeout_ms = 1000,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_RD_REG_MUL,
+        .reg_addr = 0,
+        .reg_len = 32,
+        .resp = mst_resp,
+    };
+    struct mb_mst_request wr = rd;
+    wr.func = MODBUS_FUN_WR_REG_MUL;
+    wr.reg_addr = 100;
+    wr.data = wr_data;
+    wr.data_len = sizeof(wr_data);
+
+    uint64_t wall = now_ns(CLOCK_MONOTONIC);
+    uint64_t cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    for (uint32_t i = 0; i < num; i++)
+        TEST_ASSERT_TRUE(transact(mst, (i & 1) ? &wr : &rd, max_loops));
+
+    wall = now_ns(CLOCK_MONOTONIC) - wall;
+    cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+    TEST_ASSERT_EQUAL_UINT32(num, m_mst_ok);
+    TEST_ASSERT_EQUAL_UINT32(0, m_mst_timeout);
+    TEST_ASSERT_EQUAL_HEX16(0x0001, m_regs[100]);
+
+    printf("%s: %u frames, %.0f frames/s, %.2f us cpu/frame\n", name, num,
+        num * 1e9 / (wall ? wall : 1), cpu / 1000.0 / num);
+
+    mb_mst_destroy(mst);
+}
+
+// 主机自适应超时与熔断: 按往返时间缩短超时, 连续超时后不占用总线, 到期探测恢复
+void test_master_adaptive_timeout()
+{
+    mb_mst_handle mst = mb_mst_init(&m_mst_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+
+    struct mb_mst_slave_stats stats;
+    TEST_ASSERT_FALSE(mb_mst_get_slave_stats(mst, SLAVE_ADDR, &stats));
+
+    struct mb_mst_request rd = {
+        .timeout_ms = 1000,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_RD_REG_MUL,
+        .reg_addr = 0,
+        .reg_len = 2,
+        .resp = mst_resp,
+    };
+    for (int i = 0; i < 20; i++)
+        TEST_ASSERT_TRUE(transact(mst, &rd, 16));
+
+    TEST_ASSERT_TRUE(mb_mst_get_slave_stats(mst, SLAVE_ADDR, &stats));
+    TEST_ASSERT_EQUAL(MB_MST_SLAVE_ONLINE, stats.health);
+    TEST_ASSERT_EQUAL_UINT32(20, stats.ok);
+    TEST_ASSERT_EQUAL_UINT32(MB_MST_RTO_MIN_MS * 1000, stats.rto_us);
+
+    // 从机掉线: 超时按往返时间估算, 重发加倍, 远小于请求的1秒
+    for (int n = 0; n < MB_MST_BREAKER_FAILS; n++) {
+        link_reset();
+        uint32_t timeouts = m_mst_timeout;
+        uint64_t start = now_ns(CLOCK_MONOTONIC);
+        TEST_ASSERT_NOT_EQUAL(0, mb_mst_pdu_request(mst, &rd));
+        while (m_mst_timeout == timeouts) {
+            usleep(mb_mst_next_deadline(mst) * 1000);
+            mb_mst_poll(mst);
+        }
+        uint64_t elapsed_ms = (now_ns(CLOCK_MONOTONIC) - start) / 1000000;
+
+        TEST_ASSERT_EQUAL(8 * MASTER_REPEATS, link_len(&m_m2s));
+        TEST_ASSERT_TRUE(elapsed_ms >= MB_MST_RTO_MIN_MS * 7);
+        TEST_ASSERT_TRUE(elapsed_ms < 500);
+    }
+
+    TEST_ASSERT_TRUE(mb_mst_get_slave_stats(mst, SLAVE_ADDR, &stats));
+    TEST_ASSERT_EQUAL(MB_MST_SLAVE_OFFLINE, stats.health);
+    TEST_ASSERT_EQUAL_UINT32(MB_MST_BREAKER_FAILS, stats.timeouts);
+    TEST_ASSERT_EQUAL_UINT32(MB_MST_BREAKER_FAILS * (MASTER_REPEATS - 1), stats.retries);
+    TEST_ASSERT_TRUE(stats.next_probe_ms > 0 && stats.next_probe_ms <= MB_MST_PROBE_MIN_MS);
+
+    // 熔断中直接失败, 不发送
+    link_reset();
+    uint32_t timeouts = m_mst_timeout;
+    TEST_ASSERT_NOT_EQUAL(0, mb_mst_pdu_request(mst, &rd));
+    mb_mst_poll(mst);
+    TEST_ASSERT_EQUAL_UINT32(timeouts + 1, m_mst_timeout);
+    TEST_ASSERT_EQUAL(0, link_len(&m_m2s));
+
+    // 到达探测时刻, 从机恢复
+    usleep((stats.next_probe_ms + 1) * 1000);
+    TEST_ASSERT_TRUE(transact(mst, &rd, 16));
+    TEST_ASSERT_TRUE(mb_mst_get_slave_stats(mst, SLAVE_ADDR, &stats));
+    TEST_ASSERT_EQUAL(MB_MST_SLAVE_ONLINE, stats.health);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.fast_fails);
+    TEST_ASSERT_EQUAL_UINT32(21, stats.ok);
+
+    mb_mst_destroy(mst);
+}
+
+// 多总线: 请求按从机地址路由, 两条总线同时有请求在途, 统计分总线与汇总
+void test_bus_parallel()
+{
+    mb_slv_handle slv2 = mb_slv_init(&m_slv2_opts, SLAVE2_ADDR, m_work, 1);
+    TEST_ASSERT_NOT_NULL(slv2);
+
+    const uint8_t slaves1[] = { SLAVE_ADDR };
+    const uint8_t slaves2[] = { SLAVE2_ADDR };
+    struct mb_bus_cfg cfg[2] = {
+        { .name = "bus1", .opts = &m_mst_opts, .slaves = slaves1, .slave_num = 1 },
+        { .name = "bus2", .opts = &m_mst2_opts, .slaves = slaves2, .slave_num = 1 },
+    };
+
+    // 同一从机不能属于两条总线
+    cfg[1].slaves = slaves1;
+    TEST_ASSERT_NULL(mb_bus_init(cfg, 2));
+    cfg[1].slaves = slaves2;
+
+    mb_bus_handle bus = mb_bus_init(cfg, 2);
+    TEST_ASSERT_NOT_NULL(bus);
+    TEST_ASSERT_EQUAL(2, mb_bus_num(bus));
+    TEST_ASSERT_NOT_NULL(mb_bus_route(bus, SLAVE_ADDR));
+    TEST_ASSERT_TRUE(mb_bus_route(bus, SLAVE_ADDR) != mb_bus_route(bus, SLAVE2_ADDR));
+
+    struct mb_mst_request rd = {
+        .timeout_ms = 1000,
+        .slave_addr = 0x55,
+        .func = MODBUS_FUN_RD_REG_MUL,
+        .reg_addr = 0,
+        .reg_len = 8,
+        .resp = mst_resp,
+    };
+    TEST_ASSERT_EQUAL(0, mb_bus_request(bus, &rd));
+
+    for (int i = 0; i < BUS_NUM; i++) {
+        rd.slave_addr = SLAVE_ADDR;
+        TEST_ASSERT_NOT_EQUAL(0, mb_bus_request(bus, &rd));
+        rd.slave_addr = SLAVE2_ADDR;
+        TEST_ASSERT_NOT_EQUAL(0, mb_bus_request(bus, &rd));
+
+        // 一次轮询两条总线都发出请求, 不必等待另一条总线的回复
+        mb_bus_poll(bus);
+        TEST_ASSERT_EQUAL(8, link_len(&m_m2s));
+        TEST_ASSERT_EQUAL(8, link_len(&m_m2s2));
+
+        mb_slv_poll(m_slv);
+        mb_slv_poll(slv2);
+        mb_bus_poll(bus);
+        TEST_ASSERT_EQUAL_UINT32((i + 1) * 2, m_mst_ok);
+    }
+
+    struct mb_bus_stats st;
+    TEST_ASSERT_TRUE(mb_bus_get_stats(bus, 0, &st));
+    TEST_ASSERT_EQUAL_UINT32(BUS_NUM, st.ok);
+    TEST_ASSERT_TRUE(mb_bus_get_stats(bus, 1, &st));
+    TEST_ASSERT_EQUAL_UINT32(BUS_NUM, st.ok);
+    TEST_ASSERT_TRUE(mb_bus_get_stats(bus, -1, &st));
+    TEST_ASSERT_EQUAL_UINT32(BUS_NUM * 2, st.ok);
+    TEST_ASSERT_EQUAL_UINT32(0, st.timeouts);
+    TEST_ASSERT_FALSE(mb_bus_get_stats(bus, 2, &st));
+    TEST_ASSERT_EQUAL(-1, mb_bus_next_deadline(bus));
+
+    mb_bus_destroy(bus);
+    mb_slv_destroy(slv2);
+}
+
+void test_master_slave_throughput()
+{
+    run_throughput(&m_mst_opts, THROUGHPUT_NUM, 16, "memory");
+}
+
+// 伪终端: 经过内核tty层的主从机往返
+void test_master_slave_pty()
+{
+    if (openpty(&m_pty_mst, &m_pty_slv, NULL, NULL, NULL) < 0)
+        TEST_IGNORE_MESSAGE("openpty unavailable");
+
+    struct termios tio;
+    int fds[2] = { m_pty_mst, m_pty_slv };
+    for (int i = 0; i < 2; i++) {
+        tcgetattr(fds[i], &tio);
+        cfmakeraw(&tio);
+        tcsetattr(fds[i], TCSANOW, &tio);
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    mb_slv_destroy(m_slv);
+    m_slv = mb_slv_init(&m_pty_slv_opts, SLAVE_ADDR, m_work, 1);
+    TEST_ASSERT_NOT_NULL(m_slv);
+
+    run_throughput(&m_pty_mst_opts, PTY_NUM, 1000000, "pty");
+
+    close(m_pty_mst);
+    close(m_pty_slv);
+    m_pty_mst = m_pty_slv = -1;
+}
+
+// 串口传输层: 按配置设置线路参数, 伪终端不支持RS485时退化方向控制, 经其收发完成往返
+void test_serial_line_config()
+{
+    if (openpty(&m_pty_mst, &m_pty_slv, NULL, NULL, NULL) < 0)
+        TEST_IGNORE_MESSAGE("openpty unavailable");
+
+    struct termios tio;
+    tcgetattr(m_pty_mst, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(m_pty_mst, TCSANOW, &tio);
+    fcntl(m_pty_mst, F_SETFL, fcntl(m_pty_mst, F_GETFL) | O_NONBLOCK);
+
+    struct mb_serial_cfg cfg = {
+        .path = ttyname(m_pty_slv),
+        .baud = 9600,
+        .parity = MB_SERIAL_PARITY_EVEN,
+        .stop_bits = 2,
+        .rs485 = true,
+    };
+    TEST_ASSERT_NOT_NULL(cfg.path);
+
+    cfg.baud = 12345;
+    TEST_ASSERT_NULL(mb_serial_open(&cfg));
+    cfg.baud = 9600;
+
+    mb_serial_handle port = mb_serial_open(&cfg);
+    TEST_ASSERT_NOT_NULL(port);
+    TEST_ASSERT_NOT_EQUAL(MB_SERIAL_DIR_KERNEL, mb_serial_dir_mode(port));
+    TEST_ASSERT_EQUAL_UINT32(9600, mb_serial_opts(port)->baud);
+
+    TEST_ASSERT_EQUAL(0, tcgetattr(mb_serial_get_fd(port), &tio));
+    TEST_ASSERT_EQUAL(B9600, cfgetospeed(&tio));
+    TEST_ASSERT_EQUAL(CS8, tio.c_cflag & CSIZE);
+    TEST_ASSERT_TRUE(tio.c_cflag & CSTOPB); // 伪终端固定清除校验位, 不检查PARENB
+    TEST_ASSERT_FALSE(tio.c_lflag & ICANON);
+
+    mb_slv_destroy(m_slv);
+    m_slv = mb_slv_init(mb_serial_opts(port), SLAVE_ADDR, m_work, 1);
+    TEST_ASSERT_NOT_NULL(m_slv);
+
+    run_throughput(&m_pty_mst_opts, PTY_NUM / 10, 1000000, "serial");
+
+    // 从机不再访问串口后关闭
+    mb_slv_destroy(m_slv);
+    m_slv = NULL;
+    mb_serial_close(port);
+
+    close(m_pty_mst);
+    close(m_pty_slv);
+    m_pty_mst = m_pty_slv = -1;
+}
+
+// 串口发送队列: 驱动写满时帧不截断, 由f_check_send续写, 清空后才算发送完成
+void test_serial_tx_queue()
+{
+    if (openpty(&m_pty_mst, &m_pty_slv, NULL, NULL, NULL) < 0)
+        TEST_IGNORE_MESSAGE("openpty unavailable");
+
+    fcntl(m_pty_mst, F_SETFL, fcntl(m_pty_mst, F_GETFL) | O_NONBLOCK);
+
+    struct mb_serial_cfg cfg = {
+        .path = ttyname(m_pty_slv),
+        .baud = 115200,
+        .stop_bits = 1,
+    };
+    mb_serial_handle port = mb_serial_open(&cfg);
+    TEST_ASSERT_NOT_NULL(port);
+    struct serial_opts *opts = mb_serial_opts(port);
+
+    // 对端不读取, 先写满驱动缓冲
+    uint8_t fill[1024];
+    memset(fill, 0xAA, sizeof(fill));
+    size_t filled = 0;
+    for (;;) {
+        ssize_t ret = write(mb_serial_get_fd(port), fill, sizeof(fill));
+        if (ret <= 0)
+            break;
+        filled += ret;
+    }
+    TEST_ASSERT_TRUE(filled > 0);
+
+    uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+    for (size_t i = 0; i < sizeof(frame); i++)
+        frame[i] = (uint8_t)i;
+    TEST_ASSERT_EQUAL(sizeof(frame), opts->f_write(frame, sizeof(frame), opts->arg));
+    TEST_ASSERT_FALSE(opts->f_check_send(opts->arg));
+
+    // 对端读取后续写, 最后收到的是完整的帧
+    uint8_t rx[sizeof(frame)];
+    size_t total = 0;
+    bool complete = false;
+    for (int loops = 0; loops < 100000 && (!complete || total < filled + sizeof(frame)); loops++) {
+        uint8_t buf[1024];
+        ssize_t ret = read(m_pty_mst, buf, sizeof(buf));
+        for (ssize_t i = 0; i < ret; i++, total++)
+            if (total >= filled)
+                rx[total - filled] = buf[i];
+        if (!complete)
+            complete = opts->f_check_send(opts->arg);
+    }
+    TEST_ASSERT_TRUE(complete);
+    TEST_ASSERT_EQUAL(filled + sizeof(frame), total);
+    TEST_ASSERT_EQUAL_MEMORY(frame, rx, sizeof(frame));
+
+    mb_serial_close(port);
+    close(m_pty_mst);
+    close(m_pty_slv);
+    m_pty_mst = m_pty_slv = -1;
+}
+
+// 对端写入1字节到串口侧被唤醒读取的延时, 伪终端不支持低延时接收时两者应接近
+static void run_rx_wakeup(bool low_latency)
+{
+    struct mb_serial_cfg cfg = {
+        .path = ttyname(m_pty_slv),
+        .baud = 115200,
+        .stop_bits = 1,
+        .low_latency = low_latency,
+    };
+    mb_serial_handle port = mb_serial_open(&cfg);
+    TEST_ASSERT_NOT_NULL(port);
+    struct serial_opts *opts = mb_serial_opts(port);
+
+    uint64_t sum = 0, max = 0;
+    for (int i = 0; i < WAKEUP_NUM; i++) {
+        uint8_t c = (uint8_t)i;
+        uint64_t start = now_ns(CLOCK_MONOTONIC);
+        TEST_ASSERT_EQUAL(1, write(m_pty_mst, &c, 1));
+
+        struct pollfd pfd = { .fd = mb_serial_get_fd(port), .events = POLLIN };
+        TEST_ASSERT_EQUAL(1, poll(&pfd, 1, 1000));
+        TEST_ASSERT_EQUAL(1, opts->f_read(&c, 1, opts->arg));
+
+        uint64_t ns = now_ns(CLOCK_MONOTONIC) - start;
+        sum += ns;
+        if (ns > max)
+            max = ns;
+    }
+    printf("rx wakeup low_latency=%s: avg %.2f us max %.2f us\n", low_latency ? "on" : "off",
+        sum / 1000.0 / WAKEUP_NUM, max / 1000.0);
+
+    // 一次读到多个字节时按字符时间估算首字节的等待下限
+    struct mb_serial_rx_stats st;
+    mb_serial_get_rx_stats(port, &st, true);
+    TEST_ASSERT_EQUAL_UINT32(WAKEUP_NUM, st.wakeups);
+    TEST_ASSERT_EQUAL_UINT32(1, st.max_burst);
+    TEST_ASSERT_EQUAL_UINT32(0, st.delay_max_us);
+
+    uint8_t burst[10] = { 0 };
+    TEST_ASSERT_EQUAL(sizeof(burst), write(m_pty_mst, burst, sizeof(burst)));
+    size_t got = 0;
+    for (int loops = 0; loops < 1000 && got < sizeof(burst); loops++) {
+        struct pollfd pfd = { .fd = mb_serial_get_fd(port), .events = POLLIN };
+        poll(&pfd, 1, 100);
+        got += opts->f_read(burst, sizeof(burst), opts->arg);
+    }
+    TEST_ASSERT_EQUAL(sizeof(burst), got);
+
+    mb_serial_get_rx_stats(port, &st, false);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(burst), st.bytes);
+    TEST_ASSERT_EQUAL_UINT32((st.max_burst - 1) * (MODBUS_RTU_CHAR_BITS * 1000000 / 115200),
+        st.delay_max_us);
+
+    mb_serial_close(port);
+}
+
+void test_serial_rx_wakeup()
+{
+    if (openpty(&m_pty_mst, &m_pty_slv, NULL, NULL, NULL) < 0)
+        TEST_IGNORE_MESSAGE("openpty unavailable");
+
+    run_rx_wakeup(false);
+    run_rx_wakeup(true);
+
+    close(m_pty_mst);
+    close(m_pty_slv);
+    m_pty_mst = m_pty_slv = -1;
+}
+
+// 抓包与回放: 串口收发写入pcap, 回放请求到新的从机, 尽快回放得到相同的回复
+void test_serial_capture_replay()
+{
+    if (openpty(&m_pty_mst, &m_pty_slv, NULL, NULL, NULL) < 0)
+        TEST_IGNORE_MESSAGE("openpty unavailable");
+
+    struct termios tio;
+    tcgetattr(m_pty_mst, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(m_pty_mst, TCSANOW, &tio);
+    fcntl(m_pty_mst, F_SETFL, fcntl(m_pty_mst, F_GETFL) | O_NONBLOCK);
+
+    struct mb_serial_cfg cfg = {
+        .path = ttyname(m_pty_slv),
+        .baud = 115200,
+        .stop_bits = 1,
+    };
+    mb_serial_handle port = mb_serial_open(&cfg);
+    TEST_ASSERT_NOT_NULL(port);
+    TEST_ASSERT_TRUE(mb_serial_capture(port, CAPTURE_PATH));
+
+    mb_slv_destroy(m_slv);
+    m_slv = mb_slv_init(mb_serial_opts(port), SLAVE_ADDR, m_work, 1);
+    TEST_ASSERT_NOT_NULL(m_slv);
+
+    run_throughput(&m_pty_mst_opts, CAPTURE_NUM, 1000000, "capture");
+
+    struct mb_link_stats live;
+    mb_slv_get_link_stats(m_slv, &live, false);
+    mb_slv_destroy(m_slv);
+    mb_serial_close(port);
+
+    // 文件头: 微秒时间戳, 自定义链路类型
+    FILE *fp = fopen(CAPTURE_PATH, "rb");
+    TEST_ASSERT_NOT_NULL(fp);
+    uint32_t hdr[6];
+    TEST_ASSERT_EQUAL(1, fread(hdr, sizeof(hdr), 1, fp));
+    fclose(fp);
+    TEST_ASSERT_EQUAL_UINT32(0xa1b2c3d4, hdr[0]);
+    TEST_ASSERT_EQUAL_UINT32(MB_CAP_DLT, hdr[5]);
+
+    mb_replay_handle rp = mb_replay_open(CAPTURE_PATH, MB_CAP_DIR_RX, false);
+    TEST_ASSERT_NOT_NULL(rp);
+    m_slv = mb_slv_init(mb_replay_opts(rp), SLAVE_ADDR, m_work, 1);
+    TEST_ASSERT_NOT_NULL(m_slv);
+
+    for (int loops = 0; loops < 100000 && !mb_replay_done(rp); loops++)
+        mb_slv_poll(m_slv);
+    TEST_ASSERT_TRUE(mb_replay_done(rp));
+
+    struct mb_replay_stats st;
+    mb_replay_get_stats(rp, &st);
+    TEST_ASSERT_EQUAL_UINT32(live.rx_bytes, st.rx_bytes);
+    TEST_ASSERT_EQUAL_UINT32(CAPTURE_NUM, st.tx_calls);
+    TEST_ASSERT_EQUAL_UINT32(live.tx_bytes, st.tx_bytes);
+
+    mb_slv_destroy(m_slv);
+    m_slv = NULL;
+    mb_replay_close(rp);
+
+    close(m_pty_mst);
+    close(m_pty_slv);
+    m_pty_mst = m_pty_slv = -1;
+    remove(CAPTURE_PATH);
+}
+
+// 实时回放: 记录按抓包时的间隔送入, 其他方向的记录跳过
+void test_replay_realtime()
+{
+    mb_cap_handle cap = mb_cap_open(CAPTURE_PATH);
+    TEST_ASSERT_NOT_NULL(cap);
+
+    uint8_t a[3] = { 1, 2, 3 }, b[2] = { 4, 5 };
+    mb_cap_write(cap, MB_CAP_DIR_RX, a, sizeof(a));
+    mb_cap_write(cap, MB_CAP_DIR_TX, b, sizeof(b));
+    usleep(20000);
+    mb_cap_write(cap, MB_CAP_DIR_RX, b, sizeof(b));
+    mb_cap_close(cap);
+
+    mb_replay_handle rp = mb_replay_open(CAPTURE_PATH, MB_CAP_DIR_RX, true);
+    TEST_ASSERT_NOT_NULL(rp);
+    struct serial_opts *opts = mb_replay_opts(rp);
+
+    uint8_t buf[8];
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+    TEST_ASSERT_EQUAL(sizeof(a), opts->f_read(buf, sizeof(buf), opts->arg));
+    TEST_ASSERT_EQUAL_MEMORY(a, buf, sizeof(a));
+    TEST_ASSERT_EQUAL(0, opts->f_read(buf, sizeof(buf), opts->arg));
+
+    size_t n = 0;
+    while (!n && now_ns(CLOCK_MONOTONIC) - start < 1000000000ULL)
+        n = opts->f_read(buf, sizeof(buf), opts->arg);
+    TEST_ASSERT_EQUAL(sizeof(b), n);
+    TEST_ASSERT_EQUAL_MEMORY(b, buf, sizeof(b));
+    TEST_ASSERT_TRUE(now_ns(CLOCK_MONOTONIC) - start >= 15000000ULL);
+
+    TEST_ASSERT_EQUAL(0, opts->f_read(buf, sizeof(buf), opts->arg));
+    TEST_ASSERT_TRUE(mb_replay_done(rp));
+
+    mb_replay_close(rp);
+    remove(CAPTURE_PATH);
+}
+
+// 实时回放: 抓包期间系统时间回拨, 回拨的记录立即送入, 之后按记录间隔继续回放
+void test_replay_clock_step_back()
+{
+    mb_cap_handle cap = mb_cap_open(CAPTURE_PATH);
+    TEST_ASSERT_NOT_NULL(cap);
+
+    uint8_t a[3] = { 1, 2, 3 }, b[2] = { 4, 5 };
+    mb_cap_write(cap, MB_CAP_DIR_RX, a, sizeof(a));
+    mb_cap_write(cap, MB_CAP_DIR_RX, b, sizeof(b));
+    usleep(20000);
+    mb_cap_write(cap, MB_CAP_DIR_RX, a, sizeof(a));
+    mb_cap_close(cap);
+
+    // 第一条记录之后的时间戳回拨1小时, 记录头: 秒、微秒、记录长度、原始长度
+    FILE *fp = fopen(CAPTURE_PATH, "r+b");
+    TEST_ASSERT_NOT_NULL(fp);
+    long off = 24;
+    for (int i = 0; i < 3; i++) {
+        uint32_t rec[4];
+        TEST_ASSERT_EQUAL(0, fseek(fp, off, SEEK_SET));
+        TEST_ASSERT_EQUAL(1, fread(rec, sizeof(rec), 1, fp));
+        if (i) {
+            rec[0] -= 3600;
+            TEST_ASSERT_EQUAL(0, fseek(fp, off, SEEK_SET));
+            TEST_ASSERT_EQUAL(1, fwrite(rec, sizeof(rec), 1, fp));
+        }
+        off += sizeof(rec) + rec[2];
+    }
+    fclose(fp);
+
+    mb_replay_handle rp = mb_replay_open(CAPTURE_PATH, MB_CAP_DIR_RX, true);
+    TEST_ASSERT_NOT_NULL(rp);
+    struct serial_opts *opts = mb_replay_opts(rp);
+
+    uint8_t buf[8];
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+    TEST_ASSERT_EQUAL(sizeof(a), opts->f_read(buf, sizeof(buf), opts->arg));
+    TEST_ASSERT_EQUAL(sizeof(b), opts->f_read(buf, sizeof(buf), opts->arg));
+    TEST_ASSERT_EQUAL_MEMORY(b, buf, sizeof(b));
+
+    size_t n = 0;
+    while (!n && now_ns(CLOCK_MONOTONIC) - start < 1000000000ULL)
+        n = opts->f_read(buf, sizeof(buf), opts->arg);
+    TEST_ASSERT_EQUAL(sizeof(a), n);
+    TEST_ASSERT_TRUE(now_ns(CLOCK_MONOTONIC) - start >= 15000000ULL);
+
+    TEST_ASSERT_EQUAL(0, opts->f_read(buf, sizeof(buf), opts->arg));
+    TEST_ASSERT_TRUE(mb_replay_done(rp));
+
+    mb_replay_close(rp);
+    remove(CAPTURE_PATH);
+}
+
+// 在回环地址监听, 用于RTU over TCP测试
+static int tcp_listen(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// 连接回环地址上的TCP从机
+static int tcp_connect(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// TCP主机流水线吞吐: 保持窗口内多个事务在途, 统计每秒帧数与每帧CPU时间
+void test_master_tcp_pipeline()
+{
+    mb_slv_tcp_handle slv_tcp = mb_slv_tcp_init(m_slv, "127.0.0.1", TCP_PORT);
+    if (!slv_tcp)
+        TEST_IGNORE_MESSAGE("tcp port unavailable");
+
+    mb_mst_tcp_handle mst = mb_mst_tcp_init();
+    TEST_ASSERT_NOT_NULL(mst);
+    int conn = mb_mst_tcp_connect(mst, "127.0.0.1", TCP_PORT, MB_MST_TCP_MODE_MBAP);
+    TEST_ASSERT_TRUE(conn >= 0);
+
+    struct mb_mst_request rd = {
+        .timeout_ms = 1000,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_RD_REG_MUL,
+        .reg_addr = 0,
+        .reg_len = 32,
+        .resp = mst_resp,
+    };
+
+    uint64_t wall = now_ns(CLOCK_MONOTONIC);
+    uint64_t cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    uint32_t sent = 0;
+    while (m_mst_ok + m_mst_timeout < TCP_NUM) {
+        while (sent < TCP_NUM && sent - m_mst_ok - m_mst_timeout < MB_MST_TCP_PIPELINE &&
+               mb_mst_tcp_request(mst, conn, &rd))
+            sent++;
+        mb_mst_tcp_poll(mst);
+        mb_slv_tcp_poll(slv_tcp);
+    }
+
+    wall = now_ns(CLOCK_MONOTONIC) - wall;
+    cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+    TEST_ASSERT_EQUAL_UINT32(TCP_NUM, m_mst_ok);
+    TEST_ASSERT_EQUAL_UINT32(0, m_mst_timeout);
+    TEST_ASSERT_EQUAL(64, m_mst_len);
+    TEST_ASSERT_EQUAL_HEX8(31, m_mst_data[63]);
+    TEST_ASSERT_EQUAL(-1, mb_mst_tcp_next_deadline(mst));
+
+    printf("tcp pipeline: %u frames, %.0f frames/s, %.2f us cpu/frame\n", TCP_NUM,
+        TCP_NUM * 1e9 / (wall ? wall : 1), cpu / 1000.0 / TCP_NUM);
+
+    // 取消的请求不回调, 从机不回复的请求到期超时
+    uint32_t ok = m_mst_ok;
+    mb_mst_req_id id = mb_mst_tcp_request(mst, conn, &rd);
+    TEST_ASSERT_TRUE(mb_mst_tcp_cancel(mst, id));
+    TEST_ASSERT_FALSE(mb_mst_tcp_cancel(mst, id));
+
+    rd.reg_addr = SLAVE_REG_NUM;
+    rd.timeout_ms = 50;
+    TEST_ASSERT_NOT_EQUAL(0, mb_mst_tcp_request(mst, conn, &rd));
+    for (int wait = 0; !m_mst_timeout; wait = mb_mst_tcp_next_deadline(mst)) {
+        TEST_ASSERT_TRUE(wait >= 0 && wait <= 50);
+        usleep(wait * 1000);
+        mb_mst_tcp_poll(mst);
+        mb_slv_tcp_poll(slv_tcp);
+    }
+    TEST_ASSERT_EQUAL_UINT32(ok, m_mst_ok);
+    TEST_ASSERT_EQUAL(-1, mb_mst_tcp_next_deadline(mst));
+
+    mb_mst_tcp_destroy(mst);
+    mb_slv_tcp_destroy(slv_tcp);
+}
+
+// RTU over TCP: 串口服务器透传RTU帧, 同一时间只有一个事务在途
+void test_master_tcp_rtu()
+{
+    int lfd = tcp_listen(TCP_PORT + 1);
+    if (lfd < 0)
+        TEST_IGNORE_MESSAGE("tcp port unavailable");
+
+    mb_mst_tcp_handle mst = mb_mst_tcp_init();
+    TEST_ASSERT_NOT_NULL(mst);
+    int conn = mb_mst_tcp_connect(mst, "127.0.0.1", TCP_PORT + 1, MB_MST_TCP_MODE_RTU);
+    TEST_ASSERT_TRUE(conn >= 0);
+
+    // 串口服务器侧用RTU从机处理接入的连接
+    m_pty_slv = accept(lfd, NULL, NULL);
+    TEST_ASSERT_TRUE(m_pty_slv >= 0);
+    fcntl(m_pty_slv, F_SETFL, fcntl(m_pty_slv, F_GETFL) | O_NONBLOCK);
+
+    mb_slv_destroy(m_slv);
+    m_slv = mb_slv_init(&m_pty_slv_opts, SLAVE_ADDR, m_work, 1);
+    TEST_ASSERT_NOT_NULL(m_slv);
+
+    uint8_t wr_data[8] = { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0 };
+    struct mb_mst_request wr = {
+        .timeout_ms = 1000,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_WR_REG_MUL,
+        .reg_addr = 10,
+        .reg_len = 4,
+        .data = wr_data,
+        .data_len = sizeof(wr_data),
+        .resp = mst_resp,
+    };
+    struct mb_mst_request rd = wr;
+    rd.func = MODBUS_FUN_RD_REG_MUL;
+    rd.data = NULL;
+    rd.data_len = 0;
+
+    // 一次提交多个请求, 按顺序逐个完成
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_NOT_EQUAL(0, mb_mst_tcp_request(mst, conn, &wr));
+        TEST_ASSERT_NOT_EQUAL(0, mb_mst_tcp_request(mst, conn, &rd));
+    }
+    for (int i = 0; i < 1000000 && m_mst_ok + m_mst_timeout < 8; i++) {
+        mb_mst_tcp_poll(mst);
+        mb_slv_poll(m_slv);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(8, m_mst_ok);
+    TEST_ASSERT_EQUAL_UINT32(0, m_mst_timeout);
+    TEST_ASSERT_EQUAL(8, m_mst_len);
+    TEST_ASSERT_EQUAL_MEMORY(wr_data, m_mst_data, 8);
+    TEST_ASSERT_EQUAL_HEX16(0x1234, m_regs[10]);
+
+    // 字节数与请求不符的回复即使CRC正确也丢弃, 不按字节数推算帧长, 请求超时
+    uint8_t bad[3 + 255 + MODBUS_CRC_BYTES_NUM] = { SLAVE_ADDR, MODBUS_FUN_RD_REG_MUL, 255 };
+    uint16_t crc = crc16_update_bytes(0xffff, bad, sizeof(bad) - MODBUS_CRC_BYTES_NUM);
+    bad[sizeof(bad) - 2] = GET_U8_LOW_FROM_U16(crc);
+    bad[sizeof(bad) - 1] = GET_U8_HIGH_FROM_U16(crc);
+
+    rd.timeout_ms = 50;
+    TEST_ASSERT_NOT_EQUAL(0, mb_mst_tcp_request(mst, conn, &rd));
+    TEST_ASSERT_EQUAL(sizeof(bad), write(m_pty_slv, bad, sizeof(bad)));
+    for (int i = 0; i < 1000000 && !m_mst_timeout; i++)
+        mb_mst_tcp_poll(mst);
+    TEST_ASSERT_EQUAL_UINT32(8, m_mst_ok);
+    TEST_ASSERT_EQUAL_UINT32(1, m_mst_timeout);
+
+    // 服务端断开, 在途请求立即失败
+    rd.timeout_ms = 1000;
+    TEST_ASSERT_NOT_EQUAL(0, mb_mst_tcp_request(mst, conn, &rd));
+    close(m_pty_slv);
+    m_pty_slv = -1;
+    for (int i = 0; i < 1000000 && m_mst_timeout < 2; i++)
+        mb_mst_tcp_poll(mst);
+    TEST_ASSERT_EQUAL_UINT32(2, m_mst_timeout);
+
+    mb_mst_tcp_destroy(mst);
+    close(lfd);
+}
+
+// 轮询TCP主机直到回调次数达到预期或超过时限
+static void tcp_poll_until(mb_mst_tcp_handle mst, uint32_t done, uint32_t max_ms)
+{
+    uint64_t end = now_ns(CLOCK_MONOTONIC) + max_ms * 1000000ull;
+
+    while (m_mst_ok + m_mst_timeout < done && now_ns(CLOCK_MONOTONIC) < end) {
+        mb_mst_tcp_poll(mst);
+        usleep(1000);
+    }
+}
+
+// 排队的请求同样按提交时刻超时: 流水线窗口已满, 或服务端不响应连接
+void test_master_tcp_queue_timeout()
+{
+    int lfd = tcp_listen(TCP_PORT + 3);
+    if (lfd < 0)
+        TEST_IGNORE_MESSAGE("tcp port unavailable");
+
+    mb_mst_tcp_handle mst = mb_mst_tcp_init();
+    TEST_ASSERT_NOT_NULL(mst);
+    int conn = mb_mst_tcp_connect(mst, "127.0.0.1", TCP_PORT + 3, MB_MST_TCP_MODE_MBAP);
+    TEST_ASSERT_TRUE(conn >= 0);
+    int srv = accept(lfd, NULL, NULL);
+    TEST_ASSERT_TRUE(srv >= 0);
+
+    struct mb_mst_request rd = {
+        .timeout_ms = 50,
+        .slave_addr = SLAVE_ADDR,
+        .func = MODBUS_FUN_RD_REG_MUL,
+        .reg_addr = 0,
+        .reg_len = 4,
+        .resp = mst_resp,
+    };
+
+    // 服务端不回复, 超出窗口的请求与在途请求一起超时, 不等窗口腾出后再计时
+    uint32_t num = MB_MST_TCP_PIPELINE + 4;
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+    for (uint32_t i = 0; i < num; i++)
+        TEST_ASSERT_NOT_EQUAL(0, mb_mst_tcp_request(mst, conn, &rd));
+    int wait = mb_mst_tcp_next_deadline(mst);
+    TEST_ASSERT_TRUE(wait > 0 && wait <= 50);
+
+    tcp_poll_until(mst, num, 1000);
+    TEST_ASSERT_EQUAL_UINT32(num, m_mst_timeout);
+    TEST_ASSERT_TRUE(now_ns(CLOCK_MONOTONIC) - start < rd.timeout_ms * 2 * 1000000ull);
+    close(srv);
+    mb_mst_tcp_destroy(mst);
+
+    // 占满监听队列, 之后的SYN被丢弃, 连接停留在连接中
+    int fill[2];
+    for (int i = 0; i < 2; i++)
+        fill[i] = tcp_connect(TCP_PORT + 3);
+
+    mst = mb_mst_tcp_init();
+    TEST_ASSERT_NOT_NULL(mst);
+    conn = mb_mst_tcp_connect(mst, "127.0.0.1", TCP_PORT + 3, MB_MST_TCP_MODE_MBAP);
+    TEST_ASSERT_TRUE(conn >= 0);
+
+    // 连接中没有请求时, 下一次处理时刻为连接超时
+    wait = mb_mst_tcp_next_deadline(mst);
+    TEST_ASSERT_TRUE(wait > 50 && wait <= MB_MST_TCP_CONNECT_TIMEOUT_MS);
+
+    m_mst_timeout = 0;
+    TEST_ASSERT_NOT_EQUAL(0, mb_mst_tcp_request(mst, conn, &rd));
+    wait = mb_mst_tcp_next_deadline(mst);
+    TEST_ASSERT_TRUE(wait > 0 && wait <= 50);
+    tcp_poll_until(mst, 1, 1000);
+    TEST_ASSERT_EQUAL_UINT32(1, m_mst_timeout);
+    TEST_ASSERT_EQUAL_UINT32(0, m_mst_ok);
+
+    mb_mst_tcp_destroy(mst);
+    for (int i = 0; i < 2; i++) {
+        if (fill[i] >= 0)
+            close(fill[i]);
+    }
+    close(lfd);
+}
+
+/***************************网关***************************/
+
+// 第二个单元与下游从机的处理表: 读返回 0x5A00 + 寄存器地址, 超出100个寄存器报地址错误
+static uint8_t reg_handle2(uint8_t func, uint16_t reg, uint16_t reg_num, uint16_t *p_in_out)
+{
+    if (reg + reg_num > 100)
+        return MODBUS_RESP_ERR_REG;
+
+    if (func == MODBUS_FUN_RD_REG_MUL) {
+        for (uint16_t i = 0; i < reg_num; i++)
+            p_in_out[i] = 0x5A00 + reg + i;
+    }
+
+    return MODBUS_RESP_SUCCESS;
+}
+
+static struct mb_slv_work m_work2[] = {
+    {
+        .start = 0,
+        .end = SLAVE_REG_NUM,
+        .resp = reg_handle2,
+    },
+};
+
+// 轮询上游从机、网关主机与下游从机, 直到上游收到回复或超时
+static size_t gw_transact(mb_mst_handle mst, mb_slv_handle ds, uint8_t *resp, uint32_t max_ms)
+{
+    uint64_t end = now_ns(CLOCK_MONOTONIC) + max_ms * 1000000ull;
+
+    while (!link_len(&m_s2m) && now_ns(CLOCK_MONOTONIC) < end) {
+        mb_slv_poll(m_slv);
+        mb_mst_poll(mst);
+        mb_slv_poll(ds);
+        usleep(100);
+    }
+
+    return link_get(&m_s2m, resp, MODBUS_FRAME_BYTES_MAX);
+}
+
+// 校验上游收到的异常回复
+static void assert_exception(uint8_t *resp, size_t len, uint8_t addr, uint8_t func,
+    uint8_t ex_code)
+{
+    TEST_ASSERT_EQUAL(5, len);
+    TEST_ASSERT_EQUAL_HEX8(addr, resp[0]);
+    TEST_ASSERT_EQUAL_HEX8(func | MODBUS_EXCEPTION_FLAG, resp[1]);
+    TEST_ASSERT_EQUAL_HEX8(ex_code, resp[2]);
+    TEST_ASSERT_EQUAL_HEX16(crc16_update_bytes(0xffff, resp, 3), COMBINE_U8_TO_U16(resp[4], resp[3]));
+}
+
+// 同一从机服务两个单元, 各自使用自己的处理表, 未注册地址不回复
+void test_slave_two_units()
+{
+    uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+    uint8_t resp[MODBUS_FRAME_BYTES_MAX];
+
+    TEST_ASSERT_TRUE(mb_slv_add_unit(m_slv, UNIT2_ADDR, m_work2, 1));
+    TEST_ASSERT_FALSE(mb_slv_add_unit(m_slv, UNIT2_ADDR, m_work2, 1));
+    TEST_ASSERT_FALSE(mb_slv_add_unit(m_slv, SLAVE_ADDR, m_work2, 1));
+
+    link_put(&m_m2s, frame, build_read(frame, SLAVE_ADDR, 10, 2));
+    mb_slv_poll(m_slv);
+    TEST_ASSERT_EQUAL(read_resp_len(2), link_get(&m_s2m, resp, sizeof(resp)));
+    TEST_ASSERT_EQUAL_HEX8(SLAVE_ADDR, resp[0]);
+    TEST_ASSERT_EQUAL_HEX16(10, COMBINE_U8_TO_U16(resp[3], resp[4]));
+
+    link_put(&m_m2s, frame, build_read(frame, UNIT2_ADDR, 10, 2));
+    mb_slv_poll(m_slv);
+    TEST_ASSERT_EQUAL(read_resp_len(2), link_get(&m_s2m, resp, sizeof(resp)));
+    TEST_ASSERT_EQUAL_HEX8(UNIT2_ADDR, resp[0]);
+    TEST_ASSERT_EQUAL_HEX16(0x5A0B, COMBINE_U8_TO_U16(resp[5], resp[6]));
+
+    // 单元的异常只计入该单元
+    link_put(&m_m2s, frame, build_read(frame, UNIT2_ADDR, 99, 2));
+    mb_slv_poll(m_slv);
+    TEST_ASSERT_EQUAL(0, link_len(&m_s2m));
+
+    struct mb_slv_unit_stats st;
+    TEST_ASSERT_TRUE(mb_slv_get_unit_stats(m_slv, UNIT2_ADDR, &st));
+    TEST_ASSERT_EQUAL_UINT32(2, st.rx_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, st.exceptions);
+    TEST_ASSERT_TRUE(mb_slv_get_unit_stats(m_slv, SLAVE_ADDR, &st));
+    TEST_ASSERT_EQUAL_UINT32(0, st.exceptions);
+
+    // 未开启网关, 未注册单元不回复
+    link_put(&m_m2s, frame, build_read(frame, SLAVE2_ADDR, 0, 2));
+    mb_slv_poll(m_slv);
+    TEST_ASSERT_EQUAL(0, link_len(&m_s2m));
+}
+
+// 网关: 未注册单元转发给下游, 读写回复原样回传
+void test_slave_gateway_forward()
+{
+    uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+    uint8_t resp[MODBUS_FRAME_BYTES_MAX];
+
+    mb_mst_handle mst = mb_mst_init(&m_mst2_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+    mb_slv_handle ds = mb_slv_init(&m_slv2_opts, SLAVE2_ADDR, m_work2, 1);
+    TEST_ASSERT_NOT_NULL(ds);
+    mb_slv_set_gateway(m_slv, mst, 1000);
+
+    link_put(&m_m2s, frame, build_read(frame, SLAVE2_ADDR, 3, 4));
+    size_t len = gw_transact(mst, ds, resp, 1000);
+    TEST_ASSERT_EQUAL(read_resp_len(4), len);
+    TEST_ASSERT_EQUAL_HEX8(SLAVE2_ADDR, resp[0]);
+    TEST_ASSERT_EQUAL_HEX8(MODBUS_FUN_RD_REG_MUL, resp[1]);
+    TEST_ASSERT_EQUAL(8, resp[2]);
+    TEST_ASSERT_EQUAL_HEX16(0x5A06, COMBINE_U8_TO_U16(resp[9], resp[10]));
+    TEST_ASSERT_EQUAL_HEX16(crc16_update_bytes(0xffff, resp, len - 2),
+        COMBINE_U8_TO_U16(resp[len - 1], resp[len - 2]));
+
+    link_put(&m_m2s, frame, build_write(frame, SLAVE2_ADDR, 20, 3, 0x100));
+    len = gw_transact(mst, ds, resp, 1000);
+    TEST_ASSERT_EQUAL(8, len);
+    TEST_ASSERT_EQUAL_HEX8(MODBUS_FUN_WR_REG_MUL, resp[1]);
+    TEST_ASSERT_EQUAL_HEX16(20, COMBINE_U8_TO_U16(resp[2], resp[3]));
+    TEST_ASSERT_EQUAL_HEX16(3, COMBINE_U8_TO_U16(resp[4], resp[5]));
+
+    // 本机单元仍由本机处理, 不经过下游
+    link_put(&m_m2s, frame, build_read(frame, SLAVE_ADDR, 0, 1));
+    mb_slv_poll(m_slv);
+    TEST_ASSERT_EQUAL(read_resp_len(1), link_get(&m_s2m, resp, sizeof(resp)));
+    TEST_ASSERT_EQUAL(0, link_len(&m_m2s2));
+
+    mb_slv_destroy(ds);
+    mb_slv_destroy(m_slv);
+    m_slv = NULL;
+    mb_mst_destroy(mst);
+}
+
+// 网关: 下游无响应回复0x0B, 下游异常回复原样转发异常码
+void test_slave_gateway_errors()
+{
+    uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+    uint8_t resp[MODBUS_FRAME_BYTES_MAX];
+
+    mb_mst_handle mst = mb_mst_init(&m_mst2_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+    mb_slv_handle ds = mb_slv_init(&m_slv2_opts, SLAVE2_ADDR, m_work2, 1);
+    TEST_ASSERT_NOT_NULL(ds);
+    mb_slv_set_gateway(m_slv, mst, GW_TIMEOUT_MS);
+
+    // 下游没有该地址的从机, 重发完后超时
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+    link_put(&m_m2s, frame, build_read(frame, UNIT2_ADDR, 0, 2));
+    size_t len = gw_transact(mst, ds, resp, 1000);
+    uint64_t elapsed_ms = (now_ns(CLOCK_MONOTONIC) - start) / 1000000;
+    assert_exception(resp, len, UNIT2_ADDR, MODBUS_FUN_RD_REG_MUL, MODBUS_EX_GW_TARGET_FAILED);
+    TEST_ASSERT_TRUE(elapsed_ms >= GW_TIMEOUT_MS * MASTER_REPEATS);
+
+    // 下游回复异常, 转发下游的异常码而不是0x0B
+    const uint8_t funcs[] = { MODBUS_FUN_RD_REG_MUL, MODBUS_FUN_WR_REG_MUL };
+    for (size_t i = 0; i < sizeof(funcs); i++) {
+        if (funcs[i] == MODBUS_FUN_RD_REG_MUL)
+            link_put(&m_m2s, frame, build_read(frame, SLAVE2_ADDR, 0, 2));
+        else
+            link_put(&m_m2s, frame, build_write(frame, SLAVE2_ADDR, 0, 2, 0));
+        mb_slv_poll(m_slv);
+        mb_mst_poll(mst);
+        TEST_ASSERT_NOT_EQUAL(0, link_len(&m_m2s2));
+        link_reset();
+
+        len = 0;
+        frame[len++] = SLAVE2_ADDR;
+        frame[len++] = funcs[i] | MODBUS_EXCEPTION_FLAG;
+        frame[len++] = MODBUS_EX_DEVICE_FAILURE;
+        link_put(&m_s2m2, frame, append_crc(frame, len));
+        len = gw_transact(mst, ds, resp, 1000);
+        assert_exception(resp, len, SLAVE2_ADDR, funcs[i], MODBUS_EX_DEVICE_FAILURE);
+    }
+
+    // 从机先于下游主机销毁, 取消转发中的请求
+    link_put(&m_m2s, frame, build_read(frame, SLAVE2_ADDR, 0, 2));
+    mb_slv_poll(m_slv);
+    TEST_ASSERT_EQUAL(0, link_len(&m_s2m));
+    mb_slv_destroy(m_slv);
+    m_slv = NULL;
+    for (int i = 0; i < 100; i++) {
+        mb_mst_poll(mst);
+        mb_slv_poll(ds);
+    }
+    TEST_ASSERT_EQUAL(0, link_len(&m_s2m));
+
+    mb_slv_destroy(ds);
+    mb_mst_destroy(mst);
+}
+
+// 读多个寄存器的MBAP请求
+static size_t build_mbap_read(uint8_t *adu, uint16_t tid, uint8_t unit, uint16_t reg, uint16_t num)
+{
+    uint8_t frame[MODBUS_FRAME_BYTES_MAX];
+    build_read(frame, unit, reg, num);
+
+    size_t len = 0;
+    adu[len++] = GET_U8_HIGH_FROM_U16(tid);
+    adu[len++] = GET_U8_LOW_FROM_U16(tid);
+    adu[len++] = 0;
+    adu[len++] = 0;
+    adu[len++] = 0;
+    adu[len++] = 6;
+    memcpy(&adu[len], frame, 6);
+    return len + 6;
+}
+
+// 网关: 上游TCP连接断开后下游才回复, 回复被丢弃, 不会发到复用该连接的新客户端
+void test_slave_gateway_closed_conn()
+{
+    mb_slv_tcp_handle slv_tcp = mb_slv_tcp_init(m_slv, "127.0.0.1", TCP_PORT + 2);
+    if (!slv_tcp)
+        TEST_IGNORE_MESSAGE("tcp port unavailable");
+
+    mb_mst_handle mst = mb_mst_init(&m_mst2_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+    mb_slv_handle ds = mb_slv_init(&m_slv2_opts, SLAVE2_ADDR, m_work2, 1);
+    TEST_ASSERT_NOT_NULL(ds);
+    mb_slv_set_gateway(m_slv, mst, 1000);
+
+    uint8_t adu[MODBUS_FRAME_BYTES_MAX];
+    uint8_t resp[MODBUS_FRAME_BYTES_MAX];
+
+    int cli = tcp_connect(TCP_PORT + 2);
+    TEST_ASSERT_TRUE(cli >= 0);
+    TEST_ASSERT_TRUE(write(cli, adu, build_mbap_read(adu, 1, SLAVE2_ADDR, 0, 2)) > 0);
+
+    // 请求已转发给下游, 下游回复前客户端断开
+    for (int i = 0; i < 1000 && mb_mst_next_deadline(mst) < 0; i++) {
+        mb_slv_tcp_poll(slv_tcp);
+        usleep(100);
+    }
+    mb_mst_poll(mst);
+    TEST_ASSERT_NOT_EQUAL(0, link_len(&m_m2s2));
+    close(cli);
+
+    // 新客户端复用同一个连接槽位
+    cli = tcp_connect(TCP_PORT + 2);
+    TEST_ASSERT_TRUE(cli >= 0);
+    for (int i = 0; i < 100; i++) {
+        mb_slv_tcp_poll(slv_tcp);
+        usleep(100);
+    }
+
+    // 下游回复到达, 旧连接的回复被丢弃
+    for (int i = 0; i < 1000 && mb_mst_next_deadline(mst) >= 0; i++) {
+        mb_slv_poll(ds);
+        mb_mst_poll(mst);
+        mb_slv_tcp_poll(slv_tcp);
+    }
+    TEST_ASSERT_EQUAL(-1, mb_mst_next_deadline(mst));
+
+    // 新客户端只收到自己事务的回复
+    TEST_ASSERT_TRUE(write(cli, adu, build_mbap_read(adu, 2, SLAVE_ADDR, 5, 1)) > 0);
+    ssize_t len = 0;
+    for (int i = 0; i < 1000 && len < 11; i++) {
+        mb_slv_tcp_poll(slv_tcp);
+        usleep(100);
+        ssize_t ret = recv(cli, resp + len, sizeof(resp) - len, MSG_DONTWAIT);
+        if (ret > 0)
+            len += ret;
+    }
+    usleep(1000);
+    mb_slv_tcp_poll(slv_tcp);
+    ssize_t ret = recv(cli, resp + len, sizeof(resp) - len, MSG_DONTWAIT);
+    if (ret > 0)
+        len += ret;
+
+    TEST_ASSERT_EQUAL(MODBUS_TCP_MBAP_BYTES_NUM + 4, len);
+    TEST_ASSERT_EQUAL_HEX16(2, COMBINE_U8_TO_U16(resp[0], resp[1]));
+    TEST_ASSERT_EQUAL_HEX8(SLAVE_ADDR, resp[6]);
+    TEST_ASSERT_EQUAL_HEX16(5, COMBINE_U8_TO_U16(resp[9], resp[10]));
+
+    close(cli);
+    mb_slv_tcp_destroy(slv_tcp);
+    mb_slv_destroy(ds);
+    mb_slv_destroy(m_slv);
+    m_slv = NULL;
+    mb_mst_destroy(mst);
+}
+
+static void gw_reply_ignore(void *arg, uint32_t tag, const uint8_t *pdu, uint16_t pdu_len)
+{
+    (void)arg;
+    (void)tag;
+    (void)pdu;
+    (void)pdu_len;
+    TEST_FAIL_MESSAGE("cancelled gateway request replied");
+}
+
+// 网关: 下游回复前销毁TCP从机, 转发被取消, 下游回复不再访问已释放的连接
+void test_slave_gateway_tcp_destroyed()
+{
+    mb_slv_tcp_handle slv_tcp = mb_slv_tcp_init(m_slv, "127.0.0.1", TCP_PORT + 4);
+    if (!slv_tcp)
+        TEST_IGNORE_MESSAGE("tcp port unavailable");
+
+    mb_mst_handle mst = mb_mst_init(&m_mst2_opts, 1);
+    TEST_ASSERT_NOT_NULL(mst);
+    mb_slv_handle ds = mb_slv_init(&m_slv2_opts, SLAVE2_ADDR, m_work2, 1);
+    TEST_ASSERT_NOT_NULL(ds);
+    mb_slv_set_gateway(m_slv, mst, 1000);
+
+    uint8_t adu[MODBUS_FRAME_BYTES_MAX];
+
+    int cli = tcp_connect(TCP_PORT + 4);
+    TEST_ASSERT_TRUE(cli >= 0);
+    TEST_ASSERT_TRUE(write(cli, adu, build_mbap_read(adu, 1, SLAVE2_ADDR, 0, 2)) > 0);
+
+    // 请求已发给下游, 下游回复前销毁TCP从机
+    for (int i = 0; i < 1000 && mb_mst_next_deadline(mst) < 0; i++) {
+        mb_slv_tcp_poll(slv_tcp);
+        usleep(100);
+    }
+    mb_mst_poll(mst);
+    TEST_ASSERT_NOT_EQUAL(0, link_len(&m_m2s2));
+
+    mb_slv_tcp_destroy(slv_tcp);
+    close(cli);
+
+    // 下游回复到达后被主机丢弃, 不再回调已释放的连接
+    for (int i = 0; i < 1000 && mb_mst_next_deadline(mst) >= 0; i++) {
+        mb_slv_poll(ds);
+        mb_mst_poll(mst);
+    }
+    TEST_ASSERT_EQUAL(-1, mb_mst_next_deadline(mst));
+
+    // 转发槽位已释放, 网关仍可继续转发
+    uint8_t resp[MODBUS_PDU_BYTES_MAX];
+    struct mb_slv_reply_ctx ctx = {.cb = gw_reply_ignore};
+    TEST_ASSERT_EQUAL(MB_SLV_PDU_PENDING,
+        mb_slv_pdu_process(m_slv, SLAVE2_ADDR, &adu[MODBUS_TCP_MBAP_BYTES_NUM], 5, resp, &ctx));
+    TEST_ASSERT_EQUAL(1, mb_slv_cancel_reply(m_slv, gw_reply_ignore, NULL));
+
+    mb_slv_destroy(ds);
+    mb_slv_destroy(m_slv);
+    m_slv = NULL;
+    mb_mst_destroy(mst);
+}
+
+// Unity 测试主函数
+int main(void)
+{
+    UNITY_BEGIN();
+
+    // 单元测试注册
+    RUN_TEST(test_slave_sticky_frames);
+    RUN_TEST(test_slave_fragmented_frames);
+    RUN_TEST(test_slave_corrupted_frames);
+    RUN_TEST(test_slave_random_noise_resync);
+    RUN_TEST(test_master_bad_byte_count);
+    RUN_TEST(test_master_timeout_retry);
+    RUN_TEST(test_master_request_pool);
+    RUN_TEST(test_slave_link_stats);
+    RUN_TEST(test_master_link_stats);
+    RUN_TEST(test_poll_plan);
+    RUN_TEST(test_poll_schedule);
+    RUN_TEST(test_cache_ttl_notify);
+    RUN_TEST(test_priv_reg_table);
+    RUN_TEST(test_master_adaptive_timeout);
+    RUN_TEST(test_bus_parallel);
+    RUN_TEST(test_master_slave_throughput);
+    RUN_TEST(test_master_slave_pty);
+    RUN_TEST(test_serial_line_config);
+    RUN_TEST(test_serial_tx_queue);
+    RUN_TEST(test_serial_rx_wakeup);
+    RUN_TEST(test_serial_capture_replay);
+    RUN_TEST(test_replay_realtime);
+    RUN_TEST(test_replay_clock_step_back);
+    RUN_TEST(test_master_tcp_pipeline);
+    RUN_TEST(test_master_tcp_rtu);
+    RUN_TEST(test_master_tcp_queue_timeout);
+    RUN_TEST(test_slave_two_units);
+    RUN_TEST(test_slave_gateway_forward);
+    RUN_TEST(test_slave_gateway_errors);
+    RUN_TEST(test_slave_gateway_closed_conn);
+    RUN_TEST(test_slave_gateway_tcp_destroyed);
+
+    return UNITY_END();
+}
@@ -38,3 +38,34 @@ target_link_libraries(test_ssl_client
 # cJSON 测试用例
 add_unity_test(test_cjson ${CMAKE_CURRENT_SOURCE_DIR}/test/test_cjson.c)
 target_link_libraries(test_cjson PRIVATE pub_lib ${CJSON_ROOT_DIR}/lib/libcjson.a)
+
+# Modbus 主从机测试用例(粘包/断包/错帧/噪声/超时/熔断/链路统计/轮询表/缓存/多总线/吞吐/伪终端/串口传输层/接收唤醒/抓包回放/TCP主机)
+add_unity_test(test_modbus ${CMAKE_CURRENT_SOURCE_DIR}/test/test_modbus.c)
+target_link_libraries(test_modbus PRIVATE pub_lib util)
+
+# ISO-TP 测试用例(单帧/多帧/块大小/CAN FD/长度扩展/溢出/序号错误/流控超时)
+add_unity_test(test_isotp ${CMAKE_CURRENT_SOURCE_DIR}/test/test_isotp.c)
+
+# CAN ID 分发测试用例(标准帧直接索引/扩展帧哈希冲突/重复注册/立即与延后处理/环形队列溢出/入队通知/交付延时分布/到达抖动)
+add_unity_test(test_can_dispatch ${CMAKE_CURRENT_SOURCE_DIR}/test/test_can_dispatch.c)
+
+# Modbus 解析模糊测试, 默认关闭
+# clang 编译时生成 libFuzzer 目标, 其他编译器(如 afl-gcc)生成从文件/标准输入读取用例的程序
+option(MODBUS_FUZZ "Build modbus parser fuzz target" OFF)
+if(MODBUS_FUZZ)
+    add_executable(fuzz_modbus
+        ${CMAKE_CURRENT_SOURCE_DIR}/test/fuzz_modbus.c
+        ${CMAKE_CURRENT_SOURCE_DIR}/source/protocol/modbus_slave.c
+        ${CMAKE_CURRENT_SOURCE_DIR}/source/protocol/modbus_master.c
+        ${CMAKE_CURRENT_SOURCE_DIR}/source/utils/crc.c
+        ${CMAKE_CURRENT_SOURCE_DIR}/source/utils/queue.c
+        ${CMAKE_CURRENT_SOURCE_DIR}/source/utils/logger.c
+    )
+    target_link_libraries(fuzz_modbus PRIVATE pthread)
+    if(CMAKE_C_COMPILER_ID MATCHES "Clang")
+        target_compile_options(fuzz_modbus PRIVATE -g -fsanitize=fuzzer,address,undefined)
+        target_link_options(fuzz_modbus PRIVATE -fsanitize=fuzzer,address,undefined)
+    else()
+        target_compile_definitions(fuzz_modbus PRIVATE FUZZ_STANDALONE)
+    endif()
+endif()